@@ -25,6 +25,7 @@ typedef enum pcm_format snd_pcm_format_t;
 #define SND_PCM_FORMAT_S16_LE   2
 #define SND_PCM_FORMAT_S24_LE   6
 #define SND_PCM_FORMAT_S32_LE  10
+#define SND_PCM_FORMAT_FLOAT_LE 14
 
 static inline int audio_format_to_cras_format(audio_format_t audio_format)
 {
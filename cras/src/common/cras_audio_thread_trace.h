@@ -0,0 +1,117 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_AUDIO_THREAD_TRACE_H_
+#define CRAS_AUDIO_THREAD_TRACE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cras_types.h"
+
+#define AUDIO_THREAD_TRACE_MAGIC 0x43524154 /* "CRAT" */
+#define AUDIO_THREAD_TRACE_VERSION 1
+/* Number of events in the trace ring, a power of two. */
+#define AUDIO_THREAD_TRACE_SIZE (1 << 14)
+
+/* One audio thread event.
+ *  ticks - The cpu counter when the event was logged, see
+ *    audio_thread_trace_ticks_to_ns().
+ *  tag - One of AUDIO_THREAD_LOG_EVENTS.
+ *  data1, data2, data3 - Event specific data, same as the event log.
+ */
+struct __attribute__ ((__packed__)) audio_thread_trace_event {
+	uint64_t ticks;
+	uint32_t tag;
+	uint32_t data1;
+	uint32_t data2;
+	uint32_t data3;
+};
+
+/* The continuous trace of the audio thread, shared with clients through a
+ * memfd they get a read only fd of.
+ *
+ * The audio thread is the only writer. Event n lives at index
+ * n & (num_events - 1) of the ring, and write_count, the total number of
+ * events written, is stored with release semantics after the event. A reader
+ * uses audio_thread_trace_snapshot() to copy out the events that weren't
+ * overwritten while it was copying.
+ *
+ *  magic - AUDIO_THREAD_TRACE_MAGIC.
+ *  version - AUDIO_THREAD_TRACE_VERSION.
+ *  num_events - Size of the ring, AUDIO_THREAD_TRACE_SIZE.
+ *  ticks_per_sec - Frequency of the cpu counter.
+ *  base_ticks, base_ns - A reading of the cpu counter and of
+ *    CLOCK_MONOTONIC_RAW taken at the same time, used to convert ticks.
+ *  write_count - Total number of events written.
+ *  events - The ring of events.
+ */
+struct __attribute__ ((packed, aligned(8))) audio_thread_trace {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_events;
+	uint32_t reserved;
+	uint64_t ticks_per_sec;
+	uint64_t base_ticks;
+	uint64_t base_ns;
+	uint64_t write_count;
+	struct audio_thread_trace_event events[AUDIO_THREAD_TRACE_SIZE];
+};
+
+/* Converts a tick count from the trace to CLOCK_MONOTONIC_RAW nanoseconds. */
+static inline uint64_t audio_thread_trace_ticks_to_ns(
+		const struct audio_thread_trace *trace, uint64_t ticks)
+{
+	int64_t delta = (int64_t)(ticks - trace->base_ticks);
+
+	return trace->base_ns +
+	       (int64_t)((double)delta * 1e9 / trace->ticks_per_sec);
+}
+
+/* Copies the events of the trace that are still valid, oldest first.
+ * Args:
+ *    trace - The trace, possibly being written by the audio thread.
+ *    events - Array of at least AUDIO_THREAD_TRACE_SIZE events to fill.
+ * Returns:
+ *    The number of events copied, or a negative error if trace isn't a
+ *    trace this version understands.
+ */
+static inline int audio_thread_trace_snapshot(
+		const struct audio_thread_trace *trace,
+		struct audio_thread_trace_event *events)
+{
+	uint64_t start, end, first, n;
+	unsigned int mask;
+
+	if (trace->magic != AUDIO_THREAD_TRACE_MAGIC ||
+	    trace->version != AUDIO_THREAD_TRACE_VERSION ||
+	    trace->num_events != AUDIO_THREAD_TRACE_SIZE)
+		return -EINVAL;
+	mask = trace->num_events - 1;
+
+	start = __atomic_load_n(&trace->write_count, __ATOMIC_ACQUIRE);
+	first = start > trace->num_events ? start - trace->num_events : 0;
+	for (n = first; n < start; n++)
+		events[n - first] = trace->events[n & mask];
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	end = __atomic_load_n(&trace->write_count, __ATOMIC_RELAXED);
+
+	/* Events before end - num_events may have been overwritten during
+	 * the copy, and event end - num_events shares its slot with event
+	 * end, which may be in the middle of being written. Drop them. */
+	if (end + 1 > first + trace->num_events) {
+		uint64_t lost = end + 1 - trace->num_events - first;
+
+		if (lost >= start - first)
+			return 0;
+		memmove(events, events + lost,
+			(start - first - lost) * sizeof(*events));
+		first += lost;
+	}
+	return start - first;
+}
+
+#endif /* CRAS_AUDIO_THREAD_TRACE_H_ */
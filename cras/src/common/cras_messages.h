@@ -15,8 +15,10 @@
 #include "cras_types.h"
 
 /* Rev when message format changes. If new messages are added, or message ID
- * values change. */
-#define CRAS_PROTO_VER 1
+ * values change.  Also rev when the layout of the audio shm area changes.
+ *  2 - Audio shm is a single ring instead of two buffers.  The server keeps
+ *      the two buffer layout for streams from version 1 clients. */
+#define CRAS_PROTO_VER 2
 #define CRAS_SERV_MAX_MSG_SIZE 256
 #define CRAS_CLIENT_MAX_MSG_SIZE 256
 #define CRAS_HOTWORD_NAME_MAX_SIZE 8
@@ -49,6 +51,9 @@ enum CRAS_SERVER_MESSAGE_ID {
 	CRAS_SERVER_GET_HOTWORD_MODELS,
 	CRAS_SERVER_SET_HOTWORD_MODEL,
 	CRAS_SERVER_REGISTER_NOTIFICATION,
+	CRAS_SERVER_DUMP_DSP_PROFILE,
+	CRAS_SERVER_DUMP_LATENCY_INFO,
+	CRAS_SERVER_GET_AUDIO_THREAD_TRACE,
 };
 
 enum CRAS_CLIENT_MESSAGE_ID {
@@ -68,6 +73,13 @@ enum CRAS_CLIENT_MESSAGE_ID {
 	CRAS_CLIENT_NODE_LEFT_RIGHT_SWAPPED_CHANGED,
 	CRAS_CLIENT_INPUT_NODE_GAIN_CHANGED,
 	CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED,
+	CRAS_CLIENT_DSP_DEBUG_INFO_READY,
+	CRAS_CLIENT_LATENCY_INFO_READY,
+	CRAS_CLIENT_AUDIO_THREAD_TRACE_READY,
+	/* Several of the notifications above in one message. A client asks
+	 * for these by registering for this id, see
+	 * cras_client_notifications. */
+	CRAS_CLIENT_NOTIFICATIONS,
 };
 
 /* Messages that control the server. These are sent from the client to affect
@@ -325,6 +337,42 @@ static inline void cras_fill_dump_audio_thread(
 	m->header.length = sizeof(*m);
 }
 
+/* Dump the per plugin dsp profile to the shared server state. */
+struct __attribute__ ((__packed__)) cras_dump_dsp_profile {
+	struct cras_server_message header;
+};
+
+static inline void cras_fill_dump_dsp_profile(
+		struct cras_dump_dsp_profile *m)
+{
+	m->header.id = CRAS_SERVER_DUMP_DSP_PROFILE;
+	m->header.length = sizeof(*m);
+}
+
+/* Dump the audio thread latency histograms to the shared server state. */
+struct __attribute__ ((__packed__)) cras_dump_latency_info {
+	struct cras_server_message header;
+};
+
+static inline void cras_fill_dump_latency_info(
+		struct cras_dump_latency_info *m)
+{
+	m->header.id = CRAS_SERVER_DUMP_LATENCY_INFO;
+	m->header.length = sizeof(*m);
+}
+
+/* Get an fd of the audio thread trace, see cras_audio_thread_trace.h. */
+struct __attribute__ ((__packed__)) cras_get_audio_thread_trace {
+	struct cras_server_message header;
+};
+
+static inline void cras_fill_get_audio_thread_trace(
+		struct cras_get_audio_thread_trace *m)
+{
+	m->header.id = CRAS_SERVER_GET_AUDIO_THREAD_TRACE;
+	m->header.length = sizeof(*m);
+}
+
 /* Add a test device. */
 struct __attribute__ ((__packed__)) cras_add_test_dev {
 	struct cras_server_message header;
@@ -457,7 +505,9 @@ static inline void cras_fill_client_connected(
 
 /*
  * Reply from server that a stream has been successfully added.
- * Two file descriptors are added, input shm followed by out shm.
+ * Two file descriptors are added, input shm followed by out shm.  Streams
+ * connected with SHM_DOORBELL get two more, the eventfd the server signals to
+ * request audio followed by the eventfd the client signals when done.
  */
 struct __attribute__ ((__packed__)) cras_client_stream_connected {
 	struct cras_client_message header;
@@ -492,6 +542,44 @@ static inline void cras_fill_client_audio_debug_info_ready(
 	m->header.length = sizeof(*m);
 }
 
+/* Sent from server to client when the dsp profile is requested. */
+struct cras_client_dsp_debug_info_ready {
+	struct cras_client_message header;
+};
+static inline void cras_fill_client_dsp_debug_info_ready(
+		struct cras_client_dsp_debug_info_ready *m)
+{
+	m->header.id = CRAS_CLIENT_DSP_DEBUG_INFO_READY;
+	m->header.length = sizeof(*m);
+}
+
+/* Sent from server to client when the latency histograms are requested. */
+struct cras_client_latency_info_ready {
+	struct cras_client_message header;
+};
+static inline void cras_fill_client_latency_info_ready(
+		struct cras_client_latency_info_ready *m)
+{
+	m->header.id = CRAS_CLIENT_LATENCY_INFO_READY;
+	m->header.length = sizeof(*m);
+}
+
+/* Sent from server to client in reply to CRAS_SERVER_GET_AUDIO_THREAD_TRACE.
+ * A read only fd of the trace memfd is attached when err is zero, err is
+ * -ENOENT if the server wasn't started with the trace enabled. */
+struct cras_client_audio_thread_trace_ready {
+	struct cras_client_message header;
+	int32_t err;
+};
+static inline void cras_fill_client_audio_thread_trace_ready(
+		struct cras_client_audio_thread_trace_ready *m,
+		int err)
+{
+	m->header.id = CRAS_CLIENT_AUDIO_THREAD_TRACE_READY;
+	m->header.length = sizeof(*m);
+	m->err = err;
+}
+
 /* Sent from server to client when hotword models info is ready. */
 struct cras_client_get_hotword_models_ready {
 	struct cras_client_message header;
@@ -634,6 +722,20 @@ static inline void cras_fill_client_num_active_streams_changed (
 	m->num_active_streams = num_active_streams;
 };
 
+/* Observer notifications queued for a client during one iteration of the
+ * server main loop, sent together. msgs holds complete client messages back
+ * to back, each starting with its own header. */
+struct __attribute__ ((__packed__)) cras_client_notifications {
+	struct cras_client_message header;
+	uint8_t msgs[0];
+};
+static inline void cras_fill_client_notifications(
+		struct cras_client_notifications *m)
+{
+	m->header.id = CRAS_CLIENT_NOTIFICATIONS;
+	m->header.length = sizeof(*m);
+}
+
 /*
  * Messages specific to passing audio between client and server
  */
@@ -13,29 +13,32 @@
 #include "cras_types.h"
 #include "cras_util.h"
 
-#define CRAS_NUM_SHM_BUFFERS 2U /* double buffer */
-#define CRAS_SHM_BUFFERS_MASK (CRAS_NUM_SHM_BUFFERS - 1)
-
 /* Configuration of the shm area.
  *
- *  used_size - The size in bytes of the sample area being actively used.
+ *  used_size - The size in bytes of the sample area being actively used.  No
+ *    more than this many bytes are ever queued in the ring.
  *  frame_bytes - The size of each frame in bytes.
+ *  ring_frames - The size of the sample ring in frames.  A power of two no
+ *    smaller than used_size / frame_bytes.
  */
 struct __attribute__ ((__packed__)) cras_audio_shm_config {
 	uint32_t used_size;
 	uint32_t frame_bytes;
+	uint32_t ring_frames;
 };
 
 /* Structure that is shared as shm between client and server.
+ *
+ * Samples are exchanged through a single producer, single consumer ring.  The
+ * client produces and the server consumes for playback, and the other way
+ * around for capture.  Both counters only ever increase, wrapping at 2^32, and
+ * frame n of the stream lives at index n & (ring_frames - 1) of the ring.
  *
  *  config - Size config data.  A copy of the config shared with clients.
- *  read_buf_idx - index of the current buffer to read from (0 or 1 if double
- *    buffered).
- *  write_buf_idx - index of the current buffer to write to (0 or 1 if double
- *    buffered).
- *  read_offset - offset of the next sample to read (one per buffer).
- *  write_offset - offset of the next sample to write (one per buffer).
- *  write_in_progress - non-zero when a write is in progress.
+ *  read_count - Total number of frames consumed.  Advanced by the consumer,
+ *    and by the producer only to drop the oldest frames on overrun.
+ *  write_count - Total number of frames produced.  Only written by the
+ *    producer.
  *  volume_scaler - volume scaling factor (0.0-1.0).
  *  muted - bool, true if stream should be muted.
  *  num_overruns - Starting at 0 this is incremented very time data is over
@@ -43,16 +46,12 @@ struct __attribute__ ((__packed__)) cras_audio_shm_config {
  *  ts - For capture, the time stamp of the next sample at read_index.  For
  *    playback, this is the time that the next sample written will be played.
  *    This is only valid in audio callbacks.
- *  samples - Audio data - a double buffered area that is used to exchange
- *    audio samples.
+ *  samples - Audio data - a ring of config.ring_frames frames.
  */
 struct __attribute__ ((__packed__)) cras_audio_shm_area {
 	struct cras_audio_shm_config config;
-	uint32_t read_buf_idx; /* use buffer A or B */
-	uint32_t write_buf_idx;
-	uint32_t read_offset[CRAS_NUM_SHM_BUFFERS];
-	uint32_t write_offset[CRAS_NUM_SHM_BUFFERS];
-	int32_t write_in_progress[CRAS_NUM_SHM_BUFFERS];
+	uint32_t read_count;
+	uint32_t write_count;
 	float volume_scaler;
 	int32_t mute;
 	int32_t callback_pending;
@@ -71,316 +70,168 @@ struct cras_audio_shm {
 	struct cras_audio_shm_area *area;
 };
 
-/* Get a pointer to the buffer at idx. */
-static inline uint8_t *cras_shm_buff_for_idx(const struct cras_audio_shm *shm,
-					     size_t idx)
+/* Loads the read counter.  The acquire pairs with the release in
+ * cras_shm_buffer_read(), after which the consumer no longer touches the
+ * frames it has read. */
+static inline uint32_t cras_shm_read_count(const struct cras_audio_shm *shm)
 {
-	assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-	idx = idx & CRAS_SHM_BUFFERS_MASK;
-	return shm->area->samples + shm->config.used_size * idx;
+	return __atomic_load_n(&shm->area->read_count, __ATOMIC_ACQUIRE);
 }
 
-/* Limit a read offset to within the buffer size. */
-static inline
-unsigned cras_shm_check_read_offset(const struct cras_audio_shm *shm,
-				    unsigned offset)
+/* Loads the write counter.  The acquire pairs with the release in
+ * cras_shm_buffer_written(), so the frames written before it are visible. */
+static inline uint32_t cras_shm_write_count(const struct cras_audio_shm *shm)
 {
-	/* The offset is allowed to be the total size, indicating that the
-	 * buffer is full. If read pointer is invalid assume it is at the
-	 * beginning. */
-	if (offset > shm->config.used_size)
-		return 0;
-	return offset;
+	return __atomic_load_n(&shm->area->write_count, __ATOMIC_ACQUIRE);
 }
 
-/* Limit a write offset to within the buffer size. */
-static inline
-unsigned cras_shm_check_write_offset(const struct cras_audio_shm *shm,
-				     unsigned offset)
+/* Get a pointer to the frame at counter value 'count' in the ring. */
+static inline uint8_t *cras_shm_frame_ptr(const struct cras_audio_shm *shm,
+					  uint32_t count)
 {
-	/* The offset is allowed to be the total size, indicating that the
-	 * buffer is full. If write pointer is invalid assume it is at the
-	 * end. */
-	if (offset > shm->config.used_size)
-		return shm->config.used_size;
-	return offset;
+	unsigned idx = count & (shm->config.ring_frames - 1);
+
+	return shm->area->samples + idx * shm->config.frame_bytes;
 }
 
-/* Get the number of frames readable in current read buffer */
-static inline
-unsigned cras_shm_get_curr_read_frames(const struct cras_audio_shm *shm)
+/* How many frames are queued?  Returns -EIO if the counters are invalid. */
+static inline int cras_shm_get_frames(const struct cras_audio_shm *shm)
 {
-	unsigned i = shm->area->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	unsigned read_offset, write_offset;
-
-	read_offset =
-		cras_shm_check_read_offset(shm, shm->area->read_offset[i]);
-	write_offset =
-		cras_shm_check_write_offset(shm, shm->area->write_offset[i]);
+	uint32_t read_count, queued;
 
-	if (read_offset > write_offset)
-		return 0;
-	else
-		return (write_offset - read_offset) / shm->config.frame_bytes;
+	/* The read counter never passes the write counter, load it first so
+	 * the difference can't go negative. */
+	read_count = cras_shm_read_count(shm);
+	queued = cras_shm_write_count(shm) - read_count;
+	if (queued > shm->config.ring_frames)
+		return -EIO;
+	return queued;
 }
 
-/* Get the base of the current read buffer. */
-static inline
-uint8_t *cras_shm_get_read_buffer_base(const struct cras_audio_shm *shm)
+/* Returns the used size of the shm region in frames. */
+static inline unsigned cras_shm_used_frames(const struct cras_audio_shm *shm)
 {
-	unsigned i = shm->area->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	return cras_shm_buff_for_idx(shm, i);
+	return shm->config.used_size / shm->config.frame_bytes;
 }
 
-/* Get the base of the current write buffer. */
+/* How many are available to be written? */
 static inline
-uint8_t *cras_shm_get_write_buffer_base(const struct cras_audio_shm *shm)
+size_t cras_shm_get_num_writeable(const struct cras_audio_shm *shm)
 {
-	unsigned i = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	int queued = cras_shm_get_frames(shm);
+	unsigned used_frames = cras_shm_used_frames(shm);
 
-	return cras_shm_buff_for_idx(shm, i);
+	if (queued < 0 || (unsigned)queued >= used_frames)
+		return 0;
+	return used_frames - queued;
 }
 
-/* Get a pointer to the next buffer to write */
+/* Get a pointer 'offset' frames past the write position.  'frames' is filled
+ * with the number of frames that can be written to the returned buffer before
+ * the ring is full or wraps around.
+ */
 static inline
 uint8_t *cras_shm_get_writeable_frames(const struct cras_audio_shm *shm,
-				       unsigned limit_frames,
+				       unsigned offset,
 				       unsigned *frames)
 {
-	unsigned i = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	unsigned write_offset;
-	const unsigned frame_bytes = shm->config.frame_bytes;
+	uint32_t count = cras_shm_write_count(shm) + offset;
+	unsigned avail = cras_shm_get_num_writeable(shm);
+	unsigned idx = count & (shm->config.ring_frames - 1);
 
-	write_offset = cras_shm_check_write_offset(shm,
-						   shm->area->write_offset[i]);
-	if (frames)
-		*frames = limit_frames - (write_offset / frame_bytes);
+	assert(frames != NULL);
 
-	return cras_shm_buff_for_idx(shm, i) + write_offset;
+	if (offset >= avail)
+		*frames = 0;
+	else
+		*frames = MIN(avail - offset, shm->config.ring_frames - idx);
+	return cras_shm_frame_ptr(shm, count);
 }
 
-/* Get a pointer to the current read buffer plus an offset.  The offset might be
- * in the next buffer. 'frames' is filled with the number of frames that can be
- * copied from the returned buffer.
+/* Get a pointer 'offset' frames past the read position.  'frames' is filled
+ * with the number of frames that can be copied from the returned buffer before
+ * reaching the write position or wrapping around.
  */
 static inline
 uint8_t *cras_shm_get_readable_frames(const struct cras_audio_shm *shm,
 				      size_t offset,
 				      size_t *frames)
 {
-	unsigned buf_idx = shm->area->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	unsigned read_offset, write_offset, final_offset;
+	uint32_t count;
+	unsigned idx;
+	int queued;
 
 	assert(frames != NULL);
 
-	read_offset =
-		cras_shm_check_read_offset(shm,
-					   shm->area->read_offset[buf_idx]);
-	write_offset =
-		cras_shm_check_write_offset(shm,
-					    shm->area->write_offset[buf_idx]);
-	final_offset = read_offset + offset * shm->config.frame_bytes;
-	if (final_offset >= write_offset) {
-		final_offset -= write_offset;
-		assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-		buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-		write_offset = cras_shm_check_write_offset(
-				shm, shm->area->write_offset[buf_idx]);
-	}
-	if (final_offset >= write_offset) {
+	queued = cras_shm_get_frames(shm);
+	if (queued < 0 || offset >= (unsigned)queued) {
 		/* Past end of samples. */
 		*frames = 0;
 		return NULL;
 	}
-	*frames = (write_offset - final_offset) / shm->config.frame_bytes;
-	return cras_shm_buff_for_idx(shm, buf_idx) + final_offset;
-}
-
-/* How many bytes are queued? */
-static inline size_t cras_shm_get_bytes_queued(const struct cras_audio_shm *shm)
-{
-	size_t total, i;
-	const unsigned used_size = shm->config.used_size;
-
-	total = 0;
-	for (i = 0; i < CRAS_NUM_SHM_BUFFERS; i++) {
-		unsigned read_offset, write_offset;
-
-		read_offset = MIN(shm->area->read_offset[i], used_size);
-		write_offset = MIN(shm->area->write_offset[i], used_size);
-
-		if (write_offset > read_offset)
-			total += write_offset - read_offset;
-	}
-	return total;
-}
-
-/* How many frames are queued? */
-static inline int cras_shm_get_frames(const struct cras_audio_shm *shm)
-{
-	size_t bytes;
-
-	bytes = cras_shm_get_bytes_queued(shm);
-	if (bytes % shm->config.frame_bytes != 0)
-		return -EIO;
-	return bytes / shm->config.frame_bytes;
-}
-
-/* How many frames in the current buffer? */
-static inline
-size_t cras_shm_get_frames_in_curr_buffer(const struct cras_audio_shm *shm)
-{
-	size_t buf_idx = shm->area->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	unsigned read_offset, write_offset;
-	const unsigned used_size = shm->config.used_size;
-
-	read_offset = MIN(shm->area->read_offset[buf_idx], used_size);
-	write_offset = MIN(shm->area->write_offset[buf_idx], used_size);
-
-	if (write_offset <= read_offset)
-		return 0;
-
-	return (write_offset - read_offset) / shm->config.frame_bytes;
-}
-
-/* Return 1 if there is an empty buffer in the list. */
-static inline int cras_shm_is_buffer_available(const struct cras_audio_shm *shm)
-{
-	size_t buf_idx = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-
-	return (shm->area->write_offset[buf_idx] == 0);
+	count = cras_shm_read_count(shm) + offset;
+	idx = count & (shm->config.ring_frames - 1);
+	*frames = MIN(queued - offset, shm->config.ring_frames - idx);
+	return cras_shm_frame_ptr(shm, count);
 }
 
-/* How many are available to be written? */
-static inline
-size_t cras_shm_get_num_writeable(const struct cras_audio_shm *shm)
+/* Drops the oldest queued frames if writing 'frames' more would queue more
+ * than used_size.  Return 1 if overrun happens, otherwise return 0. */
+static inline int cras_shm_check_write_overrun(struct cras_audio_shm *shm,
+					       unsigned frames)
 {
-	/* Not allowed to write to a buffer twice. */
-	if (!cras_shm_is_buffer_available(shm))
-		return 0;
-
-	return shm->config.used_size / shm->config.frame_bytes;
-}
-
-/* Flags an overrun if writing would cause one and reset the write offset.
- * Return 1 if overrun happens, otherwise return 0. */
-static inline int cras_shm_check_write_overrun(struct cras_audio_shm *shm)
-{
-	int ret = 0;
-	size_t write_buf_idx = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-
-	if (!shm->area->write_in_progress[write_buf_idx]) {
-		unsigned int used_size = shm->config.used_size;
-
-		if (shm->area->write_offset[write_buf_idx]) {
-			shm->area->num_overruns++; /* Will over-write unread */
-			ret = 1;
-		}
-
-		memset(cras_shm_buff_for_idx(shm, write_buf_idx), 0, used_size);
-
-		shm->area->write_in_progress[write_buf_idx] = 1;
-		shm->area->write_offset[write_buf_idx] = 0;
-	}
-	return ret;
-}
-
-/* Increment the write pointer for the current buffer. */
+	struct cras_audio_shm_area *area = shm->area;
+	uint32_t write_count = cras_shm_write_count(shm);
+	uint32_t read_count = cras_shm_read_count(shm);
+	unsigned used_frames = cras_shm_used_frames(shm);
+
+	frames = MIN(frames, used_frames);
+	do {
+		if (write_count - read_count <= used_frames - frames)
+			return 0;
+		/* The consumer may be reading concurrently, only ever move
+		 * its counter forward. */
+	} while (!__atomic_compare_exchange_n(
+			&area->read_count, &read_count,
+			write_count + frames - used_frames, 0,
+			__ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+	area->num_overruns++; /* Will over-write unread */
+	return 1;
+}
+
+/* Publishes 'frames' frames written at the write position to the consumer. */
 static inline
 void cras_shm_buffer_written(struct cras_audio_shm *shm, size_t frames)
 {
-	size_t buf_idx = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-
 	if (frames == 0)
 		return;
 
-	shm->area->write_offset[buf_idx] += frames * shm->config.frame_bytes;
-	shm->area->read_offset[buf_idx] = 0;
+	__atomic_store_n(&shm->area->write_count,
+			 cras_shm_write_count(shm) + frames,
+			 __ATOMIC_RELEASE);
 }
 
-/* Returns the number of frames that have been written to the current buffer. */
-static inline
-unsigned int cras_shm_frames_written(const struct cras_audio_shm *shm)
-{
-	size_t buf_idx = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-
-	return shm->area->write_offset[buf_idx] / shm->config.frame_bytes;
-}
-
-/* Signals the writing to this buffer is complete and moves to the next one. */
-static inline void cras_shm_buffer_write_complete(struct cras_audio_shm *shm)
-{
-	size_t buf_idx = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-
-	shm->area->write_in_progress[buf_idx] = 0;
-
-	assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-	buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-	shm->area->write_buf_idx = buf_idx;
-}
-
-/* Set the write pointer for the current buffer and complete the write. */
-static inline
-void cras_shm_buffer_written_start(struct cras_audio_shm *shm, size_t frames)
-{
-	size_t buf_idx = shm->area->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
-
-	shm->area->write_offset[buf_idx] = frames * shm->config.frame_bytes;
-	shm->area->read_offset[buf_idx] = 0;
-	cras_shm_buffer_write_complete(shm);
-}
-
-/* Increment the read pointer.  If it goes past the write pointer for this
- * buffer, move to the next buffer. */
+/* Increment the read pointer, never past the write pointer. */
 static inline
 void cras_shm_buffer_read(struct cras_audio_shm *shm, size_t frames)
 {
-	size_t buf_idx = shm->area->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	size_t remainder;
 	struct cras_audio_shm_area *area = shm->area;
-	struct cras_audio_shm_config *config = &shm->config;
+	uint32_t read_count, next;
 
 	if (frames == 0)
 		return;
 
-	area->read_offset[buf_idx] += frames * config->frame_bytes;
-	if (area->read_offset[buf_idx] >= area->write_offset[buf_idx]) {
-		remainder = area->read_offset[buf_idx] -
-				area->write_offset[buf_idx];
-		area->read_offset[buf_idx] = 0;
-		area->write_offset[buf_idx] = 0;
-		assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-		buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-		if (remainder < area->write_offset[buf_idx]) {
-			area->read_offset[buf_idx] = remainder;
-		} else {
-			area->read_offset[buf_idx] = 0;
-			area->write_offset[buf_idx] = 0;
-			if (remainder) {
-				/* Read all of this buffer too. */
-				buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-			}
-		}
-		area->read_buf_idx = buf_idx;
-	}
-}
+	read_count = cras_shm_read_count(shm);
+	do {
+		uint32_t write_count = cras_shm_write_count(shm);
 
-/* Read from the current buffer. This is similar to cras_shm_buffer_read(), but
- * it doesn't check for the case we may read from two buffers. */
-static inline
-void cras_shm_buffer_read_current(struct cras_audio_shm *shm, size_t frames)
-{
-	size_t buf_idx = shm->area->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
-	struct cras_audio_shm_area *area = shm->area;
-	struct cras_audio_shm_config *config = &shm->config;
-
-	area->read_offset[buf_idx] += frames * config->frame_bytes;
-	if (area->read_offset[buf_idx] >= area->write_offset[buf_idx]) {
-		area->read_offset[buf_idx] = 0;
-		area->write_offset[buf_idx] = 0;
-		buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-		area->read_buf_idx = buf_idx;
-	}
+		next = read_count + frames;
+		if ((int32_t)(write_count - next) < 0)
+			next = write_count;
+	} while (!__atomic_compare_exchange_n(&area->read_count, &read_count,
+					      next, 0, __ATOMIC_RELEASE,
+					      __ATOMIC_ACQUIRE));
 }
 
 /* Sets the volume for the stream.  The volume level is a scaling factor that
@@ -439,14 +290,23 @@ static inline int cras_shm_callback_pending(const struct cras_audio_shm *shm)
 }
 
 /* Sets the used_size of the shm region.  This is the maximum number of bytes
- * that is exchanged each time a buffer is passed from client to server.
+ * that can be queued between client and server.  The ring is sized to the next
+ * power of two frames, so the frame size must be set first.
  */
 static inline
 void cras_shm_set_used_size(struct cras_audio_shm *shm, unsigned used_size)
 {
+	unsigned ring_frames = 1;
+
+	while (ring_frames < used_size / shm->config.frame_bytes)
+		ring_frames <<= 1;
+
 	shm->config.used_size = used_size;
-	if (shm->area)
+	shm->config.ring_frames = ring_frames;
+	if (shm->area) {
 		shm->area->config.used_size = used_size;
+		shm->area->config.ring_frames = ring_frames;
+	}
 }
 
 /* Returns the used size of the shm region in bytes. */
@@ -455,16 +315,10 @@ static inline unsigned cras_shm_used_size(const struct cras_audio_shm *shm)
 	return shm->config.used_size;
 }
 
-/* Returns the used size of the shm region in frames. */
-static inline unsigned cras_shm_used_frames(const struct cras_audio_shm *shm)
-{
-	return shm->config.used_size / shm->config.frame_bytes;
-}
-
 /* Returns the total size of the shared memory region. */
 static inline unsigned cras_shm_total_size(const struct cras_audio_shm *shm)
 {
-	return cras_shm_used_size(shm) * CRAS_NUM_SHM_BUFFERS +
+	return shm->config.ring_frames * shm->config.frame_bytes +
 			sizeof(*shm->area);
 }
 
@@ -59,18 +59,23 @@ enum CRAS_STREAM_DIRECTION {
 };
 
 /*
- * Flags for stream types.
+ * Flags for stream types.  Despite the name of the enum they apply to output
+ * and input streams alike unless noted otherwise.
  *  BULK_AUDIO_OK - This stream is OK with receiving up to a full shm of samples
  *      in a single callback.
  *  USE_DEV_TIMING - Don't wake up based on stream timing.  Only wake when the
  *      device is ready. Input streams only.
  *  HOTWORD_STREAM - This stream is used only to listen for hotwords such as "OK
  *      Google".  Hardware will wake the device when this phrase is heard.
+ *  SHM_DOORBELL - Signal audio requests and replies with a pair of eventfds
+ *      instead of audio messages on the stream socket.  The amount of audio
+ *      is taken from the shm ring counters.  Output and input streams.
  */
 enum CRAS_INPUT_STREAM_FLAG {
 	BULK_AUDIO_OK = 0x01,
 	USE_DEV_TIMING = 0x02,
 	HOTWORD_STREAM = BULK_AUDIO_OK | USE_DEV_TIMING,
+	SHM_DOORBELL = 0x04,
 };
 
 /*
@@ -261,6 +266,127 @@ struct __attribute__ ((__packed__)) audio_debug_info {
 	struct audio_thread_event_log log;
 };
 
+/* Number of buckets in the run time histogram of a dsp instance. Bucket i
+ * counts the blocks that took [2^i, 2^(i+1)) microseconds to run, the first
+ * bucket also counts faster blocks and the last bucket slower ones. */
+#define DSP_PROFILE_HIST_BUCKETS 16
+#define MAX_DEBUG_DSP_PIPELINES 8
+#define MAX_DEBUG_DSP_INSTANCES 32
+#define DSP_DEBUG_TITLE_SIZE 32
+
+struct __attribute__ ((__packed__)) dsp_pipeline_debug_info {
+	char purpose[DSP_DEBUG_TITLE_SIZE];
+	uint32_t sample_rate;
+	uint32_t block_size;
+	uint32_t num_instances;
+	uint64_t total_blocks;
+	uint64_t total_samples;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+/* CPU time spent in one plugin instance, measured with
+ * CLOCK_THREAD_CPUTIME_ID around each call to its run function. */
+struct __attribute__ ((__packed__)) dsp_instance_debug_info {
+	char title[DSP_DEBUG_TITLE_SIZE];
+	uint32_t pipeline_idx;
+	uint64_t total_blocks;
+	uint64_t total_samples;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint32_t histogram[DSP_PROFILE_HIST_BUCKETS];
+};
+
+/* DSP profile shared from server to client. */
+struct __attribute__ ((__packed__)) dsp_debug_info {
+	uint32_t num_pipelines;
+	uint32_t num_instances;
+	struct dsp_pipeline_debug_info pipelines[MAX_DEBUG_DSP_PIPELINES];
+	struct dsp_instance_debug_info instances[MAX_DEBUG_DSP_INSTANCES];
+};
+
+/* Number of buckets in a latency histogram of the audio thread. Bucket i
+ * counts the samples in [2^i, 2^(i+1)) microseconds, the first bucket also
+ * counts shorter ones and the last bucket longer ones. */
+#define LATENCY_HIST_BUCKETS 16
+
+struct __attribute__ ((__packed__)) latency_hist_debug_info {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint32_t buckets[LATENCY_HIST_BUCKETS];
+};
+
+/* Latencies of one stream.
+ *    fetch - How late the audio thread asked for data, compared to the
+ *        callback time of the stream.
+ *    cb_response - Time from requesting data from the client to its reply.
+ */
+struct __attribute__ ((__packed__)) stream_latency_debug_info {
+	uint64_t stream_id;
+	uint32_t direction;
+	struct latency_hist_debug_info fetch;
+	struct latency_hist_debug_info cb_response;
+};
+
+/* Latencies of one device.
+ *    hw_io - Time spent moving one wake's worth of samples between the
+ *        streams and the hardware buffer, from mixing to committing for
+ *        output and from reading to sending to the streams for input.
+ */
+struct __attribute__ ((__packed__)) dev_latency_debug_info {
+	char dev_name[CRAS_NODE_NAME_BUFFER_SIZE];
+	uint32_t dev_idx;
+	uint32_t direction;
+	struct latency_hist_debug_info hw_io;
+};
+
+/* Latency histograms shared from server to client.
+ *    wake_jitter - How late the audio thread woke up after the time it
+ *        scheduled with fill_next_sleep_interval().
+ */
+struct __attribute__ ((__packed__)) latency_debug_info {
+	uint32_t num_streams;
+	uint32_t num_devs;
+	struct latency_hist_debug_info wake_jitter;
+	struct dev_latency_debug_info devs[MAX_DEBUG_DEVS];
+	struct stream_latency_debug_info streams[MAX_DEBUG_STREAMS];
+};
+
+/* The parts of the server state that are updated together. The server keeps
+ * two copies, it fills the one clients aren't reading and then switches
+ * update_count to it, so a reader never waits for an update to finish. A
+ * reader checks that update_count didn't change while it was copying, else
+ * the server may have started refilling its copy.
+ *    num_output_devs - Number of available output devices.
+ *    num_input_devs - Number of available input devices.
+ *    output_devs - Output audio devices currently attached.
+ *    input_devs - Input audio devices currently attached.
+ *    num_output_nodes - Number of available output nodes.
+ *    num_input_nodes - Number of available input nodes.
+ *    output_nodes - Output nodes currently attached.
+ *    input_nodes - Input nodes currently attached.
+ *    num_attached_clients - Number of clients attached to server.
+ *    client_info - List of first 20 attached clients.
+ *    num_active_streams - An array containing numbers or active
+ *        streams of different directions.
+ *    last_active_stream_time - Time the last stream was removed.  Can be used
+ *        to determine how long audio has been idle.
+ */
+struct __attribute__ ((packed, aligned(4))) cras_server_state_lists {
+	uint32_t num_output_devs;
+	uint32_t num_input_devs;
+	struct cras_iodev_info output_devs[CRAS_MAX_IODEVS];
+	struct cras_iodev_info input_devs[CRAS_MAX_IODEVS];
+	uint32_t num_output_nodes;
+	uint32_t num_input_nodes;
+	struct cras_ionode_info output_nodes[CRAS_MAX_IONODES];
+	struct cras_ionode_info input_nodes[CRAS_MAX_IONODES];
+	uint32_t num_attached_clients;
+	struct cras_attached_client_info client_info[CRAS_MAX_ATTACHED_CLIENTS];
+	uint32_t num_active_streams[CRAS_NUM_DIRECTIONS];
+	struct cras_timespec last_active_stream_time;
+};
 
 /* The server state that is shared with clients.
  *    state_version - Version of this structure.
@@ -283,27 +409,21 @@ struct __attribute__ ((__packed__)) audio_debug_info {
  *    min_capture_gain - Min allowed capture gain in dBFS * 100.
  *    max_capture_gain - Max allowed capture gain in dBFS * 100.
  *    num_streams_attached - Total number of streams since server started.
- *    num_output_devs - Number of available output devices.
- *    num_input_devs - Number of available input devices.
- *    output_devs - Output audio devices currently attached.
- *    input_devs - Input audio devices currently attached.
- *    num_output_nodes - Number of available output nodes.
- *    num_input_nodes - Number of available input nodes.
- *    output_nodes - Output nodes currently attached.
- *    input_nodes - Input nodes currently attached.
- *    num_attached_clients - Number of clients attached to server.
- *    client_info - List of first 20 attached clients.
- *    update_count - Incremented twice each time the struct is updated.  Odd
- *        during updates.
- *    num_active_streams - An array containing numbers or active
- *        streams of different directions.
- *    last_active_stream_time - Time the last stream was removed.  Can be used
- *        to determine how long audio has been idle.
+ *    update_count - Incremented each time the lists are updated, lists[
+ *        update_count & 1] is the current copy. Clients can wait on it with
+ *        FUTEX_WAIT, the server wakes them after each update.
+ *    lists - Two copies of the device, node and client lists, see
+ *        cras_server_state_lists.
  *    audio_debug_info - Debug data filled in when a client requests it. This
  *        isn't protected against concurrent updating, only one client should
  *        use it.
+ *    dsp_debug_info - The dsp profile, filled in when a client requests it.
+ *        Like audio_debug_info, only one client should use it.
+ *    latency_debug_info - The audio thread latency histograms, filled in when
+ *        a client requests it. Like audio_debug_info, only one client should
+ *        use it.
  */
-#define CRAS_SERVER_STATE_VERSION 2
+#define CRAS_SERVER_STATE_VERSION 5
 struct __attribute__ ((packed, aligned(4))) cras_server_state {
 	uint32_t state_version;
 	uint32_t volume;
@@ -320,20 +440,11 @@ struct __attribute__ ((packed, aligned(4))) cras_server_state {
 	int32_t min_capture_gain;
 	int32_t max_capture_gain;
 	uint32_t num_streams_attached;
-	uint32_t num_output_devs;
-	uint32_t num_input_devs;
-	struct cras_iodev_info output_devs[CRAS_MAX_IODEVS];
-	struct cras_iodev_info input_devs[CRAS_MAX_IODEVS];
-	uint32_t num_output_nodes;
-	uint32_t num_input_nodes;
-	struct cras_ionode_info output_nodes[CRAS_MAX_IONODES];
-	struct cras_ionode_info input_nodes[CRAS_MAX_IONODES];
-	uint32_t num_attached_clients;
-	struct cras_attached_client_info client_info[CRAS_MAX_ATTACHED_CLIENTS];
 	uint32_t update_count;
-	uint32_t num_active_streams[CRAS_NUM_DIRECTIONS];
-	struct cras_timespec last_active_stream_time;
+	struct cras_server_state_lists lists[2];
 	struct audio_debug_info audio_debug_info;
+	struct dsp_debug_info dsp_debug_info;
+	struct latency_debug_info latency_debug_info;
 };
 
 /* Actions for card add/remove/change. */
@@ -6,6 +6,7 @@
 #include <string.h>
 #include "crossover2.h"
 #include "biquad.h"
+#include "dsp_util.h"
 
 static void lr42_set(struct lr42 *lr42, enum biquad_type type, float freq)
 {
@@ -572,6 +573,156 @@ static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
 }
 #endif
 
+#ifdef DSP_HAVE_AVX2_FMA
+#include <immintrin.h>
+
+/* The state of a pair of LR4 filters in vector lanes, in the same order as
+ * the SSE and NEON versions: lp left, hp left, lp right, hp right. */
+struct lr42_lanes {
+	float b0[4], b1[4], b2[4], a1[4], a2[4];
+	float x1[4], x2[4], y1[4], y2[4], z1[4], z2[4];
+};
+
+#define LR42_LANES_GET(v, lp, hp, f) do { \
+		(v)->f[0] = (lp)->f; (v)->f[1] = (hp)->f; \
+		(v)->f[2] = (lp)->f; (v)->f[3] = (hp)->f; \
+	} while (0)
+#define LR42_LANES_GET_LR(v, lp, hp, f) do { \
+		(v)->f[0] = (lp)->f##L; (v)->f[1] = (hp)->f##L; \
+		(v)->f[2] = (lp)->f##R; (v)->f[3] = (hp)->f##R; \
+	} while (0)
+#define LR42_LANES_SET_LR(v, lp, hp, f) do { \
+		(lp)->f##L = (v)->f[0]; (hp)->f##L = (v)->f[1]; \
+		(lp)->f##R = (v)->f[2]; (hp)->f##R = (v)->f[3]; \
+	} while (0)
+
+static void lr42_lanes_get(struct lr42_lanes *v, const struct lr42 *lp,
+			   const struct lr42 *hp)
+{
+	LR42_LANES_GET(v, lp, hp, b0);
+	LR42_LANES_GET(v, lp, hp, b1);
+	LR42_LANES_GET(v, lp, hp, b2);
+	LR42_LANES_GET(v, lp, hp, a1);
+	LR42_LANES_GET(v, lp, hp, a2);
+	LR42_LANES_GET_LR(v, lp, hp, x1);
+	LR42_LANES_GET_LR(v, lp, hp, x2);
+	LR42_LANES_GET_LR(v, lp, hp, y1);
+	LR42_LANES_GET_LR(v, lp, hp, y2);
+	LR42_LANES_GET_LR(v, lp, hp, z1);
+	LR42_LANES_GET_LR(v, lp, hp, z2);
+}
+
+static void lr42_lanes_set(const struct lr42_lanes *v, struct lr42 *lp,
+			   struct lr42 *hp)
+{
+	LR42_LANES_SET_LR(v, lp, hp, x1);
+	LR42_LANES_SET_LR(v, lp, hp, x2);
+	LR42_LANES_SET_LR(v, lp, hp, y1);
+	LR42_LANES_SET_LR(v, lp, hp, y2);
+	LR42_LANES_SET_LR(v, lp, hp, z1);
+	LR42_LANES_SET_LR(v, lp, hp, z2);
+}
+
+/* One biquad step. Only the a1 term depends on the output of the previous
+ * sample, it goes last to keep the recursion short. */
+#define LR42_BIQUAD(x, x1, x2, y1, y2, b0, b1, b2, a1, a2, \
+		    fmadd, fnmadd, mul) \
+	fnmadd(a1, y1, fmadd(b0, x, fnmadd(a2, y2, \
+					   fmadd(b2, x2, mul(b1, x1)))))
+
+/* Runs the whole crossover in one pass. The first split works on four lanes,
+ * and its two outputs feed the merge of the low band and the split of the
+ * high band, which are independent and share a 256-bit vector: the lanes of
+ * lp[1]/hp[1] followed by the lanes of lp[2]/hp[2]. */
+DSP_TARGET_AVX2_FMA
+static void crossover2_process_avx2(struct crossover2 *xo2, int count,
+				    float *data0L, float *data0R,
+				    float *data1L, float *data1R,
+				    float *data2L, float *data2R)
+{
+	struct lr42_lanes s0, s1, s2;
+	__m128 b0, b1, b2, a1, a2, x1, x2, y1, y2, z1, z2, x, y, z;
+	__m256 B0, B1, B2, A1, A2, X1, X2, Y1, Y2, Z1, Z2, X, Y, Z;
+	__m128 lo, hi;
+	/* Takes the low and mid band of the first split to the lanes of the
+	 * merge and of the second split. */
+	const __m256i spread = _mm256_setr_epi32(0, 0, 2, 2, 1, 1, 3, 3);
+	int i;
+
+	lr42_lanes_get(&s0, &xo2->lp[0], &xo2->hp[0]);
+	lr42_lanes_get(&s1, &xo2->lp[1], &xo2->hp[1]);
+	lr42_lanes_get(&s2, &xo2->lp[2], &xo2->hp[2]);
+
+#define LOAD4(f) f = _mm_loadu_ps(s0.f)
+#define LOAD8(F, f) F = _mm256_setr_m128(_mm_loadu_ps(s1.f), \
+					 _mm_loadu_ps(s2.f))
+	LOAD4(b0); LOAD4(b1); LOAD4(b2); LOAD4(a1); LOAD4(a2);
+	LOAD4(x1); LOAD4(x2); LOAD4(y1); LOAD4(y2); LOAD4(z1); LOAD4(z2);
+	LOAD8(B0, b0); LOAD8(B1, b1); LOAD8(B2, b2); LOAD8(A1, a1);
+	LOAD8(A2, a2); LOAD8(X1, x1); LOAD8(X2, x2); LOAD8(Y1, y1);
+	LOAD8(Y2, y2); LOAD8(Z1, z1); LOAD8(Z2, z2);
+#undef LOAD4
+#undef LOAD8
+
+	for (i = 0; i < count; i++) {
+		x = _mm_setr_ps(data0L[i], data0L[i], data0R[i], data0R[i]);
+		y = LR42_BIQUAD(x, x1, x2, y1, y2, b0, b1, b2, a1, a2,
+				_mm_fmadd_ps, _mm_fnmadd_ps, _mm_mul_ps);
+		z = LR42_BIQUAD(y, y1, y2, z1, z2, b0, b1, b2, a1, a2,
+				_mm_fmadd_ps, _mm_fnmadd_ps, _mm_mul_ps);
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		z2 = z1;
+		z1 = z;
+
+		X = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(z),
+					     spread);
+		Y = LR42_BIQUAD(X, X1, X2, Y1, Y2, B0, B1, B2, A1, A2,
+				_mm256_fmadd_ps, _mm256_fnmadd_ps,
+				_mm256_mul_ps);
+		Z = LR42_BIQUAD(Y, Y1, Y2, Z1, Z2, B0, B1, B2, A1, A2,
+				_mm256_fmadd_ps, _mm256_fnmadd_ps,
+				_mm256_mul_ps);
+		X2 = X1;
+		X1 = X;
+		Y2 = Y1;
+		Y1 = Y;
+		Z2 = Z1;
+		Z1 = Z;
+
+		/* Low band is lp[1] + hp[1], mid and high are the outputs of
+		 * lp[2] and hp[2]. */
+		lo = _mm256_castps256_ps128(Z);
+		lo = _mm_add_ps(lo, _mm_movehdup_ps(lo));
+		data0L[i] = _mm_cvtss_f32(lo);
+		data0R[i] = _mm_cvtss_f32(_mm_movehl_ps(lo, lo));
+		hi = _mm256_extractf128_ps(Z, 1);
+		data1L[i] = _mm_cvtss_f32(hi);
+		data2L[i] = _mm_cvtss_f32(_mm_movehdup_ps(hi));
+		hi = _mm_movehl_ps(hi, hi);
+		data1R[i] = _mm_cvtss_f32(hi);
+		data2R[i] = _mm_cvtss_f32(_mm_movehdup_ps(hi));
+	}
+
+#define STORE4(f) _mm_storeu_ps(s0.f, f)
+#define STORE8(F, f) do { \
+		_mm_storeu_ps(s1.f, _mm256_castps256_ps128(F)); \
+		_mm_storeu_ps(s2.f, _mm256_extractf128_ps(F, 1)); \
+	} while (0)
+	STORE4(x1); STORE4(x2); STORE4(y1); STORE4(y2); STORE4(z1); STORE4(z2);
+	STORE8(X1, x1); STORE8(X2, x2); STORE8(Y1, y1); STORE8(Y2, y2);
+	STORE8(Z1, z1); STORE8(Z2, z2);
+#undef STORE4
+#undef STORE8
+
+	lr42_lanes_set(&s0, &xo2->lp[0], &xo2->hp[0]);
+	lr42_lanes_set(&s1, &xo2->lp[1], &xo2->hp[1]);
+	lr42_lanes_set(&s2, &xo2->lp[2], &xo2->hp[2]);
+}
+#endif
+
 void crossover2_init(struct crossover2 *xo2, float freq1, float freq2)
 {
 	int i;
@@ -590,6 +741,14 @@ void crossover2_process(struct crossover2 *xo2, int count,
 	if (!count)
 		return;
 
+#ifdef DSP_HAVE_AVX2_FMA
+	if (dsp_util_use_avx2_fma()) {
+		crossover2_process_avx2(xo2, count, data0L, data0R,
+					data1L, data1R, data2L, data2R);
+		return;
+	}
+#endif
+
 	lr42_split(&xo2->lp[0], &xo2->hp[0], count, data0L, data0R,
 		   data1L, data1R);
 	lr42_merge(&xo2->lp[1], &xo2->hp[1], count, data0L, data0R);
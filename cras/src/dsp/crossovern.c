@@ -0,0 +1,176 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "biquad.h"
+#include "crossovern.h"
+
+/* Four channels share a vector. The generic vector type lets the compiler pick
+ * SSE or NEON instructions for the target. */
+typedef float v4f __attribute__((vector_size(16)));
+
+#define XON_GROUPS (CROSSOVERN_MAX_CHANNELS / 4)
+
+/* Number of frames transposed into the work buffers at a time. */
+#define XON_BLOCK 64
+
+/* An LR4 filter is two biquads with the same parameters connected in series:
+ *
+ * x -- [BIQUAD] -- y -- [BIQUAD] -- z
+ *
+ * The variables [xyz][12] keep the history values, channel c is lane c % 4 of
+ * group c / 4.
+ */
+struct lr4n {
+	float b0, b1, b2;
+	float a1, a2;
+	v4f x1[XON_GROUPS], x2[XON_GROUPS];
+	v4f y1[XON_GROUPS], y2[XON_GROUPS];
+	v4f z1[XON_GROUPS], z2[XON_GROUPS];
+};
+
+/* See crossover2.h for the topology. */
+struct crossovern {
+	struct lr4n lp[3], hp[3];
+	/* Work buffers, frames of all channels interleaved in groups of four
+	 * lanes. */
+	v4f buf[3][XON_BLOCK * XON_GROUPS];
+	int num_channels;
+	int num_groups;
+};
+
+static void lr4n_set(struct lr4n *lr4, enum biquad_type type, float freq)
+{
+	struct biquad q;
+	biquad_set(&q, type, freq, 0, 0);
+	memset(lr4, 0, sizeof(*lr4));
+	lr4->b0 = q.b0;
+	lr4->b1 = q.b1;
+	lr4->b2 = q.b2;
+	lr4->a1 = q.a1;
+	lr4->a2 = q.a2;
+}
+
+/* Runs an LR4 filter over the frames of one group of channels. The output
+ * replaces, or is added to, what is in the out buffer. The buffers may be
+ * the same. */
+static void lr4n_process(struct lr4n *lr4, int g, const v4f *in, v4f *out,
+			 int stride, int count, int accumulate)
+{
+	float b0 = lr4->b0, b1 = lr4->b1, b2 = lr4->b2;
+	float a1 = lr4->a1, a2 = lr4->a2;
+	v4f x1 = lr4->x1[g], x2 = lr4->x2[g];
+	v4f y1 = lr4->y1[g], y2 = lr4->y2[g];
+	v4f z1 = lr4->z1[g], z2 = lr4->z2[g];
+	int j;
+
+	for (j = 0; j < count; j++) {
+		v4f x = in[j * stride];
+		v4f y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2;
+		v4f z = b0*y + b1*y1 + b2*y2 - a1*z1 - a2*z2;
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		z2 = z1;
+		z1 = z;
+		if (accumulate)
+			out[j * stride] += z;
+		else
+			out[j * stride] = z;
+	}
+
+	lr4->x1[g] = x1;
+	lr4->x2[g] = x2;
+	lr4->y1[g] = y1;
+	lr4->y2[g] = y2;
+	lr4->z1[g] = z1;
+	lr4->z2[g] = z2;
+}
+
+struct crossovern *crossovern_new(int num_channels, float freq1, float freq2)
+{
+	struct crossovern *xo;
+	int i;
+
+	if (num_channels < 1 || num_channels > CROSSOVERN_MAX_CHANNELS)
+		return NULL;
+	if (posix_memalign((void **)&xo, sizeof(v4f), sizeof(*xo)))
+		return NULL;
+	memset(xo, 0, sizeof(*xo));
+	xo->num_channels = num_channels;
+	xo->num_groups = (num_channels + 3) / 4;
+
+	for (i = 0; i < 3; i++) {
+		float f = (i == 0) ? freq1 : freq2;
+		lr4n_set(&xo->lp[i], BQ_LOWPASS, f);
+		lr4n_set(&xo->hp[i], BQ_HIGHPASS, f);
+	}
+	return xo;
+}
+
+void crossovern_free(struct crossovern *xo)
+{
+	free(xo);
+}
+
+static void transpose_in(float *buf, int lanes, float **data, int channels,
+			 int base, int count)
+{
+	int c, j;
+	for (c = 0; c < channels; c++)
+		for (j = 0; j < count; j++)
+			buf[j * lanes + c] = data[c][base + j];
+}
+
+static void transpose_out(const float *buf, int lanes, float **data,
+			  int channels, int base, int count)
+{
+	int c, j;
+	for (c = 0; c < channels; c++)
+		for (j = 0; j < count; j++)
+			data[c][base + j] = buf[j * lanes + c];
+}
+
+void crossovern_process(struct crossovern *xo, int count,
+			float **data0, float **data1, float **data2)
+{
+	int groups = xo->num_groups;
+	int lanes = groups * 4;
+	int base, n, g;
+
+	for (base = 0; base < count; base += n) {
+		n = count - base;
+		if (n > XON_BLOCK)
+			n = XON_BLOCK;
+
+		transpose_in((float *)xo->buf[0], lanes, data0,
+			     xo->num_channels, base, n);
+
+		for (g = 0; g < groups; g++) {
+			v4f *in = &xo->buf[0][g];
+			v4f *mid = &xo->buf[1][g];
+			v4f *out = &xo->buf[2][g];
+
+			/* Split: in -> lp0 -> in, in -> hp0 -> mid */
+			lr4n_process(&xo->hp[0], g, in, mid, groups, n, 0);
+			lr4n_process(&xo->lp[0], g, in, in, groups, n, 0);
+			/* Merge: in -> lp1 + hp1 -> out */
+			lr4n_process(&xo->hp[1], g, in, out, groups, n, 0);
+			lr4n_process(&xo->lp[1], g, in, out, groups, n, 1);
+			/* Split: mid -> hp2 -> in, mid -> lp2 -> mid */
+			lr4n_process(&xo->hp[2], g, mid, in, groups, n, 0);
+			lr4n_process(&xo->lp[2], g, mid, mid, groups, n, 0);
+		}
+
+		transpose_out((float *)xo->buf[2], lanes, data0,
+			      xo->num_channels, base, n);
+		transpose_out((float *)xo->buf[1], lanes, data1,
+			      xo->num_channels, base, n);
+		transpose_out((float *)xo->buf[0], lanes, data2,
+			      xo->num_channels, base, n);
+	}
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CROSSOVERN_H_
+#define CROSSOVERN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "crossovern" is an N channel version of the "crossover2" filter. It has the
+ * same three bands topology. All the channels share the filter coefficients,
+ * and the state of each LR4 filter is kept for all channels side by side, so
+ * one vector operation advances the filter for four channels at once. */
+
+/* Maximum number of channels a crossovern can process */
+#define CROSSOVERN_MAX_CHANNELS 8
+
+struct crossovern;
+
+/* Creates a crossovern filter.
+ * Args:
+ *    num_channels - The number of channels, in the range
+ *        [1, CROSSOVERN_MAX_CHANNELS].
+ *    freq1 - The normalized frequency splits low and mid band.
+ *    freq2 - The normalized frequency splits mid and high band.
+ * Returns:
+ *    The new filter, or NULL on error.
+ */
+struct crossovern *crossovern_new(int num_channels, float freq1, float freq2);
+
+/* Frees a crossovern filter. */
+void crossovern_free(struct crossovern *xo);
+
+/* Splits input samples to three bands.
+ * Args:
+ *    xo - The crossovern filter to use.
+ *    count - The number of input samples.
+ *    data0 - The input samples of each channel, also the place to store low
+ *            band output.
+ *    data1 - The place to store mid band output of each channel.
+ *    data2 - The place to store high band output of each channel.
+ */
+void crossovern_process(struct crossovern *xo, int count,
+			float **data0, float **data1, float **data2);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CROSSOVERN_H_ */
@@ -8,11 +8,66 @@
  * found in the LICENSE.WEBKIT file.
  */
 
+#define _GNU_SOURCE /* for CPU_SET */
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "drc.h"
 #include "drc_math.h"
+#include "dsp_util.h"
+
+/* Blocks shorter than this are processed serially, waking the workers would
+ * cost more than it saves. */
+#define DRC_PARALLEL_MIN_FRAMES 64
+
+/* How many times to poll a band a worker is running before yielding. */
+#define DRC_BARRIER_SPINS 4096
+
+enum drc_job_state {
+	DRC_JOB_IDLE,
+	DRC_JOB_POSTED,
+	DRC_JOB_CLAIMED,
+	DRC_JOB_DONE,
+};
+
+/* A band kernel posted to the worker pool by drc_process(). */
+struct drc_job {
+	struct drc_kernel *dk;
+	float **data;
+	int frames;
+	int state;
+};
+
+/* The worker pool shared by all DRC instances. drc_process() posts the mid
+ * and high band kernels as jobs, runs the low band itself, and then claims
+ * back any job no worker has picked up yet. So it never waits for a worker to
+ * wake up, only for bands that are already being processed.
+ *
+ * submit_lock - Held while jobs are in flight and while starting or stopping
+ *     the pool. drc_process() only try-locks it and processes serially if
+ *     another thread is using the pool.
+ * generation - Bumped when jobs are posted or the pool stops. The workers
+ *     wait for it to change on a futex, so posting never blocks on a lock.
+ * running - 1 while the worker threads are up.
+ */
+static struct {
+	pthread_mutex_t submit_lock;
+	unsigned int generation;
+	int running;
+	int num_threads;
+	pthread_t threads[DRC_NUM_KERNELS - 1];
+	struct drc_job jobs[DRC_NUM_KERNELS - 1];
+} workers = {
+	.submit_lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 static void set_default_parameters(struct drc *drc);
 static void init_data_buffer(struct drc *drc);
@@ -372,6 +427,218 @@ static void sum3(float *data, const float *data1, const float *data2, int n)
 }
 #endif
 
+/* Runs every posted job that nobody has claimed yet. */
+static void run_posted_jobs()
+{
+	struct drc_job *job;
+	int expected;
+	int i;
+
+	for (i = 0; i < DRC_NUM_KERNELS - 1; i++) {
+		job = &workers.jobs[i];
+		expected = DRC_JOB_POSTED;
+		if (!__atomic_compare_exchange_n(&job->state, &expected,
+						 DRC_JOB_CLAIMED, 0,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED))
+			continue;
+		dk_process(job->dk, job->data, job->frames);
+		__atomic_store_n(&job->state, DRC_JOB_DONE, __ATOMIC_RELEASE);
+	}
+}
+
+/* Tells the workers the generation changed. */
+static void wake_workers()
+{
+	__atomic_add_fetch(&workers.generation, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &workers.generation, FUTEX_WAKE_PRIVATE, INT_MAX,
+		NULL, NULL, 0);
+}
+
+static void *drc_worker(void *arg)
+{
+	unsigned int seen, generation;
+
+	/* Denormal handling is per thread, match the audio thread. */
+	dsp_enable_flush_denormal_to_zero();
+
+	seen = __atomic_load_n(&workers.generation, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&workers.running, __ATOMIC_RELAXED)) {
+		generation = __atomic_load_n(&workers.generation,
+					     __ATOMIC_ACQUIRE);
+		if (generation == seen) {
+			/* Returns at once if it changed since the load. */
+			syscall(SYS_futex, &workers.generation,
+				FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+			continue;
+		}
+		seen = generation;
+		run_posted_jobs();
+	}
+	return NULL;
+}
+
+/* Stops and joins the worker threads. Called with submit_lock held. */
+static void stop_workers()
+{
+	int i;
+
+	__atomic_store_n(&workers.running, 0, __ATOMIC_RELAXED);
+	wake_workers();
+
+	for (i = 0; i < workers.num_threads; i++)
+		pthread_join(workers.threads[i], NULL);
+	workers.num_threads = 0;
+}
+
+/* Creates a worker pinned to cpu. It runs SCHED_RR at rt_priority, or at the
+ * default policy if rt_priority is 0. */
+static int create_worker(pthread_t *thread, int cpu, int rt_priority)
+{
+	struct sched_param param;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int rc;
+
+	pthread_attr_init(&attr);
+
+	/* Keep the workers off each other's core, the scheduler would
+	 * otherwise happily stack them next to the audio thread. */
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	rc = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	if (rc)
+		goto out;
+
+	if (rt_priority > 0) {
+		param.sched_priority = rt_priority;
+		rc = pthread_attr_setinheritsched(&attr,
+						  PTHREAD_EXPLICIT_SCHED);
+		if (!rc)
+			rc = pthread_attr_setschedpolicy(&attr, SCHED_RR);
+		if (!rc)
+			rc = pthread_attr_setschedparam(&attr, &param);
+		if (rc)
+			goto out;
+	}
+
+	rc = pthread_create(thread, &attr, drc_worker, NULL);
+out:
+	pthread_attr_destroy(&attr);
+	return -rc;
+}
+
+int drc_workers_start(int rt_priority)
+{
+	cpu_set_t cpus;
+	int num_threads;
+	int cpu = -1;
+	int i;
+	int rc = 0;
+
+	pthread_mutex_lock(&workers.submit_lock);
+
+	if (workers.num_threads)
+		goto out;
+
+	/* The workers go on the CPUs this process may run on, leaving the
+	 * first one alone. On a single core serial is as good as it gets. */
+	if (sched_getaffinity(0, sizeof(cpus), &cpus)) {
+		rc = -errno;
+		goto out;
+	}
+	num_threads = CPU_COUNT(&cpus) - 1;
+	if (num_threads < 1)
+		goto out;
+	if (num_threads > DRC_NUM_KERNELS - 1)
+		num_threads = DRC_NUM_KERNELS - 1;
+	while (!CPU_ISSET(++cpu, &cpus))
+		;
+
+	__atomic_store_n(&workers.running, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < num_threads; i++) {
+		while (!CPU_ISSET(++cpu, &cpus))
+			;
+		rc = create_worker(&workers.threads[i], cpu, rt_priority);
+		if (rc < 0) {
+			stop_workers();
+			goto out;
+		}
+		workers.num_threads++;
+	}
+
+out:
+	pthread_mutex_unlock(&workers.submit_lock);
+	return rc;
+}
+
+void drc_workers_stop()
+{
+	pthread_mutex_lock(&workers.submit_lock);
+	if (workers.num_threads)
+		stop_workers();
+	pthread_mutex_unlock(&workers.submit_lock);
+}
+
+int drc_workers_running()
+{
+	return __atomic_load_n(&workers.running, __ATOMIC_RELAXED);
+}
+
+/* Applies compression to each band of the signal, in place. The bands are
+ * independent, so when the worker pool is up the mid and high band kernels
+ * run on the workers while this thread handles the low band. */
+static void process_kernels(struct drc *drc, float **data, int frames)
+{
+	float **bands[DRC_NUM_KERNELS] = { data, drc->data1, drc->data2 };
+	struct drc_job *job;
+	int spins;
+	int i;
+
+	if (frames < DRC_PARALLEL_MIN_FRAMES ||
+	    !__atomic_load_n(&workers.running, __ATOMIC_RELAXED) ||
+	    pthread_mutex_trylock(&workers.submit_lock))
+		goto serial;
+
+	/* The pool may have been stopped before the lock was taken. */
+	if (!workers.running) {
+		pthread_mutex_unlock(&workers.submit_lock);
+		goto serial;
+	}
+
+	for (i = 1; i < DRC_NUM_KERNELS; i++) {
+		job = &workers.jobs[i - 1];
+		job->dk = &drc->kernel[i];
+		job->data = bands[i];
+		job->frames = frames;
+		__atomic_store_n(&job->state, DRC_JOB_POSTED, __ATOMIC_RELEASE);
+	}
+
+	wake_workers();
+
+	dk_process(&drc->kernel[0], bands[0], frames);
+
+	/* Take back whatever the workers haven't started, then wait for the
+	 * bands they are in the middle of. */
+	run_posted_jobs();
+	for (i = 0; i < DRC_NUM_KERNELS - 1; i++) {
+		job = &workers.jobs[i];
+		spins = 0;
+		while (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) !=
+		       DRC_JOB_DONE) {
+			if (++spins > DRC_BARRIER_SPINS)
+				sched_yield();
+		}
+	}
+
+	pthread_mutex_unlock(&workers.submit_lock);
+	return;
+
+serial:
+	for (i = 0; i < DRC_NUM_KERNELS; i++)
+		dk_process(&drc->kernel[i], bands[i], frames);
+}
+
 void drc_process(struct drc *drc, float **data, int frames)
 {
 	int i;
@@ -389,9 +656,7 @@ void drc_process(struct drc *drc, float **data, int frames)
 	/* Apply compression to each band of the signal. The processing is
 	 * performed in place.
 	 */
-	dk_process(&drc->kernel[0], data, frames);
-	dk_process(&drc->kernel[1], data1, frames);
-	dk_process(&drc->kernel[2], data2, frames);
+	process_kernels(drc, data, frames);
 
 	/* Sum the three bands of signal */
 	for (i = 0; i < DRC_NUM_CHANNELS; i++)
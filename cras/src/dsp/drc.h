@@ -169,6 +169,28 @@ void drc_free(struct drc *drc);
  */
 void drc_process(struct drc *drc, float **data, int frames);
 
+/* Starts the worker threads drc_process() uses to run the band kernels of a
+ * DRC concurrently. The pool is shared by all DRC instances and uses at most
+ * one thread per extra band, pinned to CPUs other than the first this process
+ * may run on. On a single CPU system no thread is started and processing
+ * stays serial.
+ * Args:
+ *    rt_priority - The SCHED_RR priority of the workers, or 0 to use the
+ *        default policy. An audio thread running at real time priority must
+ *        not wait on workers that aren't, so the caller needs RLIMIT_RTPRIO
+ *        set to at least this.
+ * Returns:
+ *    0 on success, or a negative error code if a thread couldn't be created
+ *    or given its priority or CPU. No worker is left running then.
+ */
+int drc_workers_start(int rt_priority);
+
+/* Stops the worker threads, drc_process() goes back to serial processing. */
+void drc_workers_stop();
+
+/* Returns 1 if the worker threads are running, 0 otherwise. */
+int drc_workers_running();
+
 /* Sets a parameter for the DRC.
  * Args:
  *    drc - The DRC we want to use.
@@ -14,6 +14,7 @@
 
 #include "drc_math.h"
 #include "drc_kernel.h"
+#include "dsp_util.h"
 
 #define MAX_PRE_DELAY_FRAMES 1024
 #define MAX_PRE_DELAY_FRAMES_MASK (MAX_PRE_DELAY_FRAMES - 1)
@@ -502,6 +503,24 @@ static inline void max_abs_division(float *output,
 }
 #endif
 
+#ifdef DSP_HAVE_AVX2_FMA
+#include <immintrin.h>
+DSP_TARGET_AVX2_FMA
+static void max_abs_division_avx2(float *output,
+				  const float *data0, const float *data1)
+{
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 x, y;
+	int i;
+
+	for (i = 0; i < DIVISION_FRAMES; i += 8) {
+		x = _mm256_and_ps(_mm256_loadu_ps(data0 + i), mask);
+		y = _mm256_and_ps(_mm256_loadu_ps(data1 + i), mask);
+		_mm256_storeu_ps(output + i, _mm256_max_ps(x, y));
+	}
+}
+#endif
+
 /* Update detector_average from the last input division. */
 static void dk_update_detector_average(struct drc_kernel *dk)
 {
@@ -520,9 +539,16 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 	}
 
 	/* The max abs value across all channels for this frame */
-	max_abs_division(abs_input_array,
-			 &dk->pre_delay_buffers[0][div_start],
-			 &dk->pre_delay_buffers[1][div_start]);
+#ifdef DSP_HAVE_AVX2_FMA
+	if (dsp_util_use_avx2_fma())
+		max_abs_division_avx2(abs_input_array,
+				      &dk->pre_delay_buffers[0][div_start],
+				      &dk->pre_delay_buffers[1][div_start]);
+	else
+#endif
+		max_abs_division(abs_input_array,
+				 &dk->pre_delay_buffers[0][div_start],
+				 &dk->pre_delay_buffers[1][div_start]);
 
 	for (i = 0; i < DIVISION_FRAMES; i++) {
 		/* Compute compression amount from un-delayed signal */
@@ -952,6 +978,94 @@ static void dk_compress_output(struct drc_kernel *dk)
 }
 #endif
 
+#ifdef DSP_HAVE_AVX2_FMA
+/* warp_sinf() for eight values. */
+DSP_TARGET_AVX2_FMA
+static inline __m256 warp_sin_avx2(__m256 x)
+{
+	/* See warp_sinf() for the details for the constants. */
+	const __m256 A7 = _mm256_set1_ps(-4.3330336920917034149169921875e-3f);
+	const __m256 A5 = _mm256_set1_ps(7.9434238374233245849609375e-2f);
+	const __m256 A3 = _mm256_set1_ps(-0.645892798900604248046875f);
+	const __m256 A1 = _mm256_set1_ps(1.5707910060882568359375f);
+	__m256 x2 = _mm256_mul_ps(x, x);
+	__m256 x4 = _mm256_mul_ps(x2, x2);
+	__m256 hi = _mm256_fmadd_ps(A7, x2, A5);
+	__m256 lo = _mm256_fmadd_ps(A3, x2, A1);
+
+	return _mm256_mul_ps(_mm256_fmadd_ps(hi, x4, lo), x);
+}
+
+/* Same as the SSE version of dk_compress_output(), eight frames at a time. */
+DSP_TARGET_AVX2_FMA
+static void dk_compress_output_avx2(struct drc_kernel *dk)
+{
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	const __m256 g = _mm256_set1_ps(dk->master_linear_gain);
+	const __m256 one = _mm256_set1_ps(1);
+	int attack = envelope_rate < 1;
+	__m256 x, base, r8, gain;
+	float c, r, v[8];
+	int i;
+
+	/* Exponential approach to desired gain. Attack reduces the gain to
+	 * the desired one, release increases it exponentially to 1.0. */
+	if (attack) {
+		c = compressor_gain - scaled_desired_gain;
+		r = 1 - envelope_rate;
+		base = _mm256_set1_ps(scaled_desired_gain);
+	} else {
+		c = compressor_gain;
+		r = envelope_rate;
+		base = _mm256_setzero_ps();
+	}
+	for (i = 0; i < 8; i++) {
+		c *= r;
+		v[i] = c;
+	}
+	x = _mm256_loadu_ps(v);
+	r = r * r * r * r;
+	r8 = _mm256_set1_ps(r * r);
+
+	for (i = 0; i < DIVISION_FRAMES; i += 8) {
+		if (i)
+			x = _mm256_mul_ps(x, r8);
+		if (!attack)
+			x = _mm256_min_ps(x, one);
+
+		/* Warp pre-compression gain to smooth out sharp exponential
+		 * transition points, and apply the master gain. */
+		gain = _mm256_mul_ps(
+			warp_sin_avx2(_mm256_add_ps(x, base)), g);
+
+		_mm256_storeu_ps(ptr_left + i, _mm256_mul_ps(
+			_mm256_loadu_ps(ptr_left + i), gain));
+		_mm256_storeu_ps(ptr_right + i, _mm256_mul_ps(
+			_mm256_loadu_ps(ptr_right + i), gain));
+	}
+
+	_mm256_storeu_ps(v, _mm256_add_ps(x, base));
+	dk->compressor_gain = v[7];
+}
+#endif
+
+/* Applies dk_compress_output(), or its AVX2/FMA version if it can be used. */
+static void dk_compress_division(struct drc_kernel *dk)
+{
+#ifdef DSP_HAVE_AVX2_FMA
+	if (dsp_util_use_avx2_fma()) {
+		dk_compress_output_avx2(dk);
+		return;
+	}
+#endif
+	dk_compress_output(dk);
+}
+
 /* After one complete divison of samples have been received (and one divison of
  * samples have been output), we calculate shaped power average
  * (detector_average) from the input division, update envelope parameters from
@@ -962,7 +1076,7 @@ static void dk_process_one_division(struct drc_kernel *dk)
 {
 	dk_update_detector_average(dk);
 	dk_update_envelope(dk);
-	dk_compress_output(dk);
+	dk_compress_division(dk);
 }
 
 /* Copy the input data to the pre-delay buffer, and copy the output data back to
@@ -1038,7 +1152,7 @@ void dk_process(struct drc_kernel *dk, float *data_channels[], unsigned count)
 
 	if (!dk->processed) {
 		dk_update_envelope(dk);
-		dk_compress_output(dk);
+		dk_compress_division(dk);
 		dk->processed = 1;
 	}
 
@@ -3,6 +3,8 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
+
 #include "dsp_util.h"
 
 #ifndef max
@@ -373,12 +375,416 @@ static void interleave_stereo(float *input1, float *input2,
 #define interleave_stereo interleave_stereo
 #endif
 
+/*
+ * N-channel conversions. Four frames are converted at a time: the samples of
+ * four channels in each of the four frames are loaded and transposed, so each
+ * vector holds one channel. Channels are taken four at a time, with the last
+ * group overlapping the one before it when the channel count isn't a multiple
+ * of four. One channel is converted straight, stereo is transposed in pairs.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define HAVE_VF4
+typedef __m128 vf4;
+
+static inline vf4 vf4_load(const float *in)
+{
+	return _mm_loadu_ps(in);
+}
+
+static inline void vf4_store(float *out, vf4 v)
+{
+	_mm_storeu_ps(out, v);
+}
+
+static inline void vf4_transpose(vf4 *a, vf4 *b, vf4 *c, vf4 *d)
+{
+	_MM_TRANSPOSE4_PS(*a, *b, *c, *d);
+}
+
+/* [L0 R0 L1 R1], [L2 R2 L3 R3] -> [L0 L1 L2 L3], [R0 R1 R2 R3] */
+static inline void vf4_unzip(vf4 *a, vf4 *b)
+{
+	vf4 l = _mm_shuffle_ps(*a, *b, _MM_SHUFFLE(2, 0, 2, 0));
+	vf4 r = _mm_shuffle_ps(*a, *b, _MM_SHUFFLE(3, 1, 3, 1));
+
+	*a = l;
+	*b = r;
+}
+
+/* The inverse of vf4_unzip. */
+static inline void vf4_zip(vf4 *a, vf4 *b)
+{
+	vf4 lo = _mm_unpacklo_ps(*a, *b);
+	vf4 hi = _mm_unpackhi_ps(*a, *b);
+
+	*a = lo;
+	*b = hi;
+}
+
+static inline vf4 vf4_load_s16(const int16_t *in)
+{
+	__m128i x = _mm_loadl_epi64((const __m128i *)in);
+
+	x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+	return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / 32768.0f));
+}
+
+static inline vf4 vf4_load_s24(const int32_t *in)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)in);
+
+	x = _mm_srai_epi32(_mm_slli_epi32(x, 8), 8);
+	return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / 8388608.0f));
+}
+
+static inline vf4 vf4_load_s32(const int32_t *in)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)in);
+
+	return _mm_mul_ps(_mm_cvtepi32_ps(x),
+			  _mm_set1_ps(1.0f / 2147483648.0f));
+}
+
+/* cvtps2dq rounds to nearest with ties to even, packssdw clamps. */
+static inline void vf4_store_s16(int16_t *out, vf4 v)
+{
+	__m128i x = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(32768.0f)));
+
+	_mm_storel_epi64((__m128i *)out, _mm_packs_epi32(x, x));
+}
+
+/* Rounds to nearest with ties away from zero, like the scalar conversions.
+ * A float has no fraction bits left to add 0.5 to at 24 bits, so the value is
+ * truncated and then moved by one when the fraction truncated is at least
+ * one half. cvttps2dq gives 0x80000000 for values too large for an int, those
+ * are flipped to 0x7fffffff.
+ */
+static inline __m128i vf4_round(vf4 v)
+{
+	__m128i t = _mm_cvttps_epi32(v);
+	vf4 frac = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+	vf4 up = _mm_and_ps(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)),
+			    _mm_cmplt_ps(frac, _mm_set1_ps(1.0f)));
+	vf4 down = _mm_and_ps(_mm_cmple_ps(frac, _mm_set1_ps(-0.5f)),
+			      _mm_cmpgt_ps(frac, _mm_set1_ps(-1.0f)));
+	vf4 over = _mm_cmpge_ps(v, _mm_set1_ps(2147483648.0f));
+
+	t = _mm_sub_epi32(t, _mm_castps_si128(up));
+	t = _mm_add_epi32(t, _mm_castps_si128(down));
+	return _mm_xor_si128(t, _mm_castps_si128(over));
+}
+
+static inline void vf4_store_s24(int32_t *out, vf4 v)
+{
+	v = _mm_mul_ps(v, _mm_set1_ps(8388608.0f));
+	v = _mm_min_ps(v, _mm_set1_ps(8388607.0f));
+	v = _mm_max_ps(v, _mm_set1_ps(-8388608.0f));
+	_mm_storeu_si128((__m128i *)out, vf4_round(v));
+}
+
+static inline void vf4_store_s32(int32_t *out, vf4 v)
+{
+	v = _mm_mul_ps(v, _mm_set1_ps(2147483648.0f));
+	_mm_storeu_si128((__m128i *)out, vf4_round(v));
+}
+
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+
+#define HAVE_VF4
+typedef float32x4_t vf4;
+
+static inline vf4 vf4_load(const float *in)
+{
+	return vld1q_f32(in);
+}
+
+static inline void vf4_store(float *out, vf4 v)
+{
+	vst1q_f32(out, v);
+}
+
+static inline void vf4_transpose(vf4 *a, vf4 *b, vf4 *c, vf4 *d)
+{
+	float32x4x2_t ab = vtrnq_f32(*a, *b);
+	float32x4x2_t cd = vtrnq_f32(*c, *d);
+
+	*a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+	*b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+	*c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+	*d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+/* [L0 R0 L1 R1], [L2 R2 L3 R3] -> [L0 L1 L2 L3], [R0 R1 R2 R3] */
+static inline void vf4_unzip(vf4 *a, vf4 *b)
+{
+	float32x4x2_t lr = vuzpq_f32(*a, *b);
+
+	*a = lr.val[0];
+	*b = lr.val[1];
+}
+
+/* The inverse of vf4_unzip. */
+static inline void vf4_zip(vf4 *a, vf4 *b)
+{
+	float32x4x2_t lr = vzipq_f32(*a, *b);
+
+	*a = lr.val[0];
+	*b = lr.val[1];
+}
+
+static inline vf4 vf4_load_s16(const int16_t *in)
+{
+	return vcvtq_n_f32_s32(vmovl_s16(vld1_s16(in)), 15);
+}
+
+static inline vf4 vf4_load_s24(const int32_t *in)
+{
+	int32x4_t x = vshrq_n_s32(vshlq_n_s32(vld1q_s32(in), 8), 8);
+
+	return vcvtq_n_f32_s32(x, 23);
+}
+
+static inline vf4 vf4_load_s32(const int32_t *in)
+{
+	return vcvtq_n_f32_s32(vld1q_s32(in), 31);
+}
+
+/* Rounds to nearest with ties away from zero, clamping to the int range.
+ * Without vcvta the value is truncated and then moved by one when the
+ * fraction truncated is at least one half, adding 0.5 first would round
+ * again at 24 bits.
+ */
+static inline int32x4_t vf4_round(vf4 v)
+{
+#ifdef __aarch64__
+	return vcvtaq_s32_f32(v);
+#else
+	int32x4_t t = vcvtq_s32_f32(v);
+	vf4 frac = vsubq_f32(v, vcvtq_f32_s32(t));
+	uint32x4_t up = vandq_u32(vcgeq_f32(frac, vdupq_n_f32(0.5f)),
+				  vcltq_f32(frac, vdupq_n_f32(1.0f)));
+	uint32x4_t down = vandq_u32(vcleq_f32(frac, vdupq_n_f32(-0.5f)),
+				    vcgtq_f32(frac, vdupq_n_f32(-1.0f)));
+
+	t = vsubq_s32(t, vreinterpretq_s32_u32(up));
+	return vaddq_s32(t, vreinterpretq_s32_u32(down));
+#endif
+}
+
+static inline void vf4_store_s16(int16_t *out, vf4 v)
+{
+	vst1_s16(out, vqmovn_s32(vf4_round(vmulq_n_f32(v, 32768.0f))));
+}
+
+static inline void vf4_store_s24(int32_t *out, vf4 v)
+{
+	v = vmulq_n_f32(v, 8388608.0f);
+	v = vminq_f32(v, vdupq_n_f32(8388607.0f));
+	v = vmaxq_f32(v, vdupq_n_f32(-8388608.0f));
+	vst1q_s32(out, vf4_round(v));
+}
+
+static inline void vf4_store_s32(int32_t *out, vf4 v)
+{
+	vst1q_s32(out, vf4_round(vmulq_n_f32(v, 2147483648.0f)));
+}
+#endif
+
+/* Conversions of single samples, for the frames left over by the vector
+ * kernels and for machines without them. */
+
+static inline float s16_to_float(int16_t x)
+{
+	return x / 32768.0f;
+}
+
+static inline float s24_to_float(int32_t x)
+{
+	return (int32_t)((uint32_t)x << 8) / 256 / 8388608.0f;
+}
+
+static inline float s32_to_float(int32_t x)
+{
+	return x / 2147483648.0f;
+}
+
+static inline int16_t float_to_s16(float x)
+{
+	float f = x * 32768.0f;
+
+	f += (f >= 0) ? 0.5f : -0.5f;
+	return max(-32768, min(32767, (int)(f)));
+}
+
+/* Rounded in double, a float doesn't have the precision left to add 0.5 to
+ * a 24 bit sample. */
+static inline int32_t float_to_s24(float x)
+{
+	double f = x * 8388608.0;
+
+	f += (f >= 0) ? 0.5 : -0.5;
+	return (int32_t)max(-8388608.0, min(8388607.0, f));
+}
+
+static inline int32_t float_to_s32(float x)
+{
+	double f = x * 2147483648.0;
+
+	f += (f >= 0) ? 0.5 : -0.5;
+	return (int32_t)max(-2147483648.0, min(2147483647.0, f));
+}
+
+/* Defines deinterleave_<name>() and interleave_<name>() for samples of type
+ * int_t, using the vector kernels for whole groups of four frames. */
+#ifdef HAVE_VF4
+#define DEFINE_VF4_KERNELS(name, int_t)					\
+static int deinterleave_##name##_vf4(const int_t *input,		\
+				     float *const *output,		\
+				     int channels, int frames)		\
+{									\
+	int f, ch;							\
+									\
+	if (channels == 3)						\
+		return 0;						\
+									\
+	for (f = 0; f + 4 <= frames; f += 4) {				\
+		const int_t *in = input + f * channels;			\
+		vf4 a, b, c, d;						\
+									\
+		if (channels == 1) {					\
+			vf4_store(output[0] + f, vf4_load_##name(in));	\
+			continue;					\
+		}							\
+		if (channels == 2) {					\
+			a = vf4_load_##name(in);			\
+			b = vf4_load_##name(in + 4);			\
+			vf4_unzip(&a, &b);				\
+			vf4_store(output[0] + f, a);			\
+			vf4_store(output[1] + f, b);			\
+			continue;					\
+		}							\
+		for (ch = 0; ch < channels; ch += 4) {			\
+			if (ch > channels - 4)				\
+				ch = channels - 4;			\
+			a = vf4_load_##name(in + ch);			\
+			b = vf4_load_##name(in + channels + ch);	\
+			c = vf4_load_##name(in + 2 * channels + ch);	\
+			d = vf4_load_##name(in + 3 * channels + ch);	\
+			vf4_transpose(&a, &b, &c, &d);			\
+			vf4_store(output[ch] + f, a);			\
+			vf4_store(output[ch + 1] + f, b);		\
+			vf4_store(output[ch + 2] + f, c);		\
+			vf4_store(output[ch + 3] + f, d);		\
+		}							\
+	}								\
+	return f;							\
+}									\
+									\
+static int interleave_##name##_vf4(float *const *input, int_t *output,	\
+				   int channels, int frames)		\
+{									\
+	int f, ch;							\
+									\
+	if (channels == 3)						\
+		return 0;						\
+									\
+	for (f = 0; f + 4 <= frames; f += 4) {				\
+		int_t *out = output + f * channels;			\
+		vf4 a, b, c, d;						\
+									\
+		if (channels == 1) {					\
+			vf4_store_##name(out, vf4_load(input[0] + f));	\
+			continue;					\
+		}							\
+		if (channels == 2) {					\
+			a = vf4_load(input[0] + f);			\
+			b = vf4_load(input[1] + f);			\
+			vf4_zip(&a, &b);				\
+			vf4_store_##name(out, a);			\
+			vf4_store_##name(out + 4, b);			\
+			continue;					\
+		}							\
+		for (ch = 0; ch < channels; ch += 4) {			\
+			if (ch > channels - 4)				\
+				ch = channels - 4;			\
+			a = vf4_load(input[ch] + f);			\
+			b = vf4_load(input[ch + 1] + f);		\
+			c = vf4_load(input[ch + 2] + f);		\
+			d = vf4_load(input[ch + 3] + f);		\
+			vf4_transpose(&a, &b, &c, &d);			\
+			vf4_store_##name(out + ch, a);			\
+			vf4_store_##name(out + channels + ch, b);	\
+			vf4_store_##name(out + 2 * channels + ch, c);	\
+			vf4_store_##name(out + 3 * channels + ch, d);	\
+		}							\
+	}								\
+	return f;							\
+}
+#else
+#define DEFINE_VF4_KERNELS(name, int_t)					\
+static int deinterleave_##name##_vf4(const int_t *input,		\
+				     float *const *output,		\
+				     int channels, int frames)		\
+{									\
+	return 0;							\
+}									\
+									\
+static int interleave_##name##_vf4(float *const *input, int_t *output,	\
+				   int channels, int frames)		\
+{									\
+	return 0;							\
+}
+#endif
+
+#define DEFINE_INTERLEAVE(name, int_t)					\
+DEFINE_VF4_KERNELS(name, int_t)						\
+									\
+static void deinterleave_##name(const int_t *input,			\
+				float *const *output,			\
+				int channels, int frames)		\
+{									\
+	float *output_ptr[channels];					\
+	int i, j, done;							\
+									\
+	done = deinterleave_##name##_vf4(input, output, channels,	\
+					 frames);			\
+	input += done * channels;					\
+	for (i = 0; i < channels; i++)					\
+		output_ptr[i] = output[i] + done;			\
+									\
+	for (i = done; i < frames; i++)					\
+		for (j = 0; j < channels; j++)				\
+			*(output_ptr[j]++) = name##_to_float(*input++);	\
+}									\
+									\
+static void interleave_##name(float *const *input, int_t *output,	\
+			      int channels, int frames)			\
+{									\
+	float *input_ptr[channels];					\
+	int i, j, done;							\
+									\
+	done = interleave_##name##_vf4(input, output, channels, frames);\
+	output += done * channels;					\
+	for (i = 0; i < channels; i++)					\
+		input_ptr[i] = input[i] + done;				\
+									\
+	for (i = done; i < frames; i++)					\
+		for (j = 0; j < channels; j++)				\
+			*output++ = float_to_##name(*(input_ptr[j]++));	\
+}
+
+DEFINE_INTERLEAVE(s16, int16_t)
+DEFINE_INTERLEAVE(s24, int32_t)
+DEFINE_INTERLEAVE(s32, int32_t)
+
+
 void dsp_util_deinterleave(int16_t *input, float *const *output, int channels,
 			   int frames)
 {
-	float *output_ptr[channels];
-	int i, j;
-
 #ifdef deinterleave_stereo
 	if (channels == 2) {
 		deinterleave_stereo(input, output[0], output[1], frames);
@@ -386,36 +792,107 @@ void dsp_util_deinterleave(int16_t *input, float *const *output, int channels,
 	}
 #endif
 
+	deinterleave_s16(input, output, channels, frames);
+}
+
+void dsp_util_interleave(float *const *input, int16_t *output, int channels,
+			 int frames)
+{
+#ifdef interleave_stereo
+	if (channels == 2) {
+		interleave_stereo(input[0], input[1], output, frames);
+		return;
+	}
+#endif
+
+	interleave_s16(input, output, channels, frames);
+}
+
+void dsp_util_deinterleave_s24(const int32_t *input, float *const *output,
+			       int channels, int frames)
+{
+	deinterleave_s24(input, output, channels, frames);
+}
+
+void dsp_util_interleave_s24(float *const *input, int32_t *output,
+			     int channels, int frames)
+{
+	interleave_s24(input, output, channels, frames);
+}
+
+void dsp_util_deinterleave_s32(const int32_t *input, float *const *output,
+			       int channels, int frames)
+{
+	deinterleave_s32(input, output, channels, frames);
+}
+
+void dsp_util_interleave_s32(float *const *input, int32_t *output,
+			     int channels, int frames)
+{
+	interleave_s32(input, output, channels, frames);
+}
+
+void dsp_util_deinterleave_float(const float *input, float *const *output,
+				 int channels, int frames)
+{
+	float *output_ptr[channels];
+	int i, j;
+
+	if (channels == 1) {
+		memcpy(output[0], input, frames * sizeof(float));
+		return;
+	}
+
 	for (i = 0; i < channels; i++)
 		output_ptr[i] = output[i];
 
 	for (i = 0; i < frames; i++)
 		for (j = 0; j < channels; j++)
-			*(output_ptr[j]++) = *input++ / 32768.0f;
+			*(output_ptr[j]++) = *input++;
 }
 
-void dsp_util_interleave(float *const *input, int16_t *output, int channels,
-			 int frames)
+void dsp_util_interleave_float(float *const *input, float *output,
+			       int channels, int frames)
 {
 	float *input_ptr[channels];
 	int i, j;
 
-#ifdef interleave_stereo
-	if (channels == 2) {
-		interleave_stereo(input[0], input[1], output, frames);
+	if (channels == 1) {
+		memcpy(output, input[0], frames * sizeof(float));
 		return;
 	}
-#endif
 
 	for (i = 0; i < channels; i++)
 		input_ptr[i] = input[i];
 
 	for (i = 0; i < frames; i++)
-		for (j = 0; j < channels; j++) {
-			float f = *(input_ptr[j]++) * 32768.0f;
-			f += (f >= 0) ? 0.5f : -0.5f;
-			*output++ = max(-32768, min(32767, (int)(f)));
-		}
+		for (j = 0; j < channels; j++)
+			*output++ = *(input_ptr[j]++);
+}
+
+/* -1 until the CPU has been checked. */
+static int use_avx2_fma = -1;
+
+static int cpu_has_avx2_fma()
+{
+#ifdef DSP_HAVE_AVX2_FMA
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return 0;
+#endif
+}
+
+int dsp_util_use_avx2_fma()
+{
+	if (use_avx2_fma < 0)
+		use_avx2_fma = cpu_has_avx2_fma();
+	return use_avx2_fma;
+}
+
+int dsp_util_enable_avx2_fma(int enable)
+{
+	use_avx2_fma = enable && cpu_has_avx2_fma();
+	return use_avx2_fma;
 }
 
 void dsp_enable_flush_denormal_to_zero()
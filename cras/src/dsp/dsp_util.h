@@ -12,6 +12,15 @@ extern "C" {
 
 #include <stdint.h>
 
+/* The AVX2/FMA versions of the filters are built regardless of the compiler
+ * flags, with the target attribute, and picked at run time. Functions marked
+ * DSP_TARGET_AVX2_FMA must only be called if dsp_util_use_avx2_fma() returns
+ * 1. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define DSP_HAVE_AVX2_FMA
+#define DSP_TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+#endif
+
 /* Converts from interleaved int16_t samples to non-interleaved float samples.
  * The int16_t samples have range [-32768, 32767], and the float samples have
  * range [-1.0, 1.0].
@@ -37,6 +46,72 @@ void dsp_util_deinterleave(int16_t *input, float *const *output, int channels,
 void dsp_util_interleave(float *const *input, int16_t *output, int channels,
 			 int frames);
 
+/* Converts from interleaved S24_LE samples, held in the low 24 bits of each
+ * int32_t, to non-interleaved float samples in range [-1.0, 1.0]. Args are
+ * the same as for dsp_util_deinterleave().
+ */
+void dsp_util_deinterleave_s24(const int32_t *input, float *const *output,
+			       int channels, int frames);
+
+/* Converts from non-interleaved float samples to interleaved S24_LE samples,
+ * clipped to the 24 bit range. This is the inverse of
+ * dsp_util_deinterleave_s24().
+ */
+void dsp_util_interleave_s24(float *const *input, int32_t *output,
+			     int channels, int frames);
+
+/* Converts from interleaved S32_LE samples to non-interleaved float samples in
+ * range [-1.0, 1.0]. Args are the same as for dsp_util_deinterleave().
+ */
+void dsp_util_deinterleave_s32(const int32_t *input, float *const *output,
+			       int channels, int frames);
+
+/* Converts from non-interleaved float samples to interleaved S32_LE samples,
+ * clipped to the 32 bit range. This is the inverse of
+ * dsp_util_deinterleave_s32().
+ */
+void dsp_util_interleave_s32(float *const *input, int32_t *output,
+			     int channels, int frames);
+
+/* Converts from interleaved float samples to non-interleaved float samples.
+ * Args:
+ *    input - The interleaved input buffer. Every "channels" samples is a frame.
+ *    output - Pointers to output buffers. There are "channels" output buffers.
+ *    channels - The number of samples per frame.
+ *    frames - The number of frames to convert.
+ */
+void dsp_util_deinterleave_float(const float *input, float *const *output,
+				 int channels, int frames);
+
+/* Converts from non-interleaved float samples to interleaved float samples.
+ * This is the inverse of dsp_util_deinterleave_float(). The samples are not
+ * clipped.
+ * Args:
+ *    input - Pointers to input buffers. There are "channels" input buffers.
+ *    output - The interleaved output buffer. Every "channels" samples is a
+ *        frame.
+ *    channels - The number of samples per frame.
+ *    frames - The number of frames to convert.
+ */
+void dsp_util_interleave_float(float *const *input, float *output,
+			       int channels, int frames);
+
+/* Returns 1 if the AVX2/FMA code paths are used, that is if the CPU supports
+ * both extensions and they haven't been disabled.
+ */
+int dsp_util_use_avx2_fma();
+
+/* Enables or disables the AVX2/FMA code paths. They are enabled by default on
+ * CPUs that support them, disabling them falls back to the SSE or C code, for
+ * example to compare the two.
+ * Args:
+ *    enable - 1 to use the AVX2/FMA code if the CPU supports it, 0 to not use
+ *        it.
+ * Returns:
+ *    1 if the AVX2/FMA code paths are used after the call, 0 otherwise.
+ */
+int dsp_util_enable_avx2_fma(int enable);
+
 /* Disables denormal numbers in floating point calculation. Denormal numbers
  * happens often in IIR filters, and it can be very slow.
  */
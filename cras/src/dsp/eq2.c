@@ -4,6 +4,7 @@
  */
 
 #include <stdlib.h>
+#include "dsp_util.h"
 #include "eq2.h"
 
 struct eq2 {
@@ -314,16 +315,120 @@ static inline void eq2_process_two_sse3(struct biquad (*bq)[2],
 }
 #endif
 
+#ifdef DSP_HAVE_AVX2_FMA
+#include <immintrin.h>
+
+/* Copies a field of four cascaded biquads into lanes, the four stages of the
+ * left channel followed by the four stages of the right channel. */
+#define EQ2_LANES(bq, field) _mm256_setr_ps( \
+	bq[0][0].field, bq[1][0].field, bq[2][0].field, bq[3][0].field, \
+	bq[0][1].field, bq[1][1].field, bq[2][1].field, bq[3][1].field)
+
+/* Runs four cascaded biquads on both channels with one vector. The cascade is
+ * pipelined: in step t, stage s filters sample t - s, and its input is what
+ * stage s - 1 produced in step t - 1. Sample t leaves the last stage three
+ * steps after it enters the first. In the first and last three steps some
+ * stages have no sample to filter, those lanes keep their state. */
+DSP_TARGET_AVX2_FMA
+static void eq2_process_four_avx2(struct biquad (*bq)[2],
+				  float *data0, float *data1, int count)
+{
+	const __m256 b0 = EQ2_LANES(bq, b0);
+	const __m256 b1 = EQ2_LANES(bq, b1);
+	const __m256 b2 = EQ2_LANES(bq, b2);
+	const __m256 a1 = EQ2_LANES(bq, a1);
+	const __m256 a2 = EQ2_LANES(bq, a2);
+	const __m256i stage = _mm256_setr_epi32(0, 1, 2, 3, 0, 1, 2, 3);
+	__m256 x1 = EQ2_LANES(bq, x1);
+	__m256 x2 = EQ2_LANES(bq, x2);
+	__m256 y1 = EQ2_LANES(bq, y1);
+	__m256 y2 = EQ2_LANES(bq, y2);
+	__m256 x, y, in, acc, active;
+	__m256i t;
+	float out[8];
+	int step, s;
+
+	/* The previous output of each stage is its y1. */
+	y = y1;
+	for (step = 0; step < count + 3; step++) {
+		/* Shift the outputs up one stage and feed the new samples to
+		 * the first. */
+		if (step < count)
+			x = _mm256_insertf128_ps(
+				_mm256_castps128_ps256(
+					_mm_broadcast_ss(&data0[step])),
+				_mm_broadcast_ss(&data1[step]), 1);
+		else
+			x = _mm256_setzero_ps();
+		in = _mm256_castsi256_ps(
+			_mm256_alignr_epi8(_mm256_castps_si256(y),
+					   _mm256_castps_si256(x), 12));
+
+		/* Only the a1 term depends on the previous step's output of
+		 * the same stage, keep it last. */
+		acc = _mm256_fmadd_ps(b2, x2, _mm256_mul_ps(b1, x1));
+		acc = _mm256_fnmadd_ps(a2, y2, acc);
+		acc = _mm256_fmadd_ps(b0, in, acc);
+		y = _mm256_fnmadd_ps(a1, y1, acc);
+
+		if (step < 3 || step >= count) {
+			/* Stage s is active if 0 <= step - s < count. */
+			t = _mm256_sub_epi32(_mm256_set1_epi32(step), stage);
+			active = _mm256_castsi256_ps(_mm256_and_si256(
+				_mm256_cmpgt_epi32(t, _mm256_set1_epi32(-1)),
+				_mm256_cmpgt_epi32(_mm256_set1_epi32(count),
+						   t)));
+			y = _mm256_blendv_ps(y1, y, active);
+			x2 = _mm256_blendv_ps(x2, x1, active);
+			x1 = _mm256_blendv_ps(x1, in, active);
+			y2 = _mm256_blendv_ps(y2, y1, active);
+		} else {
+			x2 = x1;
+			x1 = in;
+			y2 = y1;
+		}
+		y1 = y;
+
+		if (step >= 3) {
+			data0[step - 3] = _mm_cvtss_f32(_mm_permute_ps(
+				_mm256_castps256_ps128(y), 0xff));
+			data1[step - 3] = _mm_cvtss_f32(_mm_permute_ps(
+				_mm256_extractf128_ps(y, 1), 0xff));
+		}
+	}
+
+#define EQ2_STORE_LANES(v, field) do { \
+		_mm256_storeu_ps(out, v); \
+		for (s = 0; s < 4; s++) { \
+			bq[s][0].field = out[s]; \
+			bq[s][1].field = out[s + 4]; \
+		} \
+	} while (0)
+
+	EQ2_STORE_LANES(x1, x1);
+	EQ2_STORE_LANES(x2, x2);
+	EQ2_STORE_LANES(y1, y1);
+	EQ2_STORE_LANES(y2, y2);
+#undef EQ2_STORE_LANES
+}
+#endif
+
 void eq2_process(struct eq2 *eq2, float *data0, float *data1, int count)
 {
-	int i;
+	int i = 0;
 	int n;
 	if (!count)
 		return;
 	n = eq2->n[0];
 	if (eq2->n[1] > n)
 		n = eq2->n[1];
-	for (i = 0; i < n; i += 2) {
+#ifdef DSP_HAVE_AVX2_FMA
+	if (dsp_util_use_avx2_fma())
+		for (; i + 4 <= n; i += 4)
+			eq2_process_four_avx2(&eq2->biquad[i], data0, data1,
+					      count);
+#endif
+	for (; i < n; i += 2) {
 		if (i + 1 == n) {
 			eq2_process_one(&eq2->biquad[i], data0, data1, count);
 		} else {
@@ -0,0 +1,157 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "eqn.h"
+
+/* Four channels share a vector. The generic vector type lets the compiler pick
+ * SSE or NEON instructions for the target. */
+typedef float v4f __attribute__((vector_size(16)));
+
+#define EQN_GROUPS (EQN_MAX_CHANNELS / 4)
+
+/* Number of frames transposed into the work buffer at a time. */
+#define EQN_BLOCK 64
+
+/* One biquad stage for all the channels. Channel c is lane c % 4 of
+ * group c / 4. */
+struct eqn_stage {
+	v4f b0[EQN_GROUPS], b1[EQN_GROUPS], b2[EQN_GROUPS];
+	v4f a1[EQN_GROUPS], a2[EQN_GROUPS];
+	v4f x1[EQN_GROUPS], x2[EQN_GROUPS];
+	v4f y1[EQN_GROUPS], y2[EQN_GROUPS];
+};
+
+struct eqn {
+	struct eqn_stage stage[MAX_BIQUADS_PER_EQN];
+	/* Frames of all channels, interleaved in groups of four lanes. */
+	v4f buf[EQN_BLOCK * EQN_GROUPS];
+	int num_channels;
+	int num_groups;
+	int num_stages;
+	int n[EQN_MAX_CHANNELS];
+};
+
+static void eqn_set_stage(struct eqn_stage *s, int channel,
+			  const struct biquad *q)
+{
+	int g = channel / 4, l = channel % 4;
+
+	s->b0[g][l] = q->b0;
+	s->b1[g][l] = q->b1;
+	s->b2[g][l] = q->b2;
+	s->a1[g][l] = q->a1;
+	s->a2[g][l] = q->a2;
+	s->x1[g][l] = q->x1;
+	s->x2[g][l] = q->x2;
+	s->y1[g][l] = q->y1;
+	s->y2[g][l] = q->y2;
+}
+
+struct eqn *eqn_new(int num_channels)
+{
+	struct eqn *eqn;
+	struct biquad identity;
+	int i, j;
+
+	if (num_channels < 1 || num_channels > EQN_MAX_CHANNELS)
+		return NULL;
+	if (posix_memalign((void **)&eqn, sizeof(v4f), sizeof(*eqn)))
+		return NULL;
+	memset(eqn, 0, sizeof(*eqn));
+	eqn->num_channels = num_channels;
+	eqn->num_groups = (num_channels + 3) / 4;
+
+	/* Initialize all biquads to identity filter, so if the channels have
+	 * different numbers of biquads, it still works. */
+	biquad_set(&identity, BQ_NONE, 0, 0, 0);
+	for (i = 0; i < MAX_BIQUADS_PER_EQN; i++)
+		for (j = 0; j < EQN_MAX_CHANNELS; j++)
+			eqn_set_stage(&eqn->stage[i], j, &identity);
+
+	return eqn;
+}
+
+void eqn_free(struct eqn *eqn)
+{
+	free(eqn);
+}
+
+int eqn_append_biquad(struct eqn *eqn, int channel,
+		      enum biquad_type type, float freq, float Q, float gain)
+{
+	struct biquad q;
+
+	biquad_set(&q, type, freq, Q, gain);
+	return eqn_append_biquad_direct(eqn, channel, &q);
+}
+
+int eqn_append_biquad_direct(struct eqn *eqn, int channel,
+			     const struct biquad *biquad)
+{
+	if (channel < 0 || channel >= eqn->num_channels)
+		return -1;
+	if (eqn->n[channel] >= MAX_BIQUADS_PER_EQN)
+		return -1;
+	eqn_set_stage(&eqn->stage[eqn->n[channel]++], channel, biquad);
+	if (eqn->n[channel] > eqn->num_stages)
+		eqn->num_stages = eqn->n[channel];
+	return 0;
+}
+
+/* Runs one stage over the frames in the work buffer, for one group of four
+ * channels. */
+static void eqn_process_stage(struct eqn_stage *s, int g, v4f *buf,
+			      int stride, int count)
+{
+	v4f b0 = s->b0[g], b1 = s->b1[g], b2 = s->b2[g];
+	v4f a1 = s->a1[g], a2 = s->a2[g];
+	v4f x1 = s->x1[g], x2 = s->x2[g];
+	v4f y1 = s->y1[g], y2 = s->y2[g];
+	int j;
+
+	for (j = 0; j < count; j++) {
+		v4f x = buf[j * stride];
+		v4f y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2;
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		buf[j * stride] = y;
+	}
+
+	s->x1[g] = x1;
+	s->x2[g] = x2;
+	s->y1[g] = y1;
+	s->y2[g] = y2;
+}
+
+void eqn_process(struct eqn *eqn, float **data, int count)
+{
+	int lanes = eqn->num_groups * 4;
+	float *buf = (float *)eqn->buf;
+	int base, n, c, i, g, j;
+
+	for (base = 0; base < count; base += n) {
+		n = count - base;
+		if (n > EQN_BLOCK)
+			n = EQN_BLOCK;
+
+		for (c = 0; c < eqn->num_channels; c++)
+			for (j = 0; j < n; j++)
+				buf[j * lanes + c] = data[c][base + j];
+
+		for (i = 0; i < eqn->num_stages; i++)
+			for (g = 0; g < eqn->num_groups; g++)
+				eqn_process_stage(&eqn->stage[i], g,
+						  &eqn->buf[g],
+						  eqn->num_groups, n);
+
+		for (c = 0; c < eqn->num_channels; c++)
+			for (j = 0; j < n; j++)
+				data[c][base + j] = buf[j * lanes + c];
+	}
+}
@@ -0,0 +1,79 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef EQN_H_
+#define EQN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "eqn" is an N channel version of the "eq2" filter. The state of each biquad
+ * stage is kept for all channels side by side, so one vector operation
+ * advances the stage for four channels at once. */
+
+#include "biquad.h"
+
+/* Maximum number of biquad filters an EQN can have per channel */
+#define MAX_BIQUADS_PER_EQN 10
+
+/* Maximum number of channels an EQN can process */
+#define EQN_MAX_CHANNELS 8
+
+struct eqn;
+
+/* Create an EQN.
+ * Args:
+ *    num_channels - The number of channels, in the range
+ *        [1, EQN_MAX_CHANNELS].
+ * Returns:
+ *    The new EQN, or NULL on error.
+ */
+struct eqn *eqn_new(int num_channels);
+
+/* Free an EQN. */
+void eqn_free(struct eqn *eqn);
+
+/* Append a biquad filter to an EQN. An EQN can have at most MAX_BIQUADS_PER_EQN
+ * biquad filters per channel.
+ * Args:
+ *    eqn - The EQN we want to use.
+ *    channel - The channel we want to append the filter to.
+ *    type - The type of the biquad filter we want to append.
+ *    frequency - The value should be in the range [0, 1]. It is relative to
+ *        half of the sampling rate.
+ *    Q, gain - The meaning depends on the type of the filter. See Web Audio
+ *        API for details.
+ * Returns:
+ *    0 if success. -1 if the eq has no room for more biquads.
+ */
+int eqn_append_biquad(struct eqn *eqn, int channel,
+		      enum biquad_type type, float freq, float Q, float gain);
+
+/* Append a biquad filter to an EQN. This is similar to eqn_append_biquad(),
+ * but it specifies the biquad coefficients directly.
+ * Args:
+ *    eqn - The EQN we want to use.
+ *    channel - The channel we want to append the filter to.
+ *    biquad - The parameters for the biquad filter.
+ * Returns:
+ *    0 if success. -1 if the eq has no room for more biquads.
+ */
+int eqn_append_biquad_direct(struct eqn *eqn, int channel,
+			     const struct biquad *biquad);
+
+/* Process a buffer of audio data through the EQN.
+ * Args:
+ *    eqn - The EQN we want to use.
+ *    data - The arrays of audio samples, one for each channel.
+ *    count - The number of elements in each of the data array to process.
+ */
+void eqn_process(struct eqn *eqn, float **data, int count);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* EQN_H_ */
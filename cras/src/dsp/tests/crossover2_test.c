@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <time.h>
+#include <math.h>
 #include <memory.h>
 
 #include "crossover2.h"
@@ -37,14 +38,31 @@ void process(struct crossover2 *xo2, int count, float *data0L, float *data0R,
 				   data2L + start, data2R + start);
 }
 
-int main(int argc, char **argv)
+/* Splits data0 into the three bands, returns the processing time in
+ * seconds. */
+static double run_crossover2(size_t frames, float *data0, float *data1,
+			     float *data2)
 {
-	size_t frames;
-	float *data0, *data1, *data2;
 	double NQ = 44100 / 2;
 	struct timespec tp1, tp2;
 	struct crossover2 xo2;
 
+	crossover2_init(&xo2, 400 / NQ, 4000 / NQ);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp1);
+	process(&xo2, frames, data0, data0 + frames, data1, data1 + frames,
+		data2, data2 + frames);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp2);
+
+	return tp_diff(&tp2, &tp1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t frames;
+	float *data0, *data1, *data2;
+	float *copy0, *copy1, *copy2;
+	double secs;
+
 	if (argc != 3 && argc != 6) {
 		printf("Usage: crossover2_test input.raw output.raw "
 		       "[low.raw mid.raw high.raw]\n");
@@ -57,14 +75,29 @@ int main(int argc, char **argv)
 	data0 = read_raw(argv[1], &frames);
 	data1 = (float *)malloc(sizeof(float) * frames * 2);
 	data2 = (float *)malloc(sizeof(float) * frames * 2);
+	copy0 = (float *)malloc(sizeof(float) * frames * 2);
+	copy1 = (float *)malloc(sizeof(float) * frames * 2);
+	copy2 = (float *)malloc(sizeof(float) * frames * 2);
+	memcpy(copy0, data0, sizeof(float) * frames * 2);
 
-	crossover2_init(&xo2, 400 / NQ, 4000 / NQ);
-	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp1);
-	process(&xo2, frames, data0, data0 + frames, data1, data1 + frames,
-		data2, data2 + frames);
-	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp2);
-	printf("processing takes %g seconds for %zu samples\n",
-	       tp_diff(&tp2, &tp1), frames * 2);
+	dsp_util_enable_avx2_fma(0);
+	secs = run_crossover2(frames, data0, data1, data2);
+	printf("processing takes %g seconds for %zu samples (%.1f ns/frame)\n",
+	       secs, frames * 2, secs * 1e9 / frames);
+
+	/* Compare the AVX2/FMA code to the default one on the same input. */
+	if (dsp_util_enable_avx2_fma(1)) {
+		float diff;
+
+		secs = run_crossover2(frames, copy0, copy1, copy2);
+		diff = dsp_util_max_abs_diff(data0, copy0, frames * 2);
+		diff = fmaxf(diff, dsp_util_max_abs_diff(data1, copy1,
+							 frames * 2));
+		diff = fmaxf(diff, dsp_util_max_abs_diff(data2, copy2,
+							 frames * 2));
+		printf("avx2/fma takes %g seconds (%.1f ns/frame), "
+		       "max difference %g\n", secs, secs * 1e9 / frames, diff);
+	}
 
 	if (argc == 6) {
 		write_raw(argv[3], data0, frames);
@@ -80,6 +113,9 @@ int main(int argc, char **argv)
 	free(data0);
 	free(data1);
 	free(data2);
+	free(copy0);
+	free(copy1);
+	free(copy2);
 
 	dsp_util_print_fp_exceptions();
 	return 0;
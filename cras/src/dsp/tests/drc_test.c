@@ -4,6 +4,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "dsp_test_util.h"
@@ -23,7 +24,8 @@ static double tp_diff(struct timespec *tp2, struct timespec *tp1)
 		+ (tp2->tv_nsec - tp1->tv_nsec) * 1e-9;
 }
 
-static void process(struct drc *drc, float *buf, size_t frames)
+/* Runs the DRC over buf, returns the processing time in seconds. */
+static double process(struct drc *drc, float *buf, size_t frames)
 {
 	struct timespec tp1, tp2;
 	int start;
@@ -38,24 +40,14 @@ static void process(struct drc *drc, float *buf, size_t frames)
 		start += chunk;
 	}
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp2);
-	printf("drc processing takes %g seconds for %zu samples\n",
-	       tp_diff(&tp2, &tp1), frames * 2);
+	return tp_diff(&tp2, &tp1);
 }
 
-int main(int argc, char **argv)
+static struct drc *create_drc()
 {
 	double NQ = 44100 / 2; /* nyquist frequency */
 	struct drc *drc;
-	size_t frames;
-	float *buf;
-
-	if (argc != 3) {
-		printf("Usage: drc_test input.raw output.raw\n");
-		return 1;
-	}
 
-	dsp_enable_flush_denormal_to_zero();
-	dsp_util_clear_fp_exceptions();
 	drc = drc_new(44100);
 
 	drc->emphasis_disabled = 0;
@@ -87,10 +79,46 @@ int main(int argc, char **argv)
 	drc_set_param(drc, 2, PARAM_POST_GAIN, 0);
 
 	drc_init(drc);
+	return drc;
+}
+
+int main(int argc, char **argv)
+{
+	struct drc *drc;
+	size_t frames;
+	float *buf, *copy;
+	double secs;
+
+	if (argc != 3) {
+		printf("Usage: drc_test input.raw output.raw\n");
+		return 1;
+	}
+
+	dsp_enable_flush_denormal_to_zero();
+	dsp_util_clear_fp_exceptions();
 	buf = read_raw(argv[1], &frames);
-	process(drc, buf, frames);
-	write_raw(argv[2], buf, frames);
+	copy = (float *)malloc(sizeof(float) * frames * 2);
+	memcpy(copy, buf, sizeof(float) * frames * 2);
+
+	dsp_util_enable_avx2_fma(0);
+	drc = create_drc();
+	secs = process(drc, buf, frames);
+	printf("drc processing takes %g seconds for %zu samples "
+	       "(%.1f ns/frame)\n", secs, frames * 2, secs * 1e9 / frames);
 	drc_free(drc);
+
+	/* Compare the AVX2/FMA code to the default one on the same input. */
+	if (dsp_util_enable_avx2_fma(1)) {
+		drc = create_drc();
+		secs = process(drc, copy, frames);
+		printf("avx2/fma takes %g seconds (%.1f ns/frame), "
+		       "max difference %g\n", secs, secs * 1e9 / frames,
+		       dsp_util_max_abs_diff(buf, copy, frames * 2));
+		drc_free(drc);
+	}
+
+	write_raw(argv[2], buf, frames);
+	free(copy);
 	free(buf);
 	dsp_util_print_fp_exceptions();
 	return 0;
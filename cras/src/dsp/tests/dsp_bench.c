@@ -0,0 +1,677 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Measures the dsp kernels and the builtin dsp modules over a matrix of block
+ * sizes, channel counts and sample rates. Each case is warmed up before it is
+ * timed, and the cost is reported as ns per frame and, when the cpu cycle
+ * counter can be read, cycles per sample.
+ *
+ * Usage: dsp_bench [-s seconds of audio per case] [-f name filter]
+ *                  [-j json output file]
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_dsp_ini.h"
+#include "cras_dsp_module.h"
+#include "crossover.h"
+#include "crossover2.h"
+#include "crossovern.h"
+#include "drc.h"
+#include "dsp_util.h"
+#include "eq.h"
+#include "eq2.h"
+#include "eqn.h"
+
+#define MAX_CHANNELS 8
+#define MAX_BLOCK 1024
+#define MAX_PARAMS (MAX_CHANNELS * 16)
+#define WARMUP_SECS 0.1
+
+static const int block_sizes[] = { 64, 256, 1024 };
+static const int sample_rates[] = { 44100, 48000, 96000 };
+static const int stereo[] = { 2, 0 };
+static const int mono[] = { 1, 0 };
+static const int multi[] = { 2, 6, 8, 0 };
+
+/* State shared by the setup, run and teardown of one case. The kernels
+ * filter "work" in place and refill it from "src" each block so the signal
+ * stays stationary, the modules read "src" and write "out" the same way the
+ * pipeline connects them. */
+struct bench_ctx {
+	int channels;
+	int block;
+	int rate;
+	float *src[MAX_CHANNELS];
+	float *work[MAX_CHANNELS];
+	float *out[3 * MAX_CHANNELS];
+	void *interleaved;
+	void *state;
+	struct plugin plugin;
+	struct dsp_module *module;
+	float params[MAX_PARAMS];
+};
+
+struct bench {
+	const char *name;
+	const int *channels;
+	void (*setup)(struct bench_ctx *c);
+	void (*run)(struct bench_ctx *c);
+	void (*teardown)(struct bench_ctx *c);
+};
+
+struct result {
+	const char *name;
+	int channels;
+	int block;
+	int rate;
+	unsigned long frames;
+	double ns_per_frame;
+	double cycles_per_sample; /* Negative when the counter is missing. */
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Opens a user space cpu cycle counter for this thread, returns -1 if the
+ * kernel or the cpu doesn't provide one. */
+static int cycles_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cycles_read(int fd)
+{
+	uint64_t count = 0;
+
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
+
+static void copy_src(struct bench_ctx *c)
+{
+	int i;
+
+	for (i = 0; i < c->channels; i++)
+		memcpy(c->work[i], c->src[i], c->block * sizeof(float));
+}
+
+/* Normalized frequency of hz at the case's sample rate. */
+static float norm(struct bench_ctx *c, float hz)
+{
+	return hz / (c->rate / 2);
+}
+
+/*
+ * Kernels
+ */
+static void biquad_setup(struct bench_ctx *c)
+{
+	c->state = eq_new();
+	eq_append_biquad(c->state, BQ_PEAKING, norm(c, 1000), 1, 3);
+}
+
+static void eq_setup(struct bench_ctx *c)
+{
+	c->state = eq_new();
+	eq_append_biquad(c->state, BQ_HIGHPASS, norm(c, 80), 0.7f, 0);
+	eq_append_biquad(c->state, BQ_PEAKING, norm(c, 250), 1, -3);
+	eq_append_biquad(c->state, BQ_PEAKING, norm(c, 3000), 2, 4);
+	eq_append_biquad(c->state, BQ_HIGHSHELF, norm(c, 10000), 0.7f, -2);
+}
+
+static void eq_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	eq_process(c->state, c->work[0], c->block);
+}
+
+static void eq_teardown(struct bench_ctx *c)
+{
+	eq_free(c->state);
+}
+
+static void eq2_setup(struct bench_ctx *c)
+{
+	int ch;
+
+	c->state = eq2_new();
+	for (ch = 0; ch < 2; ch++) {
+		eq2_append_biquad(c->state, ch, BQ_HIGHPASS, norm(c, 80),
+				  0.7f, 0);
+		eq2_append_biquad(c->state, ch, BQ_PEAKING, norm(c, 250),
+				  1, -3);
+		eq2_append_biquad(c->state, ch, BQ_PEAKING, norm(c, 3000),
+				  2, 4);
+		eq2_append_biquad(c->state, ch, BQ_HIGHSHELF, norm(c, 10000),
+				  0.7f, -2);
+	}
+}
+
+static void eq2_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	eq2_process(c->state, c->work[0], c->work[1], c->block);
+}
+
+static void eq2_teardown(struct bench_ctx *c)
+{
+	eq2_free(c->state);
+}
+
+static void eqn_setup(struct bench_ctx *c)
+{
+	int ch;
+
+	c->state = eqn_new(c->channels);
+	for (ch = 0; ch < c->channels; ch++) {
+		eqn_append_biquad(c->state, ch, BQ_HIGHPASS, norm(c, 80),
+				  0.7f, 0);
+		eqn_append_biquad(c->state, ch, BQ_PEAKING, norm(c, 250),
+				  1, -3);
+		eqn_append_biquad(c->state, ch, BQ_PEAKING, norm(c, 3000),
+				  2, 4);
+		eqn_append_biquad(c->state, ch, BQ_HIGHSHELF, norm(c, 10000),
+				  0.7f, -2);
+	}
+}
+
+static void eqn_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	eqn_process(c->state, c->work, c->block);
+}
+
+static void eqn_teardown(struct bench_ctx *c)
+{
+	eqn_free(c->state);
+}
+
+static void crossover_setup(struct bench_ctx *c)
+{
+	c->state = calloc(1, sizeof(struct crossover));
+	crossover_init(c->state, norm(c, 200), norm(c, 2000));
+}
+
+static void crossover_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	crossover_process(c->state, c->block, c->work[0], c->out[0],
+			  c->out[1]);
+}
+
+static void crossover2_setup(struct bench_ctx *c)
+{
+	c->state = calloc(1, sizeof(struct crossover2));
+	crossover2_init(c->state, norm(c, 200), norm(c, 2000));
+}
+
+static void crossover2_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	crossover2_process(c->state, c->block, c->work[0], c->work[1],
+			   c->out[0], c->out[1], c->out[2], c->out[3]);
+}
+
+static void free_state(struct bench_ctx *c)
+{
+	free(c->state);
+}
+
+static void crossovern_setup(struct bench_ctx *c)
+{
+	c->state = crossovern_new(c->channels, norm(c, 200), norm(c, 2000));
+}
+
+static void crossovern_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	crossovern_process(c->state, c->block, c->work, c->out,
+			   c->out + c->channels);
+}
+
+static void crossovern_teardown(struct bench_ctx *c)
+{
+	crossovern_free(c->state);
+}
+
+/* The three band setup of the drc section in the default dsp.ini. */
+static const float drc_bands[3][8] = {
+	/* freq, enable, threshold, knee, ratio, attack, release, boost */
+	{ 0, 1, -24, 30, 12, 0.003f, 0.2f, 0 },
+	{ 200, 1, -24, 30, 12, 0.003f, 0.2f, 0 },
+	{ 2000, 1, -24, 30, 12, 0.003f, 0.2f, 0 },
+};
+
+static void drc_setup(struct bench_ctx *c)
+{
+	struct drc *drc;
+	int i;
+
+	drc = drc_new(c->rate);
+	for (i = 0; i < DRC_NUM_KERNELS; i++) {
+		const float *b = drc_bands[i];
+		drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ,
+			      norm(c, b[0]));
+		drc_set_param(drc, i, PARAM_ENABLED, b[1]);
+		drc_set_param(drc, i, PARAM_THRESHOLD, b[2]);
+		drc_set_param(drc, i, PARAM_KNEE, b[3]);
+		drc_set_param(drc, i, PARAM_RATIO, b[4]);
+		drc_set_param(drc, i, PARAM_ATTACK, b[5]);
+		drc_set_param(drc, i, PARAM_RELEASE, b[6]);
+		drc_set_param(drc, i, PARAM_POST_GAIN, b[7]);
+	}
+	drc_init(drc);
+	c->state = drc;
+}
+
+static void drc_run(struct bench_ctx *c)
+{
+	copy_src(c);
+	drc_process(c->state, c->work, c->block);
+}
+
+static void drc_teardown(struct bench_ctx *c)
+{
+	drc_free(c->state);
+}
+
+/* The interleave cases convert a block from the device format to float and
+ * back, as cras_dsp_apply() does around the pipeline. */
+static void interleave_setup(struct bench_ctx *c)
+{
+	c->interleaved = calloc(c->block * c->channels, sizeof(int32_t));
+}
+
+static void interleave_teardown(struct bench_ctx *c)
+{
+	free(c->interleaved);
+}
+
+static void interleave_s16_run(struct bench_ctx *c)
+{
+	dsp_util_deinterleave(c->interleaved, c->work, c->channels, c->block);
+	dsp_util_interleave(c->src, c->interleaved, c->channels, c->block);
+}
+
+static void interleave_s24_run(struct bench_ctx *c)
+{
+	dsp_util_deinterleave_s24(c->interleaved, c->work, c->channels,
+				  c->block);
+	dsp_util_interleave_s24(c->src, c->interleaved, c->channels,
+				c->block);
+}
+
+static void interleave_s32_run(struct bench_ctx *c)
+{
+	dsp_util_deinterleave_s32(c->interleaved, c->work, c->channels,
+				  c->block);
+	dsp_util_interleave_s32(c->src, c->interleaved, c->channels,
+				c->block);
+}
+
+static void interleave_float_run(struct bench_ctx *c)
+{
+	dsp_util_deinterleave_float(c->interleaved, c->work, c->channels,
+				    c->block);
+	dsp_util_interleave_float(c->src, c->interleaved, c->channels,
+				  c->block);
+}
+
+/*
+ * Builtin modules
+ */
+static void add_ports(struct bench_ctx *c, enum port_direction direction,
+		      enum port_type type, int count)
+{
+	struct port *port;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		port = ARRAY_APPEND_ZERO(&c->plugin.ports);
+		port->direction = direction;
+		port->type = type;
+		port->flow_id = INVALID_FLOW_ID;
+	}
+}
+
+/* Loads the builtin module "label" with num_in audio inputs read from src,
+ * num_out audio outputs written to out and the control values in params,
+ * connected in that port order. */
+static void module_load(struct bench_ctx *c, const char *label, int num_in,
+			int num_out, const float *params, int num_params)
+{
+	int i, port = 0;
+
+	memset(&c->plugin, 0, sizeof(c->plugin));
+	c->plugin.title = label;
+	c->plugin.library = "builtin";
+	c->plugin.label = label;
+	add_ports(c, PORT_INPUT, PORT_AUDIO, num_in);
+	add_ports(c, PORT_OUTPUT, PORT_AUDIO, num_out);
+	add_ports(c, PORT_INPUT, PORT_CONTROL, num_params);
+	memcpy(c->params, params, num_params * sizeof(float));
+
+	c->module = cras_dsp_module_load_builtin(&c->plugin);
+	if (!c->module || c->module->instantiate(c->module, c->rate)) {
+		fprintf(stderr, "Failed to load builtin %s\n", label);
+		exit(1);
+	}
+	for (i = 0; i < num_in; i++)
+		c->module->connect_port(c->module, port++, c->src[i]);
+	for (i = 0; i < num_out; i++)
+		c->module->connect_port(c->module, port++, c->out[i]);
+	for (i = 0; i < num_params; i++)
+		c->module->connect_port(c->module, port++, &c->params[i]);
+}
+
+static void module_run(struct bench_ctx *c)
+{
+	c->module->run(c->module, c->block);
+}
+
+static void module_teardown(struct bench_ctx *c)
+{
+	c->module->deinstantiate(c->module);
+	c->module->free_module(c->module);
+	ARRAY_FREE(&c->plugin.ports);
+}
+
+static void mix_stereo_setup(struct bench_ctx *c)
+{
+	module_load(c, "mix_stereo", 2, 2, NULL, 0);
+}
+
+static void invert_lr_setup(struct bench_ctx *c)
+{
+	module_load(c, "invert_lr", 2, 2, NULL, 0);
+}
+
+static void swap_lr_setup(struct bench_ctx *c)
+{
+	module_load(c, "swap_lr", 2, 2, NULL, 0);
+}
+
+/* type, freq, Q, gain for each biquad, matching eq_setup(). */
+static const float eq_params[] = {
+	BQ_HIGHPASS, 80, 0.7f, 0,
+	BQ_PEAKING, 250, 1, -3,
+	BQ_PEAKING, 3000, 2, 4,
+	BQ_HIGHSHELF, 10000, 0.7f, -2,
+};
+
+#define EQ_PARAMS (int)(sizeof(eq_params) / sizeof(eq_params[0]))
+
+static void mod_eq_setup(struct bench_ctx *c)
+{
+	module_load(c, "eq", 1, 1, eq_params, EQ_PARAMS);
+}
+
+/* eq2 and eqn interleave the parameters of each channel per biquad. */
+static void fill_nch_eq_params(float *params, int channels)
+{
+	int i, ch;
+
+	for (i = 0; i < EQ_PARAMS; i += 4)
+		for (ch = 0; ch < channels; ch++)
+			memcpy(&params[i * channels + ch * 4], &eq_params[i],
+			       4 * sizeof(float));
+}
+
+static void mod_eq2_setup(struct bench_ctx *c)
+{
+	float params[2 * EQ_PARAMS];
+
+	fill_nch_eq_params(params, 2);
+	module_load(c, "eq2", 2, 2, params, 2 * EQ_PARAMS);
+}
+
+static void mod_eqn_setup(struct bench_ctx *c)
+{
+	float params[MAX_CHANNELS * EQ_PARAMS];
+
+	fill_nch_eq_params(params, c->channels);
+	module_load(c, "eqn", c->channels, c->channels, params,
+		    c->channels * EQ_PARAMS);
+}
+
+static void mod_crossovern_setup(struct bench_ctx *c)
+{
+	static const float freqs[] = { 200, 2000 };
+
+	module_load(c, "crossovern", c->channels, 3 * c->channels, freqs, 2);
+}
+
+static void mod_drc_setup(struct bench_ctx *c)
+{
+	float params[1 + 3 * 8];
+
+	params[0] = 0; /* disable_emphasis */
+	memcpy(&params[1], drc_bands, sizeof(drc_bands));
+	module_load(c, "drc", 2, 2, params, 1 + 3 * 8);
+}
+
+static const struct bench benches[] = {
+	{ "biquad", mono, biquad_setup, eq_run, eq_teardown },
+	{ "eq", mono, eq_setup, eq_run, eq_teardown },
+	{ "eq2", stereo, eq2_setup, eq2_run, eq2_teardown },
+	{ "eqn", multi, eqn_setup, eqn_run, eqn_teardown },
+	{ "crossover", mono, crossover_setup, crossover_run, free_state },
+	{ "crossover2", stereo, crossover2_setup, crossover2_run, free_state },
+	{ "crossovern", multi, crossovern_setup, crossovern_run,
+	  crossovern_teardown },
+	{ "drc", stereo, drc_setup, drc_run, drc_teardown },
+	{ "interleave_s16", multi, interleave_setup, interleave_s16_run,
+	  interleave_teardown },
+	{ "interleave_s24", multi, interleave_setup, interleave_s24_run,
+	  interleave_teardown },
+	{ "interleave_s32", multi, interleave_setup, interleave_s32_run,
+	  interleave_teardown },
+	{ "interleave_float", multi, interleave_setup, interleave_float_run,
+	  interleave_teardown },
+	{ "mod_mix_stereo", stereo, mix_stereo_setup, module_run,
+	  module_teardown },
+	{ "mod_invert_lr", stereo, invert_lr_setup, module_run,
+	  module_teardown },
+	{ "mod_swap_lr", stereo, swap_lr_setup, module_run, module_teardown },
+	{ "mod_eq", mono, mod_eq_setup, module_run, module_teardown },
+	{ "mod_eq2", stereo, mod_eq2_setup, module_run, module_teardown },
+	{ "mod_eqn", multi, mod_eqn_setup, module_run, module_teardown },
+	{ "mod_crossovern", multi, mod_crossovern_setup, module_run,
+	  module_teardown },
+	{ "mod_drc", stereo, mod_drc_setup, module_run, module_teardown },
+};
+
+static float *alloc_channel(void)
+{
+	return calloc(MAX_BLOCK, sizeof(float));
+}
+
+static void run_case(const struct bench *b, struct bench_ctx *c,
+		     int cycles_fd, double secs, struct result *r)
+{
+	unsigned long warmup, total, done;
+	uint64_t cycles;
+	double start, elapsed;
+
+	b->setup(c);
+	warmup = WARMUP_SECS * c->rate;
+	for (done = 0; done < warmup; done += c->block)
+		b->run(c);
+
+	total = secs * c->rate;
+	cycles = cycles_read(cycles_fd);
+	start = now_sec();
+	for (done = 0; done < total; done += c->block)
+		b->run(c);
+	elapsed = now_sec() - start;
+	cycles = cycles_read(cycles_fd) - cycles;
+	b->teardown(c);
+
+	r->name = b->name;
+	r->channels = c->channels;
+	r->block = c->block;
+	r->rate = c->rate;
+	r->frames = done;
+	r->ns_per_frame = elapsed * 1e9 / done;
+	r->cycles_per_sample = cycles_fd < 0 ? -1.0 :
+		(double)cycles / done / c->channels;
+}
+
+static void print_result(const struct result *r)
+{
+	printf("%-18s %2d ch %5d fr %6d Hz %9.2f ns/frame",
+	       r->name, r->channels, r->block, r->rate, r->ns_per_frame);
+	if (r->cycles_per_sample >= 0)
+		printf(" %9.2f cycles/sample", r->cycles_per_sample);
+	printf(" %8.1fx realtime\n", 1e9 / r->ns_per_frame / r->rate);
+}
+
+static void write_json(FILE *f, const struct result *results, int count,
+		       double secs)
+{
+	int i;
+
+	fprintf(f, "{\n  \"seconds\": %g,\n  \"results\": [\n", secs);
+	for (i = 0; i < count; i++) {
+		const struct result *r = &results[i];
+
+		fprintf(f, "    {\"name\": \"%s\", \"channels\": %d, "
+			"\"block\": %d, \"rate\": %d, \"frames\": %lu, "
+			"\"ns_per_frame\": %.3f, \"cycles_per_sample\": ",
+			r->name, r->channels, r->block, r->rate, r->frames,
+			r->ns_per_frame);
+		if (r->cycles_per_sample >= 0)
+			fprintf(f, "%.3f}", r->cycles_per_sample);
+		else
+			fprintf(f, "null}");
+		fprintf(f, "%s\n", i + 1 < count ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s seconds] [-f filter] [-j json_file]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx;
+	struct result *results;
+	const char *filter = NULL, *json = NULL;
+	int num_results = 0, max_results;
+	int cycles_fd, opt, i, j, k, r;
+	const int *ch;
+	double secs = 2;
+
+	while ((opt = getopt(argc, argv, "s:f:j:")) != -1) {
+		switch (opt) {
+		case 's':
+			secs = atof(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'j':
+			json = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (secs <= 0)
+		usage(argv[0]);
+
+	/* The audio thread runs the pipeline with denormals flushed. */
+	dsp_enable_flush_denormal_to_zero();
+
+	memset(&ctx, 0, sizeof(ctx));
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		ctx.src[i] = alloc_channel();
+		ctx.work[i] = alloc_channel();
+		for (j = 0; j < MAX_BLOCK; j++)
+			ctx.src[i][j] = 2.0f * rand() / RAND_MAX - 1.0f;
+	}
+	for (i = 0; i < 3 * MAX_CHANNELS; i++)
+		ctx.out[i] = alloc_channel();
+
+	cycles_fd = cycles_open();
+	if (cycles_fd < 0)
+		fprintf(stderr, "Cycle counter unavailable, "
+			"reporting time only\n");
+
+	max_results = sizeof(benches) / sizeof(benches[0]) * 4 *
+		sizeof(block_sizes) / sizeof(block_sizes[0]) *
+		sizeof(sample_rates) / sizeof(sample_rates[0]);
+	results = calloc(max_results, sizeof(*results));
+
+	printf("Processing %g seconds of audio per case\n", secs);
+	for (i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++) {
+		const struct bench *b = &benches[i];
+
+		if (filter && !strstr(b->name, filter))
+			continue;
+		for (ch = b->channels; *ch; ch++)
+		for (j = 0; j < (int)(sizeof(block_sizes) /
+				      sizeof(block_sizes[0])); j++)
+		for (k = 0; k < (int)(sizeof(sample_rates) /
+				      sizeof(sample_rates[0])); k++) {
+			struct result *res = &results[num_results++];
+
+			ctx.channels = *ch;
+			ctx.block = block_sizes[j];
+			ctx.rate = sample_rates[k];
+			run_case(b, &ctx, cycles_fd, secs, res);
+			print_result(res);
+		}
+	}
+
+	r = 0;
+	if (json) {
+		FILE *f = fopen(json, "w");
+
+		if (f) {
+			write_json(f, results, num_results, secs);
+			fclose(f);
+		} else {
+			perror(json);
+			r = 1;
+		}
+	}
+
+	if (cycles_fd >= 0)
+		close(cycles_fd);
+	free(results);
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		free(ctx.src[i]);
+		free(ctx.work[i]);
+	}
+	for (i = 0; i < 3 * MAX_CHANNELS; i++)
+		free(ctx.out[i]);
+	return r;
+}
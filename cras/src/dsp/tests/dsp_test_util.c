@@ -5,6 +5,7 @@
 
 #include <fenv.h>
 #include <float.h>
+#include <math.h>
 #include <stdio.h>
 #include "dsp_test_util.h"
 
@@ -35,3 +36,13 @@ void dsp_util_print_fp_exceptions()
 		printf("FE_UNDERFLOW ");
 	printf("\n");
 }
+
+float dsp_util_max_abs_diff(const float *a, const float *b, size_t n)
+{
+	float diff = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		diff = fmaxf(diff, fabsf(a[i] - b[i]));
+	return diff;
+}
@@ -10,6 +10,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 /* Tests if the system supports denormal numbers. Returns 1 if so, 0
  * otherwise.*/
 int dsp_util_has_denormal();
@@ -20,6 +22,9 @@ void dsp_util_clear_fp_exceptions();
 /* Prints floating point exceptions to stdout. For debugging only. */
 void dsp_util_print_fp_exceptions();
 
+/* Returns the largest absolute difference between the n samples of a and b. */
+float dsp_util_max_abs_diff(const float *a, const float *b, size_t n);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
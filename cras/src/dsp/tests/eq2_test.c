@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "dsp_test_util.h"
@@ -33,22 +34,13 @@ static void process(struct eq2 *eq2, float *data0, float *data1, int count)
 			    min(2048, count - start));
 }
 
-/* Runs the filters on an input file */
-static void test_file(const char *input_filename, const char *output_filename)
+/* Runs the eq chain on data, returns the processing time in seconds. */
+static double run_eq2(float *data, size_t frames)
 {
-	size_t frames;
-	int i;
 	double NQ = 44100 / 2; /* nyquist frequency */
 	struct timespec tp1, tp2;
 	struct eq2 *eq2;
 
-	float *data = read_raw(input_filename, &frames);
-
-	/* Set some data to 0 to test for denormals. */
-	for (i = frames / 10; i < frames; i++)
-		data[i] = 0.0;
-
-	/* eq chain */
 	eq2 = eq2_new();
 	eq2_append_biquad(eq2, 0, BQ_PEAKING, 380/NQ, 3, -10);
 	eq2_append_biquad(eq2, 0, BQ_PEAKING, 720/NQ, 3, -12);
@@ -65,11 +57,43 @@ static void test_file(const char *input_filename, const char *output_filename)
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp1);
 	process(eq2, data, data + frames, frames);
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp2);
-	printf("processing takes %g seconds for %zu samples\n",
-	       tp_diff(&tp2, &tp1), frames * 2);
 	eq2_free(eq2);
 
+	return tp_diff(&tp2, &tp1);
+}
+
+/* Runs the filters on an input file */
+static void test_file(const char *input_filename, const char *output_filename)
+{
+	size_t frames;
+	int i;
+	double secs;
+	float *copy;
+
+	float *data = read_raw(input_filename, &frames);
+
+	/* Set some data to 0 to test for denormals. */
+	for (i = frames / 10; i < frames; i++)
+		data[i] = 0.0;
+
+	copy = (float *)malloc(sizeof(float) * frames * 2);
+	memcpy(copy, data, sizeof(float) * frames * 2);
+
+	dsp_util_enable_avx2_fma(0);
+	secs = run_eq2(data, frames);
+	printf("processing takes %g seconds for %zu samples (%.1f ns/frame)\n",
+	       secs, frames * 2, secs * 1e9 / frames);
+
+	/* Compare the AVX2/FMA code to the default one on the same input. */
+	if (dsp_util_enable_avx2_fma(1)) {
+		secs = run_eq2(copy, frames);
+		printf("avx2/fma takes %g seconds (%.1f ns/frame), "
+		       "max difference %g\n", secs, secs * 1e9 / frames,
+		       dsp_util_max_abs_diff(data, copy, frames * 2));
+	}
+
 	write_raw(output_filename, data, frames);
+	free(copy);
 	free(data);
 }
 
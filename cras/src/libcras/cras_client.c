@@ -19,6 +19,9 @@
  *  running - Once the connections are established, the client will listen for
  *    requests on aud_fd and fill the shm region with the requested number of
  *    samples. This happens in the aud_cb specified in the stream parameters.
+ *    Streams added with the SHM_DOORBELL flag are instead woken through an
+ *    eventfd and reply through another, the socket is then only kept for
+ *    teardown.
  */
 
 #ifndef _GNU_SOURCE
@@ -28,16 +31,20 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <linux/futex.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/ipc.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -66,6 +73,7 @@ enum {
 	CLIENT_SET_STREAM_VOLUME_SCALER,
 	CLIENT_SERVER_CONNECT,
 	CLIENT_SERVER_CONNECT_ASYNC,
+	CLIENT_SET_SHARED_AUDIO_THREADS,
 };
 
 struct command_msg {
@@ -79,6 +87,11 @@ struct set_stream_volume_command_message {
 	float volume_scaler;
 };
 
+struct set_shared_aud_threads_command_message {
+	struct command_msg header;
+	unsigned int num_threads;
+};
+
 /* Adds a stream to the client.
  *  stream - The stream to add.
  *  stream_id_out - Filled with the stream id of the new stream.
@@ -130,6 +143,31 @@ struct cras_stream_params {
 	struct cras_audio_format format;
 };
 
+/* An audio thread servicing several streams of a client, see
+ * cras_client_set_shared_audio_threads().
+ * thread - Thread state, only changed with lock held.
+ * client - The client owning the thread.
+ * epoll_fd - Waits on the wake pipe and the audio fds of attached streams.
+ * wake_fds - Pipe to wake the thread when it should stop.
+ * lock - Held by the thread while it reads requests, and to attach or
+ *     detach a stream.  Audio callbacks run without it.
+ * servicing - The stream whose callback is running, NULL if none.
+ * servicing_done - Signaled when servicing is cleared.
+ * num_streams - Number of streams assigned to this thread.
+ * generation - Incremented each time a stream is detached.
+ */
+struct shared_aud_thread {
+	struct thread_state thread;
+	struct cras_client *client;
+	int epoll_fd;
+	int wake_fds[2];
+	pthread_mutex_t lock;
+	struct client_stream *servicing;
+	pthread_cond_t servicing_done;
+	unsigned int num_streams;
+	unsigned int generation;
+};
+
 /* Represents an attached audio stream.
  * id - Unique stream identifier.
  * aud_fd - After server connects audio messages come in here.
@@ -139,6 +177,13 @@ struct cras_stream_params {
  * tid - Thread id of the audio thread spawned for this stream.
  * running - Audio thread runs while this is non-zero.
  * wake_fds - Pipe to wake the audio thread.
+ * request_fd - eventfd signaled by the server to request audio, -1 if requests
+ *     come in as audio messages on aud_fd.
+ * reply_fd - eventfd signaled to tell the server a request was serviced.
+ * shared_thread - The shared audio thread servicing this stream, NULL if the
+ *     stream has its own thread.
+ * shared_attached - Non-zero while the stream's fds are in the epoll set of
+ *     shared_thread.  Protected by the lock of shared_thread.
  * client - The client this stream is attached to.
  * config - Audio stream configuration.
  * capture_shm - Shared memory used to exchange audio samples with the server.
@@ -153,6 +198,10 @@ struct client_stream {
 	float volume_scaler;
 	struct thread_state thread;
 	int wake_fds[2]; /* Pipe to wake the thread */
+	int request_fd;
+	int reply_fd;
+	struct shared_aud_thread *shared_thread;
+	int shared_attached;
 	struct cras_client *client;
 	struct cras_stream_params *config;
 	struct cras_audio_shm capture_shm;
@@ -204,12 +253,22 @@ typedef enum cras_socket_state {
  * streams - Linked list of streams attached to this client.
  * server_state - RO shared memory region holding server state.
  * debug_info_callback - Function to call when debug info is received.
+ * dsp_debug_info_callback - Function to call when the dsp profile is
+ *     received.
+ * latency_info_callback - Function to call when the latency histograms are
+ *     received.
+ * audio_thread_trace_callback - Function to call with the fd of the audio
+ *     thread trace.
  * get_hotword_models_cb_t - Function to call when hotword models info is ready.
  * server_err_cb - Function to call when failed to read messages from server.
  * server_err_user_arg - User argument for server_err_cb.
  * server_connection_cb - Function to called when a connection state changes.
  * server_connection_user_arg - User argument for server_connection_cb.
  * thread_priority_cb - Function to call for setting audio thread priority.
+ * num_shared_aud_threads - Number of shared audio threads to service streams
+ *     with, 0 to give each stream its own thread.
+ * shared_aud_threads - The shared audio threads, started with the first
+ *     stream.
  * observer_ops - Functions to call when system state changes.
  * observer_context - Context passed to client in state change callbacks.
  */
@@ -232,11 +291,16 @@ struct cras_client {
 	struct client_stream *streams;
 	const struct cras_server_state *server_state;
 	void (*debug_info_callback)(struct cras_client *);
+	void (*dsp_debug_info_callback)(struct cras_client *);
+	void (*latency_info_callback)(struct cras_client *);
+	void (*audio_thread_trace_callback)(struct cras_client *, int);
 	get_hotword_models_cb_t get_hotword_models_cb;
 	cras_server_error_cb_t server_err_cb;
 	cras_connection_status_cb_t server_connection_cb;
 	void *server_connection_user_arg;
 	cras_thread_priority_cb_t thread_priority_cb;
+	unsigned int num_shared_aud_threads;
+	struct shared_aud_thread *shared_aud_threads;
 	struct cras_observer_ops observer_ops;
 	void *observer_context;
 };
@@ -246,10 +310,13 @@ struct cras_client {
  *
  * client - The client
  * server_state_rwlock - lock to make the client's server_state thread-safe.
+ * server_state_waiters - Number of threads waiting for a server state update
+ *     without the lock. The server_state is kept mapped until they are gone.
  */
 struct client_int {
 	struct cras_client client;
 	pthread_rwlock_t server_state_rwlock;
+	int server_state_waiters;
 };
 
 #define to_client_int(cptr) \
@@ -602,6 +669,8 @@ static void disconnect_transition_action(struct cras_client *client, bool force)
 {
 	eventfd_t event_value;
 	cras_socket_state_t old_state = client->server_fd_state;
+	struct client_int *client_int = to_client_int(client);
+	struct cras_server_state *state;
 	struct client_stream *s;
 	int lock_rc;
 
@@ -615,13 +684,22 @@ static void disconnect_transition_action(struct cras_client *client, bool force)
 
 	/* Clean up the server_state pointer. */
 	lock_rc = server_state_wrlock(client);
-	if (client->server_state) {
-		munmap((void *)client->server_state,
-		       sizeof(*client->server_state));
-		client->server_state = NULL;
-	}
+	state = (struct cras_server_state *)client->server_state;
+	client->server_state = NULL;
 	server_state_unlock(client, lock_rc);
 
+	/* No thread starts waiting for an update now, wake the ones that are
+	 * until they have all left the futex before unmapping it. */
+	if (state) {
+		while (__atomic_load_n(&client_int->server_state_waiters,
+				       __ATOMIC_SEQ_CST)) {
+			syscall(SYS_futex, (void *)&state->update_count,
+				FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+			sched_yield();
+		}
+		munmap(state, sizeof(*state));
+	}
+
 	/* Our ID is unknown now. */
 	client->id = -1;
 
@@ -1004,23 +1082,17 @@ static int read_with_wake_fd(int wake_fd, int read_fd, uint8_t *buf, size_t len)
 
 	return nread;
 }
-/* Check the availability and configures a capture buffer.
+/* Check the availability of captured samples.
  * Args:
- *     stream - The input stream to configure buffer for.
- *     captured_frames - To be filled with the pointer to the beginning of
- *         captured buffer.
+ *     stream - The input stream to check.
  *     num_frames - Number of captured frames.
  * Returns:
- *     Number of frames available in captured_frames.
+ *     Number of frames to pass to the client, possibly in two parts if they
+ *     wrap around the end of the shm ring.
  */
 static unsigned int config_capture_buf(struct client_stream *stream,
-				       uint8_t **captured_frames,
 				       unsigned int num_frames)
 {
-	/* Always return the beginning of the read buffer because Chrome expects
-	 * so. */
-	*captured_frames = cras_shm_get_read_buffer_base(&stream->capture_shm);
-
 	/* Don't ask for more frames than the client desires. */
 	if (stream->flags & BULK_AUDIO_OK)
 		num_frames = MIN(num_frames, stream->config->buffer_frames);
@@ -1030,21 +1102,16 @@ static unsigned int config_capture_buf(struct client_stream *stream,
 	/* If shm readable frames is less than client requests, that means
 	 * overrun has happened in server side. Don't send partial corrupted
 	 * buffer to client. */
-	if (cras_shm_get_curr_read_frames(&stream->capture_shm) < num_frames)
+	if (cras_shm_get_frames(&stream->capture_shm) < (int)num_frames)
 		return 0;
 
 	return num_frames;
 }
 
-static void complete_capture_read_current(struct client_stream *stream,
-					  unsigned int num_frames)
-{
-	cras_shm_buffer_read_current(&stream->capture_shm, num_frames);
-}
-
 /* For capture streams this handles the message signalling that data is ready to
  * be passed to the user of this stream.  Calls the audio callback with the new
- * samples, and mark them as read.
+ * samples, and mark them as read.  The callback runs a second time if the
+ * samples wrap around the end of the shm ring.
  * Args:
  *    stream - The stream the message was received for.
  *    num_frames - The number of captured frames.
@@ -1056,8 +1123,10 @@ static int handle_capture_data_ready(struct client_stream *stream,
 {
 	int frames;
 	struct cras_stream_params *config;
+	struct cras_audio_shm *shm = &stream->capture_shm;
 	uint8_t *captured_frames;
-	struct timespec ts;
+	size_t readable;
+	struct timespec ts, offset_ts;
 
 	config = stream->config;
 	/* If this message is for an output stream, log error and drop it. */
@@ -1066,36 +1135,52 @@ static int handle_capture_data_ready(struct client_stream *stream,
 		return 0;
 	}
 
-	num_frames = config_capture_buf(stream, &captured_frames, num_frames);
+	num_frames = config_capture_buf(stream, num_frames);
 	if (num_frames == 0)
 		return 0;
 
-	cras_timespec_to_timespec(&ts, &stream->capture_shm.area->ts);
-
-	if (config->unified_cb)
-		frames = config->unified_cb(stream->client,
-					    stream->id,
-					    captured_frames,
-					    NULL,
-					    num_frames,
-					    &ts,
-					    NULL,
-					    config->user_data);
-	else
-		frames = config->aud_cb(stream->client,
-					stream->id,
-					captured_frames,
-					num_frames,
-					&ts,
-					config->user_data);
-	if (frames == EOF) {
-		send_stream_message(stream, CLIENT_STREAM_EOF);
-		return EOF;
-	}
-	if (frames == 0)
-		return 0;
+	cras_timespec_to_timespec(&ts, &shm->area->ts);
 
-	complete_capture_read_current(stream, frames);
+	while (num_frames) {
+		captured_frames = cras_shm_get_readable_frames(shm, 0,
+							       &readable);
+		readable = MIN(readable, num_frames);
+		if (readable == 0)
+			return 0;
+
+		if (config->unified_cb)
+			frames = config->unified_cb(stream->client,
+						    stream->id,
+						    captured_frames,
+						    NULL,
+						    readable,
+						    &ts,
+						    NULL,
+						    config->user_data);
+		else
+			frames = config->aud_cb(stream->client,
+						stream->id,
+						captured_frames,
+						readable,
+						&ts,
+						config->user_data);
+		if (frames == EOF) {
+			send_stream_message(stream, CLIENT_STREAM_EOF);
+			return EOF;
+		}
+		if (frames <= 0)
+			return 0;
+
+		cras_shm_buffer_read(shm, frames);
+		num_frames -= frames;
+		if ((unsigned int)frames < readable || num_frames == 0)
+			return 0;
+
+		/* The next sample was captured 'frames' later. */
+		cras_frames_to_time(frames, config->format.frame_rate,
+				    &offset_ts);
+		add_timespecs(&ts, &offset_ts);
+	}
 	return 0;
 }
 
@@ -1110,6 +1195,16 @@ static int send_playback_reply(struct client_stream *stream,
 	if (!cras_stream_uses_output_hw(stream->direction))
 		return 0;
 
+	/* The server reads the frames written from the shm ring. */
+	if (stream->reply_fd >= 0) {
+		uint64_t one = 1;
+
+		rc = write(stream->reply_fd, &one, sizeof(one));
+		if (rc != sizeof(one))
+			return -EPIPE;
+		return 0;
+	}
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_READY;
 	aud_msg.frames = frames;
 	aud_msg.error = error;
@@ -1121,18 +1216,21 @@ static int send_playback_reply(struct client_stream *stream,
 	return 0;
 }
 
-/* For playback streams when current buffer is empty, this handles the request
- * for more samples by calling the audio callback for the thread, and signaling
- * the server that the samples have been written. */
+/* For playback streams when there is room in the shm ring, this handles the
+ * request for more samples by calling the audio callback for the thread, and
+ * signaling the server that the samples have been written.  The callback runs
+ * a second time if the request wraps around the end of the ring. */
 static int handle_playback_request(struct client_stream *stream,
 				   unsigned int num_frames)
 {
 	uint8_t *buf;
 	int frames;
+	unsigned int writeable;
+	unsigned int written = 0;
 	int rc = 0;
 	struct cras_stream_params *config;
 	struct cras_audio_shm *shm = &stream->play_shm;
-	struct timespec ts;
+	struct timespec ts, offset_ts;
 
 	config = stream->config;
 
@@ -1142,49 +1240,61 @@ static int handle_playback_request(struct client_stream *stream,
 		return 0;
 	}
 
-	buf = cras_shm_get_write_buffer_base(&stream->play_shm);
-
 	/* Limit the amount of frames to the configured amount. */
 	num_frames = MIN(num_frames, config->cb_threshold);
 
 	cras_timespec_to_timespec(&ts, &shm->area->ts);
 
-	/* Get samples from the user */
-	if (config->unified_cb)
-		frames = config->unified_cb(stream->client,
-				stream->id,
-				NULL,
-				buf,
-				num_frames,
-				NULL,
-				&ts,
-				config->user_data);
-	else
-		frames = config->aud_cb(stream->client,
-				stream->id,
-				buf,
-				num_frames,
-				&ts,
-				config->user_data);
-	if (frames < 0) {
-		send_stream_message(stream, CLIENT_STREAM_EOF);
-		rc = frames;
-		goto reply_written;
-	}
+	while (written < num_frames) {
+		buf = cras_shm_get_writeable_frames(shm, 0, &writeable);
+		writeable = MIN(writeable, num_frames - written);
+		if (writeable == 0)
+			break;
 
-	cras_shm_buffer_written_start(shm, frames);
+		/* Get samples from the user */
+		if (config->unified_cb)
+			frames = config->unified_cb(stream->client,
+					stream->id,
+					NULL,
+					buf,
+					writeable,
+					NULL,
+					&ts,
+					config->user_data);
+		else
+			frames = config->aud_cb(stream->client,
+					stream->id,
+					buf,
+					writeable,
+					&ts,
+					config->user_data);
+		if (frames < 0) {
+			send_stream_message(stream, CLIENT_STREAM_EOF);
+			rc = frames;
+			break;
+		}
+
+		cras_shm_buffer_written(shm, frames);
+		written += frames;
+		if ((unsigned int)frames < writeable || written == num_frames)
+			break;
+
+		/* The next sample will be played 'frames' later. */
+		cras_frames_to_time(frames, config->format.frame_rate,
+				    &offset_ts);
+		add_timespecs(&ts, &offset_ts);
+	}
 
-reply_written:
 	/* Signal server that data is ready, or that an error has occurred. */
-	rc = send_playback_reply(stream, frames, rc);
+	rc = send_playback_reply(stream, written, rc);
 	return rc;
 }
 
-static void audio_thread_set_priority(struct client_stream *stream)
+static void audio_thread_set_priority(struct cras_client *client)
 {
 	/* Use provided callback to set priority if available. */
-	if (stream->client->thread_priority_cb) {
-		stream->client->thread_priority_cb(stream->client);
+	if (client->thread_priority_cb) {
+		client->thread_priority_cb(client);
 		return;
 	}
 
@@ -1194,6 +1304,79 @@ static void audio_thread_set_priority(struct client_stream *stream)
 		cras_set_nice_level(CRAS_CLIENT_NICENESS_LEVEL);
 }
 
+/* Runs the callback of a stream for a message from the server.  Returns
+ * non-zero if the stream shouldn't be serviced anymore. */
+static int handle_aud_msg(struct client_stream *stream,
+			  const struct audio_message *aud_msg)
+{
+	switch (aud_msg->id) {
+	case AUDIO_MESSAGE_DATA_READY:
+		return handle_capture_data_ready(stream, aud_msg->frames);
+	case AUDIO_MESSAGE_REQUEST_DATA:
+		return handle_playback_request(stream, aud_msg->frames);
+	default:
+		return 0;
+	}
+}
+
+/* Fills aud_msg with the request a doorbell ring stands for.  Doorbells don't
+ * carry a frame count, it comes from the shm ring or the stream config. */
+static void doorbell_aud_msg(struct client_stream *stream,
+			     struct audio_message *aud_msg)
+{
+	int frames;
+
+	aud_msg->error = 0;
+	if (cras_stream_has_input(stream->direction)) {
+		frames = cras_shm_get_frames(&stream->capture_shm);
+		aud_msg->id = AUDIO_MESSAGE_DATA_READY;
+		aud_msg->frames = MAX(frames, 0);
+	} else {
+		aud_msg->id = AUDIO_MESSAGE_REQUEST_DATA;
+		aud_msg->frames = stream->config->cb_threshold;
+	}
+}
+
+/* Waits for the server to ring the doorbell of a SHM_DOORBELL stream and fills
+ * aud_msg with the request it stands for.  The audio socket is still polled so
+ * that the thread notices when the server hangs up.  Returns the size of
+ * aud_msg, 0 if woken by wake_fd only, or a negative error code. */
+static int read_doorbell_with_wake_fd(struct client_stream *stream,
+				      struct audio_message *aud_msg)
+{
+	struct pollfd pollfds[3];
+	uint64_t count;
+	int rc;
+	char tmp;
+
+	pollfds[0].fd = stream->wake_fds[0];
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = stream->request_fd;
+	pollfds[1].events = POLLIN;
+	pollfds[2].fd = stream->aud_fd;
+	pollfds[2].events = POLLIN;
+
+	rc = poll(pollfds, 3, -1);
+	if (rc < 0)
+		return rc;
+	if (pollfds[2].revents & (POLLIN | POLLHUP | POLLERR))
+		return -EIO;
+	if (pollfds[0].revents & POLLIN) {
+		rc = read(stream->wake_fds[0], &tmp, 1);
+		if (rc < 0)
+			return rc;
+	}
+	if (!(pollfds[1].revents & POLLIN))
+		return 0;
+
+	rc = read(stream->request_fd, &count, sizeof(count));
+	if (rc != sizeof(count))
+		return -EIO;
+
+	doorbell_aud_msg(stream, aud_msg);
+	return sizeof(*aud_msg);
+}
+
 /* Listens to the audio socket for messages from the server indicating that
  * the stream needs to be serviced.  One of these runs per stream. */
 static void *audio_thread(void *arg)
@@ -1207,7 +1390,7 @@ static void *audio_thread(void *arg)
 	if (arg == NULL)
 		return (void *)-EIO;
 
-	audio_thread_set_priority(stream);
+	audio_thread_set_priority(stream->client);
 
 	/* Notify the control thread that we've started. */
 	pthread_mutex_lock(&stream->client->stream_start_lock);
@@ -1219,29 +1402,19 @@ static void *audio_thread(void *arg)
 		 * shared memory resources may not yet be available. */
 		aud_fd = (stream->thread.state == CRAS_THREAD_WARMUP) ?
 			 -1 : stream->aud_fd;
-		num_read = read_with_wake_fd(stream->wake_fds[0],
-					     aud_fd,
-					     (uint8_t *)&aud_msg,
-					     sizeof(aud_msg));
+		if (aud_fd >= 0 && stream->request_fd >= 0)
+			num_read = read_doorbell_with_wake_fd(stream, &aud_msg);
+		else
+			num_read = read_with_wake_fd(stream->wake_fds[0],
+						     aud_fd,
+						     (uint8_t *)&aud_msg,
+						     sizeof(aud_msg));
 		if (num_read < 0)
 			return (void *)-EIO;
 		if (num_read == 0)
 			continue;
 
-		switch (aud_msg.id) {
-		case AUDIO_MESSAGE_DATA_READY:
-			thread_terminated = handle_capture_data_ready(
-					stream,
-					aud_msg.frames);
-			break;
-		case AUDIO_MESSAGE_REQUEST_DATA:
-			thread_terminated = handle_playback_request(
-					stream,
-					aud_msg.frames);
-			break;
-		default:
-			break;
-		}
+		thread_terminated = handle_aud_msg(stream, &aud_msg);
 	}
 
 	return NULL;
@@ -1258,6 +1431,368 @@ static int wake_aud_thread(struct client_stream *stream)
 	return 0;
 }
 
+/*
+ * Shared audio threads.
+ *
+ * With cras_client_set_shared_audio_threads() the streams of a client are
+ * spread over a fixed set of audio threads instead of getting one each.  A
+ * shared thread waits on the audio fds of all its streams with one epoll set,
+ * and services the streams woken together in order of deadline.
+ */
+
+/* Maximum number of events collected by a shared thread in one wait. */
+#define MAX_SHARED_AUD_EVENTS 32
+
+/* A stream woken in a shared thread.
+ * stream - The stream to service.
+ * events - The epoll events of all the stream's fds.
+ * deadline - When the stream's next sample is due.
+ */
+struct shared_aud_wake {
+	struct client_stream *stream;
+	uint32_t events;
+	struct timespec deadline;
+};
+
+/* Gets when the next sample of a stream is due from the time stamp the server
+ * puts in shm with each request.  For playback this is when the next sample
+ * written will be played, for capture when the oldest unread one was
+ * captured, so the earliest is the most urgent either way. */
+static void stream_deadline(const struct client_stream *stream,
+			    struct timespec *ts)
+{
+	const struct cras_audio_shm *shm;
+
+	if (cras_stream_has_input(stream->direction))
+		shm = &stream->capture_shm;
+	else
+		shm = &stream->play_shm;
+	cras_timespec_to_timespec(ts, &shm->area->ts);
+}
+
+/* Sorts the woken streams, earliest deadline first.  Batches are small, an
+ * insertion sort keeps streams with equal deadlines in the order woken. */
+static void sort_wakes_by_deadline(struct shared_aud_wake *wakes,
+				   unsigned int num_wakes)
+{
+	struct shared_aud_wake tmp;
+	unsigned int i, j;
+
+	for (i = 1; i < num_wakes; i++) {
+		tmp = wakes[i];
+		for (j = i; j > 0; j--) {
+			if (!timespec_after(&wakes[j - 1].deadline,
+					    &tmp.deadline))
+				break;
+			wakes[j] = wakes[j - 1];
+		}
+		wakes[j] = tmp;
+	}
+}
+
+/* Removes a stream from the epoll set of its shared thread.  Called with the
+ * thread's lock held. */
+static void shared_thread_detach_locked(struct shared_aud_thread *t,
+					struct client_stream *stream)
+{
+	if (!stream->shared_attached)
+		return;
+
+	epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, stream->aud_fd, NULL);
+	if (stream->request_fd >= 0)
+		epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, stream->request_fd, NULL);
+	stream->shared_attached = 0;
+	t->generation++;
+}
+
+/* Adds the fds of a connected stream to the epoll set of its shared thread.
+ * A doorbell stream is woken by its request eventfd, the audio socket is only
+ * watched for hang ups. */
+static int shared_thread_attach(struct client_stream *stream)
+{
+	struct shared_aud_thread *t = stream->shared_thread;
+	struct epoll_event ev;
+	int rc = 0;
+
+	/* The thread reads until there is nothing left, it must not block on
+	 * one stream while others are due. */
+	cras_make_fd_nonblocking(stream->aud_fd);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.ptr = stream;
+	ev.events = stream->request_fd >= 0 ? 0 : EPOLLIN;
+
+	pthread_mutex_lock(&t->lock);
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, stream->aud_fd, &ev) < 0) {
+		rc = -errno;
+		goto unlock;
+	}
+	if (stream->request_fd >= 0) {
+		ev.events = EPOLLIN;
+		if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, stream->request_fd,
+			      &ev) < 0) {
+			rc = -errno;
+			epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, stream->aud_fd,
+				  NULL);
+			goto unlock;
+		}
+	}
+	stream->shared_attached = 1;
+unlock:
+	pthread_mutex_unlock(&t->lock);
+	return rc;
+}
+
+/* Reads the request that woke a stream in a shared thread.  Returns the size
+ * of aud_msg, 0 if there was nothing to read, or a negative error code if the
+ * stream can't be serviced anymore. */
+static int shared_thread_read_request(struct client_stream *stream,
+				      uint32_t events,
+				      struct audio_message *aud_msg)
+{
+	uint64_t count;
+	int rc;
+
+	if (events & (EPOLLHUP | EPOLLERR))
+		return -EIO;
+
+	if (stream->request_fd >= 0) {
+		rc = read(stream->request_fd, &count, sizeof(count));
+		if (rc < 0 && errno == EAGAIN)
+			return 0;
+		if (rc != sizeof(count))
+			return -EIO;
+		doorbell_aud_msg(stream, aud_msg);
+		return sizeof(*aud_msg);
+	}
+
+	rc = read(stream->aud_fd, aud_msg, sizeof(*aud_msg));
+	if (rc < 0 && errno == EAGAIN)
+		return 0;
+	if (rc != sizeof(*aud_msg))
+		return -EIO;
+	return rc;
+}
+
+/* Collects the streams woken by an epoll_wait.  A doorbell stream can be woken
+ * through two fds, its events are merged into a single wake. */
+static unsigned int collect_wakes(struct shared_aud_thread *t,
+				  const struct epoll_event *events,
+				  int num_events,
+				  struct shared_aud_wake *wakes)
+{
+	struct client_stream *stream;
+	unsigned int num_wakes = 0;
+	unsigned int j;
+	int i;
+	char tmp;
+
+	for (i = 0; i < num_events; i++) {
+		stream = (struct client_stream *)events[i].data.ptr;
+		if (stream == NULL) {
+			if (read(t->wake_fds[0], &tmp, 1) < 0)
+				syslog(LOG_ERR, "cras_client: wake read");
+			continue;
+		}
+
+		for (j = 0; j < num_wakes; j++)
+			if (wakes[j].stream == stream)
+				break;
+		if (j == num_wakes) {
+			wakes[j].stream = stream;
+			wakes[j].events = 0;
+			stream_deadline(stream, &wakes[j].deadline);
+			num_wakes++;
+		}
+		wakes[j].events |= events[i].events;
+	}
+
+	return num_wakes;
+}
+
+/* Services all the streams of a client assigned to this thread. */
+static void *shared_audio_thread(void *arg)
+{
+	struct shared_aud_thread *t = (struct shared_aud_thread *)arg;
+	struct epoll_event events[MAX_SHARED_AUD_EVENTS];
+	struct shared_aud_wake wakes[MAX_SHARED_AUD_EVENTS];
+	struct audio_message aud_msg;
+	unsigned int generation, num_wakes, i;
+	int num_events;
+	int rc;
+
+	audio_thread_set_priority(t->client);
+
+	pthread_mutex_lock(&t->lock);
+	while (thread_is_running(&t->thread)) {
+		generation = t->generation;
+		pthread_mutex_unlock(&t->lock);
+		num_events = epoll_wait(t->epoll_fd, events,
+					MAX_SHARED_AUD_EVENTS, -1);
+		pthread_mutex_lock(&t->lock);
+
+		/* A stream detached during the wait may be gone, drop the
+		 * events.  The fds are level triggered, whatever is pending
+		 * for the other streams is reported again. */
+		if (num_events <= 0 || generation != t->generation)
+			continue;
+
+		num_wakes = collect_wakes(t, events, num_events, wakes);
+		sort_wakes_by_deadline(wakes, num_wakes);
+
+		for (i = 0; i < num_wakes; i++) {
+			struct client_stream *stream = wakes[i].stream;
+			int stale;
+
+			if (!stream->shared_attached)
+				continue;
+			rc = shared_thread_read_request(stream,
+							wakes[i].events,
+							&aud_msg);
+			if (rc == 0)
+				continue;
+
+			/* A slow callback mustn't hold up attaching and
+			 * detaching streams.  Detaching this stream waits
+			 * for its callback to return. */
+			if (rc > 0) {
+				t->servicing = stream;
+				pthread_mutex_unlock(&t->lock);
+				rc = handle_aud_msg(stream, &aud_msg);
+				pthread_mutex_lock(&t->lock);
+				t->servicing = NULL;
+				pthread_cond_broadcast(&t->servicing_done);
+			}
+
+			/* The other streams woken may have been detached and
+			 * freed meanwhile, leave them to the next wait. */
+			stale = generation != t->generation;
+			if (rc)
+				shared_thread_detach_locked(t, stream);
+			if (stale)
+				break;
+			generation = t->generation;
+		}
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	return NULL;
+}
+
+/* Stops and frees the shared audio threads of a client.  The streams have all
+ * been removed by then. */
+static void stop_shared_aud_threads(struct cras_client *client)
+{
+	struct shared_aud_thread *t;
+	unsigned int i;
+	char tmp = 0;
+
+	if (client->shared_aud_threads == NULL)
+		return;
+
+	for (i = 0; i < client->num_shared_aud_threads; i++) {
+		t = &client->shared_aud_threads[i];
+		if (t->client == NULL)
+			break;
+
+		if (thread_is_running(&t->thread)) {
+			pthread_mutex_lock(&t->lock);
+			t->thread.state = CRAS_THREAD_STOP;
+			pthread_mutex_unlock(&t->lock);
+			if (write(t->wake_fds[1], &tmp, 1) != 1)
+				syslog(LOG_ERR, "cras_client: wake write");
+			pthread_join(t->thread.tid, NULL);
+		}
+		if (t->wake_fds[0] >= 0) {
+			close(t->wake_fds[0]);
+			close(t->wake_fds[1]);
+		}
+		if (t->epoll_fd >= 0)
+			close(t->epoll_fd);
+		pthread_cond_destroy(&t->servicing_done);
+		pthread_mutex_destroy(&t->lock);
+	}
+
+	free(client->shared_aud_threads);
+	client->shared_aud_threads = NULL;
+}
+
+/* Sets up one shared audio thread and starts it. */
+static int start_shared_aud_thread(struct cras_client *client,
+				   struct shared_aud_thread *t)
+{
+	struct epoll_event ev;
+	int rc;
+
+	t->client = client;
+	t->wake_fds[0] = -1;
+	t->wake_fds[1] = -1;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->servicing_done, NULL);
+
+	t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (t->epoll_fd < 0)
+		return -errno;
+
+	if (pipe(t->wake_fds) < 0) {
+		t->wake_fds[0] = -1;
+		return -errno;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->wake_fds[0], &ev) < 0)
+		return -errno;
+
+	t->thread.state = CRAS_THREAD_RUNNING;
+	rc = pthread_create(&t->thread.tid, NULL, shared_audio_thread, t);
+	if (rc) {
+		t->thread.state = CRAS_THREAD_STOP;
+		syslog(LOG_ERR, "cras_client: Couldn't create audio thread: %s",
+		       strerror(rc));
+		return -rc;
+	}
+	return 0;
+}
+
+/* Assigns a stream to the least loaded shared audio thread, starting the
+ * threads with the client's first stream. */
+static int assign_shared_aud_thread(struct client_stream *stream)
+{
+	struct cras_client *client = stream->client;
+	struct shared_aud_thread *t;
+	unsigned int i;
+	int rc;
+
+	if (client->shared_aud_threads == NULL) {
+		client->shared_aud_threads = (struct shared_aud_thread *)
+			calloc(client->num_shared_aud_threads,
+			       sizeof(*client->shared_aud_threads));
+		if (client->shared_aud_threads == NULL)
+			return -ENOMEM;
+
+		for (i = 0; i < client->num_shared_aud_threads; i++) {
+			rc = start_shared_aud_thread(
+					client, &client->shared_aud_threads[i]);
+			if (rc < 0) {
+				stop_shared_aud_threads(client);
+				return rc;
+			}
+		}
+	}
+
+	t = &client->shared_aud_threads[0];
+	for (i = 1; i < client->num_shared_aud_threads; i++)
+		if (client->shared_aud_threads[i].num_streams < t->num_streams)
+			t = &client->shared_aud_threads[i];
+
+	t->num_streams++;
+	stream->shared_thread = t;
+	stream->shared_attached = 0;
+	return 0;
+}
+
 /* Stop the audio thread for the given stream.
  * Args:
  *    stream - Stream for which to stop the audio thread.
@@ -1266,6 +1801,21 @@ static int wake_aud_thread(struct client_stream *stream)
  */
 static void stop_aud_thread(struct client_stream *stream, int join)
 {
+	struct shared_aud_thread *t = stream->shared_thread;
+
+	/* Wait for the shared thread to be done with the stream. */
+	if (t) {
+		pthread_mutex_lock(&t->lock);
+		shared_thread_detach_locked(t, stream);
+		while (t->servicing == stream)
+			pthread_cond_wait(&t->servicing_done, &t->lock);
+		pthread_mutex_unlock(&t->lock);
+		t->num_streams--;
+		stream->shared_thread = NULL;
+		stream->thread.state = CRAS_THREAD_STOP;
+		return;
+	}
+
 	if (thread_is_running(&stream->thread)) {
 		stream->thread.state = CRAS_THREAD_STOP;
 		wake_aud_thread(stream);
@@ -1292,6 +1842,14 @@ static int start_aud_thread(struct client_stream *stream)
 	int rc;
 	struct timespec future;
 
+	if (stream->client->num_shared_aud_threads) {
+		rc = assign_shared_aud_thread(stream);
+		if (rc < 0)
+			return rc;
+		stream->thread.state = CRAS_THREAD_WARMUP;
+		return 0;
+	}
+
 	rc = pipe(stream->wake_fds);
 	if (rc < 0) {
 		rc = -errno;
@@ -1333,21 +1891,21 @@ static int start_aud_thread(struct client_stream *stream)
  * Client thread.
  */
 
-/* Gets the update_count of the server state shm region. */
-static inline
-unsigned begin_server_state_read(const struct cras_server_state *state)
+/* Gets the current copy of the lists in the server state shm region, and the
+ * update_count it belongs to in count.
+ */
+static inline const struct cras_server_state_lists *
+begin_server_state_read(const struct cras_server_state *state, unsigned *count)
 {
-	unsigned count;
-
-	/* Version will be odd when the server is writing. */
-	while ((count = *(volatile unsigned *)&state->update_count) & 1)
-		sched_yield();
+	/* The server fills the other copy, no need to wait for it. */
+	*count = *(volatile unsigned *)&state->update_count;
 	__sync_synchronize();
-	return count;
+	return &state->lists[*count & 1];
 }
 
 /* Checks if the update count of the server state shm region has changed from
- * count.  Returns 0 if the count still matches.
+ * count.  Returns 0 if the count still matches, else the server may have
+ * started refilling the copy that was read.
  */
 static inline
 int end_server_state_read(const struct cras_server_state *state, unsigned count)
@@ -1373,6 +1931,17 @@ static int config_shm(struct cras_audio_shm *shm, int shm_fd, size_t size)
 	/* Copy server shm config locally. */
 	cras_shm_copy_shared_config(shm);
 
+	/* Ring indices are masked, check the ring fits in what was mapped. */
+	if (shm->config.frame_bytes == 0 || shm->config.ring_frames == 0 ||
+	    (shm->config.ring_frames & (shm->config.ring_frames - 1)) ||
+	    (uint64_t)shm->config.ring_frames * shm->config.frame_bytes +
+			sizeof(*shm->area) > size) {
+		syslog(LOG_ERR, "cras_client: Invalid shm config for stream.");
+		munmap(shm->area, size);
+		shm->area = NULL;
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
@@ -1389,17 +1958,37 @@ static void free_shm(struct client_stream *stream)
 	stream->play_shm.area = NULL;
 }
 
+/* Closes the doorbell eventfds of a SHM_DOORBELL stream, if it has them. */
+static void close_doorbell(struct client_stream *stream)
+{
+	if (stream->request_fd >= 0) {
+		close(stream->request_fd);
+		stream->request_fd = -1;
+	}
+	if (stream->reply_fd >= 0) {
+		close(stream->reply_fd);
+		stream->reply_fd = -1;
+	}
+}
+
 /* Handles the stream connected message from the server.  Check if we need a
  * format converter, configure the shared memory region, and start the audio
  * thread that will handle requests from the server. */
 static int stream_connected(struct client_stream *stream,
 			    const struct cras_client_stream_connected *msg,
-			    const int stream_fds[2], const unsigned int num_fds)
+			    const int stream_fds[4], const unsigned int num_fds)
 {
 	int rc;
 	struct cras_audio_format mfmt;
 
-	if (msg->err || num_fds != 2) {
+	/* A server without doorbell support only sends the shm fds, the
+	 * stream then keeps using audio messages. */
+	if (num_fds == 4) {
+		stream->request_fd = stream_fds[2];
+		stream->reply_fd = stream_fds[3];
+	}
+
+	if (msg->err || (num_fds != 2 && num_fds != 4)) {
 		syslog(LOG_ERR, "cras_client: Error Setting up stream %d\n",
 		       msg->err);
 		rc = msg->err;
@@ -1436,7 +2025,16 @@ static int stream_connected(struct client_stream *stream,
 	}
 
 	stream->thread.state = CRAS_THREAD_RUNNING;
-	wake_aud_thread(stream);
+	if (stream->shared_thread) {
+		rc = shared_thread_attach(stream);
+		if (rc < 0) {
+			syslog(LOG_ERR,
+			       "cras_client: Error attaching shared thread");
+			goto err_ret;
+		}
+	} else {
+		wake_aud_thread(stream);
+	}
 
 	close(stream_fds[0]);
 	close(stream_fds[1]);
@@ -1445,6 +2043,7 @@ err_ret:
 	stop_aud_thread(stream, 1);
 	close(stream_fds[0]);
 	close(stream_fds[1]);
+	close_doorbell(stream);
 	free_shm(stream);
 	return rc;
 }
@@ -1581,6 +2180,7 @@ static int client_thread_rm_stream(struct cras_client *client,
 	DL_DELETE(client->streams, stream);
 	if (stream->aud_fd >= 0)
 		close(stream->aud_fd);
+	close_doorbell(stream);
 
 	free(stream->config);
 	free(stream);
@@ -1606,6 +2206,17 @@ static int client_thread_set_stream_volume(struct cras_client *client,
 	return 0;
 }
 
+/* Sets the number of shared audio threads, before the first stream. */
+static int client_thread_set_shared_aud_threads(struct cras_client *client,
+						unsigned int num_threads)
+{
+	if (client->streams || client->shared_aud_threads)
+		return -EBUSY;
+
+	client->num_shared_aud_threads = num_threads;
+	return 0;
+}
+
 /* Attach to the shm region containing the server state. */
 static int client_attach_shm(struct cras_client *client, int shm_fd)
 {
@@ -1655,64 +2266,14 @@ static void cras_client_get_hotword_models_ready(
 	client->get_hotword_models_cb = NULL;
 }
 
-/* Handles messages from the cras server. */
-static int handle_message_from_server(struct cras_client *client)
+/* Passes an observer notification from the server to its callback. */
+static void handle_notification(struct cras_client *client,
+				const struct cras_client_message *msg)
 {
-	uint8_t buf[CRAS_CLIENT_MAX_MSG_SIZE];
-	struct cras_client_message *msg;
-	int rc = 0;
-	int nread;
-	int server_fds[2];
-	unsigned int num_fds = 2;
-
-	msg = (struct cras_client_message *)buf;
-	nread = cras_recv_with_fds(client->server_fd, buf, sizeof(buf),
-				   server_fds, &num_fds);
-	if (nread < (int)sizeof(msg->length) || (int)msg->length != nread)
-		return -EIO;
-
 	switch (msg->id) {
-	case CRAS_CLIENT_CONNECTED: {
-		struct cras_client_connected *cmsg =
-			(struct cras_client_connected *)msg;
-		if (num_fds != 1)
-			return -EINVAL;
-		rc = client_attach_shm(client, server_fds[0]);
-		if (rc)
-			return rc;
-		client->id = cmsg->client_id;
-
-		break;
-	}
-	case CRAS_CLIENT_STREAM_CONNECTED: {
-		struct cras_client_stream_connected *cmsg =
-			(struct cras_client_stream_connected *)msg;
-		struct client_stream *stream =
-			stream_from_id(client, cmsg->stream_id);
-		if (stream == NULL)
-			break;
-		rc = stream_connected(stream, cmsg, server_fds, num_fds);
-		if (rc < 0)
-			stream->config->err_cb(stream->client,
-					       stream->id,
-					       rc,
-					       stream->config->user_data);
-		break;
-	}
-	case CRAS_CLIENT_AUDIO_DEBUG_INFO_READY:
-		if (client->debug_info_callback)
-			client->debug_info_callback(client);
-		break;
-	case CRAS_CLIENT_GET_HOTWORD_MODELS_READY: {
-		struct cras_client_get_hotword_models_ready *cmsg =
-			(struct cras_client_get_hotword_models_ready *)msg;
-		cras_client_get_hotword_models_ready(client,
-				(const char *)cmsg->hotword_models);
-		break;
-	}
 	case CRAS_CLIENT_OUTPUT_VOLUME_CHANGED: {
-		struct cras_client_volume_changed *cmsg =
-			(struct cras_client_volume_changed *)msg;
+		const struct cras_client_volume_changed *cmsg =
+			(const struct cras_client_volume_changed *)msg;
 		if (client->observer_ops.output_volume_changed)
 			client->observer_ops.output_volume_changed(
 					client->observer_context,
@@ -1720,8 +2281,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_OUTPUT_MUTE_CHANGED: {
-		struct cras_client_mute_changed *cmsg =
-			(struct cras_client_mute_changed *)msg;
+		const struct cras_client_mute_changed *cmsg =
+			(const struct cras_client_mute_changed *)msg;
 		if (client->observer_ops.output_mute_changed)
 			client->observer_ops.output_mute_changed(
 					client->observer_context,
@@ -1731,8 +2292,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_CAPTURE_GAIN_CHANGED: {
-		struct cras_client_volume_changed *cmsg =
-			(struct cras_client_volume_changed *)msg;
+		const struct cras_client_volume_changed *cmsg =
+			(const struct cras_client_volume_changed *)msg;
 		if (client->observer_ops.capture_gain_changed)
 			client->observer_ops.capture_gain_changed(
 					client->observer_context,
@@ -1740,8 +2301,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_CAPTURE_MUTE_CHANGED: {
-		struct cras_client_mute_changed *cmsg =
-			(struct cras_client_mute_changed *)msg;
+		const struct cras_client_mute_changed *cmsg =
+			(const struct cras_client_mute_changed *)msg;
 		if (client->observer_ops.capture_mute_changed)
 			client->observer_ops.capture_mute_changed(
 					client->observer_context,
@@ -1756,8 +2317,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_ACTIVE_NODE_CHANGED: {
-		struct cras_client_active_node_changed *cmsg =
-			(struct cras_client_active_node_changed *)msg;
+		const struct cras_client_active_node_changed *cmsg =
+			(const struct cras_client_active_node_changed *)msg;
 		enum CRAS_STREAM_DIRECTION direction =
 			(enum CRAS_STREAM_DIRECTION)cmsg->direction;
 		if (client->observer_ops.active_node_changed)
@@ -1767,8 +2328,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_OUTPUT_NODE_VOLUME_CHANGED: {
-		struct cras_client_node_value_changed *cmsg =
-			(struct cras_client_node_value_changed *)msg;
+		const struct cras_client_node_value_changed *cmsg =
+			(const struct cras_client_node_value_changed *)msg;
 		if (client->observer_ops.output_node_volume_changed)
 			client->observer_ops.output_node_volume_changed(
 					client->observer_context,
@@ -1777,8 +2338,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_NODE_LEFT_RIGHT_SWAPPED_CHANGED: {
-		struct cras_client_node_value_changed *cmsg =
-			(struct cras_client_node_value_changed *)msg;
+		const struct cras_client_node_value_changed *cmsg =
+			(const struct cras_client_node_value_changed *)msg;
 		if (client->observer_ops.node_left_right_swapped_changed)
 			client->observer_ops.node_left_right_swapped_changed(
 					client->observer_context,
@@ -1787,8 +2348,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_INPUT_NODE_GAIN_CHANGED: {
-		struct cras_client_node_value_changed *cmsg =
-			(struct cras_client_node_value_changed *)msg;
+		const struct cras_client_node_value_changed *cmsg =
+			(const struct cras_client_node_value_changed *)msg;
 		if (client->observer_ops.input_node_gain_changed)
 			client->observer_ops.input_node_gain_changed(
 					client->observer_context,
@@ -1797,8 +2358,8 @@ static int handle_message_from_server(struct cras_client *client)
 		break;
 	}
 	case CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED: {
-		struct cras_client_num_active_streams_changed *cmsg =
-		    (struct cras_client_num_active_streams_changed *)msg;
+		const struct cras_client_num_active_streams_changed *cmsg =
+		    (const struct cras_client_num_active_streams_changed *)msg;
 		enum CRAS_STREAM_DIRECTION direction =
 			(enum CRAS_STREAM_DIRECTION)cmsg->direction;
 		if (client->observer_ops.num_active_streams_changed)
@@ -1810,6 +2371,124 @@ static int handle_message_from_server(struct cras_client *client)
 	default:
 		break;
 	}
+}
+
+/* Handles messages from the cras server. */
+static int handle_message_from_server(struct cras_client *client)
+{
+	uint8_t buf[CRAS_CLIENT_MAX_MSG_SIZE];
+	struct cras_client_message *msg;
+	int rc = 0;
+	int nread;
+	int server_fds[4];
+	unsigned int num_fds = 4;
+
+	msg = (struct cras_client_message *)buf;
+	nread = cras_recv_with_fds(client->server_fd, buf, sizeof(buf),
+				   server_fds, &num_fds);
+	if (nread < (int)sizeof(msg->length) || (int)msg->length != nread)
+		return -EIO;
+
+	switch (msg->id) {
+	case CRAS_CLIENT_CONNECTED: {
+		struct cras_client_connected *cmsg =
+			(struct cras_client_connected *)msg;
+		if (num_fds != 1)
+			return -EINVAL;
+		rc = client_attach_shm(client, server_fds[0]);
+		if (rc)
+			return rc;
+		client->id = cmsg->client_id;
+
+		break;
+	}
+	case CRAS_CLIENT_STREAM_CONNECTED: {
+		struct cras_client_stream_connected *cmsg =
+			(struct cras_client_stream_connected *)msg;
+		struct client_stream *stream =
+			stream_from_id(client, cmsg->stream_id);
+		unsigned int i;
+
+		if (stream == NULL) {
+			for (i = 0; i < num_fds; i++)
+				close(server_fds[i]);
+			break;
+		}
+		/* The server replies before it attaches the stream to a
+		 * device, attaching can still fail after the stream started. */
+		if (stream->thread.state == CRAS_THREAD_RUNNING) {
+			for (i = 0; i < num_fds; i++)
+				close(server_fds[i]);
+			stream->config->err_cb(stream->client, stream->id,
+					       cmsg->err ? cmsg->err : -EINVAL,
+					       stream->config->user_data);
+			break;
+		}
+		rc = stream_connected(stream, cmsg, server_fds, num_fds);
+		if (rc < 0)
+			stream->config->err_cb(stream->client,
+					       stream->id,
+					       rc,
+					       stream->config->user_data);
+		break;
+	}
+	case CRAS_CLIENT_AUDIO_DEBUG_INFO_READY:
+		if (client->debug_info_callback)
+			client->debug_info_callback(client);
+		break;
+	case CRAS_CLIENT_DSP_DEBUG_INFO_READY:
+		if (client->dsp_debug_info_callback)
+			client->dsp_debug_info_callback(client);
+		break;
+	case CRAS_CLIENT_LATENCY_INFO_READY:
+		if (client->latency_info_callback)
+			client->latency_info_callback(client);
+		break;
+	case CRAS_CLIENT_AUDIO_THREAD_TRACE_READY: {
+		struct cras_client_audio_thread_trace_ready *cmsg =
+			(struct cras_client_audio_thread_trace_ready *)msg;
+		int fd = -1;
+
+		if (cmsg->err == 0 && num_fds == 1)
+			fd = server_fds[0];
+		else if (num_fds == 1)
+			close(server_fds[0]);
+		if (client->audio_thread_trace_callback)
+			client->audio_thread_trace_callback(client, fd);
+		else if (fd >= 0)
+			close(fd);
+		break;
+	}
+	case CRAS_CLIENT_GET_HOTWORD_MODELS_READY: {
+		struct cras_client_get_hotword_models_ready *cmsg =
+			(struct cras_client_get_hotword_models_ready *)msg;
+		cras_client_get_hotword_models_ready(client,
+				(const char *)cmsg->hotword_models);
+		break;
+	}
+	case CRAS_CLIENT_NOTIFICATIONS: {
+		struct cras_client_notifications *cmsg =
+			(struct cras_client_notifications *)msg;
+		const uint8_t *pos = cmsg->msgs;
+		const uint8_t *end = buf + msg->length;
+
+		/* Complete notification messages back to back. */
+		while (pos + sizeof(struct cras_client_message) <= end) {
+			const struct cras_client_message *nmsg =
+				(const struct cras_client_message *)pos;
+
+			if (nmsg->length < sizeof(*nmsg) ||
+			    nmsg->length > (size_t)(end - pos))
+				return -EIO;
+			handle_notification(client, nmsg);
+			pos += nmsg->length;
+		}
+		break;
+	}
+	default:
+		handle_notification(client, msg);
+		break;
+	}
 
 	return 0;
 }
@@ -1896,6 +2575,13 @@ static int handle_command_message(struct cras_client *client,
 	case CLIENT_SERVER_CONNECT_ASYNC:
 		rc = server_connect(client);
 		break;
+	case CLIENT_SET_SHARED_AUDIO_THREADS: {
+		struct set_shared_aud_threads_command_message *threads_msg =
+			(struct set_shared_aud_threads_command_message *)msg;
+		rc = client_thread_set_shared_aud_threads(
+				client, threads_msg->num_threads);
+		break;
+	}
 	default:
 		assert(0);
 		break;
@@ -2304,6 +2990,8 @@ static inline int cras_client_send_add_stream_command_message(
 	stream->aud_fd = -1;
 	stream->wake_fds[0] = -1;
 	stream->wake_fds[1] = -1;
+	stream->request_fd = -1;
+	stream->reply_fd = -1;
 	stream->direction = config->direction;
 	stream->volume_scaler = 1.0;
 	stream->flags = config->flags;
@@ -2593,9 +3281,40 @@ const struct audio_debug_info *cras_client_get_audio_debug_info(
 	return debug_info;
 }
 
+const struct dsp_debug_info *cras_client_get_dsp_debug_info(
+		const struct cras_client *client)
+{
+	const struct dsp_debug_info *debug_info;
+	int lock_rc;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return 0;
+
+	debug_info = &client->server_state->dsp_debug_info;
+	server_state_unlock(client, lock_rc);
+	return debug_info;
+}
+
+const struct latency_debug_info *cras_client_get_latency_info(
+		const struct cras_client *client)
+{
+	const struct latency_debug_info *info;
+	int lock_rc;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return 0;
+
+	info = &client->server_state->latency_debug_info;
+	server_state_unlock(client, lock_rc);
+	return info;
+}
+
 unsigned cras_client_get_num_active_streams(const struct cras_client *client,
 					    struct timespec *ts)
 {
+	const struct cras_server_state_lists *lists;
 	unsigned num_streams, version, i;
 	int lock_rc;
 
@@ -2604,16 +3323,16 @@ unsigned cras_client_get_num_active_streams(const struct cras_client *client,
 		return 0;
 
 read_active_streams_again:
-	version = begin_server_state_read(client->server_state);
+	lists = begin_server_state_read(client->server_state, &version);
 	num_streams = 0;
 	for (i = 0; i < CRAS_NUM_DIRECTIONS; i++)
-		num_streams += client->server_state->num_active_streams[i];
+		num_streams += lists->num_active_streams[i];
 	if (ts) {
 		if (num_streams)
 			clock_gettime(CLOCK_MONOTONIC_RAW, ts);
 		else
 			cras_timespec_to_timespec(ts,
-				&client->server_state->last_active_stream_time);
+				&lists->last_active_stream_time);
 	}
 	if (end_server_state_read(client->server_state, version))
 		goto read_active_streams_again;
@@ -2622,6 +3341,53 @@ read_active_streams_again:
 	return num_streams;
 }
 
+unsigned int cras_client_get_server_state_update_count(
+		const struct cras_client *client)
+{
+	unsigned int count;
+	int lock_rc;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return 0;
+	count = *(volatile unsigned *)&client->server_state->update_count;
+	server_state_unlock(client, lock_rc);
+	return count;
+}
+
+int cras_client_wait_for_server_state_update(const struct cras_client *client,
+					     unsigned int count,
+					     const struct timespec *timeout)
+{
+	struct client_int *client_int;
+	const uint32_t *update_count;
+	int lock_rc;
+	int rc = 0;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -EINVAL;
+
+	/* Wait without the lock, so that a disconnect isn't held up. It keeps
+	 * the server_state mapped while there are waiters. */
+	client_int = to_client_int(client);
+	__atomic_add_fetch(&client_int->server_state_waiters, 1,
+			   __ATOMIC_SEQ_CST);
+	update_count = &client->server_state->update_count;
+	server_state_unlock(client, lock_rc);
+
+	/* Returns right away if the count isn't count anymore. The server
+	 * wakes every waiter after an update. */
+	if (syscall(SYS_futex, (void *)update_count, FUTEX_WAIT, count,
+		    timeout, NULL, 0) < 0 &&
+	    errno == ETIMEDOUT)
+		rc = -ETIMEDOUT;
+
+	__atomic_sub_fetch(&client_int->server_state_waiters, 1,
+			   __ATOMIC_SEQ_CST);
+	return rc;
+}
+
 int cras_client_run_thread(struct cras_client *client)
 {
 	int rc;
@@ -2655,6 +3421,7 @@ int cras_client_stop(struct cras_client *client)
 
 	send_simple_cmd_msg(client, 0, CLIENT_STOP);
 	pthread_join(client->thread.tid, NULL);
+	stop_shared_aud_threads(client);
 
 	/* The other end of the reply pipe is closed by the client thread, just
 	 * clost the read end here. */
@@ -2687,12 +3454,33 @@ void cras_client_set_thread_priority_cb(struct cras_client *client,
 	client->thread_priority_cb = cb;
 }
 
+int cras_client_set_shared_audio_threads(struct cras_client *client,
+					 unsigned int num_threads)
+{
+	struct set_shared_aud_threads_command_message msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	/* The stream list belongs to the client thread once it runs. */
+	if (!thread_is_running(&client->thread))
+		return client_thread_set_shared_aud_threads(client,
+							    num_threads);
+
+	msg.header.len = sizeof(msg);
+	msg.header.stream_id = 0;
+	msg.header.msg_id = CLIENT_SET_SHARED_AUDIO_THREADS;
+	msg.num_threads = num_threads;
+	return send_command_message(client, &msg.header);
+}
+
 int cras_client_get_output_devices(const struct cras_client *client,
 				   struct cras_iodev_info *devs,
 				   struct cras_ionode_info *nodes,
 				   size_t *num_devs, size_t *num_nodes)
 {
 	const struct cras_server_state *state;
+	const struct cras_server_state_lists *lists;
 	unsigned avail_devs, avail_nodes, version;
 	int lock_rc;
 
@@ -2702,11 +3490,11 @@ int cras_client_get_output_devices(const struct cras_client *client,
 	state = client->server_state;
 
 read_outputs_again:
-	version = begin_server_state_read(state);
-	avail_devs = MIN(*num_devs, state->num_output_devs);
-	memcpy(devs, state->output_devs, avail_devs * sizeof(*devs));
-	avail_nodes = MIN(*num_nodes, state->num_output_nodes);
-	memcpy(nodes, state->output_nodes, avail_nodes * sizeof(*nodes));
+	lists = begin_server_state_read(state, &version);
+	avail_devs = MIN(*num_devs, lists->num_output_devs);
+	memcpy(devs, lists->output_devs, avail_devs * sizeof(*devs));
+	avail_nodes = MIN(*num_nodes, lists->num_output_nodes);
+	memcpy(nodes, lists->output_nodes, avail_nodes * sizeof(*nodes));
 	if (end_server_state_read(state, version))
 		goto read_outputs_again;
 	server_state_unlock(client, lock_rc);
@@ -2723,6 +3511,7 @@ int cras_client_get_input_devices(const struct cras_client *client,
 				  size_t *num_devs, size_t *num_nodes)
 {
 	const struct cras_server_state *state;
+	const struct cras_server_state_lists *lists;
 	unsigned avail_devs, avail_nodes, version;
 	int lock_rc;
 
@@ -2732,11 +3521,11 @@ int cras_client_get_input_devices(const struct cras_client *client,
 	state = client->server_state;
 
 read_inputs_again:
-	version = begin_server_state_read(state);
-	avail_devs = MIN(*num_devs, state->num_input_devs);
-	memcpy(devs, state->input_devs, avail_devs * sizeof(*devs));
-	avail_nodes = MIN(*num_nodes, state->num_input_nodes);
-	memcpy(nodes, state->input_nodes, avail_nodes * sizeof(*nodes));
+	lists = begin_server_state_read(state, &version);
+	avail_devs = MIN(*num_devs, lists->num_input_devs);
+	memcpy(devs, lists->input_devs, avail_devs * sizeof(*devs));
+	avail_nodes = MIN(*num_nodes, lists->num_input_nodes);
+	memcpy(nodes, lists->input_nodes, avail_nodes * sizeof(*nodes));
 	if (end_server_state_read(state, version))
 		goto read_inputs_again;
 	server_state_unlock(client, lock_rc);
@@ -2752,6 +3541,7 @@ int cras_client_get_attached_clients(const struct cras_client *client,
 				     size_t max_clients)
 {
 	const struct cras_server_state *state;
+	const struct cras_server_state_lists *lists;
 	unsigned num, version;
 	int lock_rc;
 
@@ -2761,9 +3551,9 @@ int cras_client_get_attached_clients(const struct cras_client *client,
 	state = client->server_state;
 
 read_clients_again:
-	version = begin_server_state_read(state);
-	num = MIN(max_clients, state->num_attached_clients);
-	memcpy(clients, state->client_info, num * sizeof(*clients));
+	lists = begin_server_state_read(state, &version);
+	num = MIN(max_clients, lists->num_attached_clients);
+	memcpy(clients, lists->client_info, num * sizeof(*clients));
 	if (end_server_state_read(state, version))
 		goto read_clients_again;
 	server_state_unlock(client, lock_rc);
@@ -3035,6 +3825,51 @@ int cras_client_update_audio_debug_info(
 	return write_message_to_server(client, &msg.header);
 }
 
+int cras_client_update_dsp_debug_info(
+	struct cras_client *client,
+	void (*debug_info_cb)(struct cras_client *))
+{
+	struct cras_dump_dsp_profile msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	client->dsp_debug_info_callback = debug_info_cb;
+
+	cras_fill_dump_dsp_profile(&msg);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_update_latency_info(
+	struct cras_client *client,
+	void (*latency_info_cb)(struct cras_client *))
+{
+	struct cras_dump_latency_info msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	client->latency_info_callback = latency_info_cb;
+
+	cras_fill_dump_latency_info(&msg);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_get_audio_thread_trace(
+	struct cras_client *client,
+	void (*trace_cb)(struct cras_client *, int))
+{
+	struct cras_get_audio_thread_trace msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	client->audio_thread_trace_callback = trace_cb;
+
+	cras_fill_get_audio_thread_trace(&msg);
+	return write_message_to_server(client, &msg.header);
+}
+
 int cras_client_set_node_volume(struct cras_client *client,
 				cras_node_id_t node_id,
 				uint8_t volume)
@@ -3124,6 +3959,7 @@ int cras_client_get_first_dev_type_idx(const struct cras_client *client,
 				       enum CRAS_STREAM_DIRECTION direction)
 {
 	const struct cras_server_state *state;
+	const struct cras_server_state_lists *lists;
 	unsigned int version;
 	unsigned int i;
 	const struct cras_ionode_info *node_list;
@@ -3136,13 +3972,13 @@ int cras_client_get_first_dev_type_idx(const struct cras_client *client,
 	state = client->server_state;
 
 read_nodes_again:
-	version = begin_server_state_read(state);
+	lists = begin_server_state_read(state, &version);
 	if (direction == CRAS_STREAM_OUTPUT) {
-		node_list = state->output_nodes;
-		num_nodes = state->num_output_nodes;
+		node_list = lists->output_nodes;
+		num_nodes = lists->num_output_nodes;
 	} else {
-		node_list = state->input_nodes;
-		num_nodes = state->num_input_nodes;
+		node_list = lists->input_nodes;
+		num_nodes = lists->num_input_nodes;
 	}
 	for (i = 0; i < num_nodes; i++) {
 		if ((enum CRAS_NODE_TYPE)node_list[i].type_enum == type) {
@@ -3329,6 +4165,11 @@ static int reregister_notifications(struct cras_client *client)
 {
 	int rc;
 
+	/* Let the server coalesce notifications into fewer messages. */
+	rc = cras_send_register_notification(client,
+					     CRAS_CLIENT_NOTIFICATIONS, 1);
+	if (rc != 0)
+		return rc;
 	if (client->observer_ops.output_volume_changed) {
 		rc = cras_client_set_output_volume_changed_callback(
 				client,
@@ -304,6 +304,20 @@ void cras_client_set_connection_status_cb(
 void cras_client_set_thread_priority_cb(struct cras_client *client,
 					cras_thread_priority_cb_t cb);
 
+/* Services the streams of the client from a fixed number of shared audio
+ * threads instead of one thread per stream.  Each shared thread waits on all
+ * of its streams with a single epoll set, and runs the callbacks of streams
+ * that are due together in order of their shm time stamps.  Must be called
+ * before any stream is added.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    num_threads - Number of shared audio threads, 0 for a thread per stream.
+ * Returns:
+ *    0 on success, -EBUSY if the client already has streams.
+ */
+int cras_client_set_shared_audio_threads(struct cras_client *client,
+					 unsigned int num_threads);
+
 /* Returns the current list of output devices.
  *
  * Requires that the connection to the server has been established.
@@ -492,6 +506,44 @@ int cras_client_dump_dsp_info(struct cras_client *client);
 int cras_client_update_audio_debug_info(
 	struct cras_client *client, void (*cb)(struct cras_client *));
 
+/* Asks the server to fill in the cpu time spent in each dsp plugin.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    cb - A function to call when the data is received.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or isn't running.
+ */
+int cras_client_update_dsp_debug_info(
+	struct cras_client *client, void (*cb)(struct cras_client *));
+
+/* Asks the server to fill in the latency histograms of the audio thread,
+ * its open devices and streams. The audio thread isn't stopped to read them.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    cb - A function to call when the data is received.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or isn't running.
+ */
+int cras_client_update_latency_info(
+	struct cras_client *client, void (*cb)(struct cras_client *));
+
+/* Asks the server for the continuous audio thread trace, enabled by starting
+ * the server with --trace_audio_thread. The trace can be mapped read only
+ * and read with audio_thread_trace_snapshot() from cras_audio_thread_trace.h
+ * while the server keeps writing it.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    cb - A function to call with a read only fd of the trace, or -1 if the
+ *        trace isn't enabled. The callback owns the fd and must close it.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or isn't running.
+ */
+int cras_client_get_audio_thread_trace(
+	struct cras_client *client, void (*cb)(struct cras_client *, int fd));
+
 /*
  * Stream handling.
  */
@@ -821,6 +873,34 @@ long cras_client_get_system_max_capture_gain(const struct cras_client *client);
 const struct audio_debug_info *cras_client_get_audio_debug_info(
 		const struct cras_client *client);
 
+/* Gets the dsp profile.
+ *
+ * Requires that the connection to the server has been established.
+ * Access to the resulting pointer is not thread-safe.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    A pointer to the dsp profile.  This info is only updated when requested
+ *    by calling cras_client_update_dsp_debug_info.
+ */
+const struct dsp_debug_info *cras_client_get_dsp_debug_info(
+		const struct cras_client *client);
+
+/* Gets the latency histograms.
+ *
+ * Requires that the connection to the server has been established.
+ * Access to the resulting pointer is not thread-safe.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    A pointer to the latency histograms.  This info is only updated when
+ *    requested by calling cras_client_update_latency_info.
+ */
+const struct latency_debug_info *cras_client_get_latency_info(
+		const struct cras_client *client);
+
 /* Gets the number of streams currently attached to the server.
  *
  * This is the total number of capture and playback streams. If the ts argument
@@ -839,6 +919,41 @@ const struct audio_debug_info *cras_client_get_audio_debug_info(
 unsigned cras_client_get_num_active_streams(const struct cras_client *client,
 					    struct timespec *ts);
 
+/* Gets the number of updates to the device, node and client lists and to the
+ * active stream count, to pass to cras_client_wait_for_server_state_update.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    The update count of the server state.
+ */
+unsigned int cras_client_get_server_state_update_count(
+		const struct cras_client *client);
+
+/* Waits until the server updates its state, instead of polling it.
+ *
+ * Returns right away if the update count isn't count anymore. Can return
+ * before an update if interrupted or if the connection to the server is lost,
+ * check the update count again.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    count - The update count from
+ *        cras_client_get_server_state_update_count when the state was last
+ *        read.
+ *    timeout - How long to wait, NULL to wait for ever.
+ * Returns:
+ *    0 on success, -ETIMEDOUT if there was no update before the timeout,
+ *    -EINVAL if not connected.
+ */
+int cras_client_wait_for_server_state_update(const struct cras_client *client,
+					     unsigned int count,
+					     const struct timespec *timeout);
+
 
 /*
  * Utility functions.
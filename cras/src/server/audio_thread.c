@@ -4,13 +4,21 @@
  */
 
 #ifndef _GNU_SOURCE
-#define _GNU_SOURCE /* for ppoll */
+#define _GNU_SOURCE
 #endif
 
+#include <fcntl.h>
+#include <linux/memfd.h>
 #include <pthread.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "cras_audio_area.h"
 #include "audio_thread_log.h"
@@ -29,6 +37,7 @@
 #define MIN_PROCESS_TIME_US 500 /* 0.5ms - min amount of time to mix/src. */
 #define SLEEP_FUZZ_FRAMES 10 /* # to consider "close enough" to sleep frames. */
 #define MIN_READ_WAIT_US 2000 /* 2ms */
+#define MAX_EPOLL_EVENTS 32 /* Events handled per wake. */
 static const struct timespec playback_wake_fuzz_ts = {
 	0, 500 * 1000 /* 500 usec. */
 };
@@ -87,22 +96,85 @@ struct audio_thread_dev_start_ramp_msg {
 
 /* Audio thread logging. */
 struct audio_thread_event_log *atlog;
+/* Continuous trace, and the fd of its memfd shared with clients. */
+struct audio_thread_trace *attrace;
+static int trace_fd = -1;
 /* Global fmt converter used to remix output channels. */
 static struct cras_fmt_conv *remix_converter = NULL;
 
 static struct iodev_callback_list *iodev_callbacks;
 static struct timespec longest_wake;
 
+/* The epoll set the audio thread sleeps on and the timer that wakes it for the
+ * next device or stream deadline. The set holds the message pipe, the timer,
+ * the iodev callback fds and the audio fds of output streams. Its membership
+ * only changes when callbacks or streams are added and removed. */
+static int epoll_fd = -1;
+static int wake_timer_fd = -1;
+
 struct iodev_callback_list {
 	int fd;
 	int is_write;
 	int enabled;
 	thread_callback cb;
 	void *cb_data;
-	struct pollfd *pollfd;
 	struct iodev_callback_list *prev, *next;
 };
 
+/* Updates the epoll set for fd.
+ * Args:
+ *    op - One of EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL.
+ *    fd - The file descriptor to watch.
+ *    events - The epoll events to wait for on fd.
+ */
+static int thread_epoll_ctl(int op, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if (epoll_fd < 0)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, op, fd, &ev) < 0)
+		return -errno;
+	return 0;
+}
+
+static uint32_t iodev_cb_events(const struct iodev_callback_list *iodev_cb)
+{
+	if (!iodev_cb->enabled)
+		return 0;
+	return iodev_cb->is_write ? EPOLLOUT : EPOLLIN;
+}
+
+/* Points the epoll registration of fd at the combined events of every
+ * callback still using it, or removes it if none is left. Several callbacks
+ * can share an fd with different cb_data. */
+static int update_callback_fd(int fd)
+{
+	struct iodev_callback_list *iodev_cb;
+	uint32_t events = 0;
+	int found = 0;
+	int rc;
+
+	DL_FOREACH(iodev_callbacks, iodev_cb) {
+		if (iodev_cb->fd != fd)
+			continue;
+		found = 1;
+		events |= iodev_cb_events(iodev_cb);
+	}
+
+	if (!found)
+		return thread_epoll_ctl(EPOLL_CTL_DEL, fd, 0);
+
+	rc = thread_epoll_ctl(EPOLL_CTL_MOD, fd, events);
+	if (rc == -ENOENT)
+		rc = thread_epoll_ctl(EPOLL_CTL_ADD, fd, events);
+	return rc;
+}
+
 static void _audio_thread_add_callback(int fd, thread_callback cb,
 				       void *data, int is_write)
 {
@@ -121,6 +193,9 @@ static void _audio_thread_add_callback(int fd, thread_callback cb,
 	iodev_cb->is_write = is_write;
 
 	DL_APPEND(iodev_callbacks, iodev_cb);
+
+	if (update_callback_fd(fd))
+		syslog(LOG_ERR, "Failed to poll callback fd %d", fd);
 }
 
 void audio_thread_add_callback(int fd, thread_callback cb,
@@ -143,6 +218,7 @@ void audio_thread_rm_callback(int fd)
 		if (iodev_cb->fd == fd) {
 			DL_DELETE(iodev_callbacks, iodev_cb);
 			free(iodev_cb);
+			update_callback_fd(fd);
 			return;
 		}
 	}
@@ -154,7 +230,10 @@ void audio_thread_enable_callback(int fd, int enabled)
 
 	DL_FOREACH(iodev_callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
+			if (iodev_cb->enabled == !!enabled)
+				return;
 			iodev_cb->enabled = !!enabled;
+			update_callback_fd(fd);
 			return;
 		}
 	}
@@ -214,6 +293,38 @@ static void fill_odevs_zeros_min_level(struct cras_iodev *odev)
 static void thread_rm_open_adev(struct audio_thread *thread,
 				struct open_dev *adev);
 
+static int thread_find_stream(struct audio_thread *thread,
+			      struct cras_rstream *rstream);
+
+/* Wakes the thread when a client replies to a request for playback samples.
+ * The fd is edge triggered, replies are read by fetch_streams() on the next
+ * pass. A stream attached to several devices is only added once. */
+static void thread_poll_stream_fd(struct cras_rstream *stream)
+{
+	int fd = cras_rstream_get_audio_reply_fd(stream);
+	int rc;
+
+	if (fd < 0 || stream->direction != CRAS_STREAM_OUTPUT)
+		return;
+
+	rc = thread_epoll_ctl(EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLET);
+	if (rc && rc != -EEXIST)
+		syslog(LOG_ERR, "Failed to poll stream fd %d", fd);
+}
+
+/* Stops polling the stream's fd once it is not attached to any device. */
+static void thread_unpoll_stream_fd(struct audio_thread *thread,
+				    struct cras_rstream *stream)
+{
+	int fd = cras_rstream_get_audio_reply_fd(stream);
+
+	if (fd < 0 || stream->direction != CRAS_STREAM_OUTPUT ||
+	    thread_find_stream(thread, stream))
+		return;
+
+	thread_epoll_ctl(EPOLL_CTL_DEL, fd, 0);
+}
+
 static void delete_stream_from_dev(struct cras_iodev *dev,
 				   struct cras_rstream *stream)
 {
@@ -280,6 +391,7 @@ static int append_stream(struct audio_thread *thread,
 		}
 
 		cras_iodev_add_stream(dev, out);
+		thread_poll_stream_fd(stream);
 
 		/* For multiple inputs case, if the new stream is not the first
 		 * one to append, copy the 1st stream's offset to it so that
@@ -314,6 +426,7 @@ static int append_stream(struct audio_thread *thread,
 			cras_iodev_rm_stream(dev, stream);
 			dev_stream_destroy(out);
 		}
+		thread_unpoll_stream_fd(thread, stream);
 	}
 
 	return rc;
@@ -381,6 +494,7 @@ static void thread_rm_open_adev(struct audio_thread *thread,
 
 	DL_FOREACH(dev_to_rm->dev->streams, dev_stream) {
 		cras_iodev_rm_stream(dev_to_rm->dev, dev_stream->stream);
+		thread_unpoll_stream_fd(thread, dev_stream->stream);
 		dev_stream_destroy(dev_stream);
 	}
 
@@ -466,6 +580,8 @@ static int thread_remove_stream(struct audio_thread *thread,
 		delete_stream_from_dev(dev, stream);
 	}
 
+	thread_unpoll_stream_fd(thread, stream);
+
 	return 0;
 }
 
@@ -547,10 +663,10 @@ static int thread_add_stream(struct audio_thread *thread,
 	return 0;
 }
 
-/* Reads any pending audio message from the socket. */
-static void flush_old_aud_messages(struct cras_audio_shm *shm, int fd)
+/* Reads any pending reply from the client, from its socket or its doorbell. */
+static void flush_old_aud_messages(struct cras_rstream *rstream, int fd)
 {
-	struct audio_message msg;
+	struct cras_audio_shm *shm = cras_rstream_output_shm(rstream);
 	struct pollfd pollfd;
 	int err;
 
@@ -560,7 +676,9 @@ static void flush_old_aud_messages(struct cras_audio_shm *shm, int fd)
 	do {
 		err = poll(&pollfd, 1, 0);
 		if (pollfd.revents & POLLIN) {
-			err = read(fd, &msg, sizeof(msg));
+			err = cras_rstream_get_audio_request_reply(rstream);
+			if (err == 0)
+				err = 1;
 			cras_shm_set_callback_pending(shm, 0);
 		}
 	} while (err > 0);
@@ -590,14 +708,15 @@ static int fetch_streams(struct audio_thread *thread,
 		struct cras_rstream *rstream = dev_stream->stream;
 		struct cras_audio_shm *shm =
 			cras_rstream_output_shm(rstream);
-		int fd = cras_rstream_get_audio_fd(rstream);
+		int fd = cras_rstream_get_audio_reply_fd(rstream);
 		const struct timespec *next_cb_ts;
-		struct timespec now;
+		struct timespec now, fetch_ts;
 
 		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		fetch_ts = now;
 
 		if (cras_shm_callback_pending(shm) && fd >= 0) {
-			flush_old_aud_messages(shm, fd);
+			flush_old_aud_messages(rstream, fd);
 			cras_rstream_record_fetch_interval(dev_stream->stream,
 							   &now);
 		}
@@ -622,12 +741,14 @@ static int fetch_streams(struct audio_thread *thread,
 			ATLOG(
 				atlog, AUDIO_THREAD_STREAM_SKIP_CB,
 				rstream->stream_id,
-				shm->area->write_offset[0],
-				shm->area->write_offset[1]);
+				cras_shm_get_frames(shm),
+				cras_shm_get_num_writeable(shm));
 			continue;
 		}
 
 		dev_stream_set_delay(dev_stream, delay);
+		latency_hist_add_interval(&rstream->fetch_hist, next_cb_ts,
+					  &fetch_ts);
 
 		ATLOG(
 				atlog,
@@ -667,6 +788,7 @@ static int write_streams(struct audio_thread *thread,
 	struct dev_stream *curr;
 	unsigned int max_offset = 0;
 	unsigned int frame_bytes = cras_get_format_bytes(odev->ext_format);
+	unsigned int channels = odev->ext_format->num_channels;
 	unsigned int num_playing = 0;
 	unsigned int drain_limit = write_limit;
 
@@ -706,9 +828,17 @@ static int write_streams(struct audio_thread *thread,
 	if (!num_playing)
 		write_limit = drain_limit;
 
-	if (write_limit > max_offset)
+	if (odev->float_mix_buf) {
+		if (write_limit > max_offset)
+			memset(odev->float_mix_buf + max_offset * channels, 0,
+			       (write_limit - max_offset) * channels *
+				sizeof(*odev->float_mix_buf));
+		odev->float_mix_frames = MAX(odev->float_mix_frames,
+					     write_limit);
+	} else if (write_limit > max_offset) {
 		memset(dst + max_offset * frame_bytes, 0,
 		       (write_limit - max_offset) * frame_bytes);
+	}
 
 	ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_MIX,
 				    write_limit, max_offset, 0);
@@ -720,9 +850,15 @@ static int write_streams(struct audio_thread *thread,
 		offset = cras_iodev_stream_offset(odev, curr);
 		if (offset >= write_limit)
 			continue;
-		nwritten = dev_stream_mix(curr, odev->ext_format,
-					  dst + frame_bytes * offset,
-					  write_limit - offset);
+		if (odev->float_mix_buf)
+			nwritten = dev_stream_mix_float(
+					curr, odev->ext_format,
+					odev->float_mix_buf + offset * channels,
+					write_limit - offset);
+		else
+			nwritten = dev_stream_mix(curr, odev->ext_format,
+						  dst + frame_bytes * offset,
+						  write_limit - offset);
 
 		if (nwritten < 0) {
 			thread_remove_stream(thread, curr->stream, NULL);
@@ -789,6 +925,34 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 	}
 }
 
+/* Fills the event log of info with the newest events of the trace, in the
+ * format of atlog. */
+static void append_trace_dump_info(struct audio_debug_info *info,
+				   const struct audio_thread_trace *trace)
+{
+	uint64_t count = trace->write_count;
+	uint64_t first, n;
+	unsigned int i = 0;
+
+	memset(&info->log, 0, sizeof(info->log));
+	info->log.len = AUDIO_THREAD_EVENT_LOG_SIZE;
+	first = count > AUDIO_THREAD_EVENT_LOG_SIZE ?
+			count - AUDIO_THREAD_EVENT_LOG_SIZE : 0;
+	for (n = first; n < count; n++, i++) {
+		const struct audio_thread_trace_event *e =
+			&trace->events[n & (AUDIO_THREAD_TRACE_SIZE - 1)];
+		uint64_t ns = audio_thread_trace_ticks_to_ns(trace, e->ticks);
+
+		info->log.log[i].tag_sec = (e->tag << 24) |
+			((ns / 1000000000ULL) & 0x00ffffff);
+		info->log.log[i].nsec = ns % 1000000000ULL;
+		info->log.log[i].data1 = e->data1;
+		info->log.log[i].data2 = e->data2;
+		info->log.log[i].data3 = e->data3;
+	}
+	info->log.write_pos = i % AUDIO_THREAD_EVENT_LOG_SIZE;
+}
+
 /* Put stream info for the given stream into the info struct. */
 static void append_stream_dump_info(struct audio_debug_info *info,
 				    struct dev_stream *stream,
@@ -915,7 +1079,10 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 
 		info->num_streams = num_streams;
 
-		memcpy(&info->log, atlog, sizeof(info->log));
+		if (attrace)
+			append_trace_dump_info(info, attrace);
+		else
+			memcpy(&info->log, atlog, sizeof(info->log));
 		break;
 	}
 	case AUDIO_THREAD_DRAIN_STREAM: {
@@ -1231,6 +1398,7 @@ static int do_playback(struct audio_thread *thread)
 {
 	struct open_dev *adev;
 	struct dev_stream *curr;
+	struct timespec start, end;
 	int rc;
 
 	/* For multiple output case, update the number of queued frames in shm
@@ -1247,7 +1415,10 @@ static int do_playback(struct audio_thread *thread)
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
 
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
 		rc = write_output_samples(thread, adev);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+		latency_hist_add_interval(&adev->dev->hw_io_hist, &start, &end);
 		if (rc < 0) {
 			if (rc == -EPIPE) {
 				/* Handle severe underrun. */
@@ -1295,7 +1466,8 @@ static unsigned int get_stream_limit_set_delay(struct open_dev *adev,
 		rstream = stream->stream;
 
 		shm = cras_rstream_input_shm(rstream);
-		if (cras_shm_check_write_overrun(shm))
+		if (cras_shm_check_write_overrun(
+				shm, cras_rstream_get_cb_threshold(rstream)))
 			ATLOG(atlog, AUDIO_THREAD_READ_OVERRUN,
 			      adev->dev->info.idx, rstream->stream_id,
 			      shm->area->num_overruns);
@@ -1396,11 +1568,17 @@ static int do_capture(struct audio_thread *thread)
 {
 	struct open_dev *idev_list = thread->open_devs[CRAS_STREAM_INPUT];
 	struct open_dev *adev;
+	struct timespec start, end;
+	int rc;
 
 	DL_FOREACH(idev_list, adev) {
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
-		if (capture_to_streams(thread, adev) < 0)
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		rc = capture_to_streams(thread, adev);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+		latency_hist_add_interval(&adev->dev->hw_io_hist, &start, &end);
+		if (rc < 0)
 			thread_rm_open_adev(thread, adev);
 	}
 
@@ -1510,6 +1688,41 @@ int fill_next_sleep_interval(struct audio_thread *thread, struct timespec *ts)
 	return ret;
 }
 
+/* Arms the wake timer to fire after ts, or disarms it if ts is NULL. The
+ * timer is re-armed before every sleep, which also clears any expiration
+ * that hasn't been read. */
+static void set_wake_timer(const struct timespec *ts)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (ts) {
+		its.it_value = *ts;
+		/* A zero value disarms the timer, wake right away instead. */
+		if (!timespec_is_nonzero(&its.it_value))
+			its.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(wake_timer_fd, 0, &its, NULL))
+		syslog(LOG_ERR, "Failed to set wake timer: %d", errno);
+}
+
+/* Runs the enabled callbacks registered for fd. */
+static void run_iodev_callbacks(int fd, uint32_t events)
+{
+	struct iodev_callback_list *iodev_cb;
+
+	if (!(events & (EPOLLIN | EPOLLOUT)))
+		return;
+
+	DL_FOREACH(iodev_callbacks, iodev_cb) {
+		if (iodev_cb->fd != fd ||
+		    !(events & iodev_cb_events(iodev_cb)))
+			continue;
+		ATLOG(atlog, AUDIO_THREAD_IODEV_CB, iodev_cb->is_write, 0, 0);
+		iodev_cb->cb(iodev_cb->cb_data);
+	}
+}
+
 /* For playback, fill the audio buffer when needed, for capture, pull out
  * samples when they are ready.
  * This thread will attempt to run at a high priority to allow for low latency
@@ -1520,12 +1733,9 @@ int fill_next_sleep_interval(struct audio_thread *thread, struct timespec *ts)
 static void *audio_io_thread(void *arg)
 {
 	struct audio_thread *thread = (struct audio_thread *)arg;
-	struct open_dev *adev;
-	struct dev_stream *curr;
 	struct timespec ts, now, last_wake;
-	struct pollfd *pollfds;
-	unsigned int num_pollfds;
-	unsigned int pollfds_size = 32;
+	struct timespec wake_target = { 0, 0 };
+	struct epoll_event events[MAX_EPOLL_EVENTS];
 	int msg_fd;
 	int rc;
 
@@ -1539,16 +1749,11 @@ static void *audio_io_thread(void *arg)
 	longest_wake.tv_sec = 0;
 	longest_wake.tv_nsec = 0;
 
-	pollfds = (struct pollfd *)malloc(sizeof(*pollfds) * pollfds_size);
-	pollfds[0].fd = msg_fd;
-	pollfds[0].events = POLLIN;
-
 	while (1) {
 		struct timespec *wait_ts;
-		struct iodev_callback_list *iodev_cb;
+		int i, num_events;
 
 		wait_ts = NULL;
-		num_pollfds = 1;
 
 		/* device opened */
 		rc = stream_dev_io(thread);
@@ -1557,80 +1762,51 @@ static void *audio_io_thread(void *arg)
 
 		if (fill_next_sleep_interval(thread, &ts))
 			wait_ts = &ts;
+		set_wake_timer(wait_ts);
 
-restart_poll_loop:
-		num_pollfds = 1;
-
-		DL_FOREACH(iodev_callbacks, iodev_cb) {
-			if (!iodev_cb->enabled)
-				continue;
-			pollfds[num_pollfds].fd = iodev_cb->fd;
-			iodev_cb->pollfd = &pollfds[num_pollfds];
-			if (iodev_cb->is_write)
-				pollfds[num_pollfds].events = POLLOUT;
-			else
-				pollfds[num_pollfds].events = POLLIN;
-			num_pollfds++;
-			if (num_pollfds >= pollfds_size) {
-				pollfds_size *= 2;
-				pollfds = (struct pollfd *)realloc(pollfds,
-					sizeof(*pollfds) * pollfds_size);
-				goto restart_poll_loop;
-			}
-		}
-
-		/* TODO(dgreid) - once per rstream not per dev_stream */
-		DL_FOREACH(thread->open_devs[CRAS_STREAM_OUTPUT], adev) {
-			DL_FOREACH(adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				pollfds[num_pollfds].fd = fd;
-				pollfds[num_pollfds].events = POLLIN;
-				num_pollfds++;
-				if (num_pollfds >= pollfds_size) {
-					pollfds_size *= 2;
-					pollfds = (struct pollfd *)realloc(
-							pollfds,
-							sizeof(*pollfds) *
-								pollfds_size);
-					goto restart_poll_loop;
-				}
-			}
-		}
-
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 		if (last_wake.tv_sec) {
 			struct timespec this_wake;
-			clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 			subtract_timespecs(&now, &last_wake, &this_wake);
 			if (timespec_after(&this_wake, &longest_wake))
 				longest_wake = this_wake;
 		}
+		if (wait_ts) {
+			wake_target = now;
+			add_timespecs(&wake_target, wait_ts);
+		}
 
 		ATLOG(atlog, AUDIO_THREAD_SLEEP,
 					    wait_ts ? wait_ts->tv_sec : 0,
 					    wait_ts ? wait_ts->tv_nsec : 0,
 					    longest_wake.tv_nsec);
-		rc = ppoll(pollfds, num_pollfds, wait_ts, NULL);
+		num_events = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
 		clock_gettime(CLOCK_MONOTONIC_RAW, &last_wake);
-		ATLOG(atlog, AUDIO_THREAD_WAKE, rc, 0, 0);
-		if (rc <= 0)
+		ATLOG(atlog, AUDIO_THREAD_WAKE, num_events, 0, 0);
+		if (num_events <= 0)
 			continue;
 
-		if (pollfds[0].revents & POLLIN) {
+		/* Handle the message first, it may remove callbacks. */
+		for (i = 0; i < num_events; i++) {
+			if (events[i].data.fd != msg_fd)
+				continue;
 			rc = handle_playback_thread_message(thread);
 			if (rc < 0)
 				syslog(LOG_INFO, "handle message %d", rc);
 		}
 
-		DL_FOREACH(iodev_callbacks, iodev_cb) {
-			if (iodev_cb->pollfd &&
-			    iodev_cb->pollfd->revents & (POLLIN | POLLOUT)) {
-				ATLOG(
-					atlog, AUDIO_THREAD_IODEV_CB,
-					iodev_cb->is_write, 0, 0);
-				iodev_cb->cb(iodev_cb->cb_data);
-			}
+		/* The timer and stream fds only need to wake the thread, the
+		 * work for them is done by stream_dev_io(). */
+		for (i = 0; i < num_events; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == wake_timer_fd && wait_ts)
+				latency_hist_add_interval(
+					&thread->wake_jitter_hist,
+					&wake_target, &last_wake);
+			if (fd == msg_fd || fd == wake_timer_fd)
+				continue;
+			run_iodev_callbacks(fd, events[i].events);
 		}
 	}
 
@@ -1777,6 +1953,120 @@ int audio_thread_dump_thread_info(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+static uint64_t monotonic_raw_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Reads the cpu counter and CLOCK_MONOTONIC_RAW as close together as
+ * possible. */
+static void trace_read_clocks(uint64_t *ticks, uint64_t *ns)
+{
+	uint64_t before, after;
+
+	before = monotonic_raw_ns();
+	*ticks = audio_thread_trace_read_ticks();
+	after = monotonic_raw_ns();
+	*ns = before + (after - before) / 2;
+}
+
+/* Measures the frequency of the cpu counter against CLOCK_MONOTONIC_RAW,
+ * and stores the reference point used to convert ticks. */
+static void trace_calibrate(struct audio_thread_trace *trace)
+{
+	static const struct timespec wait = { 0, 20 * 1000 * 1000 };
+	uint64_t ticks0, ns0, ticks1, ns1;
+
+	trace_read_clocks(&ticks0, &ns0);
+	nanosleep(&wait, NULL);
+	trace_read_clocks(&ticks1, &ns1);
+
+#if defined(__aarch64__)
+	{
+		uint64_t freq;
+
+		__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+		trace->ticks_per_sec = freq;
+	}
+#else
+	trace->ticks_per_sec = (double)(ticks1 - ticks0) * 1e9 /
+			       (ns1 - ns0);
+#endif
+	trace->base_ticks = ticks1;
+	trace->base_ns = ns1;
+}
+
+int audio_thread_trace_enable()
+{
+	struct audio_thread_trace *trace;
+	char path[32];
+	int fd, ro_fd;
+
+	if (attrace)
+		return 0;
+
+	fd = syscall(__NR_memfd_create, "cras_audio_thread_trace",
+		     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, sizeof(*trace))) {
+		close(fd);
+		return -errno;
+	}
+
+	trace = (struct audio_thread_trace *)mmap(
+			NULL, sizeof(*trace), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (trace == MAP_FAILED) {
+		close(fd);
+		return -errno;
+	}
+
+#ifdef F_ADD_SEALS
+	/* Readers map the whole trace, don't let it change size. Where the
+	 * kernel supports it, also stop anything but the mapping above from
+	 * writing to it, even if a client reopens its fd through /proc. */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#ifdef F_SEAL_FUTURE_WRITE
+	fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL);
+#endif
+	/* Older kernels only have the mode to keep clients of another user
+	 * from reopening the fd for writing. */
+	if (fchmod(fd, 0444)) {
+		munmap(trace, sizeof(*trace));
+		close(fd);
+		return -errno;
+	}
+
+	/* Clients get an fd opened read only. */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+	close(fd);
+	if (ro_fd < 0) {
+		munmap(trace, sizeof(*trace));
+		return -errno;
+	}
+
+	trace->magic = AUDIO_THREAD_TRACE_MAGIC;
+	trace->version = AUDIO_THREAD_TRACE_VERSION;
+	trace->num_events = AUDIO_THREAD_TRACE_SIZE;
+	trace_calibrate(trace);
+
+	trace_fd = ro_fd;
+	__atomic_store_n(&attrace, trace, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int audio_thread_trace_get_fd()
+{
+	return trace_fd;
+}
+
 int audio_thread_rm_callback_sync(struct audio_thread *thread, int fd) {
 	struct audio_thread_rm_callback_msg msg;
 
@@ -1845,6 +2135,60 @@ struct cras_fmt_conv *audio_thread_get_global_remix_converter()
 	return remix_converter;
 }
 
+static void audio_thread_close_fds(struct audio_thread *thread)
+{
+	if (thread->to_thread_fds[0] != -1) {
+		close(thread->to_thread_fds[0]);
+		close(thread->to_thread_fds[1]);
+	}
+	if (thread->to_main_fds[0] != -1) {
+		close(thread->to_main_fds[0]);
+		close(thread->to_main_fds[1]);
+	}
+	if (wake_timer_fd >= 0) {
+		close(wake_timer_fd);
+		wake_timer_fd = -1;
+	}
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
+
+/* Creates the epoll set and wake timer, and adds the message pipe, the timer
+ * and any callback registered before the thread was created to the set. */
+static int audio_thread_init_epoll(struct audio_thread *thread)
+{
+	struct iodev_callback_list *iodev_cb;
+	int rc;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		return -errno;
+
+	wake_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wake_timer_fd < 0)
+		return -errno;
+
+	rc = thread_epoll_ctl(EPOLL_CTL_ADD, thread->to_thread_fds[0],
+			      EPOLLIN);
+	if (rc)
+		return rc;
+
+	rc = thread_epoll_ctl(EPOLL_CTL_ADD, wake_timer_fd, EPOLLIN);
+	if (rc)
+		return rc;
+
+	DL_FOREACH(iodev_callbacks, iodev_cb) {
+		rc = update_callback_fd(iodev_cb->fd);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
 struct audio_thread *audio_thread_create()
 {
 	int rc;
@@ -1873,6 +2217,13 @@ struct audio_thread *audio_thread_create()
 		return NULL;
 	}
 
+	if (audio_thread_init_epoll(thread)) {
+		syslog(LOG_ERR, "Failed to set up audio thread epoll");
+		audio_thread_close_fds(thread);
+		free(thread);
+		return NULL;
+	}
+
 	atlog = audio_thread_event_log_init();
 
 	return thread;
@@ -1949,14 +2300,7 @@ void audio_thread_destroy(struct audio_thread *thread)
 		pthread_join(thread->tid, NULL);
 	}
 
-	if (thread->to_thread_fds[0] != -1) {
-		close(thread->to_thread_fds[0]);
-		close(thread->to_thread_fds[1]);
-	}
-	if (thread->to_main_fds[0] != -1) {
-		close(thread->to_main_fds[0]);
-		close(thread->to_main_fds[1]);
-	}
+	audio_thread_close_fds(thread);
 
 	if (remix_converter)
 		cras_fmt_conv_destroy(remix_converter);
@@ -11,6 +11,7 @@
 
 #include "cras_iodev.h"
 #include "cras_types.h"
+#include "latency_hist.h"
 
 struct buffer_share;
 struct cras_iodev;
@@ -39,6 +40,8 @@ struct open_dev {
  *    started - Non-zero if the thread has started successfully.
  *    suspended - Non-zero if the thread is suspended.
  *    open_devs - Lists of open input and output devices.
+ *    wake_jitter_hist - How late the thread woke up on its timer, compared
+ *        to the time it scheduled.
  */
 struct audio_thread {
 	int to_thread_fds[2];
@@ -47,7 +50,7 @@ struct audio_thread {
 	int started;
 	int suspended;
 	struct open_dev *open_devs[CRAS_NUM_DIRECTIONS];
-
+	struct latency_hist wake_jitter_hist;
 };
 
 /* Callback function to be handled in main loop in audio thread.
@@ -172,6 +175,21 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info);
 
+/* Starts the continuous trace of the audio thread events. Events are written
+ * with a cpu counter time stamp to a ring in a memfd that clients can map,
+ * instead of to the event log. audio_thread_dump_thread_info() keeps working
+ * from the newest events of the trace. Called once by the main thread, before
+ * the audio thread is created.
+ * Returns:
+ *    0 on success, negative error code if the memfd can't be set up.
+ */
+int audio_thread_trace_enable();
+
+/* Returns an fd of the trace memfd opened read only, or -1 if the trace
+ * isn't enabled. The memfd is sealed against other writers where the kernel
+ * supports it. The fd is owned by the audio thread code, don't close it. */
+int audio_thread_trace_get_fd();
+
 /* Configures the global converter for output remixing. Called by main
  * thread. */
 int audio_thread_config_global_remix(struct audio_thread *thread,
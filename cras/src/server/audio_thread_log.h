@@ -11,6 +11,7 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include "cras_audio_thread_trace.h"
 #include "cras_types.h"
 
 #define AUDIO_THREAD_LOGGING	1
@@ -23,6 +24,9 @@
 #endif
 
 extern struct audio_thread_event_log *atlog;
+/* The continuous trace, NULL unless audio_thread_trace_enable() was called.
+ * While it is set events go to the trace instead of atlog. */
+extern struct audio_thread_trace *attrace;
 
 static inline
 struct audio_thread_event_log *audio_thread_event_log_init()
@@ -41,6 +45,46 @@ void audio_thread_event_log_deinit(struct audio_thread_event_log *log)
 	free(log);
 }
 
+/* Reads the cpu counter used to time stamp the trace, cheaper than
+ * clock_gettime(). Falls back to CLOCK_MONOTONIC_RAW in nanoseconds where
+ * there is no usable counter. */
+static inline uint64_t audio_thread_trace_read_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/* Appends an event to the trace, see struct audio_thread_trace. */
+static inline void audio_thread_trace_data(
+		struct audio_thread_trace *trace,
+		enum AUDIO_THREAD_LOG_EVENTS event,
+		uint32_t data1,
+		uint32_t data2,
+		uint32_t data3)
+{
+	uint64_t count = trace->write_count;
+	struct audio_thread_trace_event *e =
+		&trace->events[count & (AUDIO_THREAD_TRACE_SIZE - 1)];
+
+	e->ticks = audio_thread_trace_read_ticks();
+	e->tag = event;
+	e->data1 = data1;
+	e->data2 = data2;
+	e->data3 = data3;
+	__atomic_store_n(&trace->write_count, count + 1, __ATOMIC_RELEASE);
+}
+
 /* Log a tag and the current time, Uses two words, the first is split
  * 8 bits for tag and 24 for seconds, second word is micro seconds.
  */
@@ -53,6 +97,11 @@ static inline void audio_thread_event_log_data(
 {
 	struct timespec now;
 
+	if (attrace) {
+		audio_thread_trace_data(attrace, event, data1, data2, data3);
+		return;
+	}
+
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	log->log[log->write_pos].tag_sec =
 			(event << 24) | (now.tv_sec & 0x00ffffff);
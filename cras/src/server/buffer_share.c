@@ -163,6 +163,20 @@ unsigned int buffer_share_id_offset(const struct buffer_share *mix,
 	return o ? o->offset : 0;
 }
 
+unsigned int buffer_share_max_offset(const struct buffer_share *mix)
+{
+	unsigned int max_offset = 0;
+	unsigned int i;
+
+	for (i = 0; i < mix->id_sz; i++) {
+		const struct id_offset *o = &mix->wr_idx[i];
+
+		if (o->used)
+			max_offset = MAX(max_offset, o->offset);
+	}
+	return max_offset;
+}
+
 void *buffer_share_get_data(const struct buffer_share *mix,
 			    unsigned int id)
 {
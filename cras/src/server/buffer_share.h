@@ -53,6 +53,12 @@ unsigned int buffer_share_get_new_write_point(struct buffer_share *mix);
 unsigned int buffer_share_id_offset(const struct buffer_share *mix,
 				    unsigned int id);
 
+/*
+ * The amount by which the user furthest ahead is ahead of the current write
+ * point.  Nothing has been written past this offset yet.
+ */
+unsigned int buffer_share_max_offset(const struct buffer_share *mix);
+
 /*
  * Gets the data pointer for given id.
  */
@@ -7,11 +7,15 @@
 #include <signal.h>
 #include <syslog.h>
 
+#include "audio_thread.h"
 #include "cras_config.h"
 #include "cras_iodev_list.h"
+#include "cras_observer.h"
 #include "cras_server.h"
 #include "cras_system_state.h"
+#include "cras_util.h"
 #include "cras_dsp.h"
+#include "drc.h"
 
 static struct option long_options[] = {
 	{"dsp_config", required_argument, 0, 'd'},
@@ -19,6 +23,9 @@ static struct option long_options[] = {
 	{"device_config_dir", required_argument, 0, 'c'},
 	{"disable_profile", required_argument, 0, 'D'},
 	{"internal_ucm_suffix", required_argument, 0, 'u'},
+	{"drc_workers", no_argument, 0, 'w'},
+	{"trace_audio_thread", no_argument, 0, 't'},
+	{"volume_notify_interval_ms", required_argument, 0, 'n'},
 	{0, 0, 0, 0}
 };
 
@@ -39,6 +46,10 @@ int main(int argc, char **argv)
 	const char *device_config_dir = CRAS_CONFIG_FILE_DIR;
 	const char *internal_ucm_suffix = NULL;
 	unsigned int profile_disable_mask = 0;
+	int drc_workers = 0;
+	int rc;
+	int trace_audio_thread = 0;
+	unsigned int volume_notify_interval_ms = 0;
 
 	set_signals();
 
@@ -87,6 +98,18 @@ int main(int argc, char **argv)
 			if (*optarg != 0)
 				internal_ucm_suffix = optarg;
 			break;
+		/* Run the DRC bands concurrently on multi-core systems. */
+		case 'w':
+			drc_workers = 1;
+			break;
+		/* Log audio thread events to a trace clients can map. */
+		case 't':
+			trace_audio_thread = 1;
+			break;
+		/* Rate limit volume and gain notifications to observers. */
+		case 'n':
+			volume_notify_interval_ms = atoi(optarg);
+			break;
 		default:
 			break;
 		}
@@ -108,10 +131,23 @@ int main(int argc, char **argv)
 
 	/* Initialize system. */
 	cras_server_init();
+	cras_observer_set_volume_notify_interval(volume_notify_interval_ms);
 	cras_system_state_init(device_config_dir);
 	if (internal_ucm_suffix)
 		cras_system_state_set_internal_ucm_suffix(internal_ucm_suffix);
 	cras_dsp_init(dsp_config);
+	/* The workers only help if they run at the priority of the audio
+	 * thread, which sets the same limit for itself. Otherwise the DRC
+	 * bands are processed serially. */
+	if (drc_workers) {
+		rc = cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY);
+		if (rc == 0)
+			rc = drc_workers_start(CRAS_SERVER_RT_THREAD_PRIORITY);
+		if (rc < 0)
+			syslog(LOG_ERR, "Failed to start DRC workers: %d", rc);
+	}
+	if (trace_audio_thread && audio_thread_trace_enable() < 0)
+		syslog(LOG_ERR, "Failed to enable audio thread trace");
 	cras_iodev_list_init();
 
 	/* Start the server. */
@@ -7,8 +7,10 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "cras_alert.h"
+#include "cras_util.h"
 #include "utlist.h"
 
 /* A list of callbacks for an alert */
@@ -25,9 +27,16 @@ struct cras_alert_data {
 	char buf[];
 };
 
+/* An alert.
+ *    min_interval - Minimum time between two runs of the callbacks, zero
+ *        for no limit.
+ *    last_run - When the callbacks last ran.
+ */
 struct cras_alert {
 	int pending;
 	unsigned int flags;
+	struct timespec min_interval;
+	struct timespec last_run;
 	cras_alert_prepare prepare;
 	struct cras_alert_cb_list *callbacks;
 	struct cras_alert_data *data;
@@ -38,6 +47,8 @@ struct cras_alert {
 static struct cras_alert *all_alerts;
 /* If there is any alert pending. */
 static int has_alert_pending;
+/* If an alert is pending but waiting for its minimum interval. */
+static int has_alert_deferred;
 
 struct cras_alert *cras_alert_create(cras_alert_prepare prepare,
 				     unsigned int flags)
@@ -87,15 +98,38 @@ int cras_alert_rm_callback(struct cras_alert *alert, cras_alert_cb cb,
 	return -ENOENT;
 }
 
+void cras_alert_set_min_interval(struct cras_alert *alert, unsigned int ms)
+{
+	ms_to_timespec(ms, &alert->min_interval);
+}
+
+/* Gets the time when a rate limited alert can run next. Returns 0 if the
+ * alert isn't limited. */
+static int alert_next_run(const struct cras_alert *alert,
+			  struct timespec *next)
+{
+	if (!alert->min_interval.tv_sec && !alert->min_interval.tv_nsec)
+		return 0;
+	*next = alert->last_run;
+	add_timespecs(next, &alert->min_interval);
+	return 1;
+}
+
 /* Checks if the alert is pending, and invoke the prepare function and callbacks
- * if so. */
-static void cras_alert_process(struct cras_alert *alert)
+ * if so. Returns 1 if the alert stays pending because it ran too recently. */
+static int cras_alert_process(struct cras_alert *alert)
 {
 	struct cras_alert_cb_list *cb;
 	struct cras_alert_data *data;
+	struct timespec now, next;
 
 	if (!alert->pending)
-		return;
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (alert_next_run(alert, &next) && timespec_after(&next, &now))
+		return 1;
+	alert->last_run = now;
 
 	alert->pending = 0;
 	if (alert->prepare)
@@ -113,6 +147,7 @@ static void cras_alert_process(struct cras_alert *alert)
 		DL_DELETE(alert->data, data);
 		free(data);
 	}
+	return 0;
 }
 
 void cras_alert_pending(struct cras_alert *alert)
@@ -145,12 +180,47 @@ void cras_alert_pending_data(struct cras_alert *alert,
 void cras_alert_process_all_pending_alerts()
 {
 	struct cras_alert *alert;
+	int deferred = 0;
+
+	/* Alerts deferred earlier may be due now. */
+	if (has_alert_deferred)
+		has_alert_pending = 1;
 
 	while (has_alert_pending) {
 		has_alert_pending = 0;
+		deferred = 0;
 		DL_FOREACH(all_alerts, alert)
-			cras_alert_process(alert);
+			deferred |= cras_alert_process(alert);
+	}
+	has_alert_deferred = deferred;
+}
+
+int cras_alert_get_next_timeout(struct timespec *ts)
+{
+	struct cras_alert *alert;
+	struct timespec now, next;
+	struct timespec min = { 0, 0 };
+	int found = 0;
+
+	if (!has_alert_deferred)
+		return 0;
+
+	DL_FOREACH(all_alerts, alert) {
+		if (!alert->pending || !alert_next_run(alert, &next))
+			continue;
+		if (!found || timespec_after(&min, &next))
+			min = next;
+		found = 1;
 	}
+	if (!found)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (timespec_after(&min, &now))
+		subtract_timespecs(&min, &now, ts);
+	else
+		ts->tv_sec = ts->tv_nsec = 0;
+	return 1;
 }
 
 void cras_alert_destroy(struct cras_alert *alert)
@@ -6,6 +6,8 @@
 #ifndef _CRAS_ALERT_H
 #define _CRAS_ALERT_H
 
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -105,6 +107,16 @@ void cras_alert_pending(struct cras_alert *alert);
 void cras_alert_pending_data(struct cras_alert *alert,
 			     void *data, size_t data_size);
 
+/* Limits how often the callbacks of an alert run. An alert that becomes
+ * pending sooner than ms after its last run is held until the interval has
+ * passed, keeping its data like any pending alert. Only the last data is kept
+ * unless the alert was created with CRAS_ALERT_FLAG_KEEP_ALL_DATA.
+ * Args:
+ *    alert - A pointer to the alert.
+ *    ms - The minimum interval in milliseconds, 0 to remove the limit.
+ */
+void cras_alert_set_min_interval(struct cras_alert *alert, unsigned int ms);
+
 /* Processes all alerts that are pending.
  *
  * For all pending alerts, its prepare function will be called, then the
@@ -113,6 +125,14 @@ void cras_alert_pending_data(struct cras_alert *alert,
  */
 void cras_alert_process_all_pending_alerts();
 
+/* Gets the time until an alert held by its minimum interval can run.
+ * Args:
+ *    ts - Filled with the time to wait, zero if it is already due.
+ * Returns:
+ *    1 if an alert is held, 0 otherwise.
+ */
+int cras_alert_get_next_timeout(struct timespec *ts);
+
 /* Frees the resources used by an alert.
  * Args:
  *    alert - A pointer to the alert.
@@ -1005,6 +1005,14 @@ static int no_create_default_output_node(struct alsa_io *aio)
 	return result;
 }
 
+static int enable_float_mix(struct alsa_io *aio)
+{
+	int result;
+	if (get_ucm_flag_integer(aio, "EnableFloatMix", &result))
+		return 0;
+	return result;
+}
+
 static void set_output_node_software_volume_needed(
 	struct alsa_output_node *output, struct alsa_io *aio)
 {
@@ -1914,6 +1922,9 @@ struct cras_iodev *alsa_iodev_create(size_t card_index,
 
 		aio->enable_htimestamp =
 			ucm_get_enable_htimestamp_flag(ucm);
+
+		if (direction == CRAS_STREAM_OUTPUT)
+			iodev->float_mix_enabled = enable_float_mix(aio);
 	}
 
 	set_iodev_name(iodev, card_name, dev_name, card_index, device_index,
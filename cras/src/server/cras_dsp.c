@@ -3,15 +3,34 @@
  * found in the LICENSE file.
  */
 
-#include <pthread.h>
+#include <string.h>
+#include <sys/param.h>
 #include <syslog.h>
 #include "dumper.h"
 #include "cras_expr.h"
+#include "cras_types.h"
 #include "cras_dsp_ini.h"
 #include "cras_dsp_pipeline.h"
+#include "cras_system_state.h"
+#include "cras_tm.h"
 #include "dsp_util.h"
 #include "utlist.h"
 
+/* Length of the crossfade from the old to the new pipeline after a reload. */
+#define DSP_CROSSFADE_MS 10
+
+/* Number of frames crossfaded at a time. */
+#define DSP_CROSSFADE_CHUNK 256
+
+/* How often to retry freeing pipelines replaced by a reload. */
+#define DSP_RECLAIM_MS 20
+
+/* A pipeline replaced by a reload, waiting to be freed. */
+struct retired_pipeline {
+	struct pipeline *pipeline;
+	struct retired_pipeline *next;
+};
+
 /* We have a dsp_context for each pipeline. The context records the
  * parameters used to create a pipeline, so the pipeline can be
  * (re-)loaded later. The pipeline is (re-)loaded in the following
@@ -20,14 +39,38 @@
  * (1) The client asks to (re-)load it with cras_load_pipeline().
  * (2) The client asks to reload the ini with cras_reload_ini().
  *
- * The pipeline is (re-)loaded asynchronously in an internal thread,
- * so the client needs to use cras_dsp_get_pipeline() and
- * cras_dsp_put_pipeline() to safely access the pipeline.
+ * The pipeline is (re-)loaded in the main thread and published to the
+ * audio thread with an atomic pointer swap, so the audio thread never
+ * waits for a reload. The audio thread marks the time it uses a pipeline
+ * by counting itself in readers, see cras_dsp_get_pipeline() and
+ * cras_dsp_apply(). A replaced pipeline is kept on the retired list until
+ * the main thread sees no reader that could still hold it, then freed. The
+ * audio thread keeps running the replaced pipeline for DSP_CROSSFADE_MS
+ * after a swap and crossfades its output into the new one.
  */
 struct cras_dsp_context {
-	pthread_mutex_t mutex;
+	/* The pipeline published by the main thread. */
 	struct pipeline *pipeline;
 
+	/* The number of threads using a pipeline from this context. */
+	int readers;
+
+	/* Pipelines replaced by a reload, only touched by the main thread. */
+	struct retired_pipeline *retired;
+	struct cras_timer *reclaim_timer;
+
+	/* Owned by the audio thread, read by the main thread to know which
+	 * retired pipelines are still in use. running is the pipeline the
+	 * last cras_dsp_apply() call used and fading the one it is fading
+	 * out, if any. Both are cleared by cras_dsp_context_idle() once the
+	 * device stops applying the DSP. */
+	struct pipeline *running;
+	struct pipeline *fading;
+	int applied;
+	int fade_pos;
+	int fade_frames;
+	float fade_buf[DSP_CROSSFADE_CHUNK * CRAS_CH_MAX];
+
 	struct cras_expr_env env;
 	int sample_rate;
 	const char *purpose;
@@ -90,20 +133,68 @@ bail:
 	return NULL;
 }
 
+/* Frees the retired pipelines the audio thread can no longer use. Returns
+ * the number of pipelines still waiting. */
+static int reclaim_pipelines(struct cras_dsp_context *ctx)
+{
+	struct retired_pipeline *r, *tmp;
+	struct pipeline *running, *fading;
+	int waiting = 0;
+
+	if (!ctx->retired)
+		return 0;
+
+	/* With no reader, a reader entering later loads the current pipeline
+	 * and can only reach a retired one through running. It stores fading
+	 * before running, so load them in the opposite order. */
+	if (__atomic_load_n(&ctx->readers, __ATOMIC_SEQ_CST))
+		return 1;
+	running = __atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE);
+	fading = __atomic_load_n(&ctx->fading, __ATOMIC_ACQUIRE);
+
+	LL_FOREACH_SAFE(ctx->retired, r, tmp) {
+		if (r->pipeline == running || r->pipeline == fading) {
+			waiting++;
+			continue;
+		}
+		LL_DELETE(ctx->retired, r);
+		cras_dsp_pipeline_free(r->pipeline);
+		free(r);
+	}
+	return waiting;
+}
+
+static void reclaim_timeout(struct cras_timer *timer, void *arg)
+{
+	struct cras_dsp_context *ctx = (struct cras_dsp_context *)arg;
+
+	ctx->reclaim_timer = NULL;
+	if (reclaim_pipelines(ctx))
+		ctx->reclaim_timer = cras_tm_create_timer(
+			cras_system_state_get_tm(), DSP_RECLAIM_MS,
+			reclaim_timeout, ctx);
+}
+
 static void cmd_load_pipeline(struct cras_dsp_context *ctx)
 {
 	struct pipeline *pipeline, *old_pipeline;
+	struct retired_pipeline *r;
 
 	pipeline = prepare_pipeline(ctx);
 
-	/* This locking is short to avoild blocking audio thread. */
-	pthread_mutex_lock(&ctx->mutex);
-	old_pipeline = ctx->pipeline;
-	ctx->pipeline = pipeline;
-	pthread_mutex_unlock(&ctx->mutex);
+	/* Publish the new pipeline without blocking the audio thread. */
+	old_pipeline = __atomic_exchange_n(&ctx->pipeline, pipeline,
+					   __ATOMIC_SEQ_CST);
+	if (old_pipeline) {
+		r = calloc(1, sizeof(*r));
+		r->pipeline = old_pipeline;
+		LL_PREPEND(ctx->retired, r);
+	}
 
-	if (old_pipeline)
-		cras_dsp_pipeline_free(old_pipeline);
+	if (reclaim_pipelines(ctx) && !ctx->reclaim_timer)
+		ctx->reclaim_timer = cras_tm_create_timer(
+			cras_system_state_get_tm(), DSP_RECLAIM_MS,
+			reclaim_timeout, ctx);
 }
 
 static void cmd_reload_ini()
@@ -148,7 +239,6 @@ struct cras_dsp_context *cras_dsp_context_new(int sample_rate,
 {
 	struct cras_dsp_context *ctx = calloc(1, sizeof(*ctx));
 
-	pthread_mutex_init(&ctx->mutex, NULL);
 	initialize_environment(&ctx->env);
 	ctx->sample_rate = sample_rate;
 	ctx->purpose = strdup(purpose);
@@ -159,9 +249,18 @@ struct cras_dsp_context *cras_dsp_context_new(int sample_rate,
 
 void cras_dsp_context_free(struct cras_dsp_context *ctx)
 {
+	struct retired_pipeline *r, *tmp;
+
 	DL_DELETE(context_list, ctx);
 
-	pthread_mutex_destroy(&ctx->mutex);
+	if (ctx->reclaim_timer)
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     ctx->reclaim_timer);
+	LL_FOREACH_SAFE(ctx->retired, r, tmp) {
+		LL_DELETE(ctx->retired, r);
+		cras_dsp_pipeline_free(r->pipeline);
+		free(r);
+	}
 	if (ctx->pipeline) {
 		cras_dsp_pipeline_free(ctx->pipeline);
 		ctx->pipeline = NULL;
@@ -189,19 +288,232 @@ void cras_dsp_load_pipeline(struct cras_dsp_context *ctx)
 	cmd_load_pipeline(ctx);
 }
 
+static inline void reader_enter(struct cras_dsp_context *ctx)
+{
+	__atomic_add_fetch(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void reader_exit(struct cras_dsp_context *ctx)
+{
+	__atomic_sub_fetch(&ctx->readers, 1, __ATOMIC_RELEASE);
+}
+
 struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx)
 {
-	pthread_mutex_lock(&ctx->mutex);
-	if (!ctx->pipeline) {
-		pthread_mutex_unlock(&ctx->mutex);
-		return NULL;
-	}
-	return ctx->pipeline;
+	struct pipeline *pipeline;
+
+	reader_enter(ctx);
+	pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (!pipeline)
+		reader_exit(ctx);
+	return pipeline;
 }
 
 void cras_dsp_put_pipeline(struct cras_dsp_context *ctx)
 {
-	pthread_mutex_unlock(&ctx->mutex);
+	reader_exit(ctx);
+}
+
+/* Checks if the output of two pipelines can be mixed. A NULL pipeline passes
+ * the samples through and matches any pipeline with as many outputs as
+ * inputs. */
+static int can_crossfade(struct pipeline *from, struct pipeline *to)
+{
+	int from_in, from_out, to_in, to_out;
+
+	if (!from && !to)
+		return 0;
+	from_in = from ? cras_dsp_pipeline_get_num_input_channels(from) :
+		cras_dsp_pipeline_get_num_input_channels(to);
+	from_out = from ? cras_dsp_pipeline_get_num_output_channels(from) :
+		from_in;
+	to_in = to ? cras_dsp_pipeline_get_num_input_channels(to) : from_in;
+	to_out = to ? cras_dsp_pipeline_get_num_output_channels(to) : to_in;
+	return from_in == to_in && from_out == to_out &&
+	       from_in == from_out && from_in <= CRAS_CH_MAX;
+}
+
+/* Picks up the pipeline published by the main thread. If it changed since
+ * the last call, starts fading out the previous one. */
+static void update_running(struct cras_dsp_context *ctx)
+{
+	struct pipeline *pipeline;
+
+	pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (pipeline == ctx->running)
+		return;
+
+	ctx->fade_pos = 0;
+	ctx->fade_frames = ctx->sample_rate * DSP_CROSSFADE_MS / 1000;
+	if (ctx->applied && ctx->fade_frames > 0 &&
+	    can_crossfade(ctx->running, pipeline)) {
+		__atomic_store_n(&ctx->fading, ctx->running, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&ctx->fading, NULL, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&ctx->running, pipeline, __ATOMIC_RELEASE);
+}
+
+/* Returns the gain of the new pipeline for the frame at pos in the fade. */
+static inline float fade_gain(const struct cras_dsp_context *ctx, int pos)
+{
+	return (float)pos / ctx->fade_frames;
+}
+
+static void crossfade_samples(const struct cras_dsp_context *ctx,
+			      uint8_t *buf, const uint8_t *old,
+			      snd_pcm_format_t format, int channels,
+			      int frames)
+{
+	int i, c;
+
+	for (i = 0; i < frames; i++) {
+		float g = fade_gain(ctx, ctx->fade_pos + i);
+		int k = i * channels;
+
+		for (c = 0; c < channels; c++, k++) {
+			if (format == SND_PCM_FORMAT_S16_LE) {
+				int16_t *n = (int16_t *)buf;
+				const int16_t *o = (const int16_t *)old;
+				n[k] = o[k] + (n[k] - o[k]) * g;
+			} else {
+				int32_t *n = (int32_t *)buf;
+				const int32_t *o = (const int32_t *)old;
+				int32_t a = o[k], b = n[k];
+				if (format == SND_PCM_FORMAT_S24_LE) {
+					a = (int32_t)((uint32_t)a << 8) >> 8;
+					b = (int32_t)((uint32_t)b << 8) >> 8;
+				}
+				n[k] = a + ((double)b - a) * g;
+			}
+		}
+	}
+}
+
+static void crossfade_float(const struct cras_dsp_context *ctx, float *buf,
+			    const float *old, int channels, int frames)
+{
+	int i, c;
+
+	for (i = 0; i < frames; i++) {
+		float g = fade_gain(ctx, ctx->fade_pos + i);
+		int k = i * channels;
+
+		for (c = 0; c < channels; c++, k++)
+			buf[k] = old[k] + (buf[k] - old[k]) * g;
+	}
+}
+
+/* Runs the fading and the running pipelines over up to DSP_CROSSFADE_CHUNK
+ * frames and mixes their outputs. Returns the number of frames done. */
+static int apply_crossfade(struct cras_dsp_context *ctx, uint8_t *buf,
+			   snd_pcm_format_t format, int frames)
+{
+	struct pipeline *pipeline = ctx->running ? ctx->running : ctx->fading;
+	int channels = cras_dsp_pipeline_get_num_input_channels(pipeline);
+	int sample_bytes = format == SND_PCM_FORMAT_S16_LE ? 2 : 4;
+	uint8_t *old = (uint8_t *)ctx->fade_buf;
+
+	frames = MIN(frames, DSP_CROSSFADE_CHUNK);
+	frames = MIN(frames, ctx->fade_frames - ctx->fade_pos);
+
+	memcpy(old, buf, frames * channels * sample_bytes);
+	if (ctx->fading) {
+		if (format == SND_PCM_FORMAT_FLOAT_LE)
+			cras_dsp_pipeline_apply_float(ctx->fading,
+						      (float *)old, frames);
+		else
+			cras_dsp_pipeline_apply(ctx->fading, old, format,
+						frames);
+	}
+	if (ctx->running) {
+		if (format == SND_PCM_FORMAT_FLOAT_LE)
+			cras_dsp_pipeline_apply_float(ctx->running,
+						      (float *)buf, frames);
+		else
+			cras_dsp_pipeline_apply(ctx->running, buf, format,
+						frames);
+	}
+
+	if (format == SND_PCM_FORMAT_FLOAT_LE)
+		crossfade_float(ctx, (float *)buf, (const float *)old,
+				channels, frames);
+	else
+		crossfade_samples(ctx, buf, old, format, channels, frames);
+
+	ctx->fade_pos += frames;
+	if (ctx->fade_pos >= ctx->fade_frames)
+		__atomic_store_n(&ctx->fading, NULL, __ATOMIC_RELEASE);
+	return frames;
+}
+
+static void apply(struct cras_dsp_context *ctx, uint8_t *buf,
+		  snd_pcm_format_t format, unsigned int frames)
+{
+	int sample_bytes, channels, done;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		sample_bytes = 2;
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_FLOAT_LE:
+		sample_bytes = 4;
+		break;
+	default:
+		return;
+	}
+
+	reader_enter(ctx);
+	update_running(ctx);
+
+	while (ctx->fading && frames) {
+		channels = cras_dsp_pipeline_get_num_output_channels(
+			ctx->running ? ctx->running : ctx->fading);
+		done = apply_crossfade(ctx, buf, format, frames);
+		buf += done * channels * sample_bytes;
+		frames -= done;
+	}
+
+	if (ctx->running && frames) {
+		if (format == SND_PCM_FORMAT_FLOAT_LE)
+			cras_dsp_pipeline_apply_float(ctx->running,
+						      (float *)buf, frames);
+		else
+			cras_dsp_pipeline_apply(ctx->running, buf, format,
+						frames);
+	}
+	ctx->applied = 1;
+	reader_exit(ctx);
+}
+
+void cras_dsp_apply(struct cras_dsp_context *ctx, uint8_t *buf,
+		    snd_pcm_format_t format, unsigned int frames)
+{
+	if (format == SND_PCM_FORMAT_FLOAT_LE)
+		return;
+	apply(ctx, buf, format, frames);
+}
+
+void cras_dsp_apply_float(struct cras_dsp_context *ctx, float *buf,
+			  unsigned int frames)
+{
+	apply(ctx, (uint8_t *)buf, SND_PCM_FORMAT_FLOAT_LE, frames);
+}
+
+void cras_dsp_context_idle(struct cras_dsp_context *ctx)
+{
+	__atomic_store_n(&ctx->fading, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&ctx->running, NULL, __ATOMIC_RELEASE);
+	ctx->applied = 0;
+
+	/* Nothing pins the retired pipelines anymore. */
+	if (reclaim_pipelines(ctx) == 0 && ctx->reclaim_timer) {
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     ctx->reclaim_timer);
+		ctx->reclaim_timer = NULL;
+	}
 }
 
 void cras_dsp_reload_ini()
@@ -224,12 +536,29 @@ void cras_dsp_dump_info()
 	}
 }
 
+void cras_dsp_get_debug_info(struct dsp_debug_info *info)
+{
+	struct cras_dsp_context *ctx;
+
+	/* The instances are only timed from the first request on. */
+	cras_dsp_pipeline_set_profile_instances(1);
+
+	info->num_pipelines = 0;
+	info->num_instances = 0;
+	DL_FOREACH(context_list, ctx) {
+		if (ctx->pipeline)
+			cras_dsp_pipeline_get_debug_info(ctx->pipeline, info);
+	}
+}
+
 unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context *ctx)
 {
-	return cras_dsp_pipeline_get_num_output_channels(ctx->pipeline);
+	return cras_dsp_pipeline_get_num_output_channels(
+		__atomic_load_n(&ctx->pipeline, __ATOMIC_ACQUIRE));
 }
 
 unsigned int cras_dsp_num_input_channels(const struct cras_dsp_context *ctx)
 {
-	return cras_dsp_pipeline_get_num_input_channels(ctx->pipeline);
+	return cras_dsp_pipeline_get_num_input_channels(
+		__atomic_load_n(&ctx->pipeline, __ATOMIC_ACQUIRE));
 }
@@ -26,8 +26,8 @@ void cras_dsp_stop();
 
 /* Creates a dsp context. The context holds a pipeline and its
  * parameters.  To use the pipeline in the context, first use
- * cras_dsp_load_pipeline() to load it and then use
- * cras_dsp_get_pipeline() to lock it for access.
+ * cras_dsp_load_pipeline() to load it and then use cras_dsp_apply()
+ * to run it, or cras_dsp_get_pipeline() to access it.
  * Args:
  *    sample_rate - The sampling rate of the pipeline.
  *    purpose - The purpose of the pipeline, "playback" or "capture".
@@ -50,12 +50,15 @@ void cras_dsp_set_variable_boolean(struct cras_dsp_context *ctx, const char *key
 
 /* Loads the pipeline to the context. This should be called again when
  * new values of configuration variables may change the plugin
- * graph. The actual loading happens in another thread to avoid
- * blocking the audio thread. */
+ * graph. The new pipeline is published without blocking the audio
+ * thread, which crossfades from the old one in cras_dsp_apply(). The
+ * old pipeline is freed once the audio thread stops using it. */
 void cras_dsp_load_pipeline(struct cras_dsp_context *ctx);
 
-/* Locks the pipeline in the context for access. Returns NULL if the
- * pipeline is still being loaded or cannot be loaded. */
+/* Marks the caller as using the pipeline in the context and returns it, so
+ * it isn't freed by a reload until cras_dsp_put_pipeline(). Never blocks.
+ * Returns NULL if the pipeline is still being loaded or cannot be loaded,
+ * in which case cras_dsp_put_pipeline() must not be called. */
 struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx);
 
 /* Releases the pipeline in the context. This must be called in pair
@@ -64,12 +67,42 @@ struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx);
  * cras_dsp_get_pipeline() was called. */
 void cras_dsp_put_pipeline(struct cras_dsp_context *ctx);
 
+/* Runs the pipeline in the context over frames of interleaved samples in
+ * buf, in place. After a reload the output is crossfaded from the old to
+ * the new pipeline. Must be called from a single thread, the audio thread.
+ * Args:
+ *    ctx - The dsp context.
+ *    buf - The samples to process.
+ *    format - The sample format, S16_LE, S24_LE or S32_LE.
+ *    frames - The number of frames in buf.
+ */
+void cras_dsp_apply(struct cras_dsp_context *ctx, uint8_t *buf,
+		    snd_pcm_format_t format, unsigned int frames);
+
+/* Same as cras_dsp_apply(), for interleaved float samples. */
+void cras_dsp_apply_float(struct cras_dsp_context *ctx, float *buf,
+			  unsigned int frames);
+
+/* Tells the context the device no longer applies its DSP, e.g. because it
+ * was closed. Forgets the pipelines the last cras_dsp_apply() call ran so a
+ * reload can free them at once. Must not be called while cras_dsp_apply()
+ * may run. The next cras_dsp_apply() starts without a crossfade. */
+void cras_dsp_context_idle(struct cras_dsp_context *ctx);
+
 /* Re-reads the ini file and reloads all pipelines in the system. */
 void cras_dsp_reload_ini();
 
 /* Dump current dsp information to syslog. */
 void cras_dsp_dump_info();
 
+/* Fills info with the profile of all the loaded pipelines. Must be called
+ * from the main thread, where pipelines are (re-)loaded. The first call turns
+ * on the profile of each instance, which only shows up from the next call.
+ * Args:
+ *    info - The debug info to fill.
+ */
+void cras_dsp_get_debug_info(struct dsp_debug_info *info);
+
 /* Number of channels output. */
 unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context *ctx);
 
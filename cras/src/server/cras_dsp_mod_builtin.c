@@ -5,10 +5,12 @@
 
 #include <stdlib.h>
 #include "cras_dsp_module.h"
+#include "crossovern.h"
 #include "drc.h"
 #include "dsp_util.h"
 #include "eq.h"
 #include "eq2.h"
+#include "eqn.h"
 
 /*
  *  empty module functions (for source and sink)
@@ -38,6 +40,11 @@ static void empty_free_module(struct dsp_module *module)
 
 static int empty_get_properties(struct dsp_module *module) { return 0; }
 
+static int noop_get_properties(struct dsp_module *module)
+{
+	return MODULE_NOOP;
+}
+
 static void empty_dump(struct dsp_module *module, struct dumper *d)
 {
 	dumpf(d, "built-in module\n");
@@ -51,7 +58,7 @@ static void empty_init_module(struct dsp_module *module)
 	module->run = &empty_run;
 	module->deinstantiate = &empty_deinstantiate;
 	module->free_module = &empty_free_module;
-	module->get_properties = &empty_get_properties;
+	module->get_properties = &noop_get_properties;
 	module->dump = &empty_dump;
 }
 
@@ -356,6 +363,184 @@ static void eq2_init_module(struct dsp_module *module)
 	module->dump = &empty_dump;
 }
 
+/*
+ *  Helpers for the N channel modules. The number of channels is the number of
+ *  audio input ports given in the ini file, so these modules allocate their
+ *  data when they are loaded, like the ladspa modules do.
+ */
+struct nch_data {
+	int sample_rate;
+	int num_channels;
+	int num_ports;
+	void *filter;  /* Initialized in the first call of run() */
+	float **ports;
+};
+
+static struct nch_data *nch_data_new(struct plugin *plugin)
+{
+	struct nch_data *data;
+	struct port *port;
+	int i;
+
+	data = calloc(1, sizeof(*data));
+	if (!data)
+		return NULL;
+	FOR_ARRAY_ELEMENT(&plugin->ports, i, port) {
+		if (port->direction == PORT_INPUT && port->type == PORT_AUDIO)
+			data->num_channels++;
+	}
+	data->num_ports = ARRAY_COUNT(&plugin->ports);
+	data->ports = calloc(data->num_ports, sizeof(*data->ports));
+	if (!data->ports) {
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+static int nch_instantiate(struct dsp_module *module,
+			   unsigned long sample_rate)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	data->sample_rate = (int) sample_rate;
+	return 0;
+}
+
+static void nch_connect_port(struct dsp_module *module,
+			     unsigned long port, float *data_location)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	if (port < (unsigned long) data->num_ports)
+		data->ports[port] = data_location;
+}
+
+static void nch_free_module(struct dsp_module *module)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	free(data->ports);
+	free(data);
+	free(module);
+}
+
+/* Copies the first num_channels input ports to the ports from index out. */
+static void nch_copy_inputs(struct nch_data *data, int out,
+			    unsigned long sample_count)
+{
+	int i;
+	for (i = 0; i < data->num_channels; i++)
+		if (data->ports[i] != data->ports[out + i])
+			memcpy(data->ports[out + i], data->ports[i],
+			       sizeof(float) * sample_count);
+}
+
+/*
+ *  eqn module functions
+ *
+ *  The ports are N inputs, N outputs, then 4 parameters (type, freq, Q, gain)
+ *  per channel for each biquad.
+ */
+static void eqn_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	int n = data->num_channels;
+
+	nch_copy_inputs(data, n, sample_count);
+	if (!data->filter) {
+		float nyquist = data->sample_rate / 2;
+		struct eqn *eqn;
+		int i, channel;
+
+		eqn = eqn_new(n);
+		if (!eqn)
+			return;
+		data->filter = eqn;
+		for (i = 2 * n; i + 4 * n <= data->num_ports; i += 4 * n) {
+			if (!data->ports[i])
+				break;
+			for (channel = 0; channel < n; channel++) {
+				int k = i + channel * 4;
+				int type = (int) *data->ports[k];
+				float freq = *data->ports[k+1];
+				float Q = *data->ports[k+2];
+				float gain = *data->ports[k+3];
+				eqn_append_biquad(eqn, channel, type,
+						  freq / nyquist, Q, gain);
+			}
+		}
+	}
+
+	eqn_process(data->filter, &data->ports[n], (int) sample_count);
+}
+
+static void eqn_deinstantiate(struct dsp_module *module)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	if (data->filter)
+		eqn_free(data->filter);
+	data->filter = NULL;
+}
+
+static void eqn_init_module(struct dsp_module *module)
+{
+	module->instantiate = &nch_instantiate;
+	module->connect_port = &nch_connect_port;
+	module->get_delay = &empty_get_delay;
+	module->run = &eqn_run;
+	module->deinstantiate = &eqn_deinstantiate;
+	module->free_module = &nch_free_module;
+	module->get_properties = &empty_get_properties;
+	module->dump = &empty_dump;
+}
+
+/*
+ *  crossovern module functions
+ *
+ *  The ports are N inputs, N outputs for each of the low, mid and high bands,
+ *  then the two split frequencies in Hz.
+ */
+static void crossovern_run(struct dsp_module *module,
+			   unsigned long sample_count)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	int n = data->num_channels;
+
+	if (!data->filter) {
+		float nyquist = data->sample_rate / 2;
+
+		if (data->num_ports < 4 * n + 2)
+			return;
+		data->filter = crossovern_new(n,
+					      *data->ports[4 * n] / nyquist,
+					      *data->ports[4 * n + 1] / nyquist);
+		if (!data->filter)
+			return;
+	}
+
+	nch_copy_inputs(data, n, sample_count);
+	crossovern_process(data->filter, (int) sample_count, &data->ports[n],
+			   &data->ports[2 * n], &data->ports[3 * n]);
+}
+
+static void crossovern_deinstantiate(struct dsp_module *module)
+{
+	struct nch_data *data = (struct nch_data *) module->data;
+	if (data->filter)
+		crossovern_free(data->filter);
+	data->filter = NULL;
+}
+
+static void crossovern_init_module(struct dsp_module *module)
+{
+	module->instantiate = &nch_instantiate;
+	module->connect_port = &nch_connect_port;
+	module->get_delay = &empty_get_delay;
+	module->run = &crossovern_run;
+	module->deinstantiate = &crossovern_deinstantiate;
+	module->free_module = &nch_free_module;
+	module->get_properties = &empty_get_properties;
+	module->dump = &empty_dump;
+}
+
 /*
  *  drc module functions
  */
@@ -472,6 +657,15 @@ struct dsp_module *cras_dsp_module_load_builtin(struct plugin *plugin)
 		eq_init_module(module);
 	} else if (strcmp(plugin->label, "eq2") == 0) {
 		eq2_init_module(module);
+	} else if (strcmp(plugin->label, "eqn") == 0 ||
+		   strcmp(plugin->label, "crossovern") == 0) {
+		module->data = nch_data_new(plugin);
+		if (!module->data)
+			empty_init_module(module);
+		else if (strcmp(plugin->label, "eqn") == 0)
+			eqn_init_module(module);
+		else
+			crossovern_init_module(module);
 	} else if (strcmp(plugin->label, "drc") == 0) {
 		drc_init_module(module);
 	} else if (strcmp(plugin->label, "swap_lr") == 0) {
@@ -71,7 +71,8 @@ struct dsp_module {
 };
 
 enum {
-	MODULE_INPLACE_BROKEN = 1  /* See ladspa.h for explanation */
+	MODULE_INPLACE_BROKEN = 1,  /* See ladspa.h for explanation */
+	MODULE_NOOP = 2  /* run() does nothing, the pipeline can skip it */
 };
 
 struct dsp_module *cras_dsp_module_load_ladspa(struct plugin *plugin);
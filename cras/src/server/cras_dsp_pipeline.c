@@ -4,13 +4,25 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 #include <sys/param.h>
 #include <syslog.h>
 
+#include "cras_types.h"
 #include "cras_util.h"
 #include "cras_dsp_module.h"
 #include "cras_dsp_pipeline.h"
 #include "dsp_util.h"
+#include "eq.h"
+#include "eq2.h"
+
+/* The block sizes cras_dsp_pipeline_apply() chooses from are
+ * DSP_MIN_BLOCK_SIZE << i for i in [0, DSP_NUM_BLOCK_SIZES), the largest
+ * one is DSP_BUFFER_SIZE. Each of them is measured for DSP_TUNE_BLOCKS
+ * blocks before the cheapest per frame is kept. */
+#define DSP_MIN_BLOCK_SIZE 64
+#define DSP_NUM_BLOCK_SIZES 6
+#define DSP_TUNE_BLOCKS 64
 
 /* We have a static representation of the dsp graph in a "struct ini",
  * and here we will construct a dynamic representation of it in a
@@ -92,10 +104,54 @@ struct instance {
 	/* This is the total buffering delay from source to this instance. It is
 	 * in number of frames. */
 	int total_delay;
+
+	/* The time spent in the run() function of the module, in nanoseconds
+	 * of thread cpu time, and the number of calls and frames. */
+	int64_t total_time;
+	int64_t max_time;
+	int64_t total_blocks;
+	int64_t total_samples;
+
+	/* Histogram of the time of each run() call, see
+	 * DSP_PROFILE_HIST_BUCKETS. */
+	uint32_t histogram[DSP_PROFILE_HIST_BUCKETS];
 };
 
 DECLARE_ARRAY_TYPE(struct instance, instance_array)
 
+/* The kind of work done by a step of the execution plan. */
+enum plan_op {
+	/* Calls run() of the module of an instance. */
+	PLAN_RUN_MODULE,
+	/* A chain of builtin swap_lr, invert_lr and mix_stereo instances,
+	 * folded into one 2x2 matrix applied in a single pass. */
+	PLAN_MATRIX,
+	/* Two independent builtin mono eq instances, run as one eq2. */
+	PLAN_EQ2,
+};
+
+/* A step of the execution plan, see compile_plan(). */
+struct plan_step {
+	enum plan_op op;
+
+	/* The first instance this step runs for, it is charged the time the
+	 * step takes. */
+	struct instance *instance;
+
+	/* The number of instances this step runs for. */
+	int num_instances;
+
+	/* PLAN_RUN_MODULE: the module to run. */
+	struct dsp_module *module;
+
+	/* PLAN_MATRIX and PLAN_EQ2: the input and output buffers of the two
+	 * channels, and out = matrix * in for PLAN_MATRIX. */
+	float *in[2];
+	float *out[2];
+	float matrix[2][2];
+	struct eq2 *eq2;
+};
+
 /* An pipeline is a dynamic representation of a dsp ini file. */
 struct pipeline {
 	/* The purpose of the pipeline. "playback" or "capture" */
@@ -116,6 +172,11 @@ struct pipeline {
 	/* The audio data buffers */
 	float **buffers;
 
+	/* The flat list of steps cras_dsp_pipeline_run() executes, compiled
+	 * from the instances by cras_dsp_pipeline_instantiate(). */
+	struct plan_step *plan;
+	int num_plan_steps;
+
 	/* The instance where the audio data flow in */
 	struct instance *source_instance;
 
@@ -142,8 +203,28 @@ struct pipeline {
 
 	/* The total number of sample frames the pipeline processed */
 	int64_t total_samples;
+
+	/* The number of frames given to each cras_dsp_pipeline_run() call by
+	 * cras_dsp_pipeline_apply(). It starts at the smallest candidate
+	 * and is settled by the block tuner, see tune_block_size(). */
+	int block_size;
+
+	/* The candidate being measured by the block tuner, or -1 once the
+	 * block size is settled. */
+	int tune_index;
+
+	/* The number of blocks run with the current candidate. */
+	int tune_blocks;
+
+	/* The time spent and frames processed with each candidate. */
+	int64_t tune_time[DSP_NUM_BLOCK_SIZES];
+	int64_t tune_samples[DSP_NUM_BLOCK_SIZES];
 };
 
+/* Whether each instance of every pipeline is timed, see
+ * cras_dsp_pipeline_set_profile_instances(). */
+static int profile_instances;
+
 static struct instance *find_instance_by_plugin(instance_array *instances,
 						struct plugin *plugin)
 {
@@ -426,6 +507,7 @@ struct pipeline *cras_dsp_pipeline_create(struct ini *ini,
 
 	pipeline->ini = ini;
 	pipeline->purpose = purpose;
+	pipeline->block_size = DSP_MIN_BLOCK_SIZE;
 	/* create instances for needed plugins, in the order of dependency */
 	n = ARRAY_COUNT(&ini->plugins);
 	visited = calloc(1, n);
@@ -489,6 +571,36 @@ static void use_buffers(char *busy, audio_port_array *audio_ports)
 	}
 }
 
+/* Like use_buffers(), but gives the k-th output port the buffer of the k-th
+ * input port if it is free, so modules which process in place don't need to
+ * copy their input first. */
+static void use_buffers_inplace(char *busy, audio_port_array *audio_ports,
+				audio_port_array *input_ports)
+{
+	int i, k = 0;
+	struct audio_port *audio_port;
+
+	FOR_ARRAY_ELEMENT(audio_ports, i, audio_port) {
+		audio_port->buf_index = -1;
+		if (i < ARRAY_COUNT(input_ports)) {
+			int in = ARRAY_ELEMENT(input_ports, i)->buf_index;
+			if (!busy[in]) {
+				audio_port->buf_index = in;
+				busy[in] = 1;
+			}
+		}
+	}
+
+	FOR_ARRAY_ELEMENT(audio_ports, i, audio_port) {
+		if (audio_port->buf_index >= 0)
+			continue;
+		while (busy[k])
+			k++;
+		audio_port->buf_index = k;
+		busy[k] = 1;
+	}
+}
+
 static void unuse_buffers(char *busy, audio_port_array *audio_ports)
 {
 	int i;
@@ -585,7 +697,9 @@ static int allocate_buffers(struct pipeline *pipeline)
 			unuse_buffers(busy, &instance->input_audio_ports);
 		} else {
 			unuse_buffers(busy, &instance->input_audio_ports);
-			use_buffers(busy, &instance->output_audio_ports);
+			use_buffers_inplace(busy,
+					    &instance->output_audio_ports,
+					    &instance->input_audio_ports);
 		}
 	}
 	free(busy);
@@ -635,6 +749,245 @@ static void calculate_audio_delay(struct pipeline *pipeline)
 	}
 }
 
+static int is_builtin(struct instance *instance, const char *label)
+{
+	struct plugin *plugin = instance->plugin;
+
+	return strcmp(plugin->library, "builtin") == 0 &&
+	       strcmp(plugin->label, label) == 0;
+}
+
+/* Gets the 2x2 matrix which maps the input to the output channels of a
+ * builtin channel mixing instance. Returns 0 if the instance is one. */
+static int get_channel_matrix(struct instance *instance, float m[2][2])
+{
+	static const float swap_lr[2][2] = { { 0, 1 }, { 1, 0 } };
+	static const float invert_lr[2][2] = { { -1, 0 }, { 0, 1 } };
+	static const float mix_stereo[2][2] = { { 1, 1 }, { 1, 1 } };
+
+	if (ARRAY_COUNT(&instance->input_audio_ports) != 2 ||
+	    ARRAY_COUNT(&instance->output_audio_ports) != 2)
+		return -1;
+
+	if (is_builtin(instance, "swap_lr"))
+		memcpy(m, swap_lr, sizeof(swap_lr));
+	else if (is_builtin(instance, "invert_lr"))
+		memcpy(m, invert_lr, sizeof(invert_lr));
+	else if (is_builtin(instance, "mix_stereo"))
+		memcpy(m, mix_stereo, sizeof(mix_stereo));
+	else
+		return -1;
+	return 0;
+}
+
+static float *port_buffer(struct pipeline *pipeline, audio_port_array *ports,
+			  int index)
+{
+	return pipeline->buffers[ARRAY_ELEMENT(ports, index)->buf_index];
+}
+
+/* Returns 1 if both audio inputs of next come from the outputs of prev,
+ * and fills route with the output of prev each input of next reads. */
+static int is_fed_by(struct instance *next, struct instance *prev,
+		     int route[2])
+{
+	int i;
+	struct audio_port *audio_port;
+
+	FOR_ARRAY_ELEMENT(&next->input_audio_ports, i, audio_port) {
+		if (audio_port->peer->plugin != prev->plugin)
+			return 0;
+		route[i] = audio_port->peer -
+			   ARRAY_ELEMENT(&prev->output_audio_ports, 0);
+	}
+	return 1;
+}
+
+/* Folds the chain of channel mixing instances starting at index into one
+ * step. Returns the number of instances folded, 0 if there is none. */
+static int compile_matrix(struct pipeline *pipeline, int index,
+			  struct plan_step *step)
+{
+	instance_array *instances = &pipeline->instances;
+	struct instance *first = ARRAY_ELEMENT(instances, index);
+	struct instance *last = first;
+	float m[2][2], next[2][2], prod[2][2];
+	int route[2];
+	int n = 1;
+	int i, j;
+
+	if (get_channel_matrix(first, step->matrix) != 0)
+		return 0;
+
+	while (index + n < ARRAY_COUNT(instances)) {
+		struct instance *instance = ARRAY_ELEMENT(instances, index + n);
+
+		if (get_channel_matrix(instance, next) != 0 ||
+		    !is_fed_by(instance, last, route))
+			break;
+		memcpy(m, step->matrix, sizeof(m));
+		for (i = 0; i < 2; i++)
+			for (j = 0; j < 2; j++)
+				prod[i][j] = next[i][0] * m[route[0]][j] +
+					     next[i][1] * m[route[1]][j];
+		memcpy(step->matrix, prod, sizeof(prod));
+		last = instance;
+		n++;
+	}
+
+	step->op = PLAN_MATRIX;
+	for (i = 0; i < 2; i++) {
+		step->in[i] = port_buffer(pipeline, &first->input_audio_ports,
+					  i);
+		step->out[i] = port_buffer(pipeline, &last->output_audio_ports,
+					   i);
+	}
+	return n;
+}
+
+/* Gets the value connected to the input control port index of instance.
+ * Returns 0 if the port is connected. */
+static int get_control_value(struct instance *instance, int index,
+			     float *value)
+{
+	int i;
+	struct control_port *control_port;
+
+	FOR_ARRAY_ELEMENT(&instance->input_control_ports, i, control_port) {
+		if (control_port->original_index != index)
+			continue;
+		*value = control_port->peer ? control_port->peer->value :
+					      control_port->value;
+		return 0;
+	}
+	return -1;
+}
+
+/* Adds the biquads of a builtin eq instance to a channel of eq2, reading the
+ * parameters the same way the eq module does. */
+static int append_eq_biquads(struct pipeline *pipeline,
+			     struct instance *instance, struct eq2 *eq2,
+			     int channel)
+{
+	float nyquist = pipeline->sample_rate / 2;
+	float type, freq, Q, gain;
+	int i;
+
+	for (i = 2; i < 2 + MAX_BIQUADS_PER_EQ * 4; i += 4) {
+		if (get_control_value(instance, i, &type) != 0)
+			break;
+		if (get_control_value(instance, i + 1, &freq) != 0 ||
+		    get_control_value(instance, i + 2, &Q) != 0 ||
+		    get_control_value(instance, i + 3, &gain) != 0)
+			return -1;
+		if (eq2_append_biquad(eq2, channel, (int)type, freq / nyquist,
+				      Q, gain) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Runs the builtin mono eq instance at index together with the next one as
+ * an eq2, if they are independent and process in place. Returns the number
+ * of instances fused, 0 if they can't be. */
+static int compile_eq2(struct pipeline *pipeline, int index,
+		       struct plan_step *step)
+{
+	instance_array *instances = &pipeline->instances;
+	struct instance *eq[2];
+	int i;
+
+	if (index + 1 >= ARRAY_COUNT(instances))
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		eq[i] = ARRAY_ELEMENT(instances, index + i);
+		if (!is_builtin(eq[i], "eq") ||
+		    ARRAY_COUNT(&eq[i]->input_audio_ports) != 1 ||
+		    ARRAY_COUNT(&eq[i]->output_audio_ports) != 1)
+			return 0;
+		step->in[i] = port_buffer(pipeline, &eq[i]->input_audio_ports,
+					  0);
+		step->out[i] = port_buffer(pipeline,
+					   &eq[i]->output_audio_ports, 0);
+		if (step->in[i] != step->out[i])
+			return 0;
+	}
+	if (ARRAY_ELEMENT(&eq[1]->input_audio_ports, 0)->peer->plugin ==
+	    eq[0]->plugin)
+		return 0;
+
+	step->eq2 = eq2_new();
+	if (append_eq_biquads(pipeline, eq[0], step->eq2, 0) != 0 ||
+	    append_eq_biquads(pipeline, eq[1], step->eq2, 1) != 0) {
+		eq2_free(step->eq2);
+		step->eq2 = NULL;
+		return 0;
+	}
+	step->op = PLAN_EQ2;
+	return 2;
+}
+
+static void free_plan(struct pipeline *pipeline)
+{
+	int i;
+
+	for (i = 0; i < pipeline->num_plan_steps; i++)
+		if (pipeline->plan[i].eq2)
+			eq2_free(pipeline->plan[i].eq2);
+	free(pipeline->plan);
+	pipeline->plan = NULL;
+	pipeline->num_plan_steps = 0;
+}
+
+/* Compiles the instances into the flat list of steps run for each block.
+ * Instances whose module does nothing are dropped, chains of builtin
+ * channel mixers are folded into one matrix and pairs of builtin mono eqs
+ * are run as one eq2, so fewer passes are made over the buffers. */
+static int compile_plan(struct pipeline *pipeline)
+{
+	instance_array *instances = &pipeline->instances;
+	struct instance *instance;
+	struct plan_step *step;
+	int i = 0, n;
+
+	free_plan(pipeline);
+	pipeline->plan = calloc(ARRAY_COUNT(instances),
+				sizeof(*pipeline->plan));
+	if (!pipeline->plan)
+		return -1;
+
+	while (i < ARRAY_COUNT(instances)) {
+		instance = ARRAY_ELEMENT(instances, i);
+		if (instance->properties & MODULE_NOOP) {
+			i++;
+			continue;
+		}
+
+		step = &pipeline->plan[pipeline->num_plan_steps];
+		step->instance = instance;
+		n = compile_matrix(pipeline, i, step);
+		if (n == 0)
+			n = compile_eq2(pipeline, i, step);
+		if (n == 0) {
+			step->op = PLAN_RUN_MODULE;
+			step->module = instance->module;
+			n = 1;
+		}
+		step->num_instances = n;
+		i += n;
+
+		/* A chain which maps the channels back in place is a no-op. */
+		if (step->op == PLAN_MATRIX &&
+		    step->in[0] == step->out[0] && step->in[1] == step->out[1] &&
+		    step->matrix[0][0] == 1 && step->matrix[0][1] == 0 &&
+		    step->matrix[1][0] == 0 && step->matrix[1][1] == 1)
+			continue;
+		pipeline->num_plan_steps++;
+	}
+	return 0;
+}
+
 int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
 {
 	int i;
@@ -709,7 +1062,7 @@ int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
 	}
 
 	calculate_audio_delay(pipeline);
-	return 0;
+	return compile_plan(pipeline);
 }
 
 void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline)
@@ -724,6 +1077,7 @@ void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline)
 			instance->instantiated = 0;
 		}
 	}
+	free_plan(pipeline);
 	pipeline->sample_rate = 0;
 }
 
@@ -752,6 +1106,11 @@ int cras_dsp_pipeline_get_peak_audio_buffers(struct pipeline *pipeline)
 	return pipeline->peak_buf;
 }
 
+int cras_dsp_pipeline_get_num_plan_steps(struct pipeline *pipeline)
+{
+	return pipeline->num_plan_steps;
+}
+
 static float *find_buffer(struct pipeline *pipeline,
 			  audio_port_array *audio_ports,
 			  int index)
@@ -780,17 +1139,159 @@ float *cras_dsp_pipeline_get_sink_buffer(struct pipeline *pipeline, int index)
 			   index);
 }
 
-void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count)
+static int64_t timespec_diff_ns(const struct timespec *end,
+				const struct timespec *begin)
 {
+	return (end->tv_sec - begin->tv_sec) * 1000000000LL +
+		end->tv_nsec - begin->tv_nsec;
+}
+
+static void add_instance_statistic(struct instance *instance, int64_t t,
+				   int samples)
+{
+	int bucket = 0;
+	int64_t us = t / 1000;
+
+	while (us > 1 && bucket < DSP_PROFILE_HIST_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	instance->histogram[bucket]++;
+	instance->max_time = MAX(instance->max_time, t);
+	instance->total_time += t;
+	instance->total_blocks++;
+	instance->total_samples += samples;
+}
+
+static void run_matrix(struct plan_step *step, int sample_count)
+{
+	const float m00 = step->matrix[0][0], m01 = step->matrix[0][1];
+	const float m10 = step->matrix[1][0], m11 = step->matrix[1][1];
+	float *in0 = step->in[0], *in1 = step->in[1];
+	float *out0 = step->out[0], *out1 = step->out[1];
 	int i;
-	struct instance *instance;
 
-	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
-		struct dsp_module *module = instance->module;
-		module->run(module, sample_count);
+	for (i = 0; i < sample_count; i++) {
+		float l = in0[i], r = in1[i];
+		out0[i] = m00 * l + m01 * r;
+		out1[i] = m10 * l + m11 * r;
+	}
+}
+
+static void run_step(struct plan_step *step, int sample_count)
+{
+	switch (step->op) {
+	case PLAN_RUN_MODULE:
+		step->module->run(step->module, sample_count);
+		break;
+	case PLAN_MATRIX:
+		run_matrix(step, sample_count);
+		break;
+	case PLAN_EQ2:
+		eq2_process(step->eq2, step->out[0], step->out[1],
+			    sample_count);
+		break;
 	}
 }
 
+/* Runs the steps of the plan over sample_count frames, recording the time
+ * spent in each of them. Returns the total time in nanoseconds. */
+static int64_t run_instances_profiled(struct pipeline *pipeline,
+				      int sample_count)
+{
+	int i;
+	struct plan_step *step;
+	struct timespec begin, end;
+	int64_t t, total = 0;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+	for (i = 0; i < pipeline->num_plan_steps; i++) {
+		step = &pipeline->plan[i];
+		run_step(step, sample_count);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		t = timespec_diff_ns(&end, &begin);
+		add_instance_statistic(step->instance, t, sample_count);
+		total += t;
+		begin = end;
+	}
+	return total;
+}
+
+/* Runs the steps of the plan over sample_count frames. The time is only
+ * measured while the instances are profiled or the block size is being
+ * tuned. Returns the time in nanoseconds, or 0 if it wasn't measured. */
+static int64_t run_instances(struct pipeline *pipeline, int sample_count)
+{
+	struct timespec begin, end;
+	int i;
+
+	if (__atomic_load_n(&profile_instances, __ATOMIC_RELAXED))
+		return run_instances_profiled(pipeline, sample_count);
+
+	if (pipeline->tune_index < 0) {
+		for (i = 0; i < pipeline->num_plan_steps; i++)
+			run_step(&pipeline->plan[i], sample_count);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+	for (i = 0; i < pipeline->num_plan_steps; i++)
+		run_step(&pipeline->plan[i], sample_count);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return timespec_diff_ns(&end, &begin);
+}
+
+void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count)
+{
+	run_instances(pipeline, sample_count);
+}
+
+void cras_dsp_pipeline_set_profile_instances(int enabled)
+{
+	__atomic_store_n(&profile_instances, enabled, __ATOMIC_RELAXED);
+}
+
+/* Accounts a block run with the candidate block size being measured. Once
+ * all the candidates have been measured, settles on the one with the lowest
+ * cost per frame for this pipeline. */
+static void tune_block_size(struct pipeline *pipeline, int64_t t,
+			    int samples)
+{
+	int i, best;
+
+	if (pipeline->tune_index < 0)
+		return;
+
+	pipeline->tune_time[pipeline->tune_index] += t;
+	pipeline->tune_samples[pipeline->tune_index] += samples;
+	if (++pipeline->tune_blocks < DSP_TUNE_BLOCKS)
+		return;
+
+	pipeline->tune_blocks = 0;
+	if (++pipeline->tune_index < DSP_NUM_BLOCK_SIZES) {
+		pipeline->block_size =
+			DSP_MIN_BLOCK_SIZE << pipeline->tune_index;
+		return;
+	}
+
+	best = 0;
+	for (i = 1; i < DSP_NUM_BLOCK_SIZES; i++) {
+		/* Compare time per frame without dividing. */
+		if (pipeline->tune_time[i] * pipeline->tune_samples[best] <
+		    pipeline->tune_time[best] * pipeline->tune_samples[i])
+			best = i;
+	}
+	pipeline->block_size = DSP_MIN_BLOCK_SIZE << best;
+	pipeline->tune_index = -1;
+	syslog(LOG_DEBUG, "dsp pipeline %s block size %d",
+	       pipeline->purpose, pipeline->block_size);
+}
+
+int cras_dsp_pipeline_get_block_size(struct pipeline *pipeline)
+{
+	return pipeline->block_size;
+}
+
 void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 				     const struct timespec *time_delta,
 				     int samples)
@@ -814,26 +1315,76 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 	pipeline->total_time += t;
 }
 
-void cras_dsp_pipeline_apply(struct pipeline *pipeline,
-			     uint8_t *buf, unsigned int frames)
+/* Converts frames of interleaved samples in format to the float buffers. */
+static void deinterleave_samples(const uint8_t *buf, snd_pcm_format_t format,
+				 float *const *output, int channels,
+				 int frames)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		dsp_util_deinterleave((int16_t *)buf, output, channels,
+				      frames);
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+		dsp_util_deinterleave_s24((const int32_t *)buf, output,
+					  channels, frames);
+		break;
+	default:
+		dsp_util_deinterleave_s32((const int32_t *)buf, output,
+					  channels, frames);
+		break;
+	}
+}
+
+/* Converts frames from the float buffers to interleaved samples in format. */
+static void interleave_samples(float *const *input, uint8_t *buf,
+			       snd_pcm_format_t format, int channels,
+			       int frames)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		dsp_util_interleave(input, (int16_t *)buf, channels, frames);
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+		dsp_util_interleave_s24(input, (int32_t *)buf, channels,
+					frames);
+		break;
+	default:
+		dsp_util_interleave_s32(input, (int32_t *)buf, channels,
+					frames);
+		break;
+	}
+}
+
+/* Runs the pipeline over frames of buf. Its channel counts size the arrays
+ * of buffer pointers, so it must not be NULL. */
+static void apply_pipeline(struct pipeline *pipeline, uint8_t *buf,
+			   snd_pcm_format_t format, unsigned int frames)
 {
 	size_t remaining;
 	size_t chunk;
 	size_t i;
-	int16_t *target;
+	size_t sample_bytes;
 	unsigned int input_channels = pipeline->input_channels;
 	unsigned int output_channels = pipeline->output_channels;
 	float *source[input_channels];
 	float *sink[output_channels];
 	struct timespec begin, end, delta;
 
-	if (!pipeline || frames == 0)
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		sample_bytes = 2;
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+		sample_bytes = 4;
+		break;
+	default:
 		return;
+	}
 
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
 
-	target = (int16_t *)buf;
-
 	/* get pointers to source and sink buffers */
 	for (i = 0; i < input_channels; i++)
 		source[i] = cras_dsp_pipeline_get_source_buffer(pipeline, i);
@@ -842,20 +1393,22 @@ void cras_dsp_pipeline_apply(struct pipeline *pipeline,
 
 	remaining = frames;
 
-	/* process at most DSP_BUFFER_SIZE frames each loop */
+	/* process at most block_size frames each loop */
 	while (remaining > 0) {
-		chunk = MIN(remaining, (size_t)DSP_BUFFER_SIZE);
+		chunk = MIN(remaining, (size_t)pipeline->block_size);
 
 		/* deinterleave and convert to float */
-		dsp_util_deinterleave(target, source, input_channels, chunk);
+		deinterleave_samples(buf, format, source, input_channels,
+				     chunk);
 
 		/* Run the pipeline */
-		cras_dsp_pipeline_run(pipeline, chunk);
+		tune_block_size(pipeline, run_instances(pipeline, chunk),
+				chunk);
 
-		/* interleave and convert back to int16_t */
-		dsp_util_interleave(sink, target, output_channels, chunk);
+		/* interleave and convert back to the sample format */
+		interleave_samples(sink, buf, format, output_channels, chunk);
 
-		target += chunk * output_channels;
+		buf += chunk * output_channels * sample_bytes;
 		remaining -= chunk;
 	}
 
@@ -864,6 +1417,64 @@ void cras_dsp_pipeline_apply(struct pipeline *pipeline,
 	cras_dsp_pipeline_add_statistic(pipeline, &delta, frames);
 }
 
+void cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
+			     snd_pcm_format_t format, unsigned int frames)
+{
+	if (!pipeline || frames == 0)
+		return;
+
+	apply_pipeline(pipeline, buf, format, frames);
+}
+
+/* Same as apply_pipeline(), for float samples. */
+static void apply_pipeline_float(struct pipeline *pipeline, float *buf,
+				 unsigned int frames)
+{
+	size_t remaining;
+	size_t chunk;
+	size_t i;
+	unsigned int input_channels = pipeline->input_channels;
+	unsigned int output_channels = pipeline->output_channels;
+	float *source[input_channels];
+	float *sink[output_channels];
+	struct timespec begin, end, delta;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+
+	for (i = 0; i < input_channels; i++)
+		source[i] = cras_dsp_pipeline_get_source_buffer(pipeline, i);
+	for (i = 0; i < output_channels; i++)
+		sink[i] = cras_dsp_pipeline_get_sink_buffer(pipeline, i);
+
+	remaining = frames;
+
+	while (remaining > 0) {
+		chunk = MIN(remaining, (size_t)pipeline->block_size);
+
+		dsp_util_deinterleave_float(buf, source, input_channels,
+					    chunk);
+		tune_block_size(pipeline, run_instances(pipeline, chunk),
+				chunk);
+		dsp_util_interleave_float(sink, buf, output_channels, chunk);
+
+		buf += chunk * output_channels;
+		remaining -= chunk;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	subtract_timespecs(&end, &begin, &delta);
+	cras_dsp_pipeline_add_statistic(pipeline, &delta, frames);
+}
+
+void cras_dsp_pipeline_apply_float(struct pipeline *pipeline,
+				   float *buf, unsigned int frames)
+{
+	if (!pipeline || frames == 0)
+		return;
+
+	apply_pipeline_float(pipeline, buf, frames);
+}
+
 void cras_dsp_pipeline_free(struct pipeline *pipeline)
 {
 	int i;
@@ -887,6 +1498,7 @@ void cras_dsp_pipeline_free(struct pipeline *pipeline)
 		}
 	}
 
+	free_plan(pipeline);
 	pipeline->ini = NULL;
 	ARRAY_FREE(&pipeline->instances);
 
@@ -932,6 +1544,80 @@ static void dump_control_ports(struct dumper *d, const char *name,
 	}
 }
 
+static void dump_instance_profile(struct dumper *d,
+				  struct pipeline *pipeline,
+				  struct instance *instance)
+{
+	int i;
+
+	if (instance->total_blocks == 0)
+		return;
+	dumpf(d, "   cpu: total %" PRId64 "ns, avg %" PRId64
+	      "ns, max %" PRId64 "ns per block, load %g%%\n",
+	      instance->total_time,
+	      instance->total_time / instance->total_blocks,
+	      instance->max_time,
+	      instance->total_time * 1e-9 / instance->total_samples *
+	      pipeline->sample_rate * 100);
+	dumpf(d, "   histogram (us, log2):");
+	for (i = 0; i < DSP_PROFILE_HIST_BUCKETS; i++)
+		dumpf(d, " %u", instance->histogram[i]);
+	dumpf(d, "\n");
+}
+
+void cras_dsp_pipeline_get_debug_info(struct pipeline *pipeline,
+				      struct dsp_debug_info *info)
+{
+	struct dsp_pipeline_debug_info *p;
+	struct instance *instance;
+	int i;
+
+	if (info->num_pipelines >= MAX_DEBUG_DSP_PIPELINES)
+		return;
+
+	p = &info->pipelines[info->num_pipelines];
+	memset(p, 0, sizeof(*p));
+	strncpy(p->purpose, pipeline->purpose, sizeof(p->purpose) - 1);
+	p->sample_rate = pipeline->sample_rate;
+	p->block_size = pipeline->block_size;
+	p->total_blocks = pipeline->total_blocks;
+	p->total_samples = pipeline->total_samples;
+	p->total_ns = pipeline->total_time;
+	p->max_ns = pipeline->max_time;
+
+	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
+		struct dsp_instance_debug_info *di;
+
+		if (info->num_instances >= MAX_DEBUG_DSP_INSTANCES)
+			break;
+		di = &info->instances[info->num_instances++];
+		memset(di, 0, sizeof(*di));
+		strncpy(di->title, instance->plugin->title,
+			sizeof(di->title) - 1);
+		di->pipeline_idx = info->num_pipelines;
+		di->total_blocks = instance->total_blocks;
+		di->total_samples = instance->total_samples;
+		di->total_ns = instance->total_time;
+		di->max_ns = instance->max_time;
+		memcpy(di->histogram, instance->histogram,
+		       sizeof(di->histogram));
+		p->num_instances++;
+	}
+	info->num_pipelines++;
+}
+
+static void dump_plan_step(struct dumper *d, struct plan_step *step)
+{
+	static const char *const op_names[] = { "run", "matrix", "eq2" };
+
+	dumpf(d, "  %s from %s, %d instance(s)\n", op_names[step->op],
+	      step->instance->plugin->title, step->num_instances);
+	if (step->op == PLAN_MATRIX)
+		dumpf(d, "   [%g %g; %g %g]\n",
+		      step->matrix[0][0], step->matrix[0][1],
+		      step->matrix[1][0], step->matrix[1][1]);
+}
+
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 {
 	int i;
@@ -958,6 +1644,8 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 	      pipeline->max_time);
 	dumpf(d, " cpu load: %g%%\n", pipeline->total_time * 1e-9
 	      / pipeline->total_samples * pipeline->sample_rate * 100);
+	dumpf(d, " block size: %d%s\n", pipeline->block_size,
+	      pipeline->tune_index < 0 ? "" : " (tuning)");
 	dumpf(d, " instances (%d):\n",
 	      ARRAY_COUNT(&pipeline->instances));
 	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
@@ -965,6 +1653,7 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 		dumpf(d, "  [%d]%s mod=%p, total delay=%d\n",
 		      i, instance->plugin->title, module,
 		      instance->total_delay);
+		dump_instance_profile(d, pipeline, instance);
 		if (module)
 			module->dump(module, d);
 		dump_audio_ports(d, "input_audio_ports",
@@ -976,6 +1665,9 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 		dump_control_ports(d, "output_control_ports",
 				   &instance->output_control_ports);
 	}
+	dumpf(d, " plan (%d steps):\n", pipeline->num_plan_steps);
+	for (i = 0; i < pipeline->num_plan_steps; i++)
+		dump_plan_step(d, &pipeline->plan[i]);
 	dumpf(d, " peak_buf = %d\n", pipeline->peak_buf);
 	dumpf(d, "---- pipeline dump end ----\n");
 }
@@ -12,6 +12,7 @@ extern "C" {
 
 #include <stdint.h>
 
+#include "cras_audio_format.h"
 #include "dumper.h"
 #include "cras_dsp_ini.h"
 
@@ -31,6 +32,7 @@ extern "C" {
 #define DSP_BUFFER_SIZE 2048
 
 struct pipeline;
+struct dsp_debug_info;
 
 /* Creates a pipeline from the given ini file.
  * Args:
@@ -104,14 +106,27 @@ float *cras_dsp_pipeline_get_sink_buffer(struct pipeline *pipeline, int index);
  * pipeline. This is used by the unit test only */
 int cras_dsp_pipeline_get_peak_audio_buffers(struct pipeline *pipeline);
 
+/* Returns the number of steps cras_dsp_pipeline_run() executes for each
+ * block, after no-op instances are dropped and builtin modules are fused.
+ * This is used by the unit test only */
+int cras_dsp_pipeline_get_num_plan_steps(struct pipeline *pipeline);
+
 /* Returns the sampling rate passed by cras_dsp_pipeline_instantiate(),
  * or 0 if is has not been called */
 int cras_dsp_pipeline_get_sample_rate(struct pipeline *pipeline);
 
 /* Processes a block of audio samples. sample_count should be no more
- * than DSP_BUFFER_SIZE */
+ * than DSP_BUFFER_SIZE. The thread cpu time spent in each step of the
+ * plan compiled by cras_dsp_pipeline_instantiate() is recorded, see
+ * cras_dsp_pipeline_get_debug_info(). */
 void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count);
 
+/* Returns the number of frames cras_dsp_pipeline_apply() and
+ * cras_dsp_pipeline_apply_float() run through the pipeline at a time. It
+ * starts small and, after the pipeline has run for a while with each of the
+ * candidate sizes, settles on the one with the lowest cpu cost per frame. */
+int cras_dsp_pipeline_get_block_size(struct pipeline *pipeline);
+
 /* Add a statistic of running time for the pipeline.
  *
  * Args:
@@ -127,10 +142,40 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
  * Args:
  *    pipeline - The pipeline to run.
  *    buf - The samples to be processed, interleaved.
+ *    format - The sample format of buf, SND_PCM_FORMAT_S16_LE, S24_LE or
+ *        S32_LE. Buffers in other formats are left as they are.
  *    frames - the numver of samples in the buffer.
  */
-void cras_dsp_pipeline_apply(struct pipeline *pipeline,
-			     uint8_t *buf, unsigned int frames);
+void cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
+			     snd_pcm_format_t format, unsigned int frames);
+
+/* Runs the specified pipeline across the given interleaved float buffer in
+ * place. Unlike cras_dsp_pipeline_apply() the samples stay in float, so the
+ * output is not clipped.
+ * Args:
+ *    pipeline - The pipeline to run.
+ *    buf - The float samples to be processed, interleaved.
+ *    frames - the number of frames in the buffer.
+ */
+void cras_dsp_pipeline_apply_float(struct pipeline *pipeline,
+				   float *buf, unsigned int frames);
+
+/* Turns timing each instance of every pipeline on or off. It costs a clock
+ * read per instance and block, so it is off until someone asks for the
+ * profile. The pipelines always time each apply as a whole.
+ * Args:
+ *    enabled - Non-zero to time the instances.
+ */
+void cras_dsp_pipeline_set_profile_instances(int enabled);
+
+/* Appends the profile of the pipeline and of its instances to info. Entries
+ * past MAX_DEBUG_DSP_PIPELINES or MAX_DEBUG_DSP_INSTANCES are dropped.
+ * Args:
+ *    pipeline - The pipeline to get the profile of.
+ *    info - The debug info to append to.
+ */
+void cras_dsp_pipeline_get_debug_info(struct pipeline *pipeline,
+				      struct dsp_debug_info *info);
 
 /* Dumps the current state of the pipeline. For debugging only */
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline);
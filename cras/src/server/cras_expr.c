@@ -5,6 +5,7 @@
 
 #include <ctype.h>
 #include <stdlib.h>
+#include <sys/param.h>
 #include <syslog.h>
 
 #include "array.h"
@@ -114,17 +115,55 @@ void cras_expr_value_dump(struct dumper *d, const struct cras_expr_value *value)
 	}
 }
 
-static struct cras_expr_value *find_value(struct cras_expr_env *env,
-					  const char *name)
+/* Variable names are interned to slots shared by all the environments, so
+ * compiled expressions can find their variables by index. */
+static string_array symbols;
+
+/* The last id given to an environment and the last stamp given to a change
+ * of a value in any environment. */
+static unsigned int last_env_id;
+static unsigned int last_stamp;
+
+static int symbol_slot(const char *name)
 {
 	int i;
-	const char **key;
+	const char **symbol;
 
-	FOR_ARRAY_ELEMENT(&env->keys, i, key) {
-		if (strcmp(*key, name) == 0)
-			return ARRAY_ELEMENT(&env->values, i);
+	FOR_ARRAY_ELEMENT(&symbols, i, symbol) {
+		if (strcmp(*symbol, name) == 0)
+			return i;
 	}
-	return NULL;
+	ARRAY_APPEND(&symbols, strdup(name));
+	return ARRAY_COUNT(&symbols) - 1;
+}
+
+/* Returns the index of the value in slot plus one, zero if it's not set. */
+static int slot_index(const struct cras_expr_env *env, int slot)
+{
+	if (slot >= ARRAY_COUNT(&env->slots))
+		return 0;
+	return *ARRAY_ELEMENT(&env->slots, slot);
+}
+
+static struct cras_expr_value *slot_value(struct cras_expr_env *env,
+					  int slot)
+{
+	int index = slot_index(env, slot);
+
+	return index ? ARRAY_ELEMENT(&env->values, index - 1) : NULL;
+}
+
+static unsigned int slot_stamp(const struct cras_expr_env *env, int slot)
+{
+	int index = slot_index(env, slot);
+
+	return index ? *ARRAY_ELEMENT(&env->stamps, index - 1) : 0;
+}
+
+static struct cras_expr_value *find_value(struct cras_expr_env *env,
+					  const char *name)
+{
+	return slot_value(env, symbol_slot(name));
 }
 
 /* Insert a (key, value) pair to the environment. The value is
@@ -133,7 +172,16 @@ static struct cras_expr_value *find_value(struct cras_expr_env *env,
 static struct cras_expr_value *insert_value(struct cras_expr_env *env,
 					    const char *key)
 {
+	int slot = symbol_slot(key);
+
+	if (!env->id)
+		env->id = ++last_env_id;
+	while (ARRAY_COUNT(&env->slots) <= slot)
+		*ARRAY_APPEND_ZERO(&env->slots) = 0;
+	*ARRAY_ELEMENT(&env->slots, slot) = ARRAY_COUNT(&env->values) + 1;
+
 	*ARRAY_APPEND_ZERO(&env->keys) = strdup(key);
+	*ARRAY_APPEND_ZERO(&env->stamps) = 0;
 	return ARRAY_APPEND_ZERO(&env->values);
 }
 
@@ -146,6 +194,27 @@ static struct cras_expr_value *find_or_insert_value(struct cras_expr_env *env,
 	return value;
 }
 
+static char value_equal(const struct cras_expr_value *a,
+			const struct cras_expr_value *b)
+{
+	if (a->type != b->type)
+		return 0;
+
+	switch (a->type) {
+	case CRAS_EXPR_VALUE_TYPE_NONE:
+		break;
+	case CRAS_EXPR_VALUE_TYPE_BOOLEAN:
+		return a->u.boolean == b->u.boolean;
+	case CRAS_EXPR_VALUE_TYPE_INT:
+		return a->u.integer == b->u.integer;
+	case CRAS_EXPR_VALUE_TYPE_STRING:
+		return strcmp(a->u.string, b->u.string) == 0;
+	case CRAS_EXPR_VALUE_TYPE_FUNCTION:
+		return a->u.function == b->u.function;
+	}
+	return 1;
+}
+
 static void function_not(cras_expr_value_array *operands,
 			 struct cras_expr_value *result)
 {
@@ -222,30 +291,8 @@ static char function_equal_real(cras_expr_value_array *operands)
 		/* compare with the previous operand */
 
 		prev = ARRAY_ELEMENT(operands, i - 1);
-
-		if (prev->type != value->type)
+		if (!value_equal(prev, value))
 			return 0;
-
-		switch (prev->type) {
-		case CRAS_EXPR_VALUE_TYPE_NONE:
-			break;
-		case CRAS_EXPR_VALUE_TYPE_BOOLEAN:
-			if (prev->u.boolean != value->u.boolean)
-				return 0;
-			break;
-		case CRAS_EXPR_VALUE_TYPE_INT:
-			if (prev->u.integer != value->u.integer)
-				return 0;
-			break;
-		case CRAS_EXPR_VALUE_TYPE_STRING:
-			if (strcmp(prev->u.string, value->u.string) != 0)
-				return 0;
-			break;
-		case CRAS_EXPR_VALUE_TYPE_FUNCTION:
-			if (prev->u.function != value->u.function)
-				return 0;
-			break;
-		}
 	}
 
 	return 1;
@@ -257,11 +304,18 @@ static void function_equal(cras_expr_value_array *operands,
 	value_set_boolean(result, function_equal_real(operands));
 }
 
+/* Sets a variable, stamping it only if the value changes so the cached
+ * results of the expressions reading it stay valid otherwise. */
 static void env_set_variable(struct cras_expr_env *env, const char *name,
 			     struct cras_expr_value *new_value)
 {
 	struct cras_expr_value *value = find_or_insert_value(env, name);
+
+	if (value_equal(value, new_value))
+		return;
 	copy_value(value, new_value);
+	*ARRAY_ELEMENT(&env->stamps, ARRAY_INDEX(&env->values, value)) =
+		++last_stamp;
 }
 
 void cras_expr_env_install_builtins(struct cras_expr_env *env)
@@ -287,22 +341,29 @@ void cras_expr_env_install_builtins(struct cras_expr_env *env)
 void cras_expr_env_set_variable_boolean(struct cras_expr_env *env,
 					const char *name, char boolean)
 {
-	struct cras_expr_value *value = find_or_insert_value(env, name);
-	value_set_boolean(value, boolean);
+	struct cras_expr_value value = CRAS_EXPR_VALUE_INIT;
+
+	value_set_boolean(&value, boolean);
+	env_set_variable(env, name, &value);
 }
 
 void cras_expr_env_set_variable_integer(struct cras_expr_env *env,
 					const char *name, int integer)
 {
-	struct cras_expr_value *value = find_or_insert_value(env, name);
-	value_set_integer(value, integer);
+	struct cras_expr_value value = CRAS_EXPR_VALUE_INIT;
+
+	value_set_integer(&value, integer);
+	env_set_variable(env, name, &value);
 }
 
 void cras_expr_env_set_variable_string(struct cras_expr_env *env,
 				       const char *name, const char *str)
 {
-	struct cras_expr_value *value = find_or_insert_value(env, name);
-	value_set_string(value, str);
+	struct cras_expr_value value = CRAS_EXPR_VALUE_INIT;
+
+	value_set_string(&value, str);
+	env_set_variable(env, name, &value);
+	cras_expr_value_free(&value);
 }
 
 void cras_expr_env_free(struct cras_expr_env *env)
@@ -321,6 +382,9 @@ void cras_expr_env_free(struct cras_expr_env *env)
 
 	ARRAY_FREE(&env->keys);
 	ARRAY_FREE(&env->values);
+	ARRAY_FREE(&env->stamps);
+	ARRAY_FREE(&env->slots);
+	env->id = 0;
 }
 
 void cras_expr_env_dump(struct dumper *d, const struct cras_expr_env *env)
@@ -476,11 +540,130 @@ static struct cras_expr_expression *parse_one_expr(const char **str)
 	return NULL;
 }
 
+/* Instructions of a compiled expression. */
+enum expr_op {
+	/* Pushes literals[arg]. */
+	EXPR_OP_LITERAL,
+	/* Pushes the variable in slot arg. */
+	EXPR_OP_LOAD,
+	/* Pops arg values, calls the first one with all of them as the
+	 * operands and pushes the result. */
+	EXPR_OP_CALL,
+};
+
+struct expr_instruction {
+	enum expr_op op;
+	int arg;
+};
+
+DECLARE_ARRAY_TYPE(struct expr_instruction, expr_instruction_array);
+
+/* The number of (environment, result) pairs cached by an expression. There
+ * is one environment per dsp context, a few are alive at a time. */
+#define EXPR_CACHE_SIZE 4
+
+/* A cached result, the entry is unused while the value is none. Results
+ * that are none are not cached, they come from errors which are logged
+ * on every evaluation. */
+struct expr_cached_result {
+	/* The environment the result is for. */
+	unsigned int env_id;
+	/* The latest stamp of the variables read when it was evaluated. */
+	unsigned int stamp;
+	struct cras_expr_value value;
+};
+
+struct cras_expr_program {
+	expr_instruction_array code;
+	cras_expr_value_array literals;
+	/* The slots of the variables the expression reads. */
+	cras_expr_index_array refs;
+	/* The maximum number of values on the stack while it runs. */
+	int max_depth;
+	struct expr_cached_result cache[EXPR_CACHE_SIZE];
+	int next_cache;
+};
+
+static void emit(struct cras_expr_program *program, enum expr_op op, int arg)
+{
+	struct expr_instruction *instruction;
+
+	instruction = ARRAY_APPEND_ZERO(&program->code);
+	instruction->op = op;
+	instruction->arg = arg;
+}
+
+/* Emits the code evaluating expr and returns the stack depth it needs. */
+static int compile_one(struct cras_expr_program *program,
+		       const struct cras_expr_expression *expr)
+{
+	int i, slot, depth = 1;
+	struct cras_expr_expression **psub;
+
+	switch (expr->type) {
+	case EXPR_TYPE_NONE:
+		emit(program, EXPR_OP_LITERAL, ARRAY_COUNT(&program->literals));
+		ARRAY_APPEND_ZERO(&program->literals);
+		break;
+	case EXPR_TYPE_LITERAL:
+		emit(program, EXPR_OP_LITERAL, ARRAY_COUNT(&program->literals));
+		copy_value(ARRAY_APPEND_ZERO(&program->literals),
+			   (struct cras_expr_value *)&expr->u.literal);
+		break;
+	case EXPR_TYPE_VARIABLE:
+		slot = symbol_slot(expr->u.variable);
+		if (ARRAY_FIND(&program->refs, slot) < 0)
+			ARRAY_APPEND(&program->refs, slot);
+		emit(program, EXPR_OP_LOAD, slot);
+		break;
+	case EXPR_TYPE_COMPOUND:
+		FOR_ARRAY_ELEMENT(&expr->u.children, i, psub) {
+			int sub_depth = i + compile_one(program, *psub);
+			depth = MAX(depth, sub_depth);
+		}
+		emit(program, EXPR_OP_CALL, ARRAY_COUNT(&expr->u.children));
+		break;
+	}
+	return depth;
+}
+
+static struct cras_expr_program *compile_program(
+		const struct cras_expr_expression *expr)
+{
+	struct cras_expr_program *program;
+
+	program = calloc(1, sizeof(*program));
+	program->max_depth = compile_one(program, expr);
+	return program;
+}
+
+static void free_program(struct cras_expr_program *program)
+{
+	int i;
+	struct cras_expr_value *value;
+
+	if (!program)
+		return;
+	FOR_ARRAY_ELEMENT(&program->literals, i, value)
+		cras_expr_value_free(value);
+	for (i = 0; i < EXPR_CACHE_SIZE; i++)
+		cras_expr_value_free(&program->cache[i].value);
+	ARRAY_FREE(&program->code);
+	ARRAY_FREE(&program->literals);
+	ARRAY_FREE(&program->refs);
+	free(program);
+}
+
 struct cras_expr_expression *cras_expr_expression_parse(const char *str)
 {
+	struct cras_expr_expression *expr;
+
 	if (!str)
 		return NULL;
-	return parse_one_expr(&str);
+	expr = parse_one_expr(&str);
+	if (expr)
+		expr->program = compile_program(expr);
+	return expr;
 }
 
 static void dump_value(struct dumper *d, const struct cras_expr_value *value,
@@ -565,64 +748,124 @@ void cras_expr_expression_free(struct cras_expr_expression *expr)
 		break;
 	}
 	}
+	free_program(expr->program);
 	free(expr);
 }
 
+/* Runs the compiled expression. The values on the stack borrow the literals
+ * and the variables, only the results of calls are owned and freed. */
+static void run_program(struct cras_expr_program *program,
+			struct cras_expr_env *env,
+			struct cras_expr_value *result)
+{
+	struct cras_expr_value stack[program->max_depth];
+	char owned[program->max_depth];
+	struct expr_instruction *instruction;
+	struct cras_expr_value *value;
+	int i, j, sp = 0;
+
+	FOR_ARRAY_ELEMENT(&program->code, i, instruction) {
+		switch (instruction->op) {
+		case EXPR_OP_LITERAL:
+			stack[sp] = *ARRAY_ELEMENT(&program->literals,
+						   instruction->arg);
+			owned[sp++] = 0;
+			break;
+		case EXPR_OP_LOAD:
+			value = slot_value(env, instruction->arg);
+			if (value == NULL) {
+				syslog(LOG_ERR, "cannot find value for %s",
+				       *ARRAY_ELEMENT(&symbols,
+						      instruction->arg));
+				memset(&stack[sp], 0, sizeof(stack[sp]));
+			} else {
+				stack[sp] = *value;
+			}
+			owned[sp++] = 0;
+			break;
+		case EXPR_OP_CALL:
+		{
+			int n = instruction->arg;
+			cras_expr_value_array operands = {
+				n, n, &stack[sp - n]
+			};
+			struct cras_expr_value call_result =
+				CRAS_EXPR_VALUE_INIT;
+
+			if (n == 0)
+				syslog(LOG_ERR, "empty compound expression?");
+			else if (stack[sp - n].type ==
+				 CRAS_EXPR_VALUE_TYPE_FUNCTION)
+				stack[sp - n].u.function(&operands,
+							 &call_result);
+			else
+				syslog(LOG_ERR,
+				       "first element is not a function");
+
+			for (j = sp - n; j < sp; j++)
+				if (owned[j])
+					cras_expr_value_free(&stack[j]);
+			sp -= n;
+			stack[sp] = call_result;
+			owned[sp++] = 1;
+			break;
+		}
+		}
+	}
+
+	copy_value(result, &stack[0]);
+	if (owned[0])
+		cras_expr_value_free(&stack[0]);
+}
+
+/* Returns the latest stamp of the variables the program reads in env. */
+static unsigned int refs_stamp(const struct cras_expr_program *program,
+			       const struct cras_expr_env *env)
+{
+	int i;
+	int *slot;
+	unsigned int stamp = 0;
+
+	FOR_ARRAY_ELEMENT(&program->refs, i, slot) {
+		unsigned int slot_changed = slot_stamp(env, *slot);
+		stamp = MAX(stamp, slot_changed);
+	}
+	return stamp;
+}
+
 void cras_expr_expression_eval(struct cras_expr_expression *expr,
 			       struct cras_expr_env *env,
 			       struct cras_expr_value *result)
 {
+	struct cras_expr_program *program;
+	struct expr_cached_result *cached;
+	unsigned int stamp;
+	int i;
+
 	cras_expr_value_free(result);
 
-	switch (expr->type) {
-	case EXPR_TYPE_NONE:
-		break;
-	case EXPR_TYPE_LITERAL:
-		copy_value(result, &expr->u.literal);
-		break;
-	case EXPR_TYPE_VARIABLE:
-	{
-		struct cras_expr_value *value = find_value(env,
-							   expr->u.variable);
-		if (value == NULL) {
-			syslog(LOG_ERR, "cannot find value for %s",
-			       expr->u.variable);
-		} else {
-			copy_value(result, value);
+	if (!expr->program)
+		expr->program = compile_program(expr);
+	program = expr->program;
+
+	/* Reuse the last result for env if no variable read has changed. */
+	stamp = refs_stamp(program, env);
+	for (i = 0; i < EXPR_CACHE_SIZE; i++) {
+		cached = &program->cache[i];
+		if (cached->env_id == env->id && cached->stamp == stamp &&
+		    cached->value.type != CRAS_EXPR_VALUE_TYPE_NONE) {
+			copy_value(result, &cached->value);
+			return;
 		}
-		break;
 	}
-	case EXPR_TYPE_COMPOUND:
-	{
-		int i;
-		struct cras_expr_expression **psub;
-		cras_expr_value_array values = ARRAY_INIT;
-		struct cras_expr_value *value;
 
-		FOR_ARRAY_ELEMENT(&expr->u.children, i, psub) {
-			value = ARRAY_APPEND_ZERO(&values);
-			cras_expr_expression_eval(*psub, env, value);
-		}
+	run_program(program, env, result);
 
-		if (ARRAY_COUNT(&values) > 0) {
-			struct cras_expr_value *f = ARRAY_ELEMENT(&values, 0);
-			if (f->type == CRAS_EXPR_VALUE_TYPE_FUNCTION)
-				f->u.function(&values, result);
-			else
-				syslog(LOG_ERR,
-				       "first element is not a function");
-		} else {
-			syslog(LOG_ERR, "empty compound expression?");
-		}
-
-		FOR_ARRAY_ELEMENT(&values, i, value) {
-			cras_expr_value_free(value);
-		}
-
-		ARRAY_FREE(&values);
-		break;
-	}
-	}
+	cached = &program->cache[program->next_cache];
+	program->next_cache = (program->next_cache + 1) % EXPR_CACHE_SIZE;
+	cached->env_id = env->id;
+	cached->stamp = stamp;
+	copy_value(&cached->value, result);
 }
 
 int cras_expr_expression_eval_int(struct cras_expr_expression *expr,
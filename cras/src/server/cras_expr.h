@@ -51,6 +51,10 @@ enum expr_type {
 
 DECLARE_ARRAY_TYPE(struct cras_expr_expression *, expr_array);
 
+/* The compiled form of an expression, a stack based bytecode with the
+ * variables resolved to slots. It also caches the last results. */
+struct cras_expr_program;
+
 struct cras_expr_expression {
 	enum expr_type type;
 	union {
@@ -58,15 +62,28 @@ struct cras_expr_expression {
 		const char *variable;
 		expr_array children;
 	} u;
+	/* Compiled by cras_expr_expression_parse(), or on the first
+	 * evaluation of a sub-expression. */
+	struct cras_expr_program *program;
 };
 
 /* Environment */
 
 DECLARE_ARRAY_TYPE(const char *, string_array);
+DECLARE_ARRAY_TYPE(int, cras_expr_index_array);
+DECLARE_ARRAY_TYPE(unsigned int, cras_expr_stamp_array);
 
 struct cras_expr_env {
 	string_array keys;
 	cras_expr_value_array values;
+	/* The stamp of the last change to each value. A cached result of an
+	 * expression is valid until a variable it reads gets a new stamp. */
+	cras_expr_stamp_array stamps;
+	/* Maps the slot of a variable name to its index in values plus one,
+	 * zero if it is not set in this environment. */
+	cras_expr_index_array slots;
+	/* Identifies this environment in the caches of the expressions. */
+	unsigned int id;
 };
 
 /* initial value for the environment type is zero */
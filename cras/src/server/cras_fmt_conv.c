@@ -29,6 +29,10 @@ typedef size_t (*channel_converter_t)(struct cras_fmt_conv *conv,
 				      const int16_t *in,
 				      size_t in_frames,
 				      int16_t *out);
+typedef void (*fused_converter_t)(struct cras_fmt_conv *conv,
+				  const uint8_t *in,
+				  size_t in_frames,
+				  uint8_t *out);
 
 /* Member data for the resampler. */
 struct cras_fmt_conv {
@@ -38,6 +42,9 @@ struct cras_fmt_conv {
 	sample_format_converter_t in_format_converter;
 	sample_format_converter_t out_format_converter;
 	struct linear_resampler *resampler;
+	/* Does the whole conversion in one pass, if set. Used when the linear
+	 * resampler isn't needed. */
+	fused_converter_t fused_converter;
 	struct cras_audio_format in_fmt;
 	struct cras_audio_format out_fmt;
 	uint8_t *tmp_bufs[MAX_NUM_CONVERTERS - 1];
@@ -413,6 +420,199 @@ static void surround51_to_stereo_downmix_mtx(float **mtx,
 	normalize_buf(mtx[STEREO_R], 6);
 }
 
+/*
+ * Fused conversions, doing the sample format and channel conversions in one
+ * pass without intermediate buffers. They give the same result as the chain
+ * of converters above, so samples still go through S16 on the way.
+ */
+
+static inline int16_t read_s16le(const int16_t *in)
+{
+	return *in;
+}
+
+static inline int16_t read_s24le(const int32_t *in)
+{
+	return (int16_t)((*in & 0x00ffffff) >> 8);
+}
+
+static inline int16_t read_s32le(const int32_t *in)
+{
+	return (int16_t)(*in >> 16);
+}
+
+static inline void write_s16le(int16_t *out, int16_t sample)
+{
+	*out = sample;
+}
+
+static inline void write_s24le(int32_t *out, int16_t sample)
+{
+	*out = (int32_t)sample << 8;
+}
+
+static inline void write_s32le(int32_t *out, int16_t sample)
+{
+	*out = (int32_t)sample << 16;
+}
+
+/* Channel conversions that have fused versions. */
+enum fused_channel_op {
+	FUSED_MONO_TO_STEREO,
+	FUSED_STEREO_TO_MONO,
+	FUSED_STEREO_TO_51,
+	FUSED_51_TO_STEREO,
+	FUSED_NUM_CHANNEL_OPS,
+};
+
+/* Defines the fused converters from format "in" to format "out" for each of
+ * the channel conversions, and a table of them indexed by fused_channel_op.
+ */
+#define DEFINE_FUSED_CONVERTERS(in, in_t, out, out_t)			\
+static void fused_##in##_to_##out##_mono_to_stereo(			\
+		struct cras_fmt_conv *conv, const uint8_t *in_buf,	\
+		size_t in_frames, uint8_t *out_buf)			\
+{									\
+	const in_t *_in = (const in_t *)in_buf;				\
+	out_t *_out = (out_t *)out_buf;					\
+	size_t i;							\
+									\
+	for (i = 0; i < in_frames; i++) {				\
+		int16_t sample = read_##in(&_in[i]);			\
+		write_##out(&_out[2 * i], sample);			\
+		write_##out(&_out[2 * i + 1], sample);			\
+	}								\
+}									\
+									\
+static void fused_##in##_to_##out##_stereo_to_mono(			\
+		struct cras_fmt_conv *conv, const uint8_t *in_buf,	\
+		size_t in_frames, uint8_t *out_buf)			\
+{									\
+	const in_t *_in = (const in_t *)in_buf;				\
+	out_t *_out = (out_t *)out_buf;					\
+	size_t i;							\
+									\
+	for (i = 0; i < in_frames; i++)					\
+		write_##out(&_out[i],					\
+			    s16_add_and_clip(read_##in(&_in[2 * i]),	\
+					     read_##in(&_in[2 * i + 1])));\
+}									\
+									\
+static void fused_##in##_to_##out##_stereo_to_51(			\
+		struct cras_fmt_conv *conv, const uint8_t *in_buf,	\
+		size_t in_frames, uint8_t *out_buf)			\
+{									\
+	const in_t *_in = (const in_t *)in_buf;				\
+	out_t *_out = (out_t *)out_buf;					\
+	size_t left = conv->out_fmt.channel_layout[CRAS_CH_FL];		\
+	size_t right = conv->out_fmt.channel_layout[CRAS_CH_FR];	\
+	size_t i, ch;							\
+									\
+	for (i = 0; i < in_frames; i++, _out += 6) {			\
+		for (ch = 0; ch < 6; ch++)				\
+			write_##out(&_out[ch], 0);			\
+		write_##out(&_out[left], read_##in(&_in[2 * i]));	\
+		write_##out(&_out[right], read_##in(&_in[2 * i + 1]));	\
+	}								\
+}									\
+									\
+static void fused_##in##_to_##out##_51_to_stereo(			\
+		struct cras_fmt_conv *conv, const uint8_t *in_buf,	\
+		size_t in_frames, uint8_t *out_buf)			\
+{									\
+	const in_t *_in = (const in_t *)in_buf;				\
+	out_t *_out = (out_t *)out_buf;					\
+	size_t i;							\
+									\
+	for (i = 0; i < in_frames; i++, _in += 6) {			\
+		int16_t half_center = read_##in(&_in[4]) / 2;		\
+		write_##out(&_out[2 * i],				\
+			    s16_add_and_clip(read_##in(&_in[0]),	\
+					     half_center));		\
+		write_##out(&_out[2 * i + 1],				\
+			    s16_add_and_clip(read_##in(&_in[1]),	\
+					     half_center));		\
+	}								\
+}									\
+									\
+static const fused_converter_t fused_##in##_to_##out[] = {		\
+	[FUSED_MONO_TO_STEREO] = fused_##in##_to_##out##_mono_to_stereo,\
+	[FUSED_STEREO_TO_MONO] = fused_##in##_to_##out##_stereo_to_mono,\
+	[FUSED_STEREO_TO_51] = fused_##in##_to_##out##_stereo_to_51,	\
+	[FUSED_51_TO_STEREO] = fused_##in##_to_##out##_51_to_stereo,	\
+};
+
+DEFINE_FUSED_CONVERTERS(s16le, int16_t, s24le, int32_t)
+DEFINE_FUSED_CONVERTERS(s16le, int16_t, s32le, int32_t)
+DEFINE_FUSED_CONVERTERS(s24le, int32_t, s16le, int16_t)
+DEFINE_FUSED_CONVERTERS(s24le, int32_t, s24le, int32_t)
+DEFINE_FUSED_CONVERTERS(s24le, int32_t, s32le, int32_t)
+DEFINE_FUSED_CONVERTERS(s32le, int32_t, s16le, int16_t)
+DEFINE_FUSED_CONVERTERS(s32le, int32_t, s24le, int32_t)
+DEFINE_FUSED_CONVERTERS(s32le, int32_t, s32le, int32_t)
+
+/* Returns the fused converters from format in to format out, or NULL if there
+ * aren't any. S16 to S16 has none, the channel converter alone is one pass. */
+static const fused_converter_t *fused_converters(snd_pcm_format_t in,
+						 snd_pcm_format_t out)
+{
+	switch (in) {
+	case SND_PCM_FORMAT_S16_LE:
+		if (out == SND_PCM_FORMAT_S24_LE)
+			return fused_s16le_to_s24le;
+		if (out == SND_PCM_FORMAT_S32_LE)
+			return fused_s16le_to_s32le;
+		return NULL;
+	case SND_PCM_FORMAT_S24_LE:
+		if (out == SND_PCM_FORMAT_S16_LE)
+			return fused_s24le_to_s16le;
+		if (out == SND_PCM_FORMAT_S24_LE)
+			return fused_s24le_to_s24le;
+		if (out == SND_PCM_FORMAT_S32_LE)
+			return fused_s24le_to_s32le;
+		return NULL;
+	case SND_PCM_FORMAT_S32_LE:
+		if (out == SND_PCM_FORMAT_S16_LE)
+			return fused_s32le_to_s16le;
+		if (out == SND_PCM_FORMAT_S24_LE)
+			return fused_s32le_to_s24le;
+		if (out == SND_PCM_FORMAT_S32_LE)
+			return fused_s32le_to_s32le;
+		return NULL;
+	default:
+		return NULL;
+	}
+}
+
+/* Picks a fused converter for the whole chain of conv, if it has one. Only
+ * chains of format and channel conversions are fused, SRC keeps the chain. */
+static fused_converter_t select_fused_converter(
+		const struct cras_fmt_conv *conv)
+{
+	const fused_converter_t *converters;
+	enum fused_channel_op op;
+
+	if (conv->speex_state)
+		return NULL;
+
+	if (conv->channel_converter == s16_mono_to_stereo)
+		op = FUSED_MONO_TO_STEREO;
+	else if (conv->channel_converter == s16_stereo_to_mono)
+		op = FUSED_STEREO_TO_MONO;
+	else if (conv->channel_converter == s16_stereo_to_51 &&
+		 conv->out_fmt.channel_layout[CRAS_CH_FL] != -1 &&
+		 conv->out_fmt.channel_layout[CRAS_CH_FR] != -1)
+		op = FUSED_STEREO_TO_51;
+	else if (conv->channel_converter == s16_51_to_stereo)
+		op = FUSED_51_TO_STEREO;
+	else
+		return NULL;
+
+	converters = fused_converters(conv->in_fmt.format,
+				      conv->out_fmt.format);
+	return converters ? converters[op] : NULL;
+}
+
 /*
  * Exported interface
  */
@@ -564,11 +764,13 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 		}
 	}
 
-	/* Set up linear resampler. */
+	/* Set up linear resampler. It runs on S16_LE samples, either right
+	 * after the input format conversion or right after SRC. */
 	conv->num_converters++;
 	conv->resampler = linear_resampler_create(
-			out->num_channels,
-			cras_get_format_bytes(out),
+			pre_linear_resample ? in->num_channels
+					    : out->num_channels,
+			SND_PCM_FORMAT_S16_LE,
 			out->frame_rate,
 			out->frame_rate);
 	if (conv->resampler == NULL) {
@@ -592,6 +794,8 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 
 	assert(conv->num_converters <= MAX_NUM_CONVERTERS);
 
+	conv->fused_converter = select_fused_converter(conv);
+
 	return conv;
 }
 
@@ -757,6 +961,13 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	}
 	fr_out = fr_in;
 
+	if (conv->fused_converter && !pre_linear_resample &&
+	    !post_linear_resample) {
+		conv->fused_converter(conv, in_buf, fr_in, out_buf);
+		*in_frames = fr_in;
+		return fr_out;
+	}
+
 	/* Set up a chain of buffers.  The output buffer of the first conversion
 	 * is used as input to the second and so forth, ending in the output
 	 * buffer. */
@@ -770,6 +981,14 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	buffers[0] = (uint8_t *)in_buf;
 	buffers[used_converters] = out_buf;
 
+	/* If the input format isn't S16_LE convert to it. */
+	if (conv->in_fmt.format != SND_PCM_FORMAT_S16_LE) {
+		conv->in_format_converter(buffers[buf_idx],
+					  fr_in * conv->in_fmt.num_channels,
+					  (uint8_t *)buffers[buf_idx + 1]);
+		buf_idx++;
+	}
+
 	if (pre_linear_resample) {
 		linear_resample_fr = fr_in;
 		unsigned resample_limit = out_frames;
@@ -792,14 +1011,6 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		buf_idx++;
 	}
 
-	/* If the input format isn't S16_LE convert to it. */
-	if (conv->in_fmt.format != SND_PCM_FORMAT_S16_LE) {
-		conv->in_format_converter(buffers[buf_idx],
-					  fr_in * conv->in_fmt.num_channels,
-					  (uint8_t *)buffers[buf_idx + 1]);
-		buf_idx++;
-	}
-
 	/* Then channel conversion. */
 	if (conv->channel_converter != NULL) {
 		conv->channel_converter(conv,
@@ -340,22 +340,27 @@ static void set_default_channel_layout(struct cras_iodev *iodev)
 /* Applies the DSP to the samples for the iodev if applicable. */
 static void apply_dsp(struct cras_iodev *iodev, uint8_t *buf, size_t frames)
 {
+	const struct cras_audio_format *fmt = iodev->format;
 	struct cras_dsp_context *ctx;
-	struct pipeline *pipeline;
 
 	ctx = iodev->dsp_context;
 	if (!ctx)
 		return;
 
-	pipeline = cras_dsp_get_pipeline(ctx);
-	if (!pipeline)
-		return;
+	cras_dsp_apply(ctx, buf, fmt->format, frames);
+}
+
+/* Applies the DSP to the float mix bus of the iodev if applicable. */
+static void apply_dsp_float(struct cras_iodev *iodev, float *buf,
+			    size_t frames)
+{
+	struct cras_dsp_context *ctx;
 
-	cras_dsp_pipeline_apply(pipeline,
-				buf,
-				frames);
+	ctx = iodev->dsp_context;
+	if (!ctx)
+		return;
 
-	cras_dsp_put_pipeline(ctx);
+	cras_dsp_apply_float(ctx, buf, frames);
 }
 
 static void cras_iodev_free_dsp(struct cras_iodev *iodev)
@@ -820,6 +825,46 @@ unsigned int cras_iodev_max_stream_offset(const struct cras_iodev *iodev)
 	return max;
 }
 
+static void free_float_mix_buf(struct cras_iodev *iodev)
+{
+	free(iodev->float_mix_buf);
+	iodev->float_mix_buf = NULL;
+	iodev->float_mix_frames = 0;
+}
+
+/* Allocates the float mix bus for an output device that asks for one. The
+ * DSP runs in place on the bus, so it is only used when the DSP doesn't change
+ * the channel count. */
+static void alloc_float_mix_buf(struct cras_iodev *iodev)
+{
+	free_float_mix_buf(iodev);
+
+	if (!iodev->float_mix_enabled ||
+	    iodev->direction != CRAS_STREAM_OUTPUT ||
+	    !iodev->format || !iodev->ext_format)
+		return;
+
+	if (iodev->format->num_channels != iodev->ext_format->num_channels)
+		return;
+
+	switch (iodev->format->format) {
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		break;
+	default:
+		return;
+	}
+
+	iodev->float_mix_buf = calloc(
+		iodev->buffer_size * iodev->ext_format->num_channels,
+		sizeof(*iodev->float_mix_buf));
+	if (!iodev->float_mix_buf)
+		syslog(LOG_ERR, "Failed to allocate float mix buffer for %s",
+		       iodev->info.name);
+}
+
 int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level)
 {
 	int rc;
@@ -828,6 +873,8 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level)
 	if (rc < 0)
 		return rc;
 
+	alloc_float_mix_buf(iodev);
+
 	/* Make sure the min_cb_level doesn't get too large. */
 	iodev->min_cb_level = MIN(iodev->buffer_size / 2, cb_level);
 	iodev->max_cb_level = 0;
@@ -869,6 +916,10 @@ int cras_iodev_close(struct cras_iodev *iodev)
 	iodev->state = CRAS_IODEV_STATE_CLOSE;
 	if (iodev->ramp)
 		cras_ramp_reset(iodev->ramp);
+	/* The audio thread is done with the device, and with its DSP. */
+	if (iodev->dsp_context)
+		cras_dsp_context_idle(iodev->dsp_context);
+	free_float_mix_buf(iodev);
 	return 0;
 }
 
@@ -878,12 +929,123 @@ int cras_iodev_put_input_buffer(struct cras_iodev *iodev, unsigned int nframes)
 	return iodev->put_buffer(iodev, nframes);
 }
 
+/* Commits nframes of processed samples in frames to the device. */
+static int put_output_frames(struct cras_iodev *iodev, uint8_t *frames,
+			     unsigned int nframes)
+{
+	struct cras_fmt_conv * remix_converter =
+			audio_thread_get_global_remix_converter();
+
+	if (remix_converter)
+		cras_channel_remix_convert(remix_converter,
+				   iodev->format,
+				   frames,
+				   nframes);
+	rate_estimator_add_frames(iodev->rate_est, nframes);
+	return iodev->put_buffer(iodev, nframes);
+}
+
+/* Drops the first nframes frames from the float mix bus, moving the frames
+ * mixed past them to the front. */
+static void consume_float_mix_frames(struct cras_iodev *iodev,
+				     unsigned int nframes)
+{
+	unsigned int channels = iodev->ext_format->num_channels;
+
+	if (nframes >= iodev->float_mix_frames) {
+		iodev->float_mix_frames = 0;
+		return;
+	}
+
+	iodev->float_mix_frames -= nframes;
+	memmove(iodev->float_mix_buf, iodev->float_mix_buf + nframes * channels,
+		iodev->float_mix_frames * channels *
+			sizeof(*iodev->float_mix_buf));
+}
+
+/* Float mix bus version of cras_iodev_put_output_buffer. Runs DSP and volume
+ * on the bus and quantizes the result into frames once. The loopback hooks
+ * take samples in the device format, a copy is quantized for them only when
+ * they are set. */
+static int put_float_mix_output(struct cras_iodev *iodev, uint8_t *frames,
+				unsigned int nframes)
+{
+	const struct cras_audio_format *fmt = iodev->format;
+	float *buf = iodev->float_mix_buf;
+	unsigned int nsamples = nframes * fmt->num_channels;
+	struct cras_ramp_action ramp_action = {
+		.type = CRAS_RAMP_ACTION_NONE,
+		.scaler = 0.0f,
+		.increment = 0.0f,
+	};
+	float software_volume_scaler;
+	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
+
+	/* Frames that no stream has mixed to are silent. */
+	if (nframes > iodev->float_mix_frames) {
+		memset(buf + iodev->float_mix_frames * fmt->num_channels, 0,
+		       (nframes - iodev->float_mix_frames) *
+			fmt->num_channels * sizeof(*buf));
+		iodev->float_mix_frames = nframes;
+	}
+
+	if (iodev->pre_dsp_hook) {
+		cras_mix_quantize_float(fmt->format, frames, buf, nsamples);
+		iodev->pre_dsp_hook(frames, nframes, iodev->ext_format,
+				    iodev->pre_dsp_hook_cb_data);
+	}
+
+	if (iodev->ramp)
+		ramp_action = cras_ramp_get_current_action(iodev->ramp);
+
+	if (output_should_mute(iodev) &&
+	    ramp_action.type != CRAS_RAMP_ACTION_PARTIAL) {
+		const unsigned int frame_bytes = cras_get_format_bytes(fmt);
+		cras_mix_mute_buffer(frames, frame_bytes, nframes);
+	} else {
+		apply_dsp_float(iodev, buf, nframes);
+
+		if (iodev->post_dsp_hook) {
+			cras_mix_quantize_float(fmt->format, frames, buf,
+						nsamples);
+			iodev->post_dsp_hook(frames, nframes, fmt,
+					     iodev->post_dsp_hook_cb_data);
+		}
+
+		if (software_volume_needed)
+			software_volume_scaler =
+				cras_iodev_get_software_volume_scaler(iodev);
+
+		if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL) {
+			float starting_scaler = ramp_action.scaler;
+			float increment = ramp_action.increment;
+
+			if (software_volume_needed) {
+				starting_scaler *= software_volume_scaler;
+				increment *= software_volume_scaler;
+			}
+
+			cras_scale_float_buffer_increment(
+					buf, nframes, starting_scaler,
+					increment, fmt->num_channels);
+			cras_ramp_update_ramped_frames(iodev->ramp, nframes);
+		} else if (software_volume_needed) {
+			cras_scale_float_buffer(buf, nsamples,
+						software_volume_scaler);
+		}
+
+		cras_mix_quantize_float(fmt->format, frames, buf, nsamples);
+	}
+
+	consume_float_mix_frames(iodev, nframes);
+
+	return put_output_frames(iodev, frames, nframes);
+}
+
 int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes)
 {
 	const struct cras_audio_format *fmt = iodev->format;
-	struct cras_fmt_conv * remix_converter =
-			audio_thread_get_global_remix_converter();
 	struct cras_ramp_action ramp_action = {
 		.type = CRAS_RAMP_ACTION_NONE,
 		.scaler = 0.0f,
@@ -892,6 +1054,9 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 	float software_volume_scaler;
 	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
 
+	if (iodev->float_mix_buf)
+		return put_float_mix_output(iodev, frames, nframes);
+
 	if (iodev->pre_dsp_hook)
 		iodev->pre_dsp_hook(frames, nframes, iodev->ext_format,
 				    iodev->pre_dsp_hook_cb_data);
@@ -944,13 +1109,7 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 		}
 	}
 
-	if (remix_converter)
-		cras_channel_remix_convert(remix_converter,
-				   iodev->format,
-				   frames,
-				   nframes);
-	rate_estimator_add_frames(iodev->rate_est, nframes);
-	return iodev->put_buffer(iodev, nframes);
+	return put_output_frames(iodev, frames, nframes);
 }
 
 int cras_iodev_get_input_buffer(struct cras_iodev *iodev,
@@ -1106,6 +1265,11 @@ int cras_iodev_fill_odev_zeros(struct cras_iodev *odev, unsigned int frames)
 		/* This assumes consecutive channel areas. */
 		buf = area->channels[0].buf;
 		memset(buf, 0, frames_written * frame_bytes);
+		if (odev->float_mix_buf)
+			memset(odev->float_mix_buf, 0,
+			       MIN(frames_written, odev->float_mix_frames) *
+				odev->ext_format->num_channels *
+				sizeof(*odev->float_mix_buf));
 		cras_iodev_put_output_buffer(odev, buf, frames_written);
 		frames -= frames_written;
 	}
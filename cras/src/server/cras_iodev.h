@@ -17,6 +17,7 @@
 #include "cras_dsp.h"
 #include "cras_iodev_info.h"
 #include "cras_messages.h"
+#include "latency_hist.h"
 
 struct buffer_share;
 struct cras_ramp;
@@ -169,6 +170,16 @@ struct cras_ionode {
  * reset_request_pending - The flag for pending reset request.
  * ramp - The cras_ramp struct to control ramping up/down at mute/unmute and
  *        start of playback.
+ * float_mix_enabled - For output: True to mix streams on a float32 bus and
+ *     quantize to the device format once, after DSP and volume.
+ * float_mix_buf - The float32 mix bus allocated when the device is opened with
+ *     float_mix_enabled set, NULL otherwise. Samples are interleaved with the
+ *     channel count of ext_format and frame 0 is the next frame that will be
+ *     committed to the device.
+ * float_mix_frames - The number of frames at the start of float_mix_buf that
+ *     hold mixed samples.
+ * hw_io_hist - Time the audio thread spends writing to (output) or reading
+ *     from (input) the hardware buffer on each wake.
  */
 struct cras_iodev {
 	void (*set_volume)(struct cras_iodev *iodev);
@@ -230,6 +241,10 @@ struct cras_iodev {
 	void *post_dsp_hook_cb_data;
 	int reset_request_pending;
 	struct cras_ramp* ramp;
+	int float_mix_enabled;
+	float *float_mix_buf;
+	unsigned int float_mix_frames;
+	struct latency_hist hw_io_hist;
 	struct cras_iodev *prev, *next;
 };
 
@@ -506,7 +521,9 @@ int cras_iodev_buffer_avail(struct cras_iodev *iodev, unsigned hw_level);
 /* Marks a buffer from get_buffer as read. */
 int cras_iodev_put_input_buffer(struct cras_iodev *iodev, unsigned int nframes);
 
-/* Marks a buffer from get_buffer as written. */
+/* Marks a buffer from get_buffer as written. If the device has a float mix
+ * bus the first nframes frames of it are processed and quantized into frames
+ * and then dropped from the bus. */
 int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes);
 
@@ -1005,7 +1005,7 @@ cras_node_id_t cras_iodev_list_get_active_node_id(
 
 void cras_iodev_list_update_device_list()
 {
-	struct cras_server_state *state;
+	struct cras_server_state_lists *state;
 
 	state = cras_system_state_update_begin();
 	if (!state)
@@ -1196,6 +1196,52 @@ struct stream_list *cras_iodev_list_get_stream_list()
 	return stream_list;
 }
 
+void cras_iodev_list_get_latency_info(struct latency_debug_info *info)
+{
+	struct cras_iodev *dev;
+	struct cras_rstream *rstream;
+	int dir;
+
+	if (audio_thread)
+		latency_hist_get(&audio_thread->wake_jitter_hist,
+				 &info->wake_jitter);
+	else
+		memset(&info->wake_jitter, 0, sizeof(info->wake_jitter));
+
+	info->num_devs = 0;
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH(devs[dir].iodevs, dev) {
+			struct dev_latency_debug_info *di;
+
+			if (info->num_devs == MAX_DEBUG_DEVS)
+				break;
+			if (!cras_iodev_is_open(dev))
+				continue;
+			di = &info->devs[info->num_devs++];
+			strncpy(di->dev_name, dev->info.name,
+				sizeof(di->dev_name) - 1);
+			di->dev_name[sizeof(di->dev_name) - 1] = '\0';
+			di->dev_idx = dev->info.idx;
+			di->direction = dev->direction;
+			latency_hist_get(&dev->hw_io_hist, &di->hw_io);
+		}
+	}
+
+	info->num_streams = 0;
+	DL_FOREACH(stream_list_get(stream_list), rstream) {
+		struct stream_latency_debug_info *si;
+
+		if (info->num_streams == MAX_DEBUG_STREAMS)
+			break;
+		si = &info->streams[info->num_streams++];
+		si->stream_id = rstream->stream_id;
+		si->direction = rstream->direction;
+		latency_hist_get(&rstream->fetch_hist, &si->fetch);
+		latency_hist_get(&rstream->cb_response_hist,
+				 &si->cb_response);
+	}
+}
+
 int cras_iodev_list_set_device_enabled_callback(
 		device_enabled_callback_t device_enabled_cb, void *cb_data)
 {
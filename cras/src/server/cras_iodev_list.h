@@ -204,6 +204,14 @@ struct audio_thread *cras_iodev_list_get_audio_thread();
 /* Gets the list of all active audio streams attached to devices. */
 struct stream_list *cras_iodev_list_get_stream_list();
 
+/* Fills info with the latency histograms of the audio thread, the open
+ * devices and the streams. Must be called from the main thread, the audio
+ * thread keeps updating the histograms while they are read.
+ * Args:
+ *    info - The debug info to fill.
+ */
+void cras_iodev_list_get_latency_info(struct latency_debug_info *info);
+
 /* Sets the function to call when a device is enabled or disabled. */
 int cras_iodev_list_set_device_enabled_callback(
 		device_enabled_callback_t device_enabled_cb, void *cb_data);
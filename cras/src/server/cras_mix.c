@@ -78,3 +78,28 @@ size_t cras_mix_mute_buffer(uint8_t *dst,
 {
 	return ops->mute_buffer(dst, frame_bytes, count);
 }
+
+void cras_mix_add_float(snd_pcm_format_t fmt, float *dst, const uint8_t *src,
+			unsigned int count, int mute, float mix_vol)
+{
+	ops->add_float(fmt, dst, src, count, mute, mix_vol);
+}
+
+void cras_scale_float_buffer_increment(float *buff, unsigned int frame,
+				       float scaler, float increment,
+				       int channel)
+{
+	ops->scale_float_buffer_increment(buff, frame * channel, scaler,
+					  increment, channel);
+}
+
+void cras_scale_float_buffer(float *buff, unsigned int count, float scaler)
+{
+	ops->scale_float_buffer(buff, count, scaler);
+}
+
+void cras_mix_quantize_float(snd_pcm_format_t fmt, uint8_t *dst,
+			     const float *src, unsigned int count)
+{
+	ops->quantize_float(fmt, dst, src, count);
+}
@@ -79,4 +79,48 @@ size_t cras_mix_mute_buffer(uint8_t *dst,
 			    size_t frame_bytes,
 			    size_t count);
 
+/* Converts src to float and adds it to the float mix buffer dst. The float
+ * samples are normalized to the full scale of fmt and are not clipped.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*) of src.
+ *    dst - Float buffer of samples to mix to.
+ *    src - Buffer of samples to mix from.
+ *    count - The number of samples to mix.
+ *    mute - Is the stream providing the buffer muted.
+ *    mix_vol - Scaler for the buffer to be mixed.
+ */
+void cras_mix_add_float(snd_pcm_format_t fmt, float *dst, const uint8_t *src,
+			unsigned int count, int mute, float mix_vol);
+
+/* Float version of cras_scale_buffer_increment.
+ * Args:
+ *    buff - Float buffer of samples to scale.
+ *    frame - The number of frames to render.
+ *    scaler - Amount to scale samples (0.0 - 1.0).
+ *    increment - The increment(+/-) of scaler at each frame.
+ *    channel - Number of samples in a frame.
+ */
+void cras_scale_float_buffer_increment(float *buff, unsigned int frame,
+				       float scaler, float increment,
+				       int channel);
+
+/* Float version of cras_scale_buffer.
+ * Args:
+ *    buff - Float buffer of samples to scale.
+ *    count - The number of samples to scale.
+ *    scaler - Amount to scale samples (0.0 - 1.0).
+ */
+void cras_scale_float_buffer(float *buff, unsigned int count, float scaler);
+
+/* Converts a float mix buffer back to the given format, rounding and
+ * clipping each sample.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*) of dst.
+ *    dst - Buffer to write the samples to.
+ *    src - Float buffer of samples normalized to the full scale of fmt.
+ *    count - The number of samples to convert.
+ */
+void cras_mix_quantize_float(snd_pcm_format_t fmt, uint8_t *dst,
+			     const float *src, unsigned int count);
+
 #endif /* _CRAS_MIX_H */
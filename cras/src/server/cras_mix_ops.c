@@ -4,6 +4,7 @@
  */
 
 #include <stdint.h>
+#include <sys/param.h>
 
 #include "cras_system_state.h"
 #include "cras_mix_ops.h"
@@ -11,6 +12,9 @@
 #define MAX_VOLUME_TO_SCALE 0.9999999
 #define MIN_VOLUME_TO_SCALE 0.0000001
 
+#define S24_MAX 0x007fffff
+#define S24_MIN ((int32_t)0xff800000)
+
 /* function suffixes for SIMD ops */
 #ifdef OPS_SSE42
 	#define OPS(a) a ## _sse42
@@ -32,6 +36,631 @@ static inline int need_to_scale(float scaler) {
 	return (scaler < 0.99 || scaler > 1.01);
 }
 
+/*
+ * SIMD kernels.
+ *
+ * Each kernel handles the largest prefix of the buffer that fills whole
+ * vectors and returns the number of samples it processed, the scalar loops
+ * below finish the remainder. The kernels do the same float multiply and
+ * truncation as the scalar code so the output is bit-exact with it; the
+ * saturating adds replace the compare-and-clip of the scalar loops.
+ *
+ * The vec_* helpers wrap the instruction set this copy of the file is built
+ * for. x86 builds pick them up from the -m flags of the sse42/avx/avx2/fma
+ * variants, ARM builds always have NEON.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define MIX_SIMD_LANES 8
+#define MIX_SIMD_S16_LANES 16
+
+typedef __m256i vec_i32;
+typedef __m256 vec_f32;
+
+static inline void vec_adds_s16(int16_t *dst, const int16_t *src)
+{
+	__m256i d = _mm256_loadu_si256((const __m256i *)dst);
+	__m256i s = _mm256_loadu_si256((const __m256i *)src);
+	_mm256_storeu_si256((__m256i *)dst, _mm256_adds_epi16(d, s));
+}
+
+static inline vec_i32 vec_load_s16(const int16_t *p)
+{
+	return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+
+/* Stores with saturation to the S16 range. */
+static inline void vec_store_s16(int16_t *p, vec_i32 v)
+{
+	_mm_storeu_si128((__m128i *)p,
+			 _mm_packs_epi32(_mm256_castsi256_si128(v),
+					 _mm256_extracti128_si256(v, 1)));
+}
+
+/* Loads every other sample, starting from the first. */
+static inline vec_i32 vec_load_s16_even(const int16_t *p)
+{
+	__m256i x = _mm256_loadu_si256((const __m256i *)p);
+	return _mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16);
+}
+
+/* Stores to every other sample with saturation, leaving the odd ones. */
+static inline void vec_store_s16_even(int16_t *p, vec_i32 v)
+{
+	__m256i x = _mm256_loadu_si256((const __m256i *)p);
+	v = _mm256_min_epi32(_mm256_max_epi32(v, _mm256_set1_epi32(INT16_MIN)),
+			     _mm256_set1_epi32(INT16_MAX));
+	_mm256_storeu_si256((__m256i *)p, _mm256_blend_epi16(x, v, 0x55));
+}
+
+static inline vec_i32 vec_load_s32(const int32_t *p)
+{
+	return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline void vec_store_s32(int32_t *p, vec_i32 v)
+{
+	_mm256_storeu_si256((__m256i *)p, v);
+}
+
+/* The even lanes come back in a shuffled order, vec_store_s32_even undoes
+ * the same shuffle so lane-wise math in between is unaffected. */
+static inline vec_i32 vec_load_s32_even(const int32_t *p)
+{
+	__m256 a = _mm256_loadu_ps((const float *)p);
+	__m256 b = _mm256_loadu_ps((const float *)(p + 8));
+	return _mm256_castps_si256(
+			_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline void vec_store_s32_even(int32_t *p, vec_i32 v)
+{
+	__m256 a = _mm256_loadu_ps((const float *)p);
+	__m256 b = _mm256_loadu_ps((const float *)(p + 8));
+	__m256i odd = _mm256_castps_si256(
+			_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	_mm256_storeu_si256((__m256i *)p, _mm256_unpacklo_epi32(v, odd));
+	_mm256_storeu_si256((__m256i *)(p + 8), _mm256_unpackhi_epi32(v, odd));
+}
+
+#define vec_load_f32 _mm256_loadu_ps
+#define vec_set1_f32 _mm256_set1_ps
+#define vec_set1_i32 _mm256_set1_epi32
+#define vec_cvt_f32 _mm256_cvtepi32_ps
+#define vec_cvtt_i32 _mm256_cvttps_epi32
+#define vec_mul_f32 _mm256_mul_ps
+#define vec_add_f32 _mm256_add_ps
+#define vec_add_i32 _mm256_add_epi32
+
+static inline vec_i32 vec_clamp_i32(vec_i32 v, int32_t lo, int32_t hi)
+{
+	return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_set1_epi32(lo)),
+				_mm256_set1_epi32(hi));
+}
+
+/* cvttps2dq returns INT32_MIN for anything out of range, fix up the lanes
+ * that overflowed in the positive direction. */
+static inline vec_i32 vec_cvtt_sat_i32(vec_f32 f)
+{
+	__m256 ovf = _mm256_cmp_ps(f, _mm256_set1_ps(2147483648.0f),
+				   _CMP_GE_OQ);
+	return _mm256_blendv_epi8(_mm256_cvttps_epi32(f),
+				  _mm256_set1_epi32(INT32_MAX),
+				  _mm256_castps_si256(ovf));
+}
+
+/* Picks orig in the lanes where gain is exactly 1.0, scaled elsewhere. */
+static inline vec_i32 vec_keep_unity_i32(vec_f32 gain, vec_i32 orig,
+					 vec_i32 scaled)
+{
+	__m256 unity = _mm256_cmp_ps(gain, _mm256_set1_ps(1.0f), _CMP_EQ_OQ);
+	return _mm256_blendv_epi8(scaled, orig, _mm256_castps_si256(unity));
+}
+
+static inline vec_i32 vec_adds_i32(vec_i32 a, vec_i32 b)
+{
+	__m256i sum = _mm256_add_epi32(a, b);
+	/* A lane overflowed if its sign differs from both operands. */
+	__m256i ovf = _mm256_and_si256(_mm256_xor_si256(sum, a),
+				       _mm256_xor_si256(sum, b));
+	__m256i sat = _mm256_xor_si256(_mm256_srai_epi32(a, 31),
+				       _mm256_set1_epi32(INT32_MAX));
+	return _mm256_blendv_epi8(sum, sat, _mm256_srai_epi32(ovf, 31));
+}
+
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+
+#define MIX_SIMD_LANES 4
+#define MIX_SIMD_S16_LANES 8
+
+typedef __m128i vec_i32;
+typedef __m128 vec_f32;
+
+static inline void vec_adds_s16(int16_t *dst, const int16_t *src)
+{
+	__m128i d = _mm_loadu_si128((const __m128i *)dst);
+	__m128i s = _mm_loadu_si128((const __m128i *)src);
+	_mm_storeu_si128((__m128i *)dst, _mm_adds_epi16(d, s));
+}
+
+static inline vec_i32 vec_load_s16(const int16_t *p)
+{
+	return _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)p));
+}
+
+/* Stores with saturation to the S16 range. */
+static inline void vec_store_s16(int16_t *p, vec_i32 v)
+{
+	_mm_storel_epi64((__m128i *)p, _mm_packs_epi32(v, v));
+}
+
+/* Loads every other sample, starting from the first. */
+static inline vec_i32 vec_load_s16_even(const int16_t *p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	return _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+}
+
+/* Stores to every other sample with saturation, leaving the odd ones. */
+static inline void vec_store_s16_even(int16_t *p, vec_i32 v)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	v = _mm_min_epi32(_mm_max_epi32(v, _mm_set1_epi32(INT16_MIN)),
+			  _mm_set1_epi32(INT16_MAX));
+	_mm_storeu_si128((__m128i *)p, _mm_blend_epi16(x, v, 0x55));
+}
+
+static inline vec_i32 vec_load_s32(const int32_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void vec_store_s32(int32_t *p, vec_i32 v)
+{
+	_mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline vec_i32 vec_load_s32_even(const int32_t *p)
+{
+	__m128 a = _mm_loadu_ps((const float *)p);
+	__m128 b = _mm_loadu_ps((const float *)(p + 4));
+	return _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline void vec_store_s32_even(int32_t *p, vec_i32 v)
+{
+	__m128 a = _mm_loadu_ps((const float *)p);
+	__m128 b = _mm_loadu_ps((const float *)(p + 4));
+	__m128i odd = _mm_castps_si128(
+			_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	_mm_storeu_si128((__m128i *)p, _mm_unpacklo_epi32(v, odd));
+	_mm_storeu_si128((__m128i *)(p + 4), _mm_unpackhi_epi32(v, odd));
+}
+
+#define vec_load_f32 _mm_loadu_ps
+#define vec_set1_f32 _mm_set1_ps
+#define vec_set1_i32 _mm_set1_epi32
+#define vec_cvt_f32 _mm_cvtepi32_ps
+#define vec_cvtt_i32 _mm_cvttps_epi32
+#define vec_mul_f32 _mm_mul_ps
+#define vec_add_f32 _mm_add_ps
+#define vec_add_i32 _mm_add_epi32
+
+static inline vec_i32 vec_clamp_i32(vec_i32 v, int32_t lo, int32_t hi)
+{
+	return _mm_min_epi32(_mm_max_epi32(v, _mm_set1_epi32(lo)),
+			     _mm_set1_epi32(hi));
+}
+
+/* cvttps2dq returns INT32_MIN for anything out of range, fix up the lanes
+ * that overflowed in the positive direction. */
+static inline vec_i32 vec_cvtt_sat_i32(vec_f32 f)
+{
+	__m128 ovf = _mm_cmpge_ps(f, _mm_set1_ps(2147483648.0f));
+	return _mm_blendv_epi8(_mm_cvttps_epi32(f), _mm_set1_epi32(INT32_MAX),
+			       _mm_castps_si128(ovf));
+}
+
+/* Picks orig in the lanes where gain is exactly 1.0, scaled elsewhere. */
+static inline vec_i32 vec_keep_unity_i32(vec_f32 gain, vec_i32 orig,
+					 vec_i32 scaled)
+{
+	__m128 unity = _mm_cmpeq_ps(gain, _mm_set1_ps(1.0f));
+	return _mm_blendv_epi8(scaled, orig, _mm_castps_si128(unity));
+}
+
+static inline vec_i32 vec_adds_i32(vec_i32 a, vec_i32 b)
+{
+	__m128i sum = _mm_add_epi32(a, b);
+	/* A lane overflowed if its sign differs from both operands. */
+	__m128i ovf = _mm_and_si128(_mm_xor_si128(sum, a),
+				    _mm_xor_si128(sum, b));
+	__m128i sat = _mm_xor_si128(_mm_srai_epi32(a, 31),
+				    _mm_set1_epi32(INT32_MAX));
+	return _mm_blendv_epi8(sum, sat, _mm_srai_epi32(ovf, 31));
+}
+
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+
+#define MIX_SIMD_LANES 4
+#define MIX_SIMD_S16_LANES 8
+
+typedef int32x4_t vec_i32;
+typedef float32x4_t vec_f32;
+
+static inline void vec_adds_s16(int16_t *dst, const int16_t *src)
+{
+	vst1q_s16(dst, vqaddq_s16(vld1q_s16(dst), vld1q_s16(src)));
+}
+
+static inline vec_i32 vec_load_s16(const int16_t *p)
+{
+	return vmovl_s16(vld1_s16(p));
+}
+
+/* Stores with saturation to the S16 range. */
+static inline void vec_store_s16(int16_t *p, vec_i32 v)
+{
+	vst1_s16(p, vqmovn_s32(v));
+}
+
+/* Loads every other sample, starting from the first. */
+static inline vec_i32 vec_load_s16_even(const int16_t *p)
+{
+	return vmovl_s16(vld2_s16(p).val[0]);
+}
+
+/* Stores to every other sample with saturation, leaving the odd ones. */
+static inline void vec_store_s16_even(int16_t *p, vec_i32 v)
+{
+	int16x4x2_t x = vld2_s16(p);
+	x.val[0] = vqmovn_s32(v);
+	vst2_s16(p, x);
+}
+
+#define vec_load_s32 vld1q_s32
+#define vec_store_s32 vst1q_s32
+
+static inline vec_i32 vec_load_s32_even(const int32_t *p)
+{
+	return vld2q_s32(p).val[0];
+}
+
+static inline void vec_store_s32_even(int32_t *p, vec_i32 v)
+{
+	int32x4x2_t x = vld2q_s32(p);
+	x.val[0] = v;
+	vst2q_s32(p, x);
+}
+
+#define vec_load_f32 vld1q_f32
+#define vec_set1_f32 vdupq_n_f32
+#define vec_set1_i32 vdupq_n_s32
+#define vec_cvt_f32 vcvtq_f32_s32
+#define vec_mul_f32 vmulq_f32
+#define vec_add_f32 vaddq_f32
+#define vec_add_i32 vaddq_s32
+#define vec_adds_i32 vqaddq_s32
+/* vcvt already saturates out of range values. */
+#define vec_cvtt_i32 vcvtq_s32_f32
+#define vec_cvtt_sat_i32 vcvtq_s32_f32
+
+static inline vec_i32 vec_clamp_i32(vec_i32 v, int32_t lo, int32_t hi)
+{
+	return vminq_s32(vmaxq_s32(v, vdupq_n_s32(lo)), vdupq_n_s32(hi));
+}
+
+/* Picks orig in the lanes where gain is exactly 1.0, scaled elsewhere. */
+static inline vec_i32 vec_keep_unity_i32(vec_f32 gain, vec_i32 orig,
+					 vec_i32 scaled)
+{
+	return vbslq_s32(vceqq_f32(gain, vdupq_n_f32(1.0f)), orig, scaled);
+}
+#endif
+
+#ifdef MIX_SIMD_LANES
+
+/* Samples worth of per-sample gains computed at a time for volume ramps. */
+#define MIX_RAMP_BLOCK 256
+
+static size_t simd_add_clip_s16(int16_t *dst, const int16_t *src, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_S16_LANES <= count; i += MIX_SIMD_S16_LANES)
+		vec_adds_s16(dst + i, src + i);
+	return i;
+}
+
+static size_t simd_scale_add_clip_s16(int16_t *dst, const int16_t *src,
+				      size_t count, float vol)
+{
+	vec_f32 scale = vec_set1_f32(vol);
+	vec_i32 s;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		s = vec_cvtt_i32(vec_mul_f32(vec_cvt_f32(vec_load_s16(src + i)),
+					     scale));
+		vec_store_s16(dst + i, vec_add_i32(vec_load_s16(dst + i), s));
+	}
+	return i;
+}
+
+/* Also used in place to scale a buffer. */
+static size_t simd_copy_scaled_s16(int16_t *dst, const int16_t *src,
+				   size_t count, float vol)
+{
+	vec_f32 scale = vec_set1_f32(vol);
+	vec_f32 f;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		f = vec_mul_f32(vec_cvt_f32(vec_load_s16(src + i)), scale);
+		vec_store_s16(dst + i, vec_cvtt_i32(f));
+	}
+	return i;
+}
+
+static size_t simd_scale_gains_s16(int16_t *buf, const float *gains,
+				   size_t count)
+{
+	vec_f32 f;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		f = vec_mul_f32(vec_cvt_f32(vec_load_s16(buf + i)),
+				vec_load_f32(gains + i));
+		vec_store_s16(buf + i, vec_cvtt_i32(f));
+	}
+	return i;
+}
+
+/* Handles the contiguous case and the case of every other sample, which is
+ * one channel of a stereo stream. Other strides are left to the caller. */
+static size_t simd_scale_add_stride_s16(int16_t *dst, const int16_t *src,
+					unsigned int dst_stride,
+					unsigned int src_stride,
+					size_t count, float scaler)
+{
+	vec_f32 scale = vec_set1_f32(scaler);
+	int scaled = need_to_scale(scaler);
+	vec_i32 d, s;
+	size_t i;
+
+	if (dst_stride != src_stride)
+		return 0;
+
+	if (dst_stride == 2) {
+		for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+			d = vec_load_s16(dst + i);
+			s = vec_load_s16(src + i);
+			if (scaled)
+				d = vec_cvtt_i32(vec_add_f32(vec_cvt_f32(d),
+					vec_mul_f32(vec_cvt_f32(s), scale)));
+			else
+				d = vec_add_i32(d, s);
+			vec_store_s16(dst + i, d);
+		}
+		return i;
+	}
+
+	/* Each vector covers the sample after the last frame too, which is
+	 * past the end of the area when mixing the second channel. Leave the
+	 * last frame to the caller. */
+	if (dst_stride == 4) {
+		for (i = 0; i + MIX_SIMD_LANES < count; i += MIX_SIMD_LANES) {
+			d = vec_load_s16_even(dst + 2 * i);
+			s = vec_load_s16_even(src + 2 * i);
+			if (scaled)
+				d = vec_cvtt_i32(vec_add_f32(vec_cvt_f32(d),
+					vec_mul_f32(vec_cvt_f32(s), scale)));
+			else
+				d = vec_add_i32(d, s);
+			vec_store_s16_even(dst + 2 * i, d);
+		}
+		return i;
+	}
+
+	return 0;
+}
+
+static size_t simd_add_clip_s24(int32_t *dst, const int32_t *src, size_t count)
+{
+	vec_i32 sum;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		sum = vec_add_i32(vec_load_s32(dst + i), vec_load_s32(src + i));
+		vec_store_s32(dst + i, vec_clamp_i32(sum, S24_MIN, S24_MAX));
+	}
+	return i;
+}
+
+static size_t simd_scale_add_clip_s24(int32_t *dst, const int32_t *src,
+				      size_t count, float vol)
+{
+	vec_f32 scale = vec_set1_f32(vol);
+	vec_i32 s, sum;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		s = vec_cvtt_i32(vec_mul_f32(vec_cvt_f32(vec_load_s32(src + i)),
+					     scale));
+		sum = vec_add_i32(vec_load_s32(dst + i), s);
+		vec_store_s32(dst + i, vec_clamp_i32(sum, S24_MIN, S24_MAX));
+	}
+	return i;
+}
+
+static size_t simd_add_clip_s32(int32_t *dst, const int32_t *src, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES)
+		vec_store_s32(dst + i, vec_adds_i32(vec_load_s32(dst + i),
+						    vec_load_s32(src + i)));
+	return i;
+}
+
+static size_t simd_scale_add_clip_s32(int32_t *dst, const int32_t *src,
+				      size_t count, float vol)
+{
+	vec_f32 scale = vec_set1_f32(vol);
+	vec_i32 s;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		s = vec_cvtt_i32(vec_mul_f32(vec_cvt_f32(vec_load_s32(src + i)),
+					     scale));
+		vec_store_s32(dst + i, vec_adds_i32(vec_load_s32(dst + i), s));
+	}
+	return i;
+}
+
+/* Shared by S24_LE and S32_LE, also used in place to scale a buffer. */
+static size_t simd_copy_scaled_s32(int32_t *dst, const int32_t *src,
+				   size_t count, float vol)
+{
+	vec_f32 scale = vec_set1_f32(vol);
+	vec_f32 f;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		f = vec_mul_f32(vec_cvt_f32(vec_load_s32(src + i)), scale);
+		vec_store_s32(dst + i, vec_cvtt_i32(f));
+	}
+	return i;
+}
+
+/* Samples wider than 24 bits don't survive the trip through float, so the
+ * ones at unity gain are passed through untouched like the scalar ramp
+ * does. */
+static size_t simd_scale_gains_s32(int32_t *buf, const float *gains,
+				   size_t count)
+{
+	vec_f32 f, g;
+	vec_i32 v;
+	size_t i;
+
+	for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+		v = vec_load_s32(buf + i);
+		g = vec_load_f32(gains + i);
+		f = vec_mul_f32(vec_cvt_f32(v), g);
+		vec_store_s32(buf + i,
+			      vec_keep_unity_i32(g, v, vec_cvtt_i32(f)));
+	}
+	return i;
+}
+
+/* Mixes one S24_LE or S32_LE value per lane, as the scalar stride loops do.
+ * S24_LE clamps to 24 bits, S32_LE sums with 32 bit saturation. */
+static inline vec_i32 simd_stride_sum_s32(vec_i32 d, vec_i32 s, int scaled,
+					  vec_f32 scale, int is_s24)
+{
+	vec_f32 f;
+
+	if (scaled) {
+		f = vec_add_f32(vec_cvt_f32(d),
+				vec_mul_f32(vec_cvt_f32(s), scale));
+		if (is_s24)
+			return vec_clamp_i32(vec_cvtt_i32(f), S24_MIN, S24_MAX);
+		return vec_cvtt_sat_i32(f);
+	}
+	if (is_s24)
+		return vec_clamp_i32(vec_add_i32(d, s), S24_MIN, S24_MAX);
+	return vec_adds_i32(d, s);
+}
+
+static size_t simd_scale_add_stride_s32(int32_t *dst, const int32_t *src,
+					unsigned int dst_stride,
+					unsigned int src_stride,
+					size_t count, float scaler, int is_s24)
+{
+	vec_f32 scale = vec_set1_f32(scaler);
+	int scaled = need_to_scale(scaler);
+	vec_i32 d;
+	size_t i;
+
+	if (dst_stride != src_stride)
+		return 0;
+
+	if (dst_stride == 4) {
+		for (i = 0; i + MIX_SIMD_LANES <= count; i += MIX_SIMD_LANES) {
+			d = simd_stride_sum_s32(vec_load_s32(dst + i),
+						vec_load_s32(src + i),
+						scaled, scale, is_s24);
+			vec_store_s32(dst + i, d);
+		}
+		return i;
+	}
+
+	/* Like the s16 case, keep the vectors off the sample after the last
+	 * frame. */
+	if (dst_stride == 8) {
+		for (i = 0; i + MIX_SIMD_LANES < count; i += MIX_SIMD_LANES) {
+			d = simd_stride_sum_s32(vec_load_s32_even(dst + 2 * i),
+						vec_load_s32_even(src + 2 * i),
+						scaled, scale, is_s24);
+			vec_store_s32_even(dst + 2 * i, d);
+		}
+		return i;
+	}
+
+	return 0;
+}
+
+/* Gain of one frame of a volume ramp, matching the checks of the scalar
+ * ramp loops. Multiplying by exactly 1.0 or 0.0 reproduces their skip and
+ * zero cases. */
+static inline float ramp_gain(float scaler)
+{
+	if (scaler > MAX_VOLUME_TO_SCALE)
+		return 1.0f;
+	if (scaler < MIN_VOLUME_TO_SCALE)
+		return 0.0f;
+	return scaler;
+}
+
+/* Fills gains with one entry per sample for as many whole frames of the ramp
+ * as fit in both MIX_RAMP_BLOCK and count, advancing scaler once per frame.
+ * Returns the number of samples filled. */
+static unsigned int fill_ramp_gains(float *gains, unsigned int count,
+				    int step, float *scaler, float increment)
+{
+	unsigned int n = 0;
+	float gain;
+	int j;
+
+	while (n + step <= MIN(count, MIX_RAMP_BLOCK)) {
+		gain = ramp_gain(*scaler);
+		for (j = 0; j < step; j++)
+			gains[n++] = gain;
+		*scaler += increment;
+	}
+	return n;
+}
+
+#else
+
+#define simd_add_clip_s16(dst, src, count) 0
+#define simd_scale_add_clip_s16(dst, src, count, vol) 0
+#define simd_copy_scaled_s16(dst, src, count, vol) 0
+#define simd_scale_add_stride_s16(dst, src, dst_stride, src_stride, count, \
+				  scaler) 0
+#define simd_add_clip_s24(dst, src, count) 0
+#define simd_scale_add_clip_s24(dst, src, count, vol) 0
+#define simd_add_clip_s32(dst, src, count) 0
+#define simd_scale_add_clip_s32(dst, src, count, vol) 0
+#define simd_copy_scaled_s32(dst, src, count, vol) 0
+#define simd_scale_add_stride_s32(dst, src, dst_stride, src_stride, count, \
+				  scaler, is_s24) 0
+
+#endif /* MIX_SIMD_LANES */
+
 /*
  * Signed 16 bit little endian functions.
  */
@@ -43,7 +672,7 @@ static void cras_mix_add_clip_s16_le(int16_t *dst,
 	int32_t sum;
 	size_t i;
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_add_clip_s16(dst, src, count); i < count; i++) {
 		sum = dst[i] + src[i];
 		if (sum > INT16_MAX)
 			sum = INT16_MAX;
@@ -66,7 +695,8 @@ static void scale_add_clip_s16_le(int16_t *dst,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s16_le(dst, src, count);
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_scale_add_clip_s16(dst, src, count, vol);
+	     i < count; i++) {
 		sum = dst[i] + (int16_t)(src[i] * vol);
 		if (sum > INT16_MAX)
 			sum = INT16_MAX;
@@ -90,7 +720,8 @@ static void copy_scaled_s16_le(int16_t *dst,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_copy_scaled_s16(dst, src, count, volume_scaler);
+	     i < count; i++)
 		dst[i] = src[i] * volume_scaler;
 }
 
@@ -108,6 +739,22 @@ static void cras_scale_buffer_inc_s16_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#ifdef MIX_SIMD_LANES
+	if (step <= MIX_RAMP_BLOCK) {
+		float gains[MIX_RAMP_BLOCK];
+		unsigned int n, k;
+
+		while ((n = fill_ramp_gains(gains, count - i, step, &scaler,
+					    increment))) {
+			for (k = simd_scale_gains_s16(out + i, gains, n);
+			     k < n; k++)
+				out[i + k] *= gains[k];
+			i += n;
+		}
+		return;
+	}
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			if (scaler > MAX_VOLUME_TO_SCALE) {
@@ -136,7 +783,7 @@ static void cras_scale_buffer_s16_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_copy_scaled_s16(out, out, count, scaler); i < count; i++)
 		out[i] *= scaler;
 }
 
@@ -167,10 +814,15 @@ static void cras_mix_add_scale_stride_s16_le(uint8_t *dst, uint8_t *src,
 {
 	unsigned int i;
 
+	i = simd_scale_add_stride_s16((int16_t *)dst, (const int16_t *)src,
+				      dst_stride, src_stride, count, scaler);
+	dst += i * dst_stride;
+	src += i * src_stride;
+
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 2) {
 
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int16_t *)dst +
@@ -187,7 +839,7 @@ static void cras_mix_add_scale_stride_s16_le(uint8_t *dst, uint8_t *src,
 		}
 	} else if (dst_stride == src_stride && dst_stride == 4) {
 
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int16_t *)dst +
@@ -203,7 +855,7 @@ static void cras_mix_add_scale_stride_s16_le(uint8_t *dst, uint8_t *src,
 			src += 4;
 		}
 	} else {
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int16_t *)dst +
@@ -232,7 +884,7 @@ static void cras_mix_add_clip_s24_le(int32_t *dst,
 	int32_t sum;
 	size_t i;
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_add_clip_s24(dst, src, count); i < count; i++) {
 		sum = dst[i] + src[i];
 		if (sum > 0x007fffff)
 			sum = 0x007fffff;
@@ -255,7 +907,8 @@ static void scale_add_clip_s24_le(int32_t *dst,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s24_le(dst, src, count);
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_scale_add_clip_s24(dst, src, count, vol);
+	     i < count; i++) {
 		sum = dst[i] + (int32_t)(src[i] * vol);
 		if (sum > 0x007fffff)
 			sum = 0x007fffff;
@@ -279,7 +932,8 @@ static void copy_scaled_s24_le(int32_t *dst,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_copy_scaled_s32(dst, src, count, volume_scaler);
+	     i < count; i++)
 		dst[i] = src[i] * volume_scaler;
 }
 
@@ -297,6 +951,23 @@ static void cras_scale_buffer_inc_s24_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#ifdef MIX_SIMD_LANES
+	if (step <= MIX_RAMP_BLOCK) {
+		float gains[MIX_RAMP_BLOCK];
+		unsigned int n, k;
+
+		while ((n = fill_ramp_gains(gains, count - i, step, &scaler,
+					    increment))) {
+			for (k = simd_scale_gains_s32(out + i, gains, n);
+			     k < n; k++)
+				if (gains[k] != 1.0f)
+					out[i + k] *= gains[k];
+			i += n;
+		}
+		return;
+	}
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			if (scaler > MAX_VOLUME_TO_SCALE) {
@@ -325,7 +996,7 @@ static void cras_scale_buffer_s24_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_copy_scaled_s32(out, out, count, scaler); i < count; i++)
 		out[i] *= scaler;
 }
 
@@ -356,10 +1027,15 @@ static void cras_mix_add_scale_stride_s24_le(uint8_t *dst, uint8_t *src,
 {
 	unsigned int i;
 
+	i = simd_scale_add_stride_s32((int32_t *)dst, (const int32_t *)src,
+				      dst_stride, src_stride, count, scaler, 1);
+	dst += i * dst_stride;
+	src += i * src_stride;
+
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 4) {
 
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int32_t *)dst +
@@ -376,7 +1052,7 @@ static void cras_mix_add_scale_stride_s24_le(uint8_t *dst, uint8_t *src,
 		}
 	} else {
 
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int32_t *)dst +
@@ -405,7 +1081,7 @@ static void cras_mix_add_clip_s32_le(int32_t *dst,
 	int64_t sum;
 	size_t i;
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_add_clip_s32(dst, src, count); i < count; i++) {
 		sum = (int64_t)dst[i] + (int64_t)src[i];
 		if (sum > INT32_MAX)
 			sum = INT32_MAX;
@@ -428,7 +1104,8 @@ static void scale_add_clip_s32_le(int32_t *dst,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s32_le(dst, src, count);
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_scale_add_clip_s32(dst, src, count, vol);
+	     i < count; i++) {
 		sum = (int64_t)dst[i] + (int64_t)(src[i] * vol);
 		if (sum > INT32_MAX)
 			sum = INT32_MAX;
@@ -452,7 +1129,8 @@ static void copy_scaled_s32_le(int32_t *dst,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_copy_scaled_s32(dst, src, count, volume_scaler);
+	     i < count; i++)
 		dst[i] = src[i] * volume_scaler;
 }
 
@@ -470,6 +1148,23 @@ static void cras_scale_buffer_inc_s32_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#ifdef MIX_SIMD_LANES
+	if (step <= MIX_RAMP_BLOCK) {
+		float gains[MIX_RAMP_BLOCK];
+		unsigned int n, k;
+
+		while ((n = fill_ramp_gains(gains, count - i, step, &scaler,
+					    increment))) {
+			for (k = simd_scale_gains_s32(out + i, gains, n);
+			     k < n; k++)
+				if (gains[k] != 1.0f)
+					out[i + k] *= gains[k];
+			i += n;
+		}
+		return;
+	}
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			if (scaler > MAX_VOLUME_TO_SCALE) {
@@ -498,7 +1193,7 @@ static void cras_scale_buffer_s32_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_copy_scaled_s32(out, out, count, scaler); i < count; i++)
 		out[i] *= scaler;
 }
 
@@ -529,16 +1224,22 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 {
 	unsigned int i;
 
+	i = simd_scale_add_stride_s32((int32_t *)dst, (const int32_t *)src,
+				      dst_stride, src_stride, count, scaler, 0);
+	dst += i * dst_stride;
+	src += i * src_stride;
+
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 4) {
 
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int64_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int32_t *)dst +
 						*(int32_t *)src * scaler;
 			else
-				sum = *(int32_t *)dst + *(int32_t *)src;
+				sum = (int64_t)*(int32_t *)dst +
+						*(int32_t *)src;
 			if (sum > INT32_MAX)
 				sum = INT32_MAX;
 			else if (sum < INT32_MIN)
@@ -549,13 +1250,14 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 		}
 	} else {
 
-		for (i = 0; i < count; i++) {
+		for (; i < count; i++) {
 			int64_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int32_t *)dst +
 						*(int32_t *)src * scaler;
 			else
-				sum = *(int32_t *)dst + *(int32_t *)src;
+				sum = (int64_t)*(int32_t *)dst +
+						*(int32_t *)src;
 			if (sum > INT32_MAX)
 				sum = INT32_MAX;
 			else if (sum < INT32_MIN)
@@ -761,6 +1463,176 @@ static void cras_mix_add_scale_stride_s24_3le(uint8_t *dst, uint8_t *src,
 	}
 }
 
+/*
+ * Float32 mix bus functions.
+ *
+ * Samples on the bus are normalized to [-1.0, 1.0) of the full scale of the
+ * device format, the same range the DSP pipeline works in. Nothing is clipped
+ * until the bus is quantized back to the device format.
+ */
+
+/* Full scale of each format as a float. */
+static inline float format_full_scale(snd_pcm_format_t fmt)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return 32768.0f;
+	case SND_PCM_FORMAT_S24_LE:
+		return 8388608.0f;
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		return 2147483648.0f;
+	default:
+		return 0.0f;
+	}
+}
+
+/* Scales, rounds and clips one float sample to [min, max]. */
+static inline int32_t quantize_sample(float f, float full_scale,
+				      int32_t max, int32_t min)
+{
+	f *= full_scale;
+	if (f >= (float)max)
+		return max;
+	if (f <= (float)min)
+		return min;
+	return (int32_t)(f + ((f >= 0) ? 0.5f : -0.5f));
+}
+
+static void mix_add_float(snd_pcm_format_t fmt, float *dst,
+			  const uint8_t *src, unsigned int count,
+			  int mute, float mix_vol)
+{
+	unsigned int i;
+	float gain;
+
+	if (mute || (mix_vol < MIN_VOLUME_TO_SCALE))
+		return;
+
+	gain = mix_vol / format_full_scale(fmt);
+
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE: {
+		const int16_t *in = (const int16_t *)src;
+		for (i = 0; i < count; i++)
+			dst[i] += in[i] * gain;
+		break;
+	}
+	case SND_PCM_FORMAT_S24_LE: {
+		const int32_t *in = (const int32_t *)src;
+		for (i = 0; i < count; i++)
+			dst[i] += ((int32_t)((uint32_t)in[i] << 8) >> 8) *
+				  gain;
+		break;
+	}
+	case SND_PCM_FORMAT_S32_LE: {
+		const int32_t *in = (const int32_t *)src;
+		for (i = 0; i < count; i++)
+			dst[i] += in[i] * gain;
+		break;
+	}
+	case SND_PCM_FORMAT_S24_3LE: {
+		int32_t sample;
+		for (i = 0; i < count; i++) {
+			convert_single_s243le_to_s32le(&sample, src);
+			dst[i] += sample * gain;
+			src += 3;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void scale_float_buffer_increment(float *buff, unsigned int count,
+					 float scaler, float increment,
+					 int step)
+{
+	unsigned int i = 0;
+	int j;
+
+	if (scaler > MAX_VOLUME_TO_SCALE && increment > 0)
+		return;
+
+	if (scaler < MIN_VOLUME_TO_SCALE && increment < 0) {
+		memset(buff, 0, count * sizeof(*buff));
+		return;
+	}
+
+	while (i + step <= count) {
+		for (j = 0; j < step; j++) {
+			if (scaler > MAX_VOLUME_TO_SCALE) {
+			} else if (scaler < MIN_VOLUME_TO_SCALE) {
+				buff[i] = 0;
+			} else {
+				buff[i] *= scaler;
+			}
+			i++;
+		}
+		scaler += increment;
+	}
+}
+
+static void scale_float_buffer(float *buff, unsigned int count, float scaler)
+{
+	unsigned int i;
+
+	if (scaler > MAX_VOLUME_TO_SCALE)
+		return;
+
+	if (scaler < MIN_VOLUME_TO_SCALE) {
+		memset(buff, 0, count * sizeof(*buff));
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		buff[i] *= scaler;
+}
+
+static void mix_quantize_float(snd_pcm_format_t fmt, uint8_t *dst,
+			       const float *src, unsigned int count)
+{
+	unsigned int i;
+
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE: {
+		int16_t *out = (int16_t *)dst;
+		for (i = 0; i < count; i++)
+			out[i] = quantize_sample(src[i], 32768.0f,
+						 INT16_MAX, INT16_MIN);
+		break;
+	}
+	case SND_PCM_FORMAT_S24_LE: {
+		int32_t *out = (int32_t *)dst;
+		for (i = 0; i < count; i++)
+			out[i] = quantize_sample(src[i], 8388608.0f,
+						 S24_MAX, S24_MIN);
+		break;
+	}
+	case SND_PCM_FORMAT_S32_LE: {
+		int32_t *out = (int32_t *)dst;
+		for (i = 0; i < count; i++)
+			out[i] = quantize_sample(src[i], 2147483648.0f,
+						 INT32_MAX, INT32_MIN);
+		break;
+	}
+	case SND_PCM_FORMAT_S24_3LE: {
+		int32_t sample;
+		for (i = 0; i < count; i++) {
+			sample = quantize_sample(src[i], 8388608.0f,
+						 S24_MAX, S24_MIN);
+			sample = (int32_t)((uint32_t)sample << 8);
+			convert_single_s32le_to_s243le(dst, &sample);
+			dst += 3;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
 static void scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 				   unsigned int count, float scaler,
 				   float increment, int step)
@@ -859,4 +1731,8 @@ const struct cras_mix_ops OPS(mixer_ops) = {
 	.add = mix_add,
 	.add_scale_stride = mix_add_scale_stride,
 	.mute_buffer = mix_mute_buffer,
+	.add_float = mix_add_float,
+	.scale_float_buffer_increment = scale_float_buffer_increment,
+	.scale_float_buffer = scale_float_buffer,
+	.quantize_float = mix_quantize_float,
 };
@@ -28,6 +28,10 @@ extern const struct cras_mix_ops mixer_ops_fma;
  *   add: See cras_mix_add.
  *   add_scale_stride: See cras_mix_add_scale_stride.
  *   mute_buffer: cras_mix_mute_buffer.
+ *   add_float: See cras_mix_add_float.
+ *   scale_float_buffer_increment: See cras_scale_float_buffer_increment.
+ *   scale_float_buffer: See cras_scale_float_buffer.
+ *   quantize_float: See cras_mix_quantize_float.
  */
 struct cras_mix_ops {
 	void (*scale_buffer_increment)(snd_pcm_format_t fmt, uint8_t *buff,
@@ -45,5 +49,15 @@ struct cras_mix_ops {
 	size_t (*mute_buffer)(uint8_t *dst,
 			    size_t frame_bytes,
 			    size_t count);
+	void (*add_float)(snd_pcm_format_t fmt, float *dst,
+			  const uint8_t *src, unsigned int count,
+			  int mute, float mix_vol);
+	void (*scale_float_buffer_increment)(float *buff, unsigned int count,
+					     float scaler, float increment,
+					     int step);
+	void (*scale_float_buffer)(float *buff, unsigned int count,
+				   float scaler);
+	void (*quantize_float)(snd_pcm_format_t fmt, uint8_t *dst,
+			       const float *src, unsigned int count);
 };
 #endif
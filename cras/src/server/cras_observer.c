@@ -296,9 +296,14 @@ int cras_observer_server_init()
 	CRAS_OBSERVER_SET_ALERT(nodes, nodes_prepare, 0);
 	CRAS_OBSERVER_SET_ALERT(active_node, nodes_prepare,
 				CRAS_ALERT_FLAG_KEEP_ALL_DATA);
-	CRAS_OBSERVER_SET_ALERT(output_node_volume, NULL, 0);
+	/* The node volume and gain alerts carry the node that changed, keep
+	 * the data for every node while they are held. Clients only get the
+	 * last value of each node, see cras_rclient.c. */
+	CRAS_OBSERVER_SET_ALERT(output_node_volume, NULL,
+				CRAS_ALERT_FLAG_KEEP_ALL_DATA);
 	CRAS_OBSERVER_SET_ALERT(node_left_right_swapped, NULL, 0);
-	CRAS_OBSERVER_SET_ALERT(input_node_gain, NULL, 0);
+	CRAS_OBSERVER_SET_ALERT(input_node_gain, NULL,
+				CRAS_ALERT_FLAG_KEEP_ALL_DATA);
 	CRAS_OBSERVER_SET_ALERT(suspend_changed, NULL, 0);
 
 	CRAS_OBSERVER_SET_ALERT_WITH_DIRECTION(
@@ -338,6 +343,16 @@ void cras_observer_server_free()
 	g_observer = NULL;
 }
 
+void cras_observer_set_volume_notify_interval(unsigned int ms)
+{
+	if (!g_observer)
+		return;
+	cras_alert_set_min_interval(g_observer->alerts.output_volume, ms);
+	cras_alert_set_min_interval(g_observer->alerts.capture_gain, ms);
+	cras_alert_set_min_interval(g_observer->alerts.output_node_volume, ms);
+	cras_alert_set_min_interval(g_observer->alerts.input_node_gain, ms);
+}
+
 int cras_observer_ops_are_empty(const struct cras_observer_ops *ops)
 {
 	return memcmp(ops, &g_empty_ops, sizeof(*ops)) == 0;
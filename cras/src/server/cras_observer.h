@@ -55,6 +55,12 @@ int cras_observer_server_init();
 /* Destroy the observer server. */
 void cras_observer_server_free();
 
+/* Limits how often the volume and gain notifications are sent while a value
+ * keeps changing, like during a volume ramp. Observers get the latest value
+ * at most once every ms milliseconds, 0 sends every change.
+ */
+void cras_observer_set_volume_notify_interval(unsigned int ms);
+
 /* Notify observers of output volume change. */
 void cras_observer_notify_output_volume(int32_t volume);
 
@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <syslog.h>
 
@@ -16,22 +17,159 @@
 #include "cras_observer.h"
 #include "cras_rclient.h"
 #include "cras_rstream.h"
+#include "cras_shm_v1.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "stream_list.h"
 #include "utlist.h"
 
+/* Room for the notifications queued for a client, they must fit in one
+ * CRAS_CLIENT_NOTIFICATIONS message. */
+#define NOTIFY_BUF_SIZE (CRAS_CLIENT_MAX_MSG_SIZE - \
+			 sizeof(struct cras_client_notifications))
+
 /* An attached client.
  *  id - The id of the client.
  *  fd - Connection for client communication.
+ *  batch_notifications - The client accepts CRAS_CLIENT_NOTIFICATIONS.
+ *  notify_buf - Observer notifications not sent yet, complete messages back
+ *      to back.
+ *  notify_len - Bytes used in notify_buf.
+ *  notify_count - Number of messages in notify_buf.
+ *  notify_queued - The client is in the notify_clients list.
+ *  notify_next - Next client in the notify_clients list.
  */
 struct cras_rclient {
 	struct cras_observer_client *observer;
 	size_t id;
 	int fd;
+	int batch_notifications;
+	uint8_t notify_buf[NOTIFY_BUF_SIZE];
+	unsigned int notify_len;
+	unsigned int notify_count;
+	int notify_queued;
+	struct cras_rclient *notify_next;
+};
+
+/* Clients with notifications queued since the last
+ * cras_rclient_flush_notifications(). */
+static struct cras_rclient *notify_clients;
+
+/* A stream the client was told about that isn't attached to its devices yet.
+ *  client - The client that connected the stream.
+ *  stream_id - The id of the stream.
+ *  format - The format of the stream, for the error reply.
+ */
+struct pending_stream {
+	struct cras_rclient *client;
+	cras_stream_id_t stream_id;
+	struct cras_audio_format format;
+	struct pending_stream *prev, *next;
 };
 
+/* Streams waiting for cras_rclient_attach_pending_streams(). */
+static struct pending_stream *pending_streams;
+
+/* Checks if the queued notification old is an older value of the same state
+ * as msg, so that only msg needs to be sent. Active node changes are kept in
+ * order, like the alert that sends them. */
+static int notification_replaces(const struct cras_client_message *old,
+				 const struct cras_client_message *msg)
+{
+	if (old->id != msg->id)
+		return 0;
+
+	switch (msg->id) {
+	case CRAS_CLIENT_OUTPUT_VOLUME_CHANGED:
+	case CRAS_CLIENT_OUTPUT_MUTE_CHANGED:
+	case CRAS_CLIENT_CAPTURE_GAIN_CHANGED:
+	case CRAS_CLIENT_CAPTURE_MUTE_CHANGED:
+	case CRAS_CLIENT_NODES_CHANGED:
+		return 1;
+	case CRAS_CLIENT_OUTPUT_NODE_VOLUME_CHANGED:
+	case CRAS_CLIENT_NODE_LEFT_RIGHT_SWAPPED_CHANGED:
+	case CRAS_CLIENT_INPUT_NODE_GAIN_CHANGED:
+		return ((const struct cras_client_node_value_changed *)old)
+				->node_id ==
+		       ((const struct cras_client_node_value_changed *)msg)
+				->node_id;
+	case CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED:
+		return ((const struct cras_client_num_active_streams_changed *)
+				old)->direction ==
+		       ((const struct cras_client_num_active_streams_changed *)
+				msg)->direction;
+	default:
+		return 0;
+	}
+}
+
+/* Sends the queued notifications of a client, in one message if the client
+ * accepts them batched. */
+static void send_queued_notifications(struct cras_rclient *client)
+{
+	uint8_t buf[CRAS_CLIENT_MAX_MSG_SIZE];
+	struct cras_client_notifications *batch =
+		(struct cras_client_notifications *)buf;
+	const struct cras_client_message *msg;
+	unsigned int pos;
+
+	if (client->notify_count == 0)
+		return;
+
+	if (client->batch_notifications && client->notify_count > 1) {
+		cras_fill_client_notifications(batch);
+		memcpy(batch->msgs, client->notify_buf, client->notify_len);
+		batch->header.length += client->notify_len;
+		cras_rclient_send_message(client, &batch->header, NULL, 0);
+	} else {
+		for (pos = 0; pos < client->notify_len; pos += msg->length) {
+			msg = (const struct cras_client_message *)
+					&client->notify_buf[pos];
+			cras_rclient_send_message(client, msg, NULL, 0);
+		}
+	}
+	client->notify_len = 0;
+	client->notify_count = 0;
+}
+
+/* Queues an observer notification for the client, replacing an older value
+ * of the same state. It is sent by cras_rclient_flush_notifications(). */
+static void queue_notification(struct cras_rclient *client,
+			       const struct cras_client_message *msg)
+{
+	unsigned int pos;
+
+	for (pos = 0; pos < client->notify_len; ) {
+		struct cras_client_message *old =
+			(struct cras_client_message *)&client->notify_buf[pos];
+		unsigned int len = old->length;
+
+		if (notification_replaces(old, msg)) {
+			/* The new value goes at the end, after anything that
+			 * was queued before it. */
+			memmove(old, &client->notify_buf[pos + len],
+				client->notify_len - pos - len);
+			client->notify_len -= len;
+			client->notify_count--;
+			break;
+		}
+		pos += len;
+	}
+
+	if (client->notify_len + msg->length > sizeof(client->notify_buf))
+		send_queued_notifications(client);
+	memcpy(&client->notify_buf[client->notify_len], msg, msg->length);
+	client->notify_len += msg->length;
+	client->notify_count++;
+
+	if (!client->notify_queued) {
+		client->notify_queued = 1;
+		client->notify_next = notify_clients;
+		notify_clients = client;
+	}
+}
+
 /* Handles a message from the client to connect a new stream */
 static int handle_client_stream_connect(struct cras_rclient *client,
 					const struct cras_connect_message *msg,
@@ -41,11 +179,24 @@ static int handle_client_stream_connect(struct cras_rclient *client,
 	struct cras_client_stream_connected reply;
 	struct cras_audio_format remote_fmt;
 	struct cras_rstream_config stream_config;
+	struct pending_stream *pending;
 	int rc;
-	int stream_fds[2];
+	int stream_fds[4];
+	unsigned int num_fds = 2;
 
 	unpack_cras_audio_format(&remote_fmt, &msg->format);
 
+	/* The shm layout depends on the protocol version, version 1 clients
+	 * keep the two buffer layout and can't use a doorbell. */
+	if (msg->proto_version != CRAS_PROTO_VER &&
+	    (msg->proto_version != CRAS_SHM_V1_PROTO_VER ||
+	     (msg->flags & SHM_DOORBELL))) {
+		syslog(LOG_ERR, "Stream connect with proto version %u, need %u",
+		       msg->proto_version, CRAS_PROTO_VER);
+		rc = -EINVAL;
+		goto reply_err;
+	}
+
 	/* check the aud_fd is valid. */
 	if (aud_fd < 0) {
 		syslog(LOG_ERR, "Invalid fd in stream connect.\n");
@@ -66,9 +217,18 @@ static int handle_client_stream_connect(struct cras_rclient *client,
 	stream_config.cb_threshold = msg->cb_threshold;
 	stream_config.audio_fd = aud_fd;
 	stream_config.client = client;
-	rc = stream_list_add(cras_iodev_list_get_stream_list(),
-			     &stream_config, &stream);
+	stream_config.proto_version = msg->proto_version;
+	pending = (struct pending_stream *)calloc(1, sizeof(*pending));
+	if (!pending) {
+		rc = -ENOMEM;
+		goto reply_err;
+	}
+	/* Only set up the shm here, opening a device can take a while. The
+	 * stream is attached after the main loop handled the other clients. */
+	rc = stream_list_add_pending(cras_iodev_list_get_stream_list(),
+				     &stream_config, &stream);
 	if (rc) {
+		free(pending);
 		rc = -ENOMEM;
 		goto reply_err;
 	}
@@ -83,14 +243,25 @@ static int handle_client_stream_connect(struct cras_rclient *client,
 			cras_rstream_get_total_shm_size(stream));
 	stream_fds[0] = cras_rstream_input_shm_fd(stream);
 	stream_fds[1] = cras_rstream_output_shm_fd(stream);
-	rc = cras_rclient_send_message(client, &reply.header, stream_fds, 2);
+	if (cras_rstream_get_request_fd(stream) >= 0) {
+		stream_fds[2] = cras_rstream_get_request_fd(stream);
+		stream_fds[3] = cras_rstream_get_audio_reply_fd(stream);
+		num_fds = 4;
+	}
+	rc = cras_rclient_send_message(client, &reply.header, stream_fds,
+				       num_fds);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Failed to send connected messaged\n");
 		stream_list_rm(cras_iodev_list_get_stream_list(),
 			       stream->stream_id);
+		free(pending);
 		goto reply_err;
 	}
 
+	pending->client = client;
+	pending->stream_id = msg->stream_id;
+	pending->format = remote_fmt;
+	DL_APPEND(pending_streams, pending);
 	return 0;
 
 reply_err:
@@ -128,6 +299,45 @@ static void dump_audio_thread_info(struct cras_rclient *client)
 	cras_rclient_send_message(client, &msg.header, NULL, 0);
 }
 
+/* Handles dumping the dsp profile back to the client. */
+static void dump_dsp_profile(struct cras_rclient *client)
+{
+	struct cras_client_dsp_debug_info_ready msg;
+	struct cras_server_state *state;
+
+	cras_fill_client_dsp_debug_info_ready(&msg);
+	state = cras_system_state_get_no_lock();
+	cras_dsp_get_debug_info(&state->dsp_debug_info);
+	cras_rclient_send_message(client, &msg.header, NULL, 0);
+}
+
+/* Handles dumping the audio thread latency histograms back to the client. */
+static void dump_latency_info(struct cras_rclient *client)
+{
+	struct cras_client_latency_info_ready msg;
+	struct cras_server_state *state;
+
+	cras_fill_client_latency_info_ready(&msg);
+	state = cras_system_state_get_no_lock();
+	cras_iodev_list_get_latency_info(&state->latency_debug_info);
+	cras_rclient_send_message(client, &msg.header, NULL, 0);
+}
+
+/* Sends a read only fd of the audio thread trace back to the client. */
+static void get_audio_thread_trace(struct cras_rclient *client)
+{
+	struct cras_client_audio_thread_trace_ready msg;
+	int fd = audio_thread_trace_get_fd();
+
+	if (fd < 0) {
+		cras_fill_client_audio_thread_trace_ready(&msg, -ENOENT);
+		cras_rclient_send_message(client, &msg.header, NULL, 0);
+		return;
+	}
+	cras_fill_client_audio_thread_trace_ready(&msg, 0);
+	cras_rclient_send_message(client, &msg.header, &fd, 1);
+}
+
 static void handle_get_hotword_models(struct cras_rclient *client,
 				      cras_node_id_t node_id)
 {
@@ -165,7 +375,7 @@ static void send_output_volume_changed(void *context, int32_t volume)
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_output_volume_changed(&msg, volume);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_output_mute_changed(void *context, int muted,
@@ -176,7 +386,7 @@ static void send_output_mute_changed(void *context, int muted,
 
 	cras_fill_client_output_mute_changed(&msg, muted,
 					     user_muted, mute_locked);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_capture_gain_changed(void *context, int32_t gain)
@@ -185,7 +395,7 @@ static void send_capture_gain_changed(void *context, int32_t gain)
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_capture_gain_changed(&msg, gain);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_capture_mute_changed(void *context, int muted, int mute_locked)
@@ -194,7 +404,7 @@ static void send_capture_mute_changed(void *context, int muted, int mute_locked)
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_capture_mute_changed(&msg, muted, mute_locked);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_nodes_changed(void *context)
@@ -203,7 +413,7 @@ static void send_nodes_changed(void *context)
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_nodes_changed(&msg);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_active_node_changed(void *context,
@@ -214,7 +424,7 @@ static void send_active_node_changed(void *context,
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_active_node_changed(&msg, dir, node_id);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_output_node_volume_changed(void *context,
@@ -225,7 +435,7 @@ static void send_output_node_volume_changed(void *context,
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_output_node_volume_changed(&msg, node_id, volume);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_node_left_right_swapped_changed(void *context,
@@ -237,7 +447,7 @@ static void send_node_left_right_swapped_changed(void *context,
 
 	cras_fill_client_node_left_right_swapped_changed(
 						&msg, node_id, swapped);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_input_node_gain_changed(void *context,
@@ -248,7 +458,7 @@ static void send_input_node_gain_changed(void *context,
 	struct cras_rclient *client = (struct cras_rclient *)context;
 
 	cras_fill_client_input_node_gain_changed(&msg, node_id, gain);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void send_num_active_streams_changed(void *context,
@@ -260,7 +470,7 @@ static void send_num_active_streams_changed(void *context,
 
 	cras_fill_client_num_active_streams_changed(
 					&msg, dir, num_active_streams);
-	cras_rclient_send_message(client, &msg.header, NULL, 0);
+	queue_notification(client, &msg.header);
 }
 
 static void register_for_notification(struct cras_rclient *client,
@@ -313,6 +523,9 @@ static void register_for_notification(struct cras_rclient *client,
 		observer_ops.num_active_streams_changed =
 			do_register ? send_num_active_streams_changed : NULL;
 		break;
+	case CRAS_CLIENT_NOTIFICATIONS:
+		client->batch_notifications = do_register;
+		break;
 	default:
 		syslog(LOG_ERR,
 		       "Invalid client notification message ID: %u", msg_id);
@@ -361,12 +574,70 @@ struct cras_rclient *cras_rclient_create(int fd, size_t id)
 /* Removes all streams that the client owns and destroys it. */
 void cras_rclient_destroy(struct cras_rclient *client)
 {
+	struct cras_rclient **prev;
+	struct pending_stream *pending;
+
+	DL_FOREACH(pending_streams, pending) {
+		if (pending->client == client) {
+			DL_DELETE(pending_streams, pending);
+			free(pending);
+		}
+	}
+	if (client->notify_queued) {
+		for (prev = &notify_clients; *prev != client;
+		     prev = &(*prev)->notify_next)
+			;
+		*prev = client->notify_next;
+	}
 	cras_observer_remove(client->observer);
 	stream_list_rm_all_client_streams(
 			cras_iodev_list_get_stream_list(), client);
 	free(client);
 }
 
+/* Node attributes whose value is all there is to setting them. Plugging has
+ * side effects beyond the value, like selecting the node, so every plug
+ * message is handled. */
+static int node_attr_coalesces(enum ionode_attr attr)
+{
+	switch (attr) {
+	case IONODE_ATTR_VOLUME:
+	case IONODE_ATTR_CAPTURE_GAIN:
+	case IONODE_ATTR_SWAP_LEFT_RIGHT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+int cras_rclient_message_superseded(const struct cras_server_message *msg,
+				    const struct cras_server_message *later)
+{
+	if (msg->id != later->id || msg->length != later->length)
+		return 0;
+
+	switch (msg->id) {
+	case CRAS_SERVER_SET_SYSTEM_VOLUME:
+		return msg->length == sizeof(struct cras_set_system_volume);
+	case CRAS_SERVER_SET_SYSTEM_CAPTURE_GAIN:
+		return msg->length ==
+			sizeof(struct cras_set_system_capture_gain);
+	case CRAS_SERVER_SET_NODE_ATTR: {
+		const struct cras_set_node_attr *m =
+			(const struct cras_set_node_attr *)msg;
+		const struct cras_set_node_attr *l =
+			(const struct cras_set_node_attr *)later;
+
+		if (msg->length != sizeof(*m))
+			return 0;
+		return m->node_id == l->node_id && m->attr == l->attr &&
+		       node_attr_coalesces(m->attr);
+	}
+	default:
+		return 0;
+	}
+}
+
 /* Entry point for handling a message from the client.  Called from the main
  * server context. */
 int cras_rclient_message_from_client(struct cras_rclient *client,
@@ -461,6 +732,15 @@ int cras_rclient_message_from_client(struct cras_rclient *client,
 	case CRAS_SERVER_DUMP_AUDIO_THREAD:
 		dump_audio_thread_info(client);
 		break;
+	case CRAS_SERVER_DUMP_DSP_PROFILE:
+		dump_dsp_profile(client);
+		break;
+	case CRAS_SERVER_DUMP_LATENCY_INFO:
+		dump_latency_info(client);
+		break;
+	case CRAS_SERVER_GET_AUDIO_THREAD_TRACE:
+		get_audio_thread_trace(client);
+		break;
 	case CRAS_SERVER_ADD_TEST_DEV: {
 		const struct cras_add_test_dev *m =
 			(const struct cras_add_test_dev *)msg;
@@ -517,6 +797,43 @@ int cras_rclient_message_from_client(struct cras_rclient *client,
 	return 0;
 }
 
+void cras_rclient_flush_notifications()
+{
+	struct cras_rclient *client;
+
+	while (notify_clients) {
+		client = notify_clients;
+		notify_clients = client->notify_next;
+		client->notify_queued = 0;
+		send_queued_notifications(client);
+	}
+}
+
+void cras_rclient_attach_pending_streams()
+{
+	struct pending_stream *pending;
+	struct cras_client_stream_connected reply;
+	int rc;
+
+	DL_FOREACH(pending_streams, pending) {
+		DL_DELETE(pending_streams, pending);
+		rc = stream_list_attach_stream(
+				cras_iodev_list_get_stream_list(),
+				pending->stream_id);
+		/* -ENOENT, the client removed the stream already. */
+		if (rc && rc != -ENOENT) {
+			syslog(LOG_ERR, "Failed to attach stream %x: %d",
+			       pending->stream_id, rc);
+			cras_fill_client_stream_connected(&reply, rc,
+							  pending->stream_id,
+							  &pending->format, 0);
+			cras_rclient_send_message(pending->client,
+						  &reply.header, NULL, 0);
+		}
+		free(pending);
+	}
+}
+
 /* Sends a message to the client. */
 int cras_rclient_send_message(const struct cras_rclient *client,
 			      const struct cras_client_message *msg,
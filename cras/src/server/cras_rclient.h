@@ -40,6 +40,33 @@ int cras_rclient_message_from_client(struct cras_rclient *client,
 				     const struct cras_server_message *msg,
 				     int fd);
 
+/* Checks if a message only sets a value that a later message from the same
+ * client sets again, so handling the later one alone has the same result.
+ * Used to skip the intermediate values of a burst of setters, like a volume
+ * slider being dragged.
+ * Args:
+ *    msg - A message received from the client.
+ *    later - A message received after msg.
+ * Returns:
+ *    1 if msg can be dropped, 0 otherwise.
+ */
+int cras_rclient_message_superseded(const struct cras_server_message *msg,
+				    const struct cras_server_message *later);
+
+/* Sends the observer notifications queued for every client since the last
+ * call. Notifications are queued per client, an older value of some state is
+ * replaced by a newer one, and a client that registered for
+ * CRAS_CLIENT_NOTIFICATIONS gets them all in one message. Called by the main
+ * loop after the alerts are processed. */
+void cras_rclient_flush_notifications();
+
+/* Attaches the streams connected since the last call to their devices. The
+ * client is told a stream is connected as soon as its shm is set up, the
+ * devices are opened here once the main loop handled all the ready clients.
+ * A client gets a second CRAS_CLIENT_STREAM_CONNECTED with the error if its
+ * stream can't be attached. */
+void cras_rclient_attach_pending_streams();
+
 /* Sends a message to the client.
  * Args:
  *    client - The client to send the message to.
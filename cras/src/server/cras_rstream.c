@@ -5,6 +5,7 @@
 
 #include <fcntl.h>
 #include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <syslog.h>
@@ -15,16 +16,51 @@
 #include "cras_rclient.h"
 #include "cras_rstream.h"
 #include "cras_shm.h"
+#include "cras_shm_v1.h"
 #include "cras_types.h"
 #include "buffer_share.h"
 #include "cras_system_state.h"
 
+/* Maps the version 1 area shared with the client and allocates the private
+ * ring the server uses for the stream. */
+static int setup_legacy_shm(struct cras_rstream *stream,
+			    struct cras_audio_shm *shm,
+			    struct rstream_shm_info *shm_info)
+{
+	struct cras_audio_shm_area_v1 *area;
+
+	area = mmap(NULL, shm_info->length, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, shm_info->shm_fd, 0);
+	if (area == MAP_FAILED)
+		goto err;
+
+	shm->area = calloc(1, cras_shm_total_size(shm));
+	if (!shm->area) {
+		munmap(area, shm_info->length);
+		goto err;
+	}
+
+	cras_shm_set_volume_scaler(shm, 1.0);
+	memcpy(&shm->area->config, &shm->config, sizeof(shm->config));
+
+	area->config.used_size = cras_shm_used_size(shm);
+	area->config.frame_bytes = cras_shm_frame_bytes(shm);
+	area->volume_scaler = 1.0;
+	stream->legacy_area = area;
+	return 0;
+
+err:
+	cras_shm_close_unlink(shm_info->shm_name, shm_info->shm_fd);
+	return -ENOMEM;
+}
+
 /* Configure the shm area for the stream. */
 static int setup_shm(struct cras_rstream *stream,
 		     struct cras_audio_shm *shm,
-		     struct rstream_shm_info *shm_info)
+		     struct rstream_shm_info *shm_info,
+		     int legacy)
 {
-	size_t used_size, samples_size, frame_bytes;
+	size_t used_size, frame_bytes;
 	const struct cras_audio_format *fmt = &stream->format;
 
 	if (shm->area != NULL) /* already setup */
@@ -33,8 +69,15 @@ static int setup_shm(struct cras_rstream *stream,
 	frame_bytes = snd_pcm_format_physical_width(fmt->format) / 8 *
 			fmt->num_channels;
 	used_size = stream->buffer_frames * frame_bytes;
-	samples_size = used_size * CRAS_NUM_SHM_BUFFERS;
-	shm_info->length = sizeof(struct cras_audio_shm_area) + samples_size;
+
+	/* Size the ring before the area exists, the config is copied once it
+	 * is mapped. */
+	cras_shm_set_frame_bytes(shm, frame_bytes);
+	cras_shm_set_used_size(shm, used_size);
+	if (legacy)
+		shm_info->length = cras_shm_v1_total_size(used_size);
+	else
+		shm_info->length = cras_shm_total_size(shm);
 
 	snprintf(shm_info->shm_name, sizeof(shm_info->shm_name),
 		 "/cras-%d-stream-%08x", getpid(), stream->stream_id);
@@ -43,6 +86,9 @@ static int setup_shm(struct cras_rstream *stream,
 	if (shm_info->shm_fd < 0)
 		return shm_info->shm_fd;
 
+	if (legacy)
+		return setup_legacy_shm(stream, shm, shm_info);
+
 	/* mmap shm. */
 	shm->area = mmap(NULL, shm_info->length,
 			 PROT_READ | PROT_WRITE, MAP_SHARED,
@@ -53,21 +99,18 @@ static int setup_shm(struct cras_rstream *stream,
 	}
 
 	cras_shm_set_volume_scaler(shm, 1.0);
-	/* Set up config and copy to shared area. */
-	cras_shm_set_frame_bytes(shm, frame_bytes);
-	shm->config.frame_bytes = frame_bytes;
-	cras_shm_set_used_size(shm, used_size);
+	/* Copy config to shared area. */
 	memcpy(&shm->area->config, &shm->config, sizeof(shm->config));
 	return 0;
 }
 
 /* Setup the shared memory area used for audio samples. */
-static inline int setup_shm_area(struct cras_rstream *stream)
+static inline int setup_shm_area(struct cras_rstream *stream, int legacy)
 {
 	int rc;
 
 	rc = setup_shm(stream, &stream->shm,
-			&stream->shm_info);
+			&stream->shm_info, legacy);
 	if (rc)
 		return rc;
 	stream->audio_area =
@@ -128,6 +171,22 @@ static int verify_rstream_parameters(enum CRAS_STREAM_DIRECTION direction,
 	return 0;
 }
 
+/* Creates the request and reply eventfds for a SHM_DOORBELL stream. */
+static int setup_doorbell(struct cras_rstream *stream)
+{
+	stream->request_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stream->request_fd < 0)
+		return -errno;
+
+	stream->reply_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stream->reply_fd < 0) {
+		close(stream->request_fd);
+		stream->request_fd = -1;
+		return -errno;
+	}
+	return 0;
+}
+
 /* Exported functions */
 
 int cras_rstream_create(struct cras_rstream_config *config,
@@ -162,10 +221,26 @@ int cras_rstream_create(struct cras_rstream_config *config,
 	stream->is_pinned = (config->dev_idx != NO_DEVICE);
 	stream->pinned_dev_idx = config->dev_idx;
 	stream->fd = config->audio_fd;
+	stream->request_fd = -1;
+	stream->reply_fd = -1;
+
+	if (stream->flags & SHM_DOORBELL) {
+		rc = setup_doorbell(stream);
+		if (rc < 0) {
+			syslog(LOG_ERR, "failed to setup doorbell %d\n", rc);
+			free(stream);
+			return rc;
+		}
+	}
 
-	rc = setup_shm_area(stream);
+	rc = setup_shm_area(stream,
+			    config->proto_version == CRAS_SHM_V1_PROTO_VER);
 	if (rc < 0) {
 		syslog(LOG_ERR, "failed to setup shm %d\n", rc);
+		if (stream->request_fd >= 0) {
+			close(stream->request_fd);
+			close(stream->reply_fd);
+		}
 		free(stream);
 		return rc;
 	}
@@ -185,7 +260,17 @@ void cras_rstream_destroy(struct cras_rstream *stream)
 {
 	cras_system_state_stream_removed(stream->direction);
 	close(stream->fd);
-	if (stream->shm.area != NULL) {
+	if (stream->request_fd >= 0) {
+		close(stream->request_fd);
+		close(stream->reply_fd);
+	}
+	if (stream->legacy_area != NULL) {
+		munmap(stream->legacy_area, stream->shm_info.length);
+		free(stream->shm.area);
+		cras_shm_close_unlink(stream->shm_info.shm_name,
+				      stream->shm_info.shm_fd);
+		cras_audio_area_destroy(stream->audio_area);
+	} else if (stream->shm.area != NULL) {
 		munmap(stream->shm.area, stream->shm_info.length);
 		cras_shm_close_unlink(stream->shm_info.shm_name,
 				      stream->shm_info.shm_fd);
@@ -207,6 +292,22 @@ void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 	}
 }
 
+/* Adds the time since the pending request for data to cb_response_hist, once
+ * per request. */
+static void record_response_time(struct cras_rstream *stream)
+{
+	struct timespec now;
+
+	if (!stream->request_ts.tv_sec && !stream->request_ts.tv_nsec)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	latency_hist_add_interval(&stream->cb_response_hist,
+				  &stream->request_ts, &now);
+	stream->request_ts.tv_sec = 0;
+	stream->request_ts.tv_nsec = 0;
+}
+
 static void init_audio_message(struct audio_message *msg,
 			       enum CRAS_AUDIO_MESSAGE_ID id,
 			       uint32_t frames)
@@ -216,6 +317,106 @@ static void init_audio_message(struct audio_message *msg,
 	msg->frames = frames;
 }
 
+/* Wakes the client of a SHM_DOORBELL stream.  The client works out what it was
+ * woken for from the stream direction and the shm ring counters. */
+static int ring_doorbell(int fd)
+{
+	uint64_t one = 1;
+	int rc;
+
+	rc = write(fd, &one, sizeof(one));
+	if (rc < 0)
+		return -errno;
+	return rc;
+}
+
+/* Moves the frames a version 1 client wrote to its area into the ring, as
+ * many as the ring has room for. */
+static void legacy_pull_playback(struct cras_rstream *stream)
+{
+	struct cras_audio_shm_area_v1 *area = stream->legacy_area;
+	struct cras_audio_shm *shm = &stream->shm;
+	unsigned int used_size = cras_shm_used_size(shm);
+	unsigned int frame_bytes = cras_shm_frame_bytes(shm);
+	unsigned int i;
+
+	for (i = 0; i < CRAS_SHM_V1_NUM_BUFFERS; i++) {
+		unsigned int idx = area->read_buf_idx & CRAS_SHM_V1_BUFFERS_MASK;
+		unsigned int read_offset = area->read_offset[idx];
+		unsigned int write_offset = MIN(area->write_offset[idx],
+						used_size);
+		uint8_t *src = cras_shm_v1_buff_for_idx(area, used_size, idx);
+
+		while (read_offset + frame_bytes <= write_offset) {
+			unsigned int frames;
+			uint8_t *dst = cras_shm_get_writeable_frames(shm, 0,
+								     &frames);
+
+			if (frames == 0)
+				break;
+			frames = MIN(frames,
+				     (write_offset - read_offset) / frame_bytes);
+			memcpy(dst, src + read_offset, frames * frame_bytes);
+			cras_shm_buffer_written(shm, frames);
+			read_offset += frames * frame_bytes;
+		}
+
+		if (read_offset + frame_bytes <= write_offset) {
+			/* The ring is full, take the rest next time. */
+			area->read_offset[idx] = read_offset;
+			return;
+		}
+		if (write_offset == 0)
+			return;
+		area->read_offset[idx] = 0;
+		area->write_offset[idx] = 0;
+		area->read_buf_idx = (idx + 1) & CRAS_SHM_V1_BUFFERS_MASK;
+	}
+}
+
+/* Moves up to 'frames' captured frames from the ring to the next buffer of the
+ * area shared with a version 1 client.  Returns the number of frames moved,
+ * zero if the client hasn't read both buffers yet, the frames then stay in
+ * the ring. */
+static unsigned int legacy_push_capture(struct cras_rstream *stream,
+					unsigned int frames)
+{
+	struct cras_audio_shm_area_v1 *area = stream->legacy_area;
+	struct cras_audio_shm *shm = &stream->shm;
+	unsigned int used_size = cras_shm_used_size(shm);
+	unsigned int frame_bytes = cras_shm_frame_bytes(shm);
+	unsigned int idx = area->write_buf_idx & CRAS_SHM_V1_BUFFERS_MASK;
+	uint8_t *dst = cras_shm_v1_buff_for_idx(area, used_size, idx);
+	unsigned int done = 0;
+
+	if (area->write_offset[idx])
+		return 0;
+
+	frames = MIN(frames, used_size / frame_bytes);
+	while (done < frames) {
+		size_t avail;
+		uint8_t *src = cras_shm_get_readable_frames(shm, 0, &avail);
+
+		if (avail == 0)
+			break;
+		avail = MIN(avail, frames - done);
+		memcpy(dst + done * frame_bytes, src, avail * frame_bytes);
+		cras_shm_buffer_read(shm, avail);
+		done += avail;
+	}
+	if (done == 0)
+		return 0;
+
+	area->ts = shm->area->ts;
+	area->num_overruns = cras_shm_num_overruns(shm);
+	area->read_offset[idx] = 0;
+	/* The client reads the samples once it sees the offset. */
+	__atomic_store_n(&area->write_offset[idx], done * frame_bytes,
+			 __ATOMIC_RELEASE);
+	area->write_buf_idx = (idx + 1) & CRAS_SHM_V1_BUFFERS_MASK;
+	return done;
+}
+
 int cras_rstream_request_audio(struct cras_rstream *stream,
 			       const struct timespec *now)
 {
@@ -227,6 +428,13 @@ int cras_rstream_request_audio(struct cras_rstream *stream,
 		return 0;
 
 	stream->last_fetch_ts = *now;
+	stream->request_ts = *now;
+
+	if (stream->request_fd >= 0)
+		return ring_doorbell(stream->request_fd);
+
+	if (stream->legacy_area)
+		stream->legacy_area->ts = stream->shm.area->ts;
 
 	init_audio_message(&msg, AUDIO_MESSAGE_REQUEST_DATA,
 			   stream->cb_threshold);
@@ -241,7 +449,14 @@ int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count)
 	struct audio_message msg;
 	int rc;
 
-	cras_shm_buffer_write_complete(&stream->shm);
+	if (stream->request_fd >= 0)
+		return ring_doorbell(stream->request_fd);
+
+	if (stream->legacy_area) {
+		count = legacy_push_capture(stream, count);
+		if (count == 0)
+			return 0;
+	}
 
 	init_audio_message(&msg, AUDIO_MESSAGE_DATA_READY, count);
 	rc = write(stream->fd, &msg, sizeof(msg));
@@ -250,14 +465,27 @@ int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count)
 	return rc;
 }
 
-int cras_rstream_get_audio_request_reply(const struct cras_rstream *stream)
+int cras_rstream_get_audio_request_reply(struct cras_rstream *stream)
 {
 	struct audio_message msg;
+	uint64_t count;
 	int rc;
 
+	/* Reading the eventfd consumes every reply signaled so far. */
+	if (stream->reply_fd >= 0) {
+		rc = read(stream->reply_fd, &count, sizeof(count));
+		if (rc < 0)
+			return -errno;
+		record_response_time(stream);
+		return 0;
+	}
+
 	rc = read(stream->fd, &msg, sizeof(msg));
 	if (rc < 0)
 		return -errno;
+	record_response_time(stream);
+	if (stream->legacy_area)
+		legacy_pull_playback(stream);
 	if (msg.error < 0)
 		return msg.error;
 	return 0;
@@ -333,6 +561,11 @@ unsigned int cras_rstream_dev_offset(const struct cras_rstream *rstream,
 	return buffer_share_id_offset(rstream->buf_state, dev_id);
 }
 
+unsigned int cras_rstream_max_dev_offset(const struct cras_rstream *rstream)
+{
+	return buffer_share_max_offset(rstream->buf_state);
+}
+
 void cras_rstream_update_queued_frames(struct cras_rstream *rstream)
 {
 	const struct cras_audio_shm *shm = cras_rstream_output_shm(rstream);
@@ -351,6 +584,11 @@ float cras_rstream_get_volume_scaler(struct cras_rstream *rstream)
 {
 	const struct cras_audio_shm *shm = cras_rstream_output_shm(rstream);
 
+	if (rstream->legacy_area) {
+		float scaler = rstream->legacy_area->volume_scaler;
+
+		return MIN(MAX(scaler, 0.0f), 1.0f);
+	}
 	return cras_shm_get_volume_scaler(shm);
 }
 
@@ -363,5 +601,7 @@ uint8_t *cras_rstream_get_readable_frames(struct cras_rstream *rstream,
 
 int cras_rstream_get_mute(const struct cras_rstream *rstream)
 {
+	if (rstream->legacy_area)
+		return !!rstream->legacy_area->mute;
 	return cras_shm_get_mute(&rstream->shm);
 }
@@ -11,7 +11,9 @@
 
 #include "cras_shm.h"
 #include "cras_types.h"
+#include "latency_hist.h"
 
+struct cras_audio_shm_area_v1;
 struct cras_rclient;
 struct dev_mix;
 
@@ -45,6 +47,10 @@ struct master_dev_info {
  *    direction - input or output.
  *    flags - Indicative of what special handling is needed.
  *    fd - Socket for requesting and sending audio buffer events.
+ *    request_fd - eventfd signaled to ask the client for audio, -1 unless
+ *        the stream was connected with SHM_DOORBELL.
+ *    reply_fd - eventfd the client signals once it has serviced a request,
+ *        -1 unless the stream was connected with SHM_DOORBELL.
  *    buffer_frames - Buffer size in frames.
  *    cb_threshold - Callback client when this much is left.
  *    master_dev_info - The info of the master device this stream attaches to.
@@ -52,12 +58,20 @@ struct master_dev_info {
  *    client - The client who uses this stream.
  *    shm_info - Configuration data for shared memory
  *    shm - shared memory
+ *    legacy_area - The two buffer area shared with a client that connected
+ *        with protocol version 1, NULL otherwise.  shm is then private to
+ *        the server, see cras_shm_v1.h.
  *    audio_area - space for playback/capture audio
  *    format - format of the stream
  *    next_cb_ts - Next callback time for this stream.
  *    sleep_interval_ts - Time between audio callbacks.
  *    last_fetch_ts - The time of the last stream fetch.
+ *    request_ts - The time the pending request for data was sent, zero once
+ *        the client's reply has been read.
  *    longest_fetch_interval_ts - Longest interval between two fetches.
+ *    fetch_hist - How late each fetch was compared to next_cb_ts.
+ *    cb_response_hist - Time from each request for data to the client's
+ *        reply.
  *    buf_state - State of the buffer from all devices for this stream.
  *    num_attached_devs - Number of iodevs this stream has attached to.
  *    queued_frames - Cached value of the number of queued frames in shm.
@@ -70,6 +84,8 @@ struct cras_rstream {
 	enum CRAS_STREAM_DIRECTION direction;
 	uint32_t flags;
 	int fd;
+	int request_fd;
+	int reply_fd;
 	size_t buffer_frames;
 	size_t cb_threshold;
 	int is_draining;
@@ -77,12 +93,16 @@ struct cras_rstream {
 	struct cras_rclient *client;
 	struct rstream_shm_info shm_info;
 	struct cras_audio_shm shm;
+	struct cras_audio_shm_area_v1 *legacy_area;
 	struct cras_audio_area *audio_area;
 	struct cras_audio_format format;
 	struct timespec next_cb_ts;
 	struct timespec sleep_interval_ts;
 	struct timespec last_fetch_ts;
+	struct timespec request_ts;
 	struct timespec longest_fetch_interval;
+	struct latency_hist fetch_hist;
+	struct latency_hist cb_response_hist;
 	struct buffer_share *buf_state;
 	int num_attached_devs;
 	int queued_frames;
@@ -101,6 +121,8 @@ struct cras_rstream {
  *    cb_threshold - # of frames when to request more from the client.
  *    audio_fd - The fd to read/write audio signals to.
  *    client - The client that owns this stream.
+ *    proto_version - CRAS_PROTO_VER the client connected with, selects the
+ *        layout of the shm area.
  */
 struct cras_rstream_config {
 	cras_stream_id_t stream_id;
@@ -113,6 +135,7 @@ struct cras_rstream_config {
 	size_t cb_threshold;
 	int audio_fd;
 	struct cras_rclient *client;
+	uint32_t proto_version;
 };
 
 /* Creates an rstream.
@@ -187,6 +210,23 @@ static inline int cras_rstream_get_audio_fd(const struct cras_rstream *stream)
 	return stream->fd;
 }
 
+/* Gets the fd that becomes readable when the client replies to a request for
+ * audio.  This is the reply eventfd for doorbell streams, and the audio socket
+ * otherwise. */
+static inline
+int cras_rstream_get_audio_reply_fd(const struct cras_rstream *stream)
+{
+	return stream->reply_fd >= 0 ? stream->reply_fd : stream->fd;
+}
+
+/* Gets the eventfd the server signals to request audio, -1 if the stream
+ * exchanges audio messages on its socket. */
+static inline
+int cras_rstream_get_request_fd(const struct cras_rstream *stream)
+{
+	return stream->request_fd;
+}
+
 /* Gets the is_draning flag. */
 static inline
 int cras_rstream_get_is_draining(const struct cras_rstream *stream)
@@ -217,11 +257,7 @@ static inline int cras_rstream_input_shm_fd(const struct cras_rstream *stream)
 static inline size_t cras_rstream_get_total_shm_size(
 		const struct cras_rstream *stream)
 {
-	if (stream->direction == CRAS_STREAM_OUTPUT)
-		return cras_shm_total_size(&stream->shm);
-
-	/* Use the shm size for loopback streams. */
-	return cras_shm_total_size(&stream->shm);
+	return stream->shm_info.length;
 }
 
 /* Gets shared memory region for this stream. */
@@ -261,8 +297,9 @@ int cras_rstream_request_audio(struct cras_rstream *stream,
 
 /* Tells a capture client that count frames are ready. */
 int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count);
-/* Waits for the response to a request for audio. */
-int cras_rstream_get_audio_request_reply(const struct cras_rstream *stream);
+/* Reads the response to a request for audio. The time since the request is
+ * added to cb_response_hist. */
+int cras_rstream_get_audio_request_reply(struct cras_rstream *stream);
 
 /* Let the rstream know when a device is added or removed. */
 void cras_rstream_dev_attach(struct cras_rstream *rstream,
@@ -281,16 +318,21 @@ void cras_rstream_update_output_read_pointer(struct cras_rstream *rstream);
 unsigned int cras_rstream_dev_offset(const struct cras_rstream *rstream,
 				     unsigned int dev_id);
 
+/* Returns the offset of the device furthest past the write pointer. */
+unsigned int cras_rstream_max_dev_offset(const struct cras_rstream *rstream);
+
+/* Returns the number of captured frames the client hasn't read yet. */
 static inline unsigned int cras_rstream_level(struct cras_rstream *rstream)
 {
 	const struct cras_audio_shm *shm = cras_rstream_input_shm(rstream);
-	return cras_shm_frames_written(shm);
+	int frames = cras_shm_get_frames(shm);
+
+	return frames < 0 ? 0 : frames;
 }
 
 static inline int cras_rstream_input_level_met(struct cras_rstream *rstream)
 {
-	const struct cras_audio_shm *shm = cras_rstream_input_shm(rstream);
-	return cras_shm_frames_written(shm) >= rstream->cb_threshold;
+	return cras_rstream_level(rstream) >= rstream->cb_threshold;
 }
 
 /* Updates the number of queued frames in shm. The queued frames should be
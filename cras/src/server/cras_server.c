@@ -9,13 +9,12 @@
 #include <dbus/dbus.h>
 #endif
 #include <errno.h>
-#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/param.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -51,20 +50,46 @@
 #include "cras_mix.h"
 #include "utlist.h"
 
+/* Max number of ready fds handled per wake of the main loop, any others are
+ * returned by the next epoll_wait. */
+#define MAX_SERVER_EPOLL_EVENTS 64
+
+/* Max number of messages read from a client socket per wake. */
+#define MAX_CLIENT_MSGS_PER_WAKE 16
+
+/* What an fd in the main loop's epoll set belongs to. */
+enum server_fd_type {
+	SERVER_FD_LISTEN,
+	SERVER_FD_CLIENT,
+	SERVER_FD_CALLBACK,
+};
+
+/* Stored in the epoll data of each fd so a ready fd is dispatched without
+ * searching the clients or callbacks.
+ * Members:
+ *    type - What data points to.
+ *    data - The attached_client or client_callback, unused for the listening
+ *        socket.
+ */
+struct server_fd {
+	enum server_fd_type type;
+	void *data;
+};
+
 /* Store a list of clients that are attached to the server.
  * Members:
  *    id - Unique identifier for this client.
  *    fd - socket file descriptor used to communicate with client.
  *    ucred - Process, user, and group ID of the client.
  *    client - rclient to handle messages from this client.
- *    pollfd - Pointer to struct pollfd for this callback.
+ *    sfd - Epoll data for fd.
  */
 struct attached_client {
 	size_t id;
 	int fd;
 	struct ucred ucred;
 	struct cras_rclient *client;
-	struct pollfd *pollfd;
+	struct server_fd sfd;
 	struct attached_client *next, *prev;
 };
 
@@ -77,30 +102,62 @@ struct attached_client {
  *    fd - The file descriptor passed to select.
  *    callack - The funciton to call when fd is ready.
  *    callback_data - Pointer passed to the callback.
- *    pollfd - Pointer to struct pollfd for this callback.
+ *    sfd - Epoll data for select_fd.
+ *    deleted - Set by rm_select_fd, the callback is freed after the current
+ *        main loop iteration, which may still hold its epoll data.
  */
 struct client_callback {
 	int select_fd;
 	void (*callback)(void *);
 	void *callback_data;
-	struct pollfd *pollfd;
+	struct server_fd sfd;
 	int deleted;
 	struct client_callback *prev, *next;
 };
 
-/* Local server data. */
+/* Local server data.
+ * Members:
+ *    epoll_fd - The main loop waits on this set, it holds the listening
+ *        socket, every client socket and every callback fd.
+ */
 struct server_data {
+	int epoll_fd;
 	struct attached_client *clients_head;
 	size_t num_clients;
 	struct client_callback *client_callbacks;
-	size_t num_client_callbacks;
 	size_t next_client_id;
-} server_instance;
+} server_instance = {
+	.epoll_fd = -1,
+};
+
+/* Adds fd to the main loop's epoll set, ready for reading.
+ * Args:
+ *    fd - The file descriptor to watch.
+ *    sfd - Returned in the epoll data when fd is ready.
+ */
+static int server_epoll_add(int fd, struct server_fd *sfd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = sfd;
+	if (epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+	return 0;
+}
+
+static void server_epoll_del(int fd)
+{
+	/* The fd may already be closed, which removed it from the set. */
+	epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
 
 /* Remove a client from the list and destroy it.  Calling rclient_destroy will
  * also free all the streams owned by the client */
 static void remove_client(struct attached_client *client)
 {
+	server_epoll_del(client->fd);
 	close(client->fd);
 	DL_DELETE(server_instance.clients_head, client);
 	server_instance.num_clients--;
@@ -108,37 +165,131 @@ static void remove_client(struct attached_client *client)
 	free(client);
 }
 
-/* This is called when "select" indicates that the client has written data to
- * the socket.  Read out one message and pass it to the client message handler.
+/* Receives the messages queued on a client socket without blocking, each with
+ * at most one attached fd.
+ * Args:
+ *    fd - The client socket.
+ *    bufs - Filled with one message per buffer.
+ *    lens - Filled with the size of each message, 0 at the end of the stream.
+ *    fds - Filled with the fd attached to each message, or -1.
+ * Returns:
+ *    The number of messages received, or a negative error code.
  */
+static int recv_client_messages(
+		int fd,
+		uint8_t bufs[MAX_CLIENT_MSGS_PER_WAKE][CRAS_SERV_MAX_MSG_SIZE],
+		unsigned int *lens, int *fds)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control[MAX_CLIENT_MSGS_PER_WAKE];
+	struct mmsghdr msgs[MAX_CLIENT_MSGS_PER_WAKE];
+	struct iovec iovs[MAX_CLIENT_MSGS_PER_WAKE];
+	struct cmsghdr *cmsg;
+	int i, num_msgs;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < MAX_CLIENT_MSGS_PER_WAKE; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = CRAS_SERV_MAX_MSG_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = control[i].buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+	}
+
+	num_msgs = recvmmsg(fd, msgs, MAX_CLIENT_MSGS_PER_WAKE, MSG_DONTWAIT,
+			    NULL);
+	if (num_msgs < 0)
+		return -errno;
+
+	for (i = 0; i < num_msgs; i++) {
+		lens[i] = msgs[i].msg_len;
+		fds[i] = -1;
+		for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_RIGHTS &&
+			    cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+				memcpy(&fds[i], CMSG_DATA(cmsg), sizeof(int));
+				break;
+			}
+		}
+	}
+	return num_msgs;
+}
+
+/* Checks if a later message in the batch sets the same value as message
+ * idx, see cras_rclient_message_superseded(). Messages with an fd are always
+ * handled. */
+static int message_superseded(
+		uint8_t bufs[MAX_CLIENT_MSGS_PER_WAKE][CRAS_SERV_MAX_MSG_SIZE],
+		const int *fds, int idx, int num_valid)
+{
+	const struct cras_server_message *msg =
+		(const struct cras_server_message *)bufs[idx];
+	int i;
+
+	if (fds[idx] != -1)
+		return 0;
+	for (i = idx + 1; i < num_valid; i++)
+		if (fds[i] == -1 &&
+		    cras_rclient_message_superseded(
+				msg, (const struct cras_server_message *)bufs[i]))
+			return 1;
+	return 0;
+}
+
+/* This is called when epoll indicates that the client has written data to
+ * the socket. Read out the queued messages, up to MAX_CLIENT_MSGS_PER_WAKE, and
+ * pass them to the client message handler in order. Setters overridden by a
+ * later message of the batch are skipped. */
 static void handle_message_from_client(struct attached_client *client)
 {
-	uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
+	uint8_t bufs[MAX_CLIENT_MSGS_PER_WAKE][CRAS_SERV_MAX_MSG_SIZE];
+	unsigned int lens[MAX_CLIENT_MSGS_PER_WAKE];
+	int fds[MAX_CLIENT_MSGS_PER_WAKE];
 	struct cras_server_message *msg;
-	int nread;
-	int fd;
-	unsigned int num_fds = 1;
-
-	msg = (struct cras_server_message *)buf;
-	nread = cras_recv_with_fds(client->fd, buf, sizeof(buf), &fd, &num_fds);
-	if (nread < sizeof(msg->length))
-		goto read_error;
-	if (msg->length != nread)
-		goto read_error;
-	cras_rclient_message_from_client(client->client, msg, fd);
-	return;
-
-read_error:
-	if (fd != -1)
-		close(fd);
-	switch (nread) {
-	case 0:
-		break;
-	default:
-		syslog(LOG_DEBUG, "read err [%d] '%s', removing client %zu",
-		       -nread, strerror(-nread), client->id);
-		break;
+	int i, num_msgs, num_valid;
+	int err = 0;
+
+	num_msgs = recv_client_messages(client->fd, bufs, lens, fds);
+	if (num_msgs == -EAGAIN)
+		return;
+	if (num_msgs < 0) {
+		err = num_msgs;
+		num_msgs = 0;
 	}
+
+	/* Messages up to the first bad one or the end of the stream are
+	 * handled before the client is removed. */
+	for (num_valid = 0; num_valid < num_msgs; num_valid++) {
+		msg = (struct cras_server_message *)bufs[num_valid];
+		if (lens[num_valid] < sizeof(msg->length) ||
+		    msg->length != lens[num_valid])
+			break;
+	}
+	if (num_msgs == 0 && err == 0)
+		err = -EIO;
+	if (num_valid < num_msgs && lens[num_valid] != 0)
+		err = -EIO;
+
+	for (i = 0; i < num_valid; i++) {
+		if (message_superseded(bufs, fds, i, num_valid))
+			continue;
+		msg = (struct cras_server_message *)bufs[i];
+		cras_rclient_message_from_client(client->client, msg, fds[i]);
+	}
+	if (num_valid == num_msgs && err == 0)
+		return;
+
+	for (i = num_valid; i < num_msgs; i++)
+		if (fds[i] != -1)
+			close(fds[i]);
+	if (err)
+		syslog(LOG_DEBUG, "read err [%d] '%s', removing client %zu",
+		       -err, strerror(-err), client->id);
 	remove_client(client);
 }
 
@@ -158,7 +309,7 @@ static void send_client_list_to_clients(struct server_data *serv)
 {
 	struct attached_client *c;
 	struct cras_attached_client_info *info;
-	struct cras_server_state *state;
+	struct cras_server_state_lists *state;
 	unsigned i;
 
 	state = cras_system_state_update_begin();
@@ -222,7 +373,8 @@ static void handle_new_connection(struct sockaddr_un *address, int fd)
 
 	poll_client->fd = connection_fd;
 	poll_client->next = NULL;
-	poll_client->pollfd = NULL;
+	poll_client->sfd.type = SERVER_FD_CLIENT;
+	poll_client->sfd.data = poll_client;
 	fill_client_info(poll_client);
 	poll_client->client = cras_rclient_create(connection_fd,
 						  poll_client->id);
@@ -233,6 +385,14 @@ static void handle_new_connection(struct sockaddr_un *address, int fd)
 		return;
 	}
 
+	if (server_epoll_add(connection_fd, &poll_client->sfd)) {
+		syslog(LOG_ERR, "failed to poll client");
+		cras_rclient_destroy(poll_client->client);
+		close(connection_fd);
+		free(poll_client);
+		return;
+	}
+
 	DL_APPEND(server_instance.clients_head, poll_client);
 	server_instance.num_clients++;
 	/* Send a current list of available inputs and outputs. */
@@ -240,7 +400,7 @@ static void handle_new_connection(struct sockaddr_un *address, int fd)
 	send_client_list_to_clients(&server_instance);
 }
 
-/* Add a file descriptor to be passed to select in the main loop. This is
+/* Add a file descriptor to be watched by the main loop. This is
  * registered with system state so that it is called when any client asks to
  * have a callback triggered based on an fd being readable. */
 static int add_select_fd(int fd, void (*cb)(void *data),
@@ -249,6 +409,7 @@ static int add_select_fd(int fd, void (*cb)(void *data),
 	struct client_callback *new_cb;
 	struct client_callback *client_cb;
 	struct server_data *serv;
+	int rc;
 
 	serv = (struct server_data *)server_data;
 	if (serv == NULL)
@@ -267,14 +428,20 @@ static int add_select_fd(int fd, void (*cb)(void *data),
 	new_cb->callback = cb;
 	new_cb->callback_data = callback_data;
 	new_cb->deleted = 0;
-	new_cb->pollfd = NULL;
+	new_cb->sfd.type = SERVER_FD_CALLBACK;
+	new_cb->sfd.data = new_cb;
+
+	rc = server_epoll_add(fd, &new_cb->sfd);
+	if (rc) {
+		free(new_cb);
+		return rc;
+	}
 
 	DL_APPEND(serv->client_callbacks, new_cb);
-	server_instance.num_client_callbacks++;
 	return 0;
 }
 
-/* Removes a file descriptor to be passed to select in the main loop. This is
+/* Removes a file descriptor watched by the main loop. This is
  * registered with system state so that it is called when any client asks to
  * remove a callback added with add_select_fd. */
 static void rm_select_fd(int fd, void *server_data)
@@ -287,8 +454,10 @@ static void rm_select_fd(int fd, void *server_data)
 		return;
 
 	DL_FOREACH(serv->client_callbacks, client_cb)
-		if (client_cb->select_fd == fd)
+		if (client_cb->select_fd == fd && !client_cb->deleted) {
 			client_cb->deleted = 1;
+			server_epoll_del(fd);
+		}
 }
 
 /* Cleans up the file descriptor list removing items deleted during the main
@@ -305,7 +474,6 @@ static void cleanup_select_fds(void *server_data)
 	DL_FOREACH(serv->client_callbacks, client_cb)
 		if (client_cb->deleted) {
 			DL_DELETE(serv->client_callbacks, client_cb);
-			server_instance.num_client_callbacks--;
 			free(client_cb);
 		}
 }
@@ -387,9 +555,19 @@ int cras_server_init()
 	/* init mixer with CPU capabilities */
 	cras_mix_init(cpu_get_flags());
 
+	/* The main loop waits on this set, callbacks can be registered
+	 * before it starts running. */
+	server_instance.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_instance.epoll_fd < 0) {
+		int rc = -errno;
+
+		syslog(LOG_ERR, "Failed to create server epoll set");
+		return rc;
+	}
+
 	/* Allow clients to register callbacks for file descriptors.
 	 * add_select_fd and rm_select_fd will add and remove file descriptors
-	 * from the list that are passed to select in the main loop below. */
+	 * from the set that the main loop below waits on. */
 	cras_system_set_select_handler(add_select_fd, rm_select_fd,
 				       &server_instance);
 	cras_main_message_init();
@@ -407,16 +585,12 @@ int cras_server_run(unsigned int profile_disable_mask)
 	int rc = 0;
 	const char *sockdir;
 	struct sockaddr_un addr;
-	struct attached_client *elm;
-	struct client_callback *client_cb;
+	struct server_fd listen_sfd = { SERVER_FD_LISTEN, NULL };
+	struct epoll_event events[MAX_SERVER_EPOLL_EVENTS];
 	struct cras_tm *tm;
-	struct timespec ts;
+	struct timespec ts, alert_ts;
 	int timers_active;
-	struct pollfd *pollfds;
-	unsigned int pollfds_size = 32;
-	unsigned int num_pollfds, poll_size_needed;
-
-	pollfds = malloc(sizeof(*pollfds) * pollfds_size);
+	int i, num_events;
 
 	cras_udev_start_sound_subsystem_monitor();
 #ifdef CRAS_DBUS
@@ -488,6 +662,12 @@ int cras_server_run(unsigned int profile_disable_mask)
 		goto bail;
 	}
 
+	rc = server_epoll_add(socket_fd, &listen_sfd);
+	if (rc < 0) {
+		syslog(LOG_ERR, "Polling server socket failed.");
+		goto bail;
+	}
+
 	tm = cras_system_state_get_tm();
 	if (!tm) {
 		syslog(LOG_ERR, "Getting timer manager.");
@@ -500,55 +680,54 @@ int cras_server_run(unsigned int profile_disable_mask)
 
 	/* Main server loop - client callbacks are run from this context. */
 	while (1) {
-		poll_size_needed = 1 + server_instance.num_clients +
-					server_instance.num_client_callbacks;
-		if (poll_size_needed > pollfds_size) {
-			pollfds_size = 2 * poll_size_needed;
-			pollfds = realloc(pollfds,
-					sizeof(*pollfds) * pollfds_size);
-		}
-
-		pollfds[0].fd = socket_fd;
-		pollfds[0].events = POLLIN;
-		num_pollfds = 1;
-
-		DL_FOREACH(server_instance.clients_head, elm) {
-			pollfds[num_pollfds].fd = elm->fd;
-			pollfds[num_pollfds].events = POLLIN;
-			elm->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
-		DL_FOREACH(server_instance.client_callbacks, client_cb) {
-			if (client_cb->deleted)
-				continue;
-			pollfds[num_pollfds].fd = client_cb->select_fd;
-			pollfds[num_pollfds].events = POLLIN;
-			client_cb->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
-
 		timers_active = cras_tm_get_next_timeout(tm, &ts);
+		/* Wake up for alerts held by their minimum interval too. */
+		if (cras_alert_get_next_timeout(&alert_ts) &&
+		    (!timers_active || timespec_after(&ts, &alert_ts))) {
+			ts = alert_ts;
+			timers_active = 1;
+		}
 
-		rc = ppoll(pollfds, num_pollfds,
-			   timers_active ? &ts : NULL, NULL);
-		if  (rc < 0)
+		num_events = epoll_wait(server_instance.epoll_fd, events,
+					MAX_SERVER_EPOLL_EVENTS,
+					timers_active ? (int)timespec_to_ms(&ts)
+						      : -1);
+		if (num_events < 0)
 			continue;
 
 		cras_tm_call_callbacks(tm);
 
-		/* Check for new connections. */
-		if (pollfds[0].revents & POLLIN)
-			handle_new_connection(&addr, socket_fd);
-		/* Check if there are messages pending for any clients. */
-		DL_FOREACH(server_instance.clients_head, elm)
-			if (elm->pollfd && elm->pollfd->revents & POLLIN)
-				handle_message_from_client(elm);
-		/* Check any client-registered fd/callback pairs. */
-		DL_FOREACH(server_instance.client_callbacks, client_cb)
-			if (!client_cb->deleted &&
-			    client_cb->pollfd &&
-			    (client_cb->pollfd->revents & POLLIN))
-				client_cb->callback(client_cb->callback_data);
+		/* Only the ready fds are visited. A client is only removed
+		 * while handling its own message and callbacks removed during
+		 * the loop are freed after it, so the epoll data of the
+		 * remaining events stays valid. */
+		for (i = 0; i < num_events; i++) {
+			struct server_fd *sfd =
+				(struct server_fd *)events[i].data.ptr;
+			struct client_callback *client_cb;
+
+			switch (sfd->type) {
+			case SERVER_FD_LISTEN:
+				/* Check for new connections. */
+				if (events[i].events & EPOLLIN)
+					handle_new_connection(&addr,
+							      socket_fd);
+				break;
+			case SERVER_FD_CLIENT:
+				/* A hang up reads as an error and removes the
+				 * client. */
+				handle_message_from_client(
+					(struct attached_client *)sfd->data);
+				break;
+			case SERVER_FD_CALLBACK:
+				client_cb = (struct client_callback *)sfd->data;
+				if (!client_cb->deleted &&
+				    (events[i].events & EPOLLIN))
+					client_cb->callback(
+						client_cb->callback_data);
+				break;
+			}
+		}
 
 		cleanup_select_fds(&server_instance);
 
@@ -557,7 +736,9 @@ int cras_server_run(unsigned int profile_disable_mask)
 			cras_dbus_dispatch(dbus_conn);
 #endif
 
+		cras_rclient_attach_pending_streams();
 		cras_alert_process_all_pending_alerts();
+		cras_rclient_flush_notifications();
 	}
 
 bail:
@@ -565,7 +746,8 @@ bail:
 		close(socket_fd);
 		unlink(addr.sun_path);
 	}
-	free(pollfds);
+	close(server_instance.epoll_fd);
+	server_instance.epoll_fd = -1;
 	cras_observer_server_free();
 	return rc;
 }
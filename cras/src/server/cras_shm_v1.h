@@ -0,0 +1,78 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The audio shm layout used by clients that connect streams with protocol
+ * version 1, before the samples moved to a single ring.  The server still
+ * shares this layout with those clients.  It keeps their samples on a private
+ * ring like any other stream, and copies frames between the ring and this
+ * area when it exchanges audio messages with the client, see cras_rstream.c.
+ */
+#ifndef CRAS_SHM_V1_H_
+#define CRAS_SHM_V1_H_
+
+#include <stdint.h>
+
+#include "cras_types.h"
+
+#define CRAS_SHM_V1_PROTO_VER 1
+#define CRAS_SHM_V1_NUM_BUFFERS 2U /* double buffer */
+#define CRAS_SHM_V1_BUFFERS_MASK (CRAS_SHM_V1_NUM_BUFFERS - 1)
+
+/* Configuration of the version 1 shm area.
+ *
+ *  used_size - The size in bytes of each of the two sample buffers.
+ *  frame_bytes - The size of each frame in bytes.
+ */
+struct __attribute__ ((__packed__)) cras_audio_shm_v1_config {
+	uint32_t used_size;
+	uint32_t frame_bytes;
+};
+
+/* Structure that is shared as shm with a version 1 client.
+ *
+ *  config - Size config data.
+ *  read_buf_idx - index of the current buffer to read from.
+ *  write_buf_idx - index of the current buffer to write to.
+ *  read_offset - offset of the next sample to read (one per buffer).
+ *  write_offset - offset of the next sample to write (one per buffer).
+ *  write_in_progress - non-zero when a write is in progress.
+ *  volume_scaler - volume scaling factor (0.0-1.0).
+ *  muted - bool, true if stream should be muted.
+ *  callback_pending - Unused, the server keeps it in its ring.
+ *  num_overruns - Number of times captured samples were dropped.
+ *  ts - Time stamp of the samples, see struct cras_audio_shm_area.
+ *  samples - Audio data - two buffers of used_size bytes each.
+ */
+struct __attribute__ ((__packed__)) cras_audio_shm_area_v1 {
+	struct cras_audio_shm_v1_config config;
+	uint32_t read_buf_idx;
+	uint32_t write_buf_idx;
+	uint32_t read_offset[CRAS_SHM_V1_NUM_BUFFERS];
+	uint32_t write_offset[CRAS_SHM_V1_NUM_BUFFERS];
+	int32_t write_in_progress[CRAS_SHM_V1_NUM_BUFFERS];
+	float volume_scaler;
+	int32_t mute;
+	int32_t callback_pending;
+	uint32_t num_overruns;
+	struct cras_timespec ts;
+	uint8_t samples[];
+};
+
+/* Returns the size of a version 1 area with buffers of used_size bytes. */
+static inline size_t cras_shm_v1_total_size(unsigned used_size)
+{
+	return sizeof(struct cras_audio_shm_area_v1) +
+	       used_size * CRAS_SHM_V1_NUM_BUFFERS;
+}
+
+/* Get a pointer to the buffer at idx.  used_size is the server's copy, the
+ * one in the area can be changed by the client. */
+static inline uint8_t *cras_shm_v1_buff_for_idx(
+		struct cras_audio_shm_area_v1 *area, unsigned used_size,
+		unsigned idx)
+{
+	return area->samples + used_size * (idx & CRAS_SHM_V1_BUFFERS_MASK);
+}
+
+#endif /* CRAS_SHM_V1_H_ */
@@ -4,13 +4,17 @@
  */
 
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "cras_alsa_card.h"
 #include "cras_config.h"
@@ -40,8 +44,8 @@ struct card_list {
  *        control which ucm config file to load.
  *    device_blacklist - Blacklist of device the server will ignore.
  *    cards - A list of active sound cards in the system.
- *    update_lock - Protects the update_count, as audio threads can update the
- *      stream count.
+ *    update_lock - Serializes the updates of the double buffered lists, as
+ *      audio threads can update the stream count.
  *    tm - The system-wide timer manager.
  */
 static struct {
@@ -63,6 +67,12 @@ static struct {
 	void *select_data;
 } state;
 
+/* Gets the copy of the lists that clients are reading. */
+static struct cras_server_state_lists *current_lists()
+{
+	return &state.exp_state->lists[state.exp_state->update_count & 1];
+}
+
 /*
  * Exported Interface.
  */
@@ -408,14 +418,14 @@ void cras_system_rm_select_fd(int fd)
 
 void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction)
 {
-	struct cras_server_state *s;
+	struct cras_server_state_lists *s;
 
 	s = cras_system_state_update_begin();
 	if (!s)
 		return;
 
 	s->num_active_streams[direction]++;
-	s->num_streams_attached++;
+	state.exp_state->num_streams_attached++;
 
 	cras_system_state_update_complete();
 	cras_observer_notify_num_active_streams(
@@ -424,7 +434,7 @@ void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction)
 
 void cras_system_state_stream_removed(enum CRAS_STREAM_DIRECTION direction)
 {
-	struct cras_server_state *s;
+	struct cras_server_state_lists *s;
 	unsigned i, sum;
 
 
@@ -452,60 +462,70 @@ unsigned cras_system_state_get_active_streams()
 	unsigned i, sum;
 	sum = 0;
 	for (i=0; i < CRAS_NUM_DIRECTIONS; i++)
-		sum += state.exp_state->num_active_streams[i];
+		sum += current_lists()->num_active_streams[i];
 	return sum;
 }
 
 unsigned cras_system_state_get_active_streams_by_direction(
 	enum CRAS_STREAM_DIRECTION direction)
 {
-	return state.exp_state->num_active_streams[direction];
+	return current_lists()->num_active_streams[direction];
 }
 
 void cras_system_state_get_last_stream_active_time(struct cras_timespec *ts)
 {
-	*ts = state.exp_state->last_active_stream_time;
+	*ts = current_lists()->last_active_stream_time;
 }
 
 int cras_system_state_get_output_devs(const struct cras_iodev_info **devs)
 {
-	*devs = state.exp_state->output_devs;
-	return state.exp_state->num_output_devs;
+	*devs = current_lists()->output_devs;
+	return current_lists()->num_output_devs;
 }
 
 int cras_system_state_get_input_devs(const struct cras_iodev_info **devs)
 {
-	*devs = state.exp_state->input_devs;
-	return state.exp_state->num_input_devs;
+	*devs = current_lists()->input_devs;
+	return current_lists()->num_input_devs;
 }
 
 int cras_system_state_get_output_nodes(const struct cras_ionode_info **nodes)
 {
-	*nodes = state.exp_state->output_nodes;
-	return state.exp_state->num_output_nodes;
+	*nodes = current_lists()->output_nodes;
+	return current_lists()->num_output_nodes;
 }
 
 int cras_system_state_get_input_nodes(const struct cras_ionode_info **nodes)
 {
-	*nodes = state.exp_state->input_nodes;
-	return state.exp_state->num_input_nodes;
+	*nodes = current_lists()->input_nodes;
+	return current_lists()->num_input_nodes;
 }
 
-struct cras_server_state *cras_system_state_update_begin()
+struct cras_server_state_lists *cras_system_state_update_begin()
 {
+	struct cras_server_state_lists *next;
+
 	if (pthread_mutex_lock(&state.update_lock)) {
 		syslog(LOG_ERR, "Failed to lock stream mutex");
 		return NULL;
 	}
 
-	__sync_fetch_and_add(&state.exp_state->update_count, 1);
-	return state.exp_state;
+	/* Clients only read the current copy. The update starts from it as
+	 * callers change some of the lists only. */
+	next = &state.exp_state->lists[(state.exp_state->update_count + 1) & 1];
+	memcpy(next, current_lists(), sizeof(*next));
+	return next;
 }
 
 void cras_system_state_update_complete()
 {
+	/* Switches clients to the new copy. This is a full barrier, the next
+	 * update can't start refilling the old copy before it. */
 	__sync_fetch_and_add(&state.exp_state->update_count, 1);
 	pthread_mutex_unlock(&state.update_lock);
+
+	syscall(SYS_futex, &state.exp_state->update_count, FUTEX_WAKE,
+		INT_MAX, NULL, NULL, 0);
 }
 
 struct cras_server_state *cras_system_state_get_no_lock()
@@ -238,14 +238,16 @@ int cras_system_state_get_output_nodes(const struct cras_ionode_info **nodes);
  */
 int cras_system_state_get_input_nodes(const struct cras_ionode_info **nodes);
 
-/* Returns a pointer to the current system state that is shared with clients.
- * This also 'locks' the structure by incrementing the update count to an odd
- * value.
+/* Starts an update of the device, node and client lists shared with clients.
+ * Returns the copy of the lists clients aren't reading, filled with the
+ * current values, or NULL on error. Clients keep reading the current copy
+ * until cras_system_state_update_complete is called.
  */
-struct cras_server_state *cras_system_state_update_begin();
+struct cras_server_state_lists *cras_system_state_update_begin();
 
-/* Unlocks the system state structure that was updated after calling
- * cras_system_state_update_begin by again incrementing the update count.
+/* Makes the lists filled after calling cras_system_state_update_begin the
+ * current copy by incrementing the update count, and wakes the clients
+ * waiting for it.
  */
 void cras_system_state_update_complete();
 
@@ -3,6 +3,7 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <syslog.h>
 
 #include "audio_thread_log.h"
@@ -12,6 +13,7 @@
 #include "cras_audio_area.h"
 #include "cras_mix.h"
 #include "cras_shm.h"
+#include "utlist.h"
 
 /*
  * Sleep this much time past the buffer size to be sure at least
@@ -32,6 +34,333 @@ static const struct timespec capture_callback_fuzz_ts = {
 	.tv_nsec = 1000000, /* 1 ms. */
 };
 
+/*
+ * An output stream is converted to the rate and channel layout of each
+ * device it plays on. When it plays on several devices with the same rate
+ * and layout that conversion is done once, and the converted frames are kept
+ * in a conv_cache the dev_streams of those devices mix from, each at its own
+ * position. Converting to the device sample format and the linear resampling
+ * that follows the clock of the device are still done per dev_stream, and are
+ * skipped when the device plays S16_LE at its nominal rate, so a stream on a
+ * single device converts only once.
+ *
+ * Every conversion appends a chunk of frames to the cache. A dev_stream moves
+ * its offset in the rstream past the stream frames of a chunk once it has
+ * mixed all of the chunk, and the chunk is dropped once every dev_stream
+ * using the cache has.
+ */
+
+/*
+ * One conversion held in a conv_cache.
+ * Members:
+ *    src_frames - The number of stream frames converted.
+ *    frames - The number of frames they were converted to.
+ */
+struct conv_cache_chunk {
+	unsigned int src_frames;
+	unsigned int frames;
+};
+
+/*
+ * Members:
+ *    stream - The stream converted.
+ *    fmt - The format converted to, S16_LE at the rate and channel layout of
+ *          the devices.
+ *    conv - Converter from the stream format to fmt.
+ *    buf - The converted frames.
+ *    buf_frames - Size of buf in frames.
+ *    start - Index of the frame at the start of buf.
+ *    frames - The number of converted frames in buf.
+ *    src_start - Read count of the stream at the frame at the start of buf.
+ *    src_end - Read count of the stream after the last frame converted.
+ *    chunks - The conversions held in buf, oldest first.
+ *    num_chunks - The number of entries used in chunks.
+ *    max_chunks - The number of entries allocated in chunks.
+ *    users - The dev_streams mixing from the cache.
+ *    num_users - The number of entries in users.
+ */
+struct dev_stream_conv_cache {
+	struct cras_rstream *stream;
+	struct cras_audio_format fmt;
+	struct cras_fmt_conv *conv;
+	uint8_t *buf;
+	unsigned int buf_frames;
+	unsigned int start;
+	unsigned int frames;
+	uint32_t src_start;
+	uint32_t src_end;
+	struct conv_cache_chunk *chunks;
+	unsigned int num_chunks;
+	unsigned int max_chunks;
+	struct dev_stream **users;
+	unsigned int num_users;
+	struct dev_stream_conv_cache *prev, *next;
+};
+
+/* All conversion caches, only used from the audio thread. */
+static struct dev_stream_conv_cache *conv_caches;
+
+static int audio_format_equal(const struct cras_audio_format *a,
+			      const struct cras_audio_format *b)
+{
+	return a->format == b->format &&
+	       a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
+
+static uint32_t stream_read_count(struct cras_rstream *rstream)
+{
+	return cras_shm_read_count(cras_rstream_output_shm(rstream));
+}
+
+/* Returns the read count of the stream at the next frame the device plays. */
+static uint32_t dev_stream_src_pos(const struct dev_stream *dev_stream)
+{
+	return stream_read_count(dev_stream->stream) +
+	       cras_rstream_dev_offset(dev_stream->stream, dev_stream->dev_id);
+}
+
+/* Finds the index of the converted frame for stream position src_pos, which
+ * has to be at the start of a chunk or at the end of the cache. */
+static int conv_cache_find_pos(const struct dev_stream_conv_cache *cache,
+			       uint32_t src_pos, unsigned int *pos)
+{
+	uint32_t src = cache->src_start;
+	unsigned int frame = cache->start;
+	unsigned int i;
+
+	for (i = 0; src != src_pos; i++) {
+		if (i == cache->num_chunks)
+			return -ENOENT;
+		src += cache->chunks[i].src_frames;
+		frame += cache->chunks[i].frames;
+	}
+	*pos = frame;
+	return 0;
+}
+
+static void conv_cache_destroy(struct dev_stream_conv_cache *cache)
+{
+	DL_DELETE(conv_caches, cache);
+	if (cache->conv)
+		cras_fmt_conv_destroy(cache->conv);
+	free(cache->buf);
+	free(cache->chunks);
+	free(cache->users);
+	free(cache);
+}
+
+static struct dev_stream_conv_cache *conv_cache_create(
+		struct cras_rstream *stream,
+		const struct cras_audio_format *fmt,
+		unsigned int max_frames,
+		uint32_t src_pos)
+{
+	struct dev_stream_conv_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	DL_APPEND(conv_caches, cache);
+
+	cache->stream = stream;
+	cache->fmt = *fmt;
+	cache->src_start = src_pos;
+	cache->src_end = src_pos;
+	cache->buf_frames = 2 * max_frames;
+	cache->buf = malloc(cache->buf_frames * cras_get_format_bytes(fmt));
+	if (!cache->buf ||
+	    config_format_converter(&cache->conv, CRAS_STREAM_OUTPUT,
+				    &stream->format, fmt, max_frames)) {
+		conv_cache_destroy(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/* Drops the chunks every user of the cache has mixed. */
+static void conv_cache_trim(struct dev_stream_conv_cache *cache)
+{
+	unsigned int frame_bytes = cras_get_format_bytes(&cache->fmt);
+	unsigned int mixed = cache->frames;
+	unsigned int dropped = 0;
+	unsigned int i;
+
+	for (i = 0; i < cache->num_users; i++)
+		mixed = MIN(mixed,
+			    cache->users[i]->conv_cache_pos - cache->start);
+
+	for (i = 0; i < cache->num_chunks; i++) {
+		if (cache->chunks[i].frames > mixed - dropped)
+			break;
+		dropped += cache->chunks[i].frames;
+		cache->src_start += cache->chunks[i].src_frames;
+	}
+	if (i == 0)
+		return;
+
+	cache->num_chunks -= i;
+	memmove(cache->chunks, cache->chunks + i,
+		cache->num_chunks * sizeof(*cache->chunks));
+	cache->start += dropped;
+	cache->frames -= dropped;
+	memmove(cache->buf, cache->buf + dropped * frame_bytes,
+		cache->frames * frame_bytes);
+}
+
+/* Makes dev_stream use the cache for the stream and fmt that has converted
+ * up to where the device starts to play, or a new one if there isn't. */
+static int conv_cache_attach(struct dev_stream *dev_stream,
+			     const struct cras_audio_format *fmt,
+			     unsigned int max_frames)
+{
+	struct cras_rstream *stream = dev_stream->stream;
+	struct dev_stream_conv_cache *cache;
+	struct dev_stream **users;
+	uint32_t src_pos;
+	unsigned int pos = 0;
+
+	/* A device that is attached starts at the read pointer. */
+	src_pos = stream_read_count(stream);
+
+	DL_FOREACH(conv_caches, cache) {
+		if (cache->stream == stream &&
+		    audio_format_equal(&cache->fmt, fmt) &&
+		    conv_cache_find_pos(cache, src_pos, &pos) == 0)
+			break;
+	}
+	if (!cache) {
+		cache = conv_cache_create(stream, fmt, max_frames, src_pos);
+		if (!cache)
+			return -ENOMEM;
+		pos = cache->start;
+	}
+
+	users = realloc(cache->users,
+			(cache->num_users + 1) * sizeof(*cache->users));
+	if (!users) {
+		if (!cache->num_users)
+			conv_cache_destroy(cache);
+		return -ENOMEM;
+	}
+	cache->users = users;
+	cache->users[cache->num_users++] = dev_stream;
+	dev_stream->conv_cache = cache;
+	dev_stream->conv_cache_pos = pos;
+	return 0;
+}
+
+static void conv_cache_detach(struct dev_stream *dev_stream)
+{
+	struct dev_stream_conv_cache *cache = dev_stream->conv_cache;
+	unsigned int i;
+
+	for (i = 0; i < cache->num_users; i++) {
+		if (cache->users[i] == dev_stream) {
+			cache->users[i] = cache->users[--cache->num_users];
+			break;
+		}
+	}
+	dev_stream->conv_cache = NULL;
+
+	if (cache->num_users)
+		conv_cache_trim(cache);
+	else
+		conv_cache_destroy(cache);
+}
+
+/* Converts the next stream frames into the cache, up to max_frames. Returns
+ * zero if nothing could be converted. */
+static int conv_cache_fill(struct dev_stream_conv_cache *cache,
+			   unsigned int max_frames)
+{
+	unsigned int frame_bytes = cras_get_format_bytes(&cache->fmt);
+	struct conv_cache_chunk *chunk;
+	unsigned int in_frames, out_frames;
+	uint8_t *src;
+	size_t frames;
+
+	max_frames = MIN(max_frames, cache->buf_frames - cache->frames);
+	if (max_frames == 0)
+		return 0;
+
+	if (cache->num_chunks == cache->max_chunks) {
+		unsigned int max_chunks = MAX(2 * cache->max_chunks, 8);
+
+		chunk = realloc(cache->chunks, max_chunks * sizeof(*chunk));
+		if (!chunk)
+			return 0;
+		cache->chunks = chunk;
+		cache->max_chunks = max_chunks;
+	}
+
+	src = cras_rstream_get_readable_frames(
+			cache->stream,
+			cache->src_end - stream_read_count(cache->stream),
+			&frames);
+	if (frames == 0)
+		return 0;
+
+	in_frames = frames;
+	out_frames = cras_fmt_conv_convert_frames(
+			cache->conv, src,
+			cache->buf + cache->frames * frame_bytes,
+			&in_frames, max_frames);
+	if (in_frames == 0 && out_frames == 0)
+		return 0;
+
+	chunk = &cache->chunks[cache->num_chunks++];
+	chunk->src_frames = in_frames;
+	chunk->frames = out_frames;
+	cache->src_end += in_frames;
+	cache->frames += out_frames;
+
+	return 1;
+}
+
+/* Returns the number of stream frames in the chunks dev_stream has mixed
+ * since it last moved its offset in the stream. */
+static unsigned int conv_cache_mixed_src_frames(
+		const struct dev_stream *dev_stream)
+{
+	const struct dev_stream_conv_cache *cache = dev_stream->conv_cache;
+	unsigned int mixed = dev_stream->conv_cache_pos - cache->start;
+	uint32_t src = cache->src_start;
+	unsigned int i;
+
+	for (i = 0; i < cache->num_chunks; i++) {
+		if (cache->chunks[i].frames > mixed)
+			break;
+		mixed -= cache->chunks[i].frames;
+		src += cache->chunks[i].src_frames;
+	}
+
+	return src - dev_stream_src_pos(dev_stream);
+}
+
+/* Converts frames counts of the stream to counts at the device and back. */
+static unsigned int stream_frames_to_dev(const struct dev_stream *dev_stream,
+					 unsigned int frames)
+{
+	if (dev_stream->conv_cache)
+		frames = cras_fmt_conv_in_frames_to_out(
+				dev_stream->conv_cache->conv, frames);
+	return cras_fmt_conv_in_frames_to_out(dev_stream->conv, frames);
+}
+
+static unsigned int dev_frames_to_stream(const struct dev_stream *dev_stream,
+					 unsigned int frames)
+{
+	frames = cras_fmt_conv_out_frames_to_in(dev_stream->conv, frames);
+	if (dev_stream->conv_cache)
+		frames = cras_fmt_conv_out_frames_to_in(
+				dev_stream->conv_cache->conv, frames);
+	return frames;
+}
+
 struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 				     unsigned int dev_id,
 				     const struct cras_audio_format *dev_fmt,
@@ -43,6 +372,7 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	int rc = 0;
 	unsigned int max_frames, dev_frames, buf_bytes;
 	const struct cras_audio_format *ofmt;
+	struct cras_audio_format mid_fmt;
 
 	out = calloc(1, sizeof(*out));
 	out->dev_id = dev_id;
@@ -54,11 +384,23 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 				 cras_frames_at_rate(stream_fmt->frame_rate,
 						     stream->buffer_frames,
 						     dev_fmt->frame_rate));
-		rc = config_format_converter(&out->conv,
-					     stream->direction,
-					     stream_fmt,
-					     dev_fmt,
-					     max_frames);
+		/* Conversion to the rate and layout of the device goes
+		 * through a cache shared with other devices, including the
+		 * first one so that the devices attached later find the
+		 * frames it has converted. */
+		mid_fmt = *dev_fmt;
+		mid_fmt.format = SND_PCM_FORMAT_S16_LE;
+		if (!audio_format_equal(stream_fmt, &mid_fmt)) {
+			rc = conv_cache_attach(out, &mid_fmt, max_frames);
+			stream_fmt = &mid_fmt;
+		}
+		if (rc == 0)
+			rc = config_format_converter(&out->conv,
+						     stream->direction,
+						     stream_fmt,
+						     dev_fmt,
+						     max_frames);
+		stream_fmt = &stream->format;
 	} else {
 		max_frames = MAX(stream->buffer_frames,
 				 cras_frames_at_rate(dev_fmt->frame_rate,
@@ -71,6 +413,8 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 					     max_frames);
 	}
 	if (rc) {
+		if (out->conv_cache)
+			conv_cache_detach(out);
 		free(out);
 		return NULL;
 	}
@@ -78,8 +422,7 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	ofmt = cras_fmt_conv_out_format(out->conv);
 
 	dev_frames = (stream->direction == CRAS_STREAM_OUTPUT)
-		? cras_fmt_conv_in_frames_to_out(out->conv,
-						 stream->buffer_frames)
+		? stream_frames_to_dev(out, stream->buffer_frames)
 		: cras_fmt_conv_out_frames_to_in(out->conv,
 						 stream->buffer_frames);
 
@@ -115,6 +458,8 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 void dev_stream_destroy(struct dev_stream *dev_stream)
 {
 	cras_rstream_dev_detach(dev_stream->stream, dev_stream->dev_id);
+	if (dev_stream->conv_cache)
+		conv_cache_detach(dev_stream);
 	if (dev_stream->conv) {
 		cras_audio_area_destroy(dev_stream->conv_area);
 		cras_fmt_conv_destroy(dev_stream->conv);
@@ -150,18 +495,113 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 
 }
 
-int dev_stream_mix(struct dev_stream *dev_stream,
-		   const struct cras_audio_format *fmt,
-		   uint8_t *dst,
-		   unsigned int num_to_write)
+/* Mixes frames in the device format from src into dst, or into float_dst when
+ * it is not NULL, and moves whichever is used past them. */
+static void mix_add_frames(struct cras_rstream *rstream,
+			   const struct cras_audio_format *fmt,
+			   uint8_t **dst,
+			   float **float_dst,
+			   uint8_t *src,
+			   unsigned int frames,
+			   float mix_vol)
+{
+	unsigned int num_samples = frames * fmt->num_channels;
+
+	if (*float_dst) {
+		cras_mix_add_float(fmt->format, *float_dst, src, num_samples,
+				   cras_rstream_get_mute(rstream), mix_vol);
+		*float_dst += num_samples;
+	} else {
+		cras_mix_add(fmt->format, *dst, src, num_samples, 1,
+			     cras_rstream_get_mute(rstream), mix_vol);
+		*dst += frames * cras_get_format_bytes(fmt);
+	}
+}
+
+/* Mixes up to num_to_write frames from the conversion cache of the stream,
+ * converting more of the stream into it when this device has caught up with
+ * the other devices sharing it. Returns the number of frames mixed. */
+static unsigned int mix_from_conv_cache(struct dev_stream *dev_stream,
+					const struct cras_audio_format *fmt,
+					uint8_t *dst,
+					float *float_dst,
+					unsigned int num_to_write,
+					float mix_vol)
+{
+	struct dev_stream_conv_cache *cache = dev_stream->conv_cache;
+	unsigned int frame_bytes = cras_get_format_bytes(&cache->fmt);
+	int convert = cras_fmt_conversion_needed(dev_stream->conv);
+	unsigned int fr_written = 0;
+	unsigned int fr_read = 0;
+	unsigned int src_frames;
+
+	while (fr_written < num_to_write) {
+		unsigned int avail, read_frames, dev_frames;
+		uint8_t *src;
+
+		avail = cache->start + cache->frames -
+			dev_stream->conv_cache_pos;
+		if (avail == 0) {
+			unsigned int wanted = num_to_write - fr_written;
+
+			if (convert)
+				wanted = cras_fmt_conv_out_frames_to_in(
+						dev_stream->conv, wanted);
+			if (conv_cache_fill(cache, MAX(wanted, 1)) == 0)
+				break;
+			continue;
+		}
+
+		src = cache->buf +
+		      (dev_stream->conv_cache_pos - cache->start) *
+		      frame_bytes;
+		if (convert) {
+			read_frames = avail;
+			dev_frames = cras_fmt_conv_convert_frames(
+					dev_stream->conv,
+					src,
+					dev_stream->conv_buffer->bytes,
+					&read_frames,
+					num_to_write - fr_written);
+			src = dev_stream->conv_buffer->bytes;
+		} else {
+			dev_frames = MIN(avail, num_to_write - fr_written);
+			read_frames = dev_frames;
+		}
+		if (dev_frames == 0 && read_frames == 0)
+			break;
+
+		mix_add_frames(dev_stream->stream, fmt, &dst, &float_dst, src,
+			       dev_frames, mix_vol);
+		dev_stream->conv_cache_pos += read_frames;
+		fr_written += dev_frames;
+		fr_read += read_frames;
+	}
+
+	src_frames = conv_cache_mixed_src_frames(dev_stream);
+	cras_rstream_dev_offset_update(dev_stream->stream, src_frames,
+				       dev_stream->dev_id);
+	conv_cache_trim(cache);
+
+	ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX,
+				    fr_written, fr_read, src_frames);
+
+	return fr_written;
+}
+
+/* Mixes frames of the stream into either dst in the device format or into
+ * the float buffer float_dst when it is not NULL. */
+static int mix_frames(struct dev_stream *dev_stream,
+		      const struct cras_audio_format *fmt,
+		      uint8_t *dst,
+		      float *float_dst,
+		      unsigned int num_to_write)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	uint8_t *src;
-	uint8_t *target = dst;
 	unsigned int fr_written, fr_read;
 	unsigned int buffer_offset;
 	int fr_in_buf;
-	unsigned int num_samples;
 	size_t frames = 0;
 	unsigned int dev_frames;
 	float mix_vol;
@@ -172,11 +612,15 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 	if (fr_in_buf < num_to_write)
 		num_to_write = fr_in_buf;
 
-	buffer_offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
-
 	/* Stream volume scaler. */
 	mix_vol = cras_rstream_get_volume_scaler(dev_stream->stream);
 
+	if (dev_stream->conv_cache)
+		return mix_from_conv_cache(dev_stream, fmt, dst, float_dst,
+					   num_to_write, mix_vol);
+
+	buffer_offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+
 	fr_written = 0;
 	fr_read = 0;
 	while (fr_written < num_to_write) {
@@ -198,10 +642,8 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 			dev_frames = MIN(frames, num_to_write - fr_written);
 			read_frames = dev_frames;
 		}
-		num_samples = dev_frames * fmt->num_channels;
-		cras_mix_add(fmt->format, target, src, num_samples, 1,
-			     cras_rstream_get_mute(rstream), mix_vol);
-		target += dev_frames * cras_get_format_bytes(fmt);
+		mix_add_frames(rstream, fmt, &dst, &float_dst, src,
+			       dev_frames, mix_vol);
 		fr_written += dev_frames;
 		fr_read += read_frames;
 	}
@@ -213,6 +655,22 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 	return fr_written;
 }
 
+int dev_stream_mix(struct dev_stream *dev_stream,
+		   const struct cras_audio_format *fmt,
+		   uint8_t *dst,
+		   unsigned int num_to_write)
+{
+	return mix_frames(dev_stream, fmt, dst, NULL, num_to_write);
+}
+
+int dev_stream_mix_float(struct dev_stream *dev_stream,
+			 const struct cras_audio_format *fmt,
+			 float *dst,
+			 unsigned int num_to_write)
+{
+	return mix_frames(dev_stream, fmt, NULL, dst, num_to_write);
+}
+
 /* Copy from the captured buffer to the temporary format converted buffer. */
 static unsigned int capture_with_fmt_conv(struct dev_stream *dev_stream,
 					  const uint8_t *source_samples,
@@ -257,6 +715,60 @@ static unsigned int capture_with_fmt_conv(struct dev_stream *dev_stream,
 	return total_read;
 }
 
+/* Copies samples from area to the stream shm, starting where this device left
+ * off.  Samples are mixed with those other devices have written, so frames no
+ * device has reached yet are cleared first.  Continues at the start of the
+ * ring if the copy reaches its end.  Returns the number of frames copied.
+ */
+static unsigned int capture_copy_to_shm(struct dev_stream *dev_stream,
+					const struct cras_audio_area *area,
+					unsigned int area_offset,
+					float software_gain_scaler)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	struct cras_audio_shm *shm = cras_rstream_input_shm(rstream);
+	unsigned int frame_bytes = cras_shm_frame_bytes(shm);
+	unsigned int total_written = 0;
+
+	while (area_offset < area->frames) {
+		unsigned int offset, max_offset, frames, written, skip;
+		uint8_t *stream_samples;
+
+		offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+		stream_samples = cras_shm_get_writeable_frames(shm, offset,
+							       &frames);
+		frames = MIN(frames, area->frames - area_offset);
+		if (frames == 0)
+			break;
+
+		max_offset = cras_rstream_max_dev_offset(rstream);
+		if (offset + frames > max_offset) {
+			skip = max_offset > offset ? max_offset - offset : 0;
+			memset(stream_samples + skip * frame_bytes, 0,
+			       (frames - skip) * frame_bytes);
+		}
+
+		rstream->audio_area->frames = frames;
+		cras_audio_area_config_buf_pointers(rstream->audio_area,
+						    &rstream->format,
+						    stream_samples);
+		written = cras_audio_area_copy(rstream->audio_area, 0,
+					       &rstream->format, area,
+					       area_offset,
+					       software_gain_scaler);
+
+		if (written == 0)
+			break;
+
+		cras_rstream_dev_offset_update(rstream, written,
+					       dev_stream->dev_id);
+		area_offset += written;
+		total_written += written;
+	}
+
+	return total_written;
+}
+
 /* Copy from the converted buffer to the stream shm.  These have the same format
  * at this point. */
 static unsigned int capture_copy_converted_to_stream(
@@ -265,13 +777,11 @@ static unsigned int capture_copy_converted_to_stream(
 		float software_gain_scaler)
 {
 	struct cras_audio_shm *shm;
-	uint8_t *stream_samples;
 	uint8_t *converted_samples;
-	unsigned int num_frames;
 	unsigned int total_written = 0;
 	unsigned int write_frames;
+	unsigned int written;
 	unsigned int frame_bytes;
-	unsigned int offset;
 	const struct cras_audio_format *fmt;
 
 	shm = cras_rstream_input_shm(rstream);
@@ -279,27 +789,16 @@ static unsigned int capture_copy_converted_to_stream(
 	fmt = cras_fmt_conv_out_format(dev_stream->conv);
 	frame_bytes = cras_get_format_bytes(fmt);
 
-	offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
-
-	stream_samples = cras_shm_get_writeable_frames(
-			shm,
-			cras_rstream_get_cb_threshold(rstream),
-			&rstream->audio_area->frames);
-	num_frames = MIN(rstream->audio_area->frames - offset,
-			 buf_queued_bytes(dev_stream->conv_buffer) /
-							frame_bytes);
-
 	ATLOG(atlog, AUDIO_THREAD_CONV_COPY,
-				    shm->area->write_buf_idx,
-				    rstream->audio_area->frames,
-				    offset);
+	      shm->area->write_count,
+	      cras_shm_get_num_writeable(shm),
+	      cras_rstream_dev_offset(rstream, dev_stream->dev_id));
 
-	while (total_written < num_frames) {
+	while (buf_queued_bytes(dev_stream->conv_buffer)) {
 		converted_samples =
 			buf_read_pointer_size(dev_stream->conv_buffer,
 					      &write_frames);
 		write_frames /= frame_bytes;
-		write_frames = MIN(write_frames, num_frames - total_written);
 
 		cras_audio_area_config_buf_pointers(dev_stream->conv_area,
 						    fmt,
@@ -307,27 +806,20 @@ static unsigned int capture_copy_converted_to_stream(
 		cras_audio_area_config_channels(dev_stream->conv_area, fmt);
 		dev_stream->conv_area->frames = write_frames;
 
-		cras_audio_area_config_buf_pointers(rstream->audio_area,
-						    &rstream->format,
-						    stream_samples);
-
-		cras_audio_area_copy(rstream->audio_area, offset,
-				     &rstream->format,
-				     dev_stream->conv_area, 0,
-				     software_gain_scaler);
+		written = capture_copy_to_shm(dev_stream, dev_stream->conv_area,
+					      0, software_gain_scaler);
 
 		buf_increment_read(dev_stream->conv_buffer,
-				   write_frames * frame_bytes);
-		total_written += write_frames;
-		cras_rstream_dev_offset_update(rstream, write_frames,
-					       dev_stream->dev_id);
-		offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+				   written * frame_bytes);
+		total_written += written;
+		if (written < write_frames)
+			break;
 	}
 
 	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE,
 				    rstream->stream_id,
 				    total_written,
-				    cras_shm_frames_written(shm));
+				    cras_shm_get_frames(shm));
 	return total_written;
 }
 
@@ -337,8 +829,6 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 			float software_gain_scaler)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
-	struct cras_audio_shm *shm;
-	uint8_t *stream_samples;
 	unsigned int nread;
 
 	/* Check if format conversion is needed. */
@@ -354,30 +844,13 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 		capture_copy_converted_to_stream(dev_stream, rstream,
 						 software_gain_scaler);
 	} else {
-		unsigned int offset =
-			cras_rstream_dev_offset(rstream, dev_stream->dev_id);
-
-		/* Set up the shm area and copy to it. */
-		shm = cras_rstream_input_shm(rstream);
-		stream_samples = cras_shm_get_writeable_frames(
-				shm,
-				cras_rstream_get_cb_threshold(rstream),
-				&rstream->audio_area->frames);
-		cras_audio_area_config_buf_pointers(rstream->audio_area,
-						    &rstream->format,
-						    stream_samples);
-
-		nread = cras_audio_area_copy(rstream->audio_area, offset,
-					     &rstream->format, area,
-					     area_offset,
-					     software_gain_scaler);
+		nread = capture_copy_to_shm(dev_stream, area, area_offset,
+					    software_gain_scaler);
 
 		ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE,
-					    rstream->stream_id,
-					    nread,
-					    cras_shm_frames_written(shm));
-		cras_rstream_dev_offset_update(rstream, nread,
-					       dev_stream->dev_id);
+		      rstream->stream_id,
+		      nread,
+		      cras_shm_get_frames(cras_rstream_input_shm(rstream)));
 	}
 
 	return nread;
@@ -405,6 +878,21 @@ int dev_stream_playback_frames(const struct dev_stream *dev_stream)
 	if (!dev_stream->conv)
 		return frames;
 
+	if (dev_stream->conv_cache) {
+		const struct dev_stream_conv_cache *cache =
+			dev_stream->conv_cache;
+		unsigned int converted, cached;
+
+		/* Frames already in the cache count at the rate they were
+		 * converted to, only the rest have to be converted. */
+		converted = cache->src_end - dev_stream_src_pos(dev_stream);
+		cached = cache->start + cache->frames -
+			 dev_stream->conv_cache_pos;
+		frames = cached + cras_fmt_conv_in_frames_to_out(
+				cache->conv,
+				frames > converted ? frames - converted : 0);
+	}
+
 	return cras_fmt_conv_in_frames_to_out(dev_stream->conv, frames);
 }
 
@@ -414,8 +902,7 @@ unsigned int dev_stream_cb_threshold(const struct dev_stream *dev_stream)
 	unsigned int cb_threshold = cras_rstream_get_cb_threshold(rstream);
 
 	if (rstream->direction == CRAS_STREAM_OUTPUT)
-		return cras_fmt_conv_in_frames_to_out(dev_stream->conv,
-						      cb_threshold);
+		return stream_frames_to_dev(dev_stream, cb_threshold);
 	else
 		return cras_fmt_conv_out_frames_to_in(dev_stream->conv,
 						      cb_threshold);
@@ -435,8 +922,10 @@ unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream)
 	shm = cras_rstream_input_shm(rstream);
 
 	wlimit = cras_rstream_get_max_write_frames(rstream);
-	wlimit -= dev_offset;
-	cras_shm_get_writeable_frames(shm, wlimit, &frames_avail);
+	frames_avail = MIN(cras_shm_get_num_writeable(shm), wlimit);
+	if (frames_avail <= dev_offset)
+		return 0;
+	frames_avail -= dev_offset;
 
 	if (!dev_stream->conv)
 		return frames_avail;
@@ -516,7 +1005,7 @@ int dev_stream_capture_update_rstream(struct dev_stream *dev_stream)
 	ATLOG(atlog, AUDIO_THREAD_CAPTURE_POST,
 				    rstream->stream_id,
 				    frames_ready,
-				    rstream->shm.area->read_buf_idx);
+				    rstream->shm.area->read_count);
 
 	rc = cras_rstream_audio_ready(rstream, frames_ready);
 
@@ -582,8 +1071,7 @@ void dev_stream_set_delay(const struct dev_stream *dev_stream,
 
 	if (rstream->direction == CRAS_STREAM_OUTPUT) {
 		shm = cras_rstream_output_shm(rstream);
-		stream_frames = cras_fmt_conv_out_frames_to_in(dev_stream->conv,
-							       delay_frames);
+		stream_frames = dev_frames_to_stream(dev_stream, delay_frames);
 		cras_set_playback_timestamp(rstream->format.frame_rate,
 					    stream_frames +
 						cras_shm_get_frames(shm),
@@ -592,11 +1080,10 @@ void dev_stream_set_delay(const struct dev_stream *dev_stream,
 		shm = cras_rstream_input_shm(rstream);
 		stream_frames = cras_fmt_conv_in_frames_to_out(dev_stream->conv,
 							       delay_frames);
-		if (cras_shm_frames_written(shm) == 0)
-			cras_set_capture_timestamp(
-					rstream->format.frame_rate,
-					stream_frames,
-					&shm->area->ts);
+		cras_set_capture_timestamp(rstream->format.frame_rate,
+					   stream_frames +
+						cras_rstream_level(rstream),
+					   &shm->area->ts);
 	}
 }
 
@@ -607,9 +1094,11 @@ int dev_stream_can_fetch(struct dev_stream *dev_stream)
 
 	shm = cras_rstream_output_shm(rstream);
 
-	/* Don't fetch if the previous request hasn't got response. */
+	/* Don't fetch if the previous request hasn't got response, or if
+	 * there isn't room for another callback's worth of samples. */
 	return !cras_shm_callback_pending(shm) &&
-	       cras_shm_is_buffer_available(shm);
+	       cras_shm_get_num_writeable(shm) >=
+			cras_rstream_get_cb_threshold(rstream);
 }
 
 int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
@@ -630,18 +1119,6 @@ int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
 	return 0;
 }
 
-int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream)
-{
-	const struct cras_rstream *stream = dev_stream->stream;
-
-	if (!stream_uses_output(stream) ||
-	    !cras_shm_callback_pending(&stream->shm) ||
-	    cras_rstream_get_is_draining(stream))
-		return -1;
-
-	return stream->fd;
-}
-
 /*
  * Needed frames from this device such that written frames in shm meets
  * cb_threshold.
@@ -18,17 +18,24 @@
 struct cras_audio_area;
 struct cras_fmt_conv;
 struct cras_iodev;
+struct dev_stream_conv_cache;
 
 /*
  * Linked list of streams of audio from/to a client.
  * Args:
  *    dev_id - Index of the hw device.
  *    stream - The rstream attached to a device.
- *    conv - Sample rate or format converter.
+ *    conv - Sample rate or format converter. When conv_cache is used it
+ *           only converts from the cache to the device format.
  *    conv_buffer - The buffer for converter if needed.
  *    conv_buffer_size_frames - Size of conv_buffer in frames.
  *    dev_rate - Sampling rate of device. This is set when dev_stream is
  *               created.
+ *    conv_cache - Frames of an output stream converted to the rate and
+ *                 channel layout of the device, shared with the other
+ *                 devices that play the stream at the same rate and layout.
+ *                 NULL if the stream doesn't need that conversion.
+ *    conv_cache_pos - Index of the next frame in conv_cache to mix.
  */
 struct dev_stream {
 	unsigned int dev_id;
@@ -38,6 +45,8 @@ struct dev_stream {
 	struct cras_audio_area *conv_area;
 	unsigned int conv_buffer_size_frames;
 	size_t dev_rate;
+	struct dev_stream_conv_cache *conv_cache;
+	unsigned int conv_cache_pos;
 	struct dev_stream *prev, *next;
 };
 
@@ -82,6 +91,21 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 		   uint8_t *dst,
 		   unsigned int num_to_write);
 
+/*
+ * Same as dev_stream_mix() but adds the frames to a float mix buffer. The
+ * converted samples are turned into float while they are mixed, nothing is
+ * clipped.
+ * Args:
+ *    dev_stream - The struct holding the stream to mix.
+ *    format - The format of the audio device.
+ *    dst - The float destination buffer for mixing.
+ *    num_to_write - The number of frames written.
+ */
+int dev_stream_mix_float(struct dev_stream *dev_stream,
+			 const struct cras_audio_format *fmt,
+			 float *dst,
+			 unsigned int num_to_write);
+
 /*
  * Reads froms from the source into the dev_stream.
  * Args:
@@ -171,12 +195,6 @@ int dev_stream_wake_time(struct dev_stream *dev_stream,
 			 struct timespec *level_tstamp,
 			 struct timespec *wake_time_out);
 
-/*
- * Returns a non-negative fd if the fd is expecting a message and should be
- * added to the list of descriptors to poll.
- */
-int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream);
-
 static inline const struct timespec *
 dev_stream_next_cb_ts(struct dev_stream *dev_stream)
 {
@@ -0,0 +1,85 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Latency histograms kept by the audio thread. Each histogram has a single
+ * writer, the audio thread, and is read by the main thread while the audio
+ * thread keeps running. Every field is accessed atomically so a reader never
+ * sees a torn value, the fields of a snapshot may be one sample apart.
+ */
+#ifndef LATENCY_HIST_H_
+#define LATENCY_HIST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "cras_types.h"
+
+/* Histogram of latencies, see LATENCY_HIST_BUCKETS.
+ *    count - Number of samples added.
+ *    total_ns - Sum of all the samples in nanoseconds.
+ *    max_ns - The largest sample in nanoseconds.
+ *    buckets - Number of samples in each log2 microsecond bucket.
+ */
+struct latency_hist {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint32_t buckets[LATENCY_HIST_BUCKETS];
+};
+
+/* Adds a sample to the histogram. Must only be called from the audio
+ * thread. */
+static inline void latency_hist_add_ns(struct latency_hist *hist,
+				       uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int bucket = 0;
+
+	while (us > 1 && bucket < LATENCY_HIST_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	__atomic_store_n(&hist->buckets[bucket], hist->buckets[bucket] + 1,
+			 __ATOMIC_RELAXED);
+	if (ns > hist->max_ns)
+		__atomic_store_n(&hist->max_ns, ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->total_ns, hist->total_ns + ns,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELAXED);
+}
+
+static inline void latency_hist_add(struct latency_hist *hist,
+				    const struct timespec *ts)
+{
+	latency_hist_add_ns(hist, (uint64_t)ts->tv_sec * 1000000000ULL +
+				  ts->tv_nsec);
+}
+
+/* Adds the time between start and end, or zero if end isn't after start. */
+static inline void latency_hist_add_interval(struct latency_hist *hist,
+					     const struct timespec *start,
+					     const struct timespec *end)
+{
+	int64_t ns = (int64_t)(end->tv_sec - start->tv_sec) * 1000000000LL +
+		     (end->tv_nsec - start->tv_nsec);
+
+	latency_hist_add_ns(hist, ns > 0 ? ns : 0);
+}
+
+/* Copies a snapshot of the histogram to info, can be called from any
+ * thread. */
+static inline void latency_hist_get(const struct latency_hist *hist,
+				    struct latency_hist_debug_info *info)
+{
+	int i;
+
+	info->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	info->total_ns = __atomic_load_n(&hist->total_ns, __ATOMIC_RELAXED);
+	info->max_ns = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+		info->buckets[i] = __atomic_load_n(&hist->buckets[i],
+						   __ATOMIC_RELAXED);
+}
+
+#endif /* LATENCY_HIST_H_ */
@@ -3,42 +3,327 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/param.h>
+
 #include "cras_audio_area.h"
 #include "cras_util.h"
 #include "linear_resampler.h"
 
+/* Output frames whose source positions are computed in one pass before the
+ * interpolation kernel runs over them. */
+#define RESAMPLE_BLOCK_FRAMES 64
+
+/* The cubic kernel picks its coefficients from a table of
+ * 2^CUBIC_PHASE_BITS phases between two input frames. */
+#define CUBIC_PHASE_BITS 8
+#define CUBIC_NUM_PHASES (1 << CUBIC_PHASE_BITS)
+#define CUBIC_NUM_TAPS 4
+
+struct linear_resampler;
+
+/* Interpolates output frames from the source positions of a block.
+ * Args:
+ *    lr - The linear resampler.
+ *    src - The input buffer.
+ *    last - Index of the last valid frame in src.
+ *    dst - Where to write the first output frame of the block.
+ *    idx - The input frame each output frame falls on or after.
+ *    frac - The 0.32 fixed point distance from idx to the output frame.
+ *    frames - The number of frames in the block.
+ */
+typedef void (*interp_func)(const struct linear_resampler *lr,
+			    const uint8_t *src, unsigned int last,
+			    uint8_t *dst, const uint32_t *idx,
+			    const uint32_t *frac, unsigned int frames);
+
 /* A linear resampler.
  * Members:
  *    num_channels - The number of channles in once frames.
+ *    format - The sample format.
  *    format_bytes - The size of one frame in bytes.
  *    src_offset - The accumulated offset for resampled src data.
  *    dst_offset - The accumulated offset for resampled dst data.
  *    to_times_100 - The numerator of the rate factor used for SRC.
  *    from_times_100 - The denominator of the rate factor used for SRC.
- *    f - The rate factor used for linear resample.
+ *    step_int - Integer part of input frames advanced per output frame.
+ *    step_rem - Remainder of input frames advanced per output frame, in
+ *        units of 1/to_times_100.
+ *    frac_scale - Converts a remainder into a 0.32 fixed point fraction,
+ *        scaled up by 2^31 and rounded up so exact fractions convert
+ *        exactly.
+ *    interp - The selected interpolation.
+ *    interp_fn - The kernel for the format and interpolation.
+ *    cubic_coefs - Per phase coefficients for the cubic kernel.
  */
 struct linear_resampler {
 	unsigned int num_channels;
+	snd_pcm_format_t format;
 	unsigned int format_bytes;
 	unsigned int src_offset;
 	unsigned int dst_offset;
 	unsigned int to_times_100;
 	unsigned int from_times_100;
-	float f;
+	unsigned int step_int;
+	unsigned int step_rem;
+	uint64_t frac_scale;
+	enum linear_resampler_interp interp;
+	interp_func interp_fn;
+	float (*cubic_coefs)[CUBIC_NUM_TAPS];
 };
 
+/* Linear kernels. Each output sample is a + (b - a) * frac, where a and b
+ * are the samples at idx and the frame after it. On the last valid frame
+ * b is a, which makes the output a copy. The inner loops run over the
+ * channels of one frame with no dependency between them so the compiler
+ * can vectorize them. */
+static inline void linear_s16(const struct linear_resampler *lr,
+			      const uint8_t *src, unsigned int last,
+			      uint8_t *dst, const uint32_t *idx,
+			      const uint32_t *frac, unsigned int frames,
+			      const unsigned int num_channels)
+{
+	const int16_t *in = (const int16_t *)src;
+	int16_t *out = (int16_t *)dst;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, out += num_channels) {
+		const int16_t *a = in + idx[i] * num_channels;
+		const int16_t *b = in + MIN(idx[i] + 1, last) * num_channels;
+		const int32_t f = frac[i] >> 17;
+
+		for (ch = 0; ch < num_channels; ch++)
+			out[ch] = a[ch] + (((b[ch] - a[ch]) * f +
+					    (1 << 14)) >> 15);
+	}
+}
+
+static inline void linear_s32(const struct linear_resampler *lr,
+			      const uint8_t *src, unsigned int last,
+			      uint8_t *dst, const uint32_t *idx,
+			      const uint32_t *frac, unsigned int frames,
+			      const unsigned int num_channels)
+{
+	const int32_t *in = (const int32_t *)src;
+	int32_t *out = (int32_t *)dst;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, out += num_channels) {
+		const int32_t *a = in + idx[i] * num_channels;
+		const int32_t *b = in + MIN(idx[i] + 1, last) * num_channels;
+		const int64_t f = frac[i] >> 1;
+
+		for (ch = 0; ch < num_channels; ch++)
+			out[ch] = a[ch] + ((((int64_t)b[ch] - a[ch]) * f +
+					    (1LL << 30)) >> 31);
+	}
+}
+
+static inline void linear_float(const struct linear_resampler *lr,
+				const uint8_t *src, unsigned int last,
+				uint8_t *dst, const uint32_t *idx,
+				const uint32_t *frac, unsigned int frames,
+				const unsigned int num_channels)
+{
+	const float *in = (const float *)src;
+	float *out = (float *)dst;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, out += num_channels) {
+		const float *a = in + idx[i] * num_channels;
+		const float *b = in + MIN(idx[i] + 1, last) * num_channels;
+		const float f = frac[i] * (1.0f / 4294967296.0f);
+
+		for (ch = 0; ch < num_channels; ch++)
+			out[ch] = a[ch] + (b[ch] - a[ch]) * f;
+	}
+}
+
+/* Cubic kernels. The four taps are the frames before idx, at idx and the
+ * two after it, clamped to the valid range of the input buffer. The phase
+ * is the fraction rounded to the nearest table entry. */
+static inline const float *cubic_taps(const struct linear_resampler *lr,
+				      uint32_t frac)
+{
+	uint64_t half = 1U << (31 - CUBIC_PHASE_BITS);
+
+	return lr->cubic_coefs[(frac + half) >> (32 - CUBIC_PHASE_BITS)];
+}
+
+static inline void cubic_s16(const struct linear_resampler *lr,
+			     const uint8_t *src, unsigned int last,
+			     uint8_t *dst, const uint32_t *idx,
+			     const uint32_t *frac, unsigned int frames,
+			     const unsigned int num_channels)
+{
+	const int16_t *in = (const int16_t *)src;
+	int16_t *out = (int16_t *)dst;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, out += num_channels) {
+		const float *c = cubic_taps(lr, frac[i]);
+		const int16_t *s0 = in + (idx[i] ? idx[i] - 1 : 0) *
+					 num_channels;
+		const int16_t *s1 = in + idx[i] * num_channels;
+		const int16_t *s2 = in + MIN(idx[i] + 1, last) * num_channels;
+		const int16_t *s3 = in + MIN(idx[i] + 2, last) * num_channels;
+
+		for (ch = 0; ch < num_channels; ch++) {
+			float v = c[0] * s0[ch] + c[1] * s1[ch] +
+				  c[2] * s2[ch] + c[3] * s3[ch];
+			v = MIN(MAX(v, INT16_MIN), INT16_MAX);
+			out[ch] = lrintf(v);
+		}
+	}
+}
+
+static inline void cubic_s32(const struct linear_resampler *lr,
+			     const uint8_t *src, unsigned int last,
+			     uint8_t *dst, const uint32_t *idx,
+			     const uint32_t *frac, unsigned int frames,
+			     const unsigned int num_channels)
+{
+	const int32_t *in = (const int32_t *)src;
+	int32_t *out = (int32_t *)dst;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, out += num_channels) {
+		const float *c = cubic_taps(lr, frac[i]);
+		const int32_t *s0 = in + (idx[i] ? idx[i] - 1 : 0) *
+					 num_channels;
+		const int32_t *s1 = in + idx[i] * num_channels;
+		const int32_t *s2 = in + MIN(idx[i] + 1, last) * num_channels;
+		const int32_t *s3 = in + MIN(idx[i] + 2, last) * num_channels;
+
+		for (ch = 0; ch < num_channels; ch++) {
+			double v = (double)c[0] * s0[ch] +
+				   (double)c[1] * s1[ch] +
+				   (double)c[2] * s2[ch] +
+				   (double)c[3] * s3[ch];
+			v = MIN(MAX(v, INT32_MIN), INT32_MAX);
+			out[ch] = lrint(v);
+		}
+	}
+}
+
+static inline void cubic_float(const struct linear_resampler *lr,
+			       const uint8_t *src, unsigned int last,
+			       uint8_t *dst, const uint32_t *idx,
+			       const uint32_t *frac, unsigned int frames,
+			       const unsigned int num_channels)
+{
+	const float *in = (const float *)src;
+	float *out = (float *)dst;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, out += num_channels) {
+		const float *c = cubic_taps(lr, frac[i]);
+		const float *s0 = in + (idx[i] ? idx[i] - 1 : 0) *
+				       num_channels;
+		const float *s1 = in + idx[i] * num_channels;
+		const float *s2 = in + MIN(idx[i] + 1, last) * num_channels;
+		const float *s3 = in + MIN(idx[i] + 2, last) * num_channels;
+
+		for (ch = 0; ch < num_channels; ch++)
+			out[ch] = c[0] * s0[ch] + c[1] * s1[ch] +
+				  c[2] * s2[ch] + c[3] * s3[ch];
+	}
+}
+
+/* Wraps each kernel in an interp_func that has copies of it for one and two
+ * channels, where the channel loop has a constant trip count and can be
+ * unrolled, and one for any other channel count. */
+#define DEFINE_INTERP_FUNC(kernel)					\
+static void interp_##kernel(const struct linear_resampler *lr,		\
+			    const uint8_t *src, unsigned int last,	\
+			    uint8_t *dst, const uint32_t *idx,		\
+			    const uint32_t *frac, unsigned int frames)	\
+{									\
+	switch (lr->num_channels) {					\
+	case 1:								\
+		kernel(lr, src, last, dst, idx, frac, frames, 1);	\
+		break;							\
+	case 2:								\
+		kernel(lr, src, last, dst, idx, frac, frames, 2);	\
+		break;							\
+	default:							\
+		kernel(lr, src, last, dst, idx, frac, frames,		\
+		       lr->num_channels);				\
+		break;							\
+	}								\
+}
+
+DEFINE_INTERP_FUNC(linear_s16)
+DEFINE_INTERP_FUNC(linear_s32)
+DEFINE_INTERP_FUNC(linear_float)
+DEFINE_INTERP_FUNC(cubic_s16)
+DEFINE_INTERP_FUNC(cubic_s32)
+DEFINE_INTERP_FUNC(cubic_float)
+
+/* Fills the Catmull-Rom coefficients for each phase. The table has one
+ * entry past the last phase so that rounding the fraction up is safe. */
+static int init_cubic_coefs(struct linear_resampler *lr)
+{
+	unsigned int i;
+
+	lr->cubic_coefs = calloc(CUBIC_NUM_PHASES + 1,
+				 sizeof(*lr->cubic_coefs));
+	if (!lr->cubic_coefs)
+		return -ENOMEM;
+
+	for (i = 0; i <= CUBIC_NUM_PHASES; i++) {
+		float t = (float)i / CUBIC_NUM_PHASES;
+		float t2 = t * t;
+		float t3 = t2 * t;
+
+		lr->cubic_coefs[i][0] = 0.5f * (-t3 + 2.0f * t2 - t);
+		lr->cubic_coefs[i][1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+		lr->cubic_coefs[i][2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+		lr->cubic_coefs[i][3] = 0.5f * (t3 - t2);
+	}
+	return 0;
+}
+
+static interp_func get_interp_func(snd_pcm_format_t format,
+				   enum linear_resampler_interp interp)
+{
+	int cubic = (interp == LINEAR_RESAMPLER_INTERP_CUBIC);
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		return cubic ? interp_cubic_s16 : interp_linear_s16;
+	case SND_PCM_FORMAT_S32_LE:
+		return cubic ? interp_cubic_s32 : interp_linear_s32;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cubic ? interp_cubic_float : interp_linear_float;
+	default:
+		return NULL;
+	}
+}
+
 struct linear_resampler *linear_resampler_create(unsigned int num_channels,
-					     unsigned int format_bytes,
+					     snd_pcm_format_t format,
 					     float src_rate,
 					     float dst_rate)
 {
 	struct linear_resampler *lr;
+	interp_func fn;
+
+	fn = get_interp_func(format, LINEAR_RESAMPLER_INTERP_LINEAR);
+	if (!fn)
+		return NULL;
 
 	lr = (struct linear_resampler *)calloc(1, sizeof(*lr));
 	if (!lr)
 		return NULL;
 	lr->num_channels = num_channels;
-	lr->format_bytes = format_bytes;
+	lr->format = format;
+	lr->format_bytes = num_channels *
+			   (format == SND_PCM_FORMAT_S16_LE ? 2 : 4);
+	lr->interp = LINEAR_RESAMPLER_INTERP_LINEAR;
+	lr->interp_fn = fn;
 
 	linear_resampler_set_rates(lr, src_rate, dst_rate);
 
@@ -47,20 +332,45 @@ struct linear_resampler *linear_resampler_create(unsigned int num_channels,
 
 void linear_resampler_destroy(struct linear_resampler *lr)
 {
-	if (lr)
+	if (lr) {
+		free(lr->cubic_coefs);
 		free(lr);
+	}
 }
 
 void linear_resampler_set_rates(struct linear_resampler *lr,
 				float from, float to)
 {
-	lr->f = (float)to / from;
-	lr->to_times_100 = to * 100;
-	lr->from_times_100 = from * 100;
+	lr->to_times_100 = MAX((unsigned int)(to * 100), 1);
+	lr->from_times_100 = MAX((unsigned int)(from * 100), 1);
+	lr->step_int = lr->from_times_100 / lr->to_times_100;
+	lr->step_rem = lr->from_times_100 % lr->to_times_100;
+	lr->frac_scale = ((1ULL << 63) + lr->to_times_100 - 1) /
+			 lr->to_times_100;
 	lr->src_offset = 0;
 	lr->dst_offset = 0;
 }
 
+int linear_resampler_set_interp(struct linear_resampler *lr,
+				enum linear_resampler_interp interp)
+{
+	interp_func fn;
+
+	fn = get_interp_func(lr->format, interp);
+	if (!fn)
+		return -EINVAL;
+
+	if (interp == LINEAR_RESAMPLER_INTERP_CUBIC && !lr->cubic_coefs) {
+		int rc = init_cubic_coefs(lr);
+		if (rc)
+			return rc;
+	}
+
+	lr->interp = interp;
+	lr->interp_fn = fn;
+	return 0;
+}
+
 /* Assuming the linear resampler transforms X frames of input buffer into
  * Y frames of output buffer. The resample method requires the last output
  * buffer at Y-1 be interpolated from input buffer in range (X-d, X-1) as
@@ -73,17 +383,22 @@ void linear_resampler_set_rates(struct linear_resampler *lr,
  * when the resampled frames number isn't sufficient to consume the first
  * buffer at input or output offset(index 0), always count as one buffer
  * used so the intput/output offset can always increment.
+ *
+ * f is to_times_100 / from_times_100, both sides of the equations are
+ * scaled by it so the counts are exact and match the positions
+ * linear_resampler_resample steps through.
  */
 unsigned int linear_resampler_out_frames_to_in(struct linear_resampler *lr,
 					       unsigned int frames)
 {
-	float in_frames;
+	uint64_t in_scaled, offset_scaled;
 	if (frames == 0)
 		return 0;
 
-	in_frames = (float)(lr->dst_offset + frames) / lr->f;
-	if ((in_frames > lr->src_offset))
-		return 1 + (unsigned int)(in_frames - lr->src_offset);
+	in_scaled = (uint64_t)(lr->dst_offset + frames) * lr->from_times_100;
+	offset_scaled = (uint64_t)lr->src_offset * lr->to_times_100;
+	if (in_scaled > offset_scaled)
+		return 1 + (in_scaled - offset_scaled) / lr->to_times_100;
 	else
 		return 1;
 }
@@ -91,13 +406,15 @@ unsigned int linear_resampler_out_frames_to_in(struct linear_resampler *lr,
 unsigned int linear_resampler_in_frames_to_out(struct linear_resampler *lr,
 					       unsigned int frames)
 {
-	float out_frames;
+	uint64_t out_scaled, offset_scaled;
 	if (frames == 0)
 		return 0;
 
-	out_frames = lr->f * (lr->src_offset + frames - 1);
-	if (out_frames > lr->dst_offset)
-		return 1 + (unsigned int)(out_frames - lr->dst_offset);
+	out_scaled = (uint64_t)(lr->src_offset + frames - 1) *
+		     lr->to_times_100;
+	offset_scaled = (uint64_t)lr->dst_offset * lr->from_times_100;
+	if (out_scaled > offset_scaled)
+		return 1 + (out_scaled - offset_scaled) / lr->from_times_100;
 	else
 		return 1;
 }
@@ -107,17 +424,26 @@ int linear_resampler_needed(struct linear_resampler *lr)
 	return lr->from_times_100 != lr->to_times_100;
 }
 
+/* The source position of output frame dst_offset + n is
+ * (dst_offset + n) * from_times_100 / to_times_100 - src_offset. It is kept
+ * as an integer frame index pos and a remainder rem in units of
+ * 1/to_times_100, so stepping to the next output frame is two additions and
+ * a carry instead of a divide. Positions before the start of the buffer are
+ * clamped to the first frame. */
 unsigned int linear_resampler_resample(struct linear_resampler *lr,
 			     uint8_t *src,
 			     unsigned int *src_frames,
 			     uint8_t *dst,
 			     unsigned dst_frames)
 {
-	int ch;
-	unsigned int src_idx = 0;
+	uint32_t idx[RESAMPLE_BLOCK_FRAMES];
+	uint32_t frac[RESAMPLE_BLOCK_FRAMES];
 	unsigned int dst_idx = 0;
-	float src_pos;
-	int16_t *in, *out;
+	unsigned int last, n;
+	uint64_t scaled;
+	int64_t pos;
+	unsigned int rem;
+	int done = 0;
 
 	/* Check for corner cases so that we can assume both src_idx and
 	 * dst_idx are valid with value 0 in the loop below. */
@@ -125,41 +451,54 @@ unsigned int linear_resampler_resample(struct linear_resampler *lr,
 		*src_frames = 0;
 		return 0;
 	}
+	last = *src_frames - 1;
 
-	for (dst_idx = 0; dst_idx <= dst_frames; dst_idx++) {
-		src_pos = (float)(lr->dst_offset + dst_idx) / lr->f;
-		if (src_pos > lr->src_offset)
-			src_pos -= lr->src_offset;
-		else
-			src_pos = 0;
-		src_idx = (unsigned int)src_pos;
-
-		if (src_pos > *src_frames - 1 || dst_idx >= dst_frames) {
-			if (src_pos > *src_frames - 1)
-				src_idx = *src_frames - 1;
-			/* When this loop stops, dst_idx is always at the last
-			 * used index incremented by 1. */
-			break;
-		}
+	scaled = (uint64_t)lr->dst_offset * lr->from_times_100;
+	pos = (int64_t)(scaled / lr->to_times_100) - lr->src_offset;
+	rem = scaled % lr->to_times_100;
 
-		in = (int16_t *)(src + src_idx * lr->format_bytes);
-		out = (int16_t *)(dst + dst_idx * lr->format_bytes);
-
-		/* Don't do linear interpolcation if src_pos falls on the
-		 * last index. */
-		if (src_idx == *src_frames - 1) {
-			for (ch = 0; ch < lr->num_channels; ch++)
-				out[ch] = in[ch];
-		} else {
-			for (ch = 0; ch < lr->num_channels; ch++) {
-				out[ch] = in[ch] + (src_pos - src_idx) *
-					(in[lr->num_channels + ch] - in[ch]);
+	while (!done) {
+		for (n = 0; n < RESAMPLE_BLOCK_FRAMES; n++) {
+			if (dst_idx + n >= dst_frames) {
+				done = 1;
+				break;
+			}
+			/* Stop once the position passes the last frame, the
+			 * output frame there needs input from the next call. */
+			if (pos > last || (pos == last && rem)) {
+				done = 1;
+				break;
+			}
+			if (pos < 0) {
+				idx[n] = 0;
+				frac[n] = 0;
+			} else {
+				idx[n] = pos;
+				frac[n] = (rem * lr->frac_scale) >> 31;
+			}
+
+			pos += lr->step_int;
+			rem += lr->step_rem;
+			if (rem >= lr->to_times_100) {
+				rem -= lr->to_times_100;
+				pos++;
 			}
 		}
 
+		lr->interp_fn(lr, src, last,
+			      dst + dst_idx * lr->format_bytes,
+			      idx, frac, n);
+		dst_idx += n;
 	}
 
-	*src_frames = src_idx + 1;
+	/* pos is now at the first output frame not written, consume the
+	 * input up to the frame it falls on. */
+	if (pos < 0)
+		*src_frames = 1;
+	else if (pos > last || (pos == last && rem))
+		*src_frames = last + 1;
+	else
+		*src_frames = pos + 1;
 
 	lr->src_offset += *src_frames;
 	lr->dst_offset += dst_idx;
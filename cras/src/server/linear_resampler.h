@@ -6,18 +6,33 @@
 #ifndef LINEAR_RESAMPLER_H_
 #define LINEAR_RESAMPLER_H_
 
+#include "cras_audio_format.h"
 
 struct linear_resampler;
 
+/* Interpolation used between input frames.
+ *    LINEAR_RESAMPLER_INTERP_LINEAR - Two tap linear interpolation.
+ *    LINEAR_RESAMPLER_INTERP_CUBIC - Four tap cubic (Catmull-Rom)
+ *        interpolation, using a polyphase table of coefficients.
+ */
+enum linear_resampler_interp {
+	LINEAR_RESAMPLER_INTERP_LINEAR,
+	LINEAR_RESAMPLER_INTERP_CUBIC,
+};
+
 /* Creates a linear resampler.
  * Args:
  *    num_channels - The number of channels in each frames.
- *    format_bytes - The length of one frame in bytes.
+ *    format - The sample format, one of SND_PCM_FORMAT_S16_LE,
+ *        SND_PCM_FORMAT_S32_LE or SND_PCM_FORMAT_FLOAT_LE.
  *    src_rate - The source rate to resample from.
  *    dst_rate - The destination rate to resample to.
+ * Returns:
+ *    The resampler, or NULL if the format isn't supported or on allocation
+ *    failure.
  */
 struct linear_resampler *linear_resampler_create(unsigned int num_channels,
-						 unsigned int format_bytes,
+						 snd_pcm_format_t format,
 						 float src_rate,
 						 float dst_rate);
 
@@ -30,6 +45,16 @@ void linear_resampler_set_rates(struct linear_resampler *lr,
 				float from,
 				float to);
 
+/* Selects the interpolation used by the resampler.
+ * Args:
+ *    lr - The linear resampler.
+ *    interp - The interpolation to use from the next resample call on.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int linear_resampler_set_interp(struct linear_resampler *lr,
+				enum linear_resampler_interp interp);
+
 /* Converts the frames count from output rate to input rate. */
 unsigned int linear_resampler_out_frames_to_in(struct linear_resampler *lr,
                                                unsigned int frames);
@@ -11,6 +11,7 @@
 
 struct stream_list {
 	struct cras_rstream *streams;
+	struct cras_rstream *streams_to_add;
 	struct cras_rstream *streams_to_delete;
 	stream_callback *stream_added_cb;
 	stream_callback *stream_removed_cb;
@@ -80,15 +81,42 @@ int stream_list_add(struct stream_list *list,
 {
 	int rc;
 
+	rc = stream_list_add_pending(list, stream_config, stream);
+	if (rc)
+		return rc;
+
+	return stream_list_attach_stream(list, (*stream)->stream_id);
+}
+
+int stream_list_add_pending(struct stream_list *list,
+			    struct cras_rstream_config *stream_config,
+			    struct cras_rstream **stream)
+{
+	int rc;
+
 	rc = list->stream_create_cb(stream_config, stream);
 	if (rc)
 		return rc;
 
-	DL_APPEND(list->streams, *stream);
-	rc = list->stream_added_cb(*stream);
+	DL_APPEND(list->streams_to_add, *stream);
+	return 0;
+}
+
+int stream_list_attach_stream(struct stream_list *list, cras_stream_id_t id)
+{
+	struct cras_rstream *stream;
+	int rc;
+
+	DL_SEARCH_SCALAR(list->streams_to_add, stream, stream_id, id);
+	if (!stream)
+		return -ENOENT;
+	DL_DELETE(list->streams_to_add, stream);
+
+	DL_APPEND(list->streams, stream);
+	rc = list->stream_added_cb(stream);
 	if (rc) {
-		DL_DELETE(list->streams, *stream);
-		list->stream_destroy_cb(*stream);
+		DL_DELETE(list->streams, stream);
+		list->stream_destroy_cb(stream);
 	}
 
 	return rc;
@@ -98,6 +126,14 @@ int stream_list_rm(struct stream_list *list, cras_stream_id_t id)
 {
 	struct cras_rstream *to_remove;
 
+	/* A pending stream was never added to a device. */
+	DL_SEARCH_SCALAR(list->streams_to_add, to_remove, stream_id, id);
+	if (to_remove) {
+		DL_DELETE(list->streams_to_add, to_remove);
+		list->stream_destroy_cb(to_remove);
+		return 0;
+	}
+
 	DL_SEARCH_SCALAR(list->streams, to_remove, stream_id, id);
 	if (!to_remove)
 		return -EINVAL;
@@ -118,6 +154,12 @@ int stream_list_rm_all_client_streams(struct stream_list *list,
 	struct cras_rstream *to_remove;
 	int rc = 0;
 
+	DL_FOREACH(list->streams_to_add, to_remove) {
+		if (to_remove->client == rclient) {
+			DL_DELETE(list->streams_to_add, to_remove);
+			list->stream_destroy_cb(to_remove);
+		}
+	}
 	DL_FOREACH(list->streams, to_remove) {
 		if (to_remove->client == rclient) {
 			DL_DELETE(list->streams, to_remove);
@@ -31,6 +31,21 @@ int stream_list_add(struct stream_list *list,
 		    struct cras_rstream_config *stream_config,
 		    struct cras_rstream **stream);
 
+/* Creates a stream without adding it to any device yet, so the client can be
+ * told about its shm before a device is opened. The stream stays pending
+ * until stream_list_attach_stream() is called. */
+int stream_list_add_pending(struct stream_list *list,
+			    struct cras_rstream_config *stream_config,
+			    struct cras_rstream **stream);
+
+/* Adds a pending stream to its devices, opening them if needed. The stream is
+ * destroyed if that fails.
+ * Returns:
+ *    0 on success, -ENOENT if the stream isn't pending anymore, or the error
+ *    from adding it.
+ */
+int stream_list_attach_stream(struct stream_list *list, cras_stream_id_t id);
+
 int stream_list_rm(struct stream_list *list, cras_stream_id_t id);
 
 int stream_list_rm_all_client_streams(struct stream_list *list,
@@ -562,6 +562,7 @@ struct audio_thread *cras_iodev_list_get_audio_thread()
 }
 // From audio_thread
 struct audio_thread_event_log *atlog;
+struct audio_thread_trace *attrace;
 
 void audio_thread_add_write_callback(int fd, thread_callback cb, void *data) {
   write_callback = cb;
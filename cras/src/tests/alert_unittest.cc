@@ -188,6 +188,37 @@ TEST(Alert, TwoAlerts) {
   cras_alert_destroy_all();
 }
 
+TEST(Alert, MinInterval) {
+  struct cras_alert *alert = cras_alert_create(
+                                 NULL, CRAS_ALERT_FLAG_KEEP_ALL_DATA);
+  struct timespec ts;
+  int data = 1;
+  cras_alert_add_callback(alert, &callback1, NULL);
+  cras_alert_set_min_interval(alert, 50);
+  ResetStub();
+
+  cras_alert_pending(alert);
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+  EXPECT_EQ(0, cras_alert_get_next_timeout(&ts));
+
+  // Too soon after the last run, held until the interval passes.
+  cras_alert_pending_data(alert, &data, sizeof(data));
+  cras_alert_pending_data(alert, &data, sizeof(data));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+  ASSERT_EQ(1, cras_alert_get_next_timeout(&ts));
+  EXPECT_EQ(0, ts.tv_sec);
+  EXPECT_GE(50000000, ts.tv_nsec);
+
+  usleep(60000);
+  cras_alert_process_all_pending_alerts();
+  // All the data kept while held is passed on.
+  EXPECT_EQ(3, cb1_called);
+  EXPECT_EQ(0, cras_alert_get_next_timeout(&ts));
+  cras_alert_destroy(alert);
+}
+
 void callback1(void *arg, void *data)
 {
   cb1_called++;
@@ -122,6 +122,7 @@ static const char *cras_alsa_jack_get_name_ret_value = 0;
 static char default_jack_name[] = "Something Jack";
 static int auto_unplug_input_node_ret = 0;
 static int auto_unplug_output_node_ret = 0;
+static int enable_float_mix_ret = 0;
 static int ucm_get_max_software_gain_called;
 static int ucm_get_max_software_gain_ret_value;
 static long ucm_get_max_software_gain_value;
@@ -1454,6 +1455,37 @@ TEST(AlsaOutputNode, AutoUnplugOutputNode) {
   alsa_iodev_destroy((struct cras_iodev *)aio);
 }
 
+TEST(AlsaOutputNode, EnableFloatMixFromUcm) {
+  struct cras_iodev *iodev;
+  struct cras_alsa_mixer * const fake_mixer = (struct cras_alsa_mixer*)2;
+  struct cras_use_case_mgr * const fake_ucm = (struct cras_use_case_mgr*)3;
+
+  ResetStubData();
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 1, fake_mixer, fake_config, fake_ucm,
+      CRAS_STREAM_OUTPUT);
+  ASSERT_NE(iodev, (void *)NULL);
+  EXPECT_EQ(0, iodev->float_mix_enabled);
+  alsa_iodev_destroy(iodev);
+
+  enable_float_mix_ret = 1;
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 1, fake_mixer, fake_config, fake_ucm,
+      CRAS_STREAM_OUTPUT);
+  ASSERT_NE(iodev, (void *)NULL);
+  EXPECT_EQ(1, iodev->float_mix_enabled);
+  alsa_iodev_destroy(iodev);
+
+  // Capture never mixes, the flag is ignored.
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 1, fake_mixer, fake_config, fake_ucm,
+      CRAS_STREAM_INPUT);
+  ASSERT_NE(iodev, (void *)NULL);
+  EXPECT_EQ(0, iodev->float_mix_enabled);
+  alsa_iodev_destroy(iodev);
+  enable_float_mix_ret = 0;
+}
+
 TEST(AlsaOutputNode, AutoUnplugInputNode) {
   struct alsa_io *aio;
   struct cras_alsa_mixer * const fake_mixer = (struct cras_alsa_mixer*)2;
@@ -2534,7 +2566,8 @@ char *ucm_get_flag(struct cras_use_case_mgr *mgr, const char *flag_name) {
   if ((!strcmp(flag_name, "AutoUnplugInputNode") &&
        auto_unplug_input_node_ret) ||
       (!strcmp(flag_name, "AutoUnplugOutputNode") &&
-       auto_unplug_output_node_ret)) {
+       auto_unplug_output_node_ret) ||
+      (!strcmp(flag_name, "EnableFloatMix") && enable_float_mix_ret)) {
     snprintf(ret, 8, "%s", "1");
     return ret;
   }
@@ -9,6 +9,7 @@ extern "C" {
 
 #include <gtest/gtest.h>
 #include <map>
+#include <sys/socket.h>
 
 #define MAX_CALLS 10
 #define BUFFER_SIZE 8192
@@ -117,6 +118,8 @@ class StreamDeviceSuite : public testing::Test {
       memset(rstream, 0, sizeof(*rstream));
       rstream->direction = direction;
       rstream->cb_threshold = 480;
+      rstream->request_fd = -1;
+      rstream->reply_fd = -1;
       rstream->shm.area = static_cast<cras_audio_shm_area*>(
           calloc(1, sizeof(rstream->shm.area)));
     }
@@ -409,6 +412,112 @@ TEST_F(StreamDeviceSuite, InputStreamsSetInputDeviceWakeTime) {
   TearDownRstream(&rstream2);
 }
 
+// Returns 1 if fd is in the audio thread's epoll set.
+static int fd_in_epoll_set(int fd) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+TEST_F(StreamDeviceSuite, EpollSetFollowsOutputStreams) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_iodev iodev2;
+  struct cras_iodev *iodevs[] = {&iodev, &iodev2};
+  struct cras_rstream rstream;
+  int fds[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&iodev2, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  rstream.fd = fds[0];
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_open_dev(thread_, &iodev2);
+  EXPECT_EQ(0, fd_in_epoll_set(fds[0]));
+
+  // Added once even though the stream is attached to both devices.
+  thread_add_stream(thread_, &rstream, iodevs, 2);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+
+  // Stays in the set until the stream leaves the last device.
+  thread_remove_stream(thread_, &rstream, &iodev);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+  thread_rm_open_dev(thread_, &iodev2);
+  EXPECT_EQ(0, fd_in_epoll_set(fds[0]));
+
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+  thread_remove_stream(thread_, &rstream, NULL);
+  EXPECT_EQ(0, fd_in_epoll_set(fds[0]));
+
+  thread_rm_open_dev(thread_, &iodev);
+  TearDownRstream(&rstream);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(StreamDeviceSuite, EpollSetUsesDoorbellReplyFd) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream;
+  int fds[2];
+  int reply_fds[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  ASSERT_EQ(0, pipe(reply_fds));
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  rstream.fd = fds[0];
+  rstream.reply_fd = reply_fds[0];
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+  EXPECT_EQ(1, fd_in_epoll_set(reply_fds[0]));
+  EXPECT_EQ(0, fd_in_epoll_set(fds[0]));
+  thread_remove_stream(thread_, &rstream, NULL);
+  EXPECT_EQ(0, fd_in_epoll_set(reply_fds[0]));
+
+  thread_rm_open_dev(thread_, &iodev);
+  TearDownRstream(&rstream);
+  close(fds[0]);
+  close(fds[1]);
+  close(reply_fds[0]);
+  close(reply_fds[1]);
+}
+
+TEST_F(StreamDeviceSuite, EpollSetFollowsCallbacks) {
+  int fds[2];
+
+  ASSERT_EQ(0, pipe(fds));
+  audio_thread_add_callback(fds[0], NULL, NULL);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+  audio_thread_enable_callback(fds[0], 0);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+  audio_thread_rm_callback(fds[0]);
+  EXPECT_EQ(0, fd_in_epoll_set(fds[0]));
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(StreamDeviceSuite, EpollSetKeepsSharedCallbackFd) {
+  int fds[2];
+  int data1, data2;
+
+  ASSERT_EQ(0, pipe(fds));
+  audio_thread_add_callback(fds[0], NULL, &data1);
+  audio_thread_add_callback(fds[0], NULL, &data2);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+  audio_thread_rm_callback(fds[0]);
+  EXPECT_EQ(1, fd_in_epoll_set(fds[0]));
+  audio_thread_rm_callback(fds[0]);
+  EXPECT_EQ(0, fd_in_epoll_set(fds[0]));
+  close(fds[0]);
+  close(fds[1]);
+}
+
 TEST_F(StreamDeviceSuite, AddRemoveMultipleStreamsOnMultipleDevices) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct cras_iodev iodev2, *piodev2 = &iodev2;
@@ -657,24 +766,102 @@ TEST(AUdioThreadStreams, DrainStream) {
   shm_area.config.frame_bytes = 4;
   shm_area.config.used_size = 4096 * 4;
   rstream.shm.config.used_size = 4096 * 4;
+  shm_area.config.ring_frames = 4096;
+  rstream.shm.config.ring_frames = 4096;
   rstream.shm.area = &shm_area;
   rstream.format.frame_rate = 48000;
   rstream.direction = CRAS_STREAM_OUTPUT;
 
-  shm_area.write_offset[0] = 1 * 4;
+  shm_area.write_count = 1;
   EXPECT_EQ(1, thread_drain_stream_ms_remaining(&thread, &rstream));
 
-  shm_area.write_offset[0] = 479 * 4;
+  shm_area.write_count = 479;
   EXPECT_EQ(10, thread_drain_stream_ms_remaining(&thread, &rstream));
 
-  shm_area.write_offset[0] = 0;
+  shm_area.write_count = 0;
   EXPECT_EQ(0, thread_drain_stream_ms_remaining(&thread, &rstream));
 
   rstream.direction = CRAS_STREAM_INPUT;
-  shm_area.write_offset[0] = 479 * 4;
+  shm_area.write_count = 479;
   EXPECT_EQ(0, thread_drain_stream_ms_remaining(&thread, &rstream));
 }
 
+TEST(AudioThreadTrace, LogSnapshotAndDump) {
+  struct audio_thread_trace_event *events;
+  const struct audio_thread_trace *trace;
+  struct audio_debug_info *info;
+  struct timespec now;
+  struct stat st;
+  uint64_t now_ns, ns;
+  int fd, i, num_events;
+
+  ASSERT_EQ(0, audio_thread_trace_enable());
+  fd = audio_thread_trace_get_fd();
+  ASSERT_GE(fd, 0);
+  // Clients get a read only fd, and can't get write access by reopening it.
+  EXPECT_EQ(O_RDONLY, fcntl(fd, F_GETFL) & O_ACCMODE);
+  EXPECT_EQ(0, fstat(fd, &st));
+  EXPECT_EQ(0444, st.st_mode & 0777);
+#ifdef F_SEAL_FUTURE_WRITE
+  if (fcntl(fd, F_GET_SEALS) & F_SEAL_FUTURE_WRITE) {
+    char path[32];
+    int rw_fd;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    rw_fd = open(path, O_RDWR);
+    if (rw_fd >= 0) {
+      EXPECT_EQ(MAP_FAILED, mmap(NULL, sizeof(*trace), PROT_WRITE,
+                                 MAP_SHARED, rw_fd, 0));
+      close(rw_fd);
+    }
+  }
+#endif
+  trace = (const struct audio_thread_trace *)mmap(
+      NULL, sizeof(*trace), PROT_READ, MAP_SHARED, fd, 0);
+  ASSERT_NE(MAP_FAILED, trace);
+
+  // Wrap the ring so the snapshot has to drop the oldest events.
+  for (i = 0; i < AUDIO_THREAD_TRACE_SIZE + 10; i++)
+    audio_thread_event_log_data(atlog, AUDIO_THREAD_WAKE, i, 0, 0);
+  audio_thread_event_log_data(atlog, AUDIO_THREAD_SLEEP, 1, 2, 3);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+  events = (struct audio_thread_trace_event *)calloc(
+      AUDIO_THREAD_TRACE_SIZE, sizeof(*events));
+  // The oldest event shares its slot with the next one to be written, so a
+  // full ring gives one event less.
+  num_events = audio_thread_trace_snapshot(trace, events);
+  ASSERT_EQ(AUDIO_THREAD_TRACE_SIZE - 1, num_events);
+  EXPECT_EQ(AUDIO_THREAD_WAKE, events[0].tag);
+  EXPECT_EQ(12, events[0].data1);
+  EXPECT_EQ(AUDIO_THREAD_SLEEP, events[num_events - 1].tag);
+  EXPECT_EQ(3, events[num_events - 1].data3);
+  for (i = 1; i < num_events; i++)
+    EXPECT_LE(events[i - 1].ticks, events[i].ticks);
+  // The calibrated time stamps are within a second of the real clock.
+  ns = audio_thread_trace_ticks_to_ns(trace, events[num_events - 1].ticks);
+  EXPECT_LE(ns, now_ns + 1000000000ULL);
+  EXPECT_GE(ns + 1000000000ULL, now_ns);
+
+  // The dump gets the newest events in the event log format.
+  info = (struct audio_debug_info *)calloc(1, sizeof(*info));
+  append_trace_dump_info(info, attrace);
+  EXPECT_EQ(AUDIO_THREAD_EVENT_LOG_SIZE, info->log.len);
+  EXPECT_EQ(0, info->log.write_pos);
+  EXPECT_EQ(AUDIO_THREAD_SLEEP,
+            info->log.log[AUDIO_THREAD_EVENT_LOG_SIZE - 1].tag_sec >> 24);
+  EXPECT_EQ(ns % 1000000000ULL,
+            info->log.log[AUDIO_THREAD_EVENT_LOG_SIZE - 1].nsec);
+
+  free(info);
+  free(events);
+  munmap((void *)trace, sizeof(*trace));
+  munmap(attrace, sizeof(*attrace));
+  attrace = NULL;
+  close(trace_fd);
+  trace_fd = -1;
+}
 
 extern "C" {
 
@@ -851,6 +1038,11 @@ void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 {
 }
 
+int cras_rstream_get_audio_request_reply(struct cras_rstream *stream)
+{
+  return 0;
+}
+
 int cras_set_rt_scheduling(int rt_lim)
 {
   return 0;
@@ -911,6 +1103,14 @@ int dev_stream_mix(struct dev_stream *dev_stream,
   return num_to_write;
 }
 
+int dev_stream_mix_float(struct dev_stream *dev_stream,
+                         const struct cras_audio_format *fmt,
+                         float *dst,
+                         unsigned int num_to_write)
+{
+  return num_to_write;
+}
+
 int dev_stream_playback_frames(const struct dev_stream *dev_stream)
 {
   return dev_stream_playback_frames_ret;
@@ -921,11 +1121,6 @@ int dev_stream_playback_update_rstream(struct dev_stream *dev_stream)
   return 0;
 }
 
-int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream)
-{
-  return dev_stream->stream->fd;
-}
-
 int dev_stream_can_fetch(struct dev_stream *dev_stream)
 {
   return 1;
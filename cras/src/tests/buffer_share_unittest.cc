@@ -109,6 +109,28 @@ TEST_F(BufferShareTestSuite, TwoDevs) {
   buffer_share_destroy(dm);
 }
 
+TEST_F(BufferShareTestSuite, MaxOffset) {
+  buffer_share *dm = buffer_share_create(1024);
+
+  EXPECT_EQ(0, buffer_share_max_offset(dm));
+  EXPECT_EQ(0, buffer_share_add_id(dm, 0xf00, NULL));
+  EXPECT_EQ(0, buffer_share_add_id(dm, 0xf02, NULL));
+
+  buffer_share_offset_update(dm, 0xf00, 500);
+  EXPECT_EQ(500, buffer_share_max_offset(dm));
+  buffer_share_offset_update(dm, 0xf02, 750);
+  EXPECT_EQ(750, buffer_share_max_offset(dm));
+
+  // Relative to the new write point.
+  EXPECT_EQ(500, buffer_share_get_new_write_point(dm));
+  EXPECT_EQ(250, buffer_share_max_offset(dm));
+
+  EXPECT_EQ(0, buffer_share_rm_id(dm, 0xf02));
+  EXPECT_EQ(0, buffer_share_max_offset(dm));
+
+  buffer_share_destroy(dm);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
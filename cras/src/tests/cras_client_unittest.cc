@@ -22,6 +22,8 @@ static int close_called;
 static int pipe_called;
 static int sendmsg_called;
 static int write_called;
+static int write_fd_value;
+static size_t write_count_value;
 static void *mmap_return_value;
 static int samples_ready_called;
 static int samples_ready_frames_value;
@@ -50,10 +52,11 @@ class CrasClientTestSuite : public testing::Test {
   protected:
 
     void InitShm(struct cras_audio_shm* shm) {
-      shm->area = static_cast<cras_audio_shm_area*>(
-          calloc(1, sizeof(*shm->area)));
+      shm->area = NULL;
       cras_shm_set_frame_bytes(shm, 4);
       cras_shm_set_used_size(shm, shm_writable_frames_ * 4);
+      shm->area = static_cast<cras_audio_shm_area*>(
+          calloc(1, cras_shm_total_size(shm)));
       memcpy(&shm->area->config, &shm->config, sizeof(shm->config));
     }
 
@@ -72,6 +75,8 @@ class CrasClientTestSuite : public testing::Test {
       client_.server_fd_state = CRAS_SOCKET_STATE_CONNECTED;
       memset(&stream_, 0, sizeof(stream_));
       stream_.id = FIRST_STREAM_ID;
+      stream_.request_fd = -1;
+      stream_.reply_fd = -1;
 
       struct cras_stream_params* config =
           static_cast<cras_stream_params*>(calloc(1, sizeof(*config)));
@@ -131,39 +136,103 @@ TEST_F(CrasClientTestSuite, HandleCaptureDataReady) {
   stream_.config->aud_cb = capture_samples_ready;
   stream_.config->unified_cb = 0;
 
-  shm->area->write_buf_idx = 0;
-  shm->area->read_buf_idx = 0;
-  shm->area->write_offset[0] = 480 * 4;
-  shm->area->read_offset[0] = 0;
+  shm->area->write_count = 480;
+  shm->area->read_count = 0;
 
-  /* Normal scenario: read buffer has full of data written,
-   * handle_capture_data_ready() should consume all 480 frames and move
-   * read_buf_idx to the next buffer. */
+  /* Normal scenario: the ring holds a full callback of data,
+   * handle_capture_data_ready() should consume all 480 frames. */
   handle_capture_data_ready(&stream_, 480);
   EXPECT_EQ(1, samples_ready_called);
   EXPECT_EQ(480, samples_ready_frames_value);
-  EXPECT_EQ(cras_shm_buff_for_idx(shm, 0), samples_ready_samples_value);
-  EXPECT_EQ(1, shm->area->read_buf_idx);
-  EXPECT_EQ(0, shm->area->write_offset[0]);
-  EXPECT_EQ(0, shm->area->read_offset[0]);
+  EXPECT_EQ(shm->area->samples, samples_ready_samples_value);
+  EXPECT_EQ(480, shm->area->read_count);
 
   /* At the beginning of overrun: handle_capture_data_ready() should not
    * proceed to call audio_cb because there's no data captured. */
-  shm->area->read_buf_idx = 0;
-  shm->area->write_offset[0] = 0;
-  shm->area->read_offset[0] = 0;
   handle_capture_data_ready(&stream_, 480);
   EXPECT_EQ(1, samples_ready_called);
-  EXPECT_EQ(0, shm->area->read_buf_idx);
+  EXPECT_EQ(480, shm->area->read_count);
 
-  /* In the middle of overrun: partially written buffer should trigger
-   * audio_cb, feed the full-sized read buffer to client. */
-  shm->area->read_buf_idx = 0;
-  shm->area->write_offset[0] = 123;
-  shm->area->read_offset[0] = 0;
+  /* In the middle of overrun: less than a callback of data should not
+   * trigger audio_cb. */
+  shm->area->write_count = 480 + 123;
   handle_capture_data_ready(&stream_, 480);
   EXPECT_EQ(1, samples_ready_called);
-  EXPECT_EQ(0, shm->area->read_buf_idx);
+  EXPECT_EQ(480, shm->area->read_count);
+
+  FreeShm(shm);
+}
+
+TEST_F(CrasClientTestSuite, HandleCaptureDataReadyWrapsRing) {
+  struct cras_audio_shm *shm = &stream_.capture_shm;
+
+  stream_.direction = CRAS_STREAM_INPUT;
+
+  shm_writable_frames_ = 480;
+  InitShm(shm);
+  ASSERT_EQ(512, shm->config.ring_frames);
+  stream_.config->format.frame_rate = 48000;
+  stream_.config->buffer_frames = 480;
+  stream_.config->cb_threshold = 480;
+  stream_.config->aud_cb = capture_samples_ready;
+  stream_.config->unified_cb = 0;
+
+  /* 112 frames before the end of the ring and 368 after it. */
+  shm->area->read_count = 400;
+  shm->area->write_count = 400 + 480;
+  handle_capture_data_ready(&stream_, 480);
+  EXPECT_EQ(2, samples_ready_called);
+  EXPECT_EQ(368, samples_ready_frames_value);
+  EXPECT_EQ(shm->area->samples, samples_ready_samples_value);
+  EXPECT_EQ(880, shm->area->read_count);
+
+  FreeShm(shm);
+}
+
+int playback_samples_requested(cras_client* client,
+                               cras_stream_id_t stream_id,
+                               uint8_t* samples,
+                               size_t frames,
+                               const timespec* sample_ts,
+                               void* arg) {
+  samples_ready_called++;
+  samples_ready_samples_value = samples;
+  samples_ready_frames_value = frames;
+  return frames;
+}
+
+TEST_F(CrasClientTestSuite, HandlePlaybackRequestWrapsRing) {
+  struct cras_audio_shm *shm = &stream_.play_shm;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+
+  shm_writable_frames_ = 480;
+  InitShm(shm);
+  stream_.config->buffer_frames = 480;
+  stream_.config->cb_threshold = 240;
+  stream_.config->aud_cb = playback_samples_requested;
+  stream_.config->unified_cb = 0;
+  stream_.config->format.frame_rate = 48000;
+
+  /* 100 frames queued, 12 left before the end of the ring. */
+  shm->area->read_count = 400;
+  shm->area->write_count = 500;
+  EXPECT_EQ(0, handle_playback_request(&stream_, 240));
+  EXPECT_EQ(2, samples_ready_called);
+  EXPECT_EQ(228, samples_ready_frames_value);
+  EXPECT_EQ(shm->area->samples, samples_ready_samples_value);
+  EXPECT_EQ(740, shm->area->write_count);
+  EXPECT_EQ(1, write_called);
+
+  /* Only room for 140 more frames in the ring. */
+  samples_ready_called = 0;
+  EXPECT_EQ(0, handle_playback_request(&stream_, 240));
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(140, samples_ready_frames_value);
+  EXPECT_EQ(880, shm->area->write_count);
+  EXPECT_EQ(2, write_called);
+
+  FreeShm(shm);
 }
 
 void CrasClientTestSuite::StreamConnected(CRAS_STREAM_DIRECTION direction) {
@@ -184,6 +253,7 @@ void CrasClientTestSuite::StreamConnected(CRAS_STREAM_DIRECTION direction) {
   memset(&area, 0, sizeof(area));
   area.config.frame_bytes = format_bytes;
   area.config.used_size = shm_writable_frames_ * format_bytes;
+  area.config.ring_frames = 128;
 
   mmap_return_value = &area;
 
@@ -241,6 +311,7 @@ void CrasClientTestSuite::StreamConnectedFail(
   memset(&area, 0, sizeof(area));
   area.config.frame_bytes = format_bytes;
   area.config.used_size = shm_writable_frames_ * format_bytes;
+  area.config.ring_frames = 128;
 
   mmap_return_value = &area;
 
@@ -258,6 +329,70 @@ void CrasClientTestSuite::StreamConnectedFail(
   EXPECT_EQ(4, close_called); // close the pipefds and shm_fds
 }
 
+TEST_F(CrasClientTestSuite, StreamConnectedWithDoorbell) {
+  struct cras_client_stream_connected msg;
+  int stream_fds[4] = {0, 1, 7, 8};
+  struct cras_audio_format server_format;
+  struct cras_audio_shm_area area;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  set_audio_format(&server_format, SND_PCM_FORMAT_S16_LE, 44100, 2);
+  memset(&area, 0, sizeof(area));
+  area.config.frame_bytes = 4;
+  area.config.used_size = shm_writable_frames_ * 4;
+  area.config.ring_frames = 128;
+  mmap_return_value = &area;
+
+  cras_fill_client_stream_connected(&msg, 0, stream_.id, &server_format,
+                                    600);
+  stream_connected(&stream_, &msg, stream_fds, 4);
+
+  EXPECT_EQ(CRAS_THREAD_RUNNING, stream_.thread.state);
+  EXPECT_EQ(7, stream_.request_fd);
+  EXPECT_EQ(8, stream_.reply_fd);
+  EXPECT_EQ(2, close_called); // Only the shm fds.
+
+  // The reply rings the doorbell instead of sending an audio message.
+  write_called = 0;
+  EXPECT_EQ(0, send_playback_reply(&stream_, 10, 0));
+  EXPECT_EQ(1, write_called);
+  EXPECT_EQ(8, write_fd_value);
+  EXPECT_EQ(sizeof(uint64_t), write_count_value);
+}
+
+TEST_F(CrasClientTestSuite, SharedThreadWakesSortedByDeadline) {
+  struct client_stream streams[4];
+  struct shared_aud_wake wakes[4];
+  const time_t deadline_sec[4] = {3, 1, 2, 1};
+
+  for (unsigned int i = 0; i < 4; i++) {
+    memset(&streams[i], 0, sizeof(streams[i]));
+    wakes[i].stream = &streams[i];
+    wakes[i].events = EPOLLIN;
+    wakes[i].deadline.tv_sec = deadline_sec[i];
+    wakes[i].deadline.tv_nsec = 0;
+  }
+
+  sort_wakes_by_deadline(wakes, 4);
+
+  // Earliest first, streams due at the same time stay in wake order.
+  EXPECT_EQ(&streams[1], wakes[0].stream);
+  EXPECT_EQ(&streams[3], wakes[1].stream);
+  EXPECT_EQ(&streams[2], wakes[2].stream);
+  EXPECT_EQ(&streams[0], wakes[3].stream);
+}
+
+TEST_F(CrasClientTestSuite, SetSharedAudioThreads) {
+  EXPECT_EQ(0, cras_client_set_shared_audio_threads(&client_, 2));
+  EXPECT_EQ(2, client_.num_shared_aud_threads);
+
+  // Can't change once the client has streams.
+  client_.streams = &stream_;
+  EXPECT_EQ(-EBUSY, cras_client_set_shared_audio_threads(&client_, 1));
+  EXPECT_EQ(2, client_.num_shared_aud_threads);
+  client_.streams = NULL;
+}
+
 TEST_F(CrasClientTestSuite, InputStreamConnectedFail) {
   StreamConnectedFail(CRAS_STREAM_INPUT);
 }
@@ -317,6 +452,8 @@ extern "C" {
 
 ssize_t write(int fd, const void *buf, size_t count) {
   ++write_called;
+  write_fd_value = fd;
+  write_count_value = count;
   return count;
 }
 
@@ -3,10 +3,13 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <math.h>
 
 #include "cras_config.h"
 #include "cras_dsp_module.h"
 #include "cras_dsp_pipeline.h"
+#include "cras_types.h"
+#include "eq2.h"
 
 #define MAX_MODULES 10
 #define MAX_MOCK_PORTS 30
@@ -170,6 +173,8 @@ static struct dsp_module *create_mock_module(struct plugin *plugin)
   }
   if (strcmp(plugin->label, "inplace_broken") == 0) {
     data->properties = MODULE_INPLACE_BROKEN;
+  } else if (strcmp(plugin->label, "noop") == 0) {
+    data->properties = MODULE_NOOP;
   } else {
     data->properties = 0;
   }
@@ -465,17 +470,28 @@ TEST_F(DspPipelineTestSuite, Complex) {
 
   int16_t *samples = new int16_t[DSP_BUFFER_SIZE];
   fill_test_data(samples, DSP_BUFFER_SIZE);
-  cras_dsp_pipeline_apply(p, (uint8_t*)samples, 100);
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 100);
   /* the data flow through 2 plugins because m4 is disabled. */
   verify_processed_data(samples, 100, 2);
   delete[] samples;
 
-  ASSERT_EQ(1, d1->run_called);
-  ASSERT_EQ(1, d3->run_called);
+  /* The block size starts at 64 frames while it is being tuned. */
+  ASSERT_EQ(2, d1->run_called);
+  ASSERT_EQ(2, d3->run_called);
 
   /* check m5 */
-  ASSERT_EQ(1, d5->run_called);
-  ASSERT_EQ(100, d5->sample_count);
+  ASSERT_EQ(2, d5->run_called);
+  ASSERT_EQ(100 - 64, d5->sample_count);
+
+  /* The float entry runs the same graph and doesn't clip. */
+  float *float_samples = new float[200];
+  for (size_t i = 0; i < 200; i++)
+    float_samples[i] = i;
+  cras_dsp_pipeline_apply_float(p, float_samples, 100);
+  for (size_t i = 0; i < 200; i++)
+    EXPECT_FLOAT_EQ(i * 4, float_samples[i]);
+  delete[] float_samples;
+  ASSERT_EQ(4, d5->run_called);
 
   /* re-instantiate */
   ASSERT_EQ(1, d5->instantiate_called);
@@ -505,6 +521,235 @@ TEST_F(DspPipelineTestSuite, Complex) {
   really_free_module(m5);
 }
 
+TEST_F(DspPipelineTestSuite, CompilePlan) {
+  /*
+   *   0 ==(a0, a1)== 1 ==(b0, b1)== 2 ==(c0)== 3 --(d0)-- 5
+   *                                    \==(c1)== 4 --(d1)-- 6 --(e1)-- /
+   */
+  const char *content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=invert_lr\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n"
+      "output_2={b0}\n"
+      "output_3={b1}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=swap_lr\n"
+      "input_0={b0}\n"
+      "input_1={b1}\n"
+      "output_2={c0}\n"
+      "output_3={c1}\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=eq\n"
+      "input_0={c0}\n"
+      "output_1={d0}\n"
+      "input_2=1\n"
+      "input_3=1000\n"
+      "input_4=0.7\n"
+      "input_5=0\n"
+      "[M4]\n"
+      "library=builtin\n"
+      "label=eq\n"
+      "input_0={c1}\n"
+      "output_1={d1}\n"
+      "input_2=6\n"
+      "input_3=3000\n"
+      "input_4=2\n"
+      "input_5=-6\n"
+      "[M6]\n"
+      "library=builtin\n"
+      "label=noop\n"
+      "input_0={d1}\n"
+      "output_1={e1}\n"
+      "[M5]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={d0}\n"
+      "input_1={e1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 1);
+
+  struct ini *ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline *p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  /* source, the folded invert_lr and swap_lr, the fused eqs and sink. The
+   * noop module is dropped. */
+  ASSERT_EQ(4, cras_dsp_pipeline_get_num_plan_steps(p));
+
+  float samples[200], left[100], right[100];
+  for (int i = 0; i < 100; i++) {
+    left[i] = samples[2 * i] = sinf(i * 0.3f);
+    right[i] = samples[2 * i + 1] = (i % 7) * 0.1f;
+  }
+  cras_dsp_pipeline_apply_float(p, samples, 100);
+
+  /* invert_lr then swap_lr gives (right, -left), then each channel goes
+   * through its eq. */
+  struct eq2 *eq2 = eq2_new();
+  eq2_append_biquad(eq2, 0, BQ_LOWPASS, 1000 / 24000.0f, 0.7f, 0);
+  eq2_append_biquad(eq2, 1, BQ_PEAKING, 3000 / 24000.0f, 2, -6);
+  float ref0[100], ref1[100];
+  for (int i = 0; i < 100; i++) {
+    ref0[i] = right[i];
+    ref1[i] = -left[i];
+  }
+  eq2_process(eq2, ref0, ref1, 100);
+  eq2_free(eq2);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_NEAR(ref0[i], samples[2 * i], 1e-5);
+    EXPECT_NEAR(ref1[i], samples[2 * i + 1], 1e-5);
+  }
+
+  struct dsp_module *m1 = find_module("m1");
+  struct dsp_module *m3 = find_module("m3");
+  struct dsp_module *m6 = find_module("m6");
+  EXPECT_EQ(0, ((struct data *)m1->data)->run_called);
+  EXPECT_EQ(0, ((struct data *)m3->data)->run_called);
+  EXPECT_EQ(0, ((struct data *)m6->data)->run_called);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, ProfileAndBlockSize) {
+  const char *content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n"
+      "output_2={b0}\n"
+      "output_3={b1}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b0}\n"
+      "input_1={b1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 1);
+  struct ini *ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline *p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  struct data *d1 = (struct data *)find_module("m1")->data;
+  float *samples = new float[2 * 1000];
+  memset(samples, 0, 2 * 1000 * sizeof(float));
+
+  /* Tuning starts with the smallest block and moves on after 64 blocks. */
+  cras_dsp_pipeline_set_profile_instances(0);
+  EXPECT_EQ(64, cras_dsp_pipeline_get_block_size(p));
+  cras_dsp_pipeline_apply_float(p, samples, 1000);
+  EXPECT_EQ(16, d1->run_called);
+  EXPECT_EQ(1000 - 15 * 64, d1->sample_count);
+  for (int i = 0; i < 3; i++)
+    cras_dsp_pipeline_apply_float(p, samples, 1000);
+  EXPECT_EQ(128, cras_dsp_pipeline_get_block_size(p));
+
+  /* After all the candidates it settles on one of them. */
+  for (int i = 0; i < 200; i++)
+    cras_dsp_pipeline_apply_float(p, samples, 1000);
+  int block_size = cras_dsp_pipeline_get_block_size(p);
+  EXPECT_EQ(0, block_size & (block_size - 1));
+  EXPECT_LE(64, block_size);
+  EXPECT_GE(DSP_BUFFER_SIZE, block_size);
+  int run_called = d1->run_called;
+  cras_dsp_pipeline_apply_float(p, samples, 1000);
+  EXPECT_EQ((1000 + block_size - 1) / block_size, d1->run_called - run_called);
+  EXPECT_EQ(block_size, cras_dsp_pipeline_get_block_size(p));
+
+  /* Only the whole pipeline is timed until the instances are profiled. */
+  struct dsp_debug_info info;
+  info.num_pipelines = 0;
+  info.num_instances = 0;
+  cras_dsp_pipeline_get_debug_info(p, &info);
+  ASSERT_EQ(1, info.num_pipelines);
+  EXPECT_STREQ("playback", info.pipelines[0].purpose);
+  EXPECT_EQ(48000, info.pipelines[0].sample_rate);
+  EXPECT_EQ(block_size, info.pipelines[0].block_size);
+  EXPECT_EQ(205 * 1000, info.pipelines[0].total_samples);
+  ASSERT_EQ(3, info.num_instances);
+  EXPECT_EQ(3, info.pipelines[0].num_instances);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(0, info.instances[i].total_blocks);
+
+  cras_dsp_pipeline_set_profile_instances(1);
+  run_called = d1->run_called;
+  cras_dsp_pipeline_apply_float(p, samples, 1000);
+  cras_dsp_pipeline_set_profile_instances(0);
+  delete[] samples;
+
+  info.num_pipelines = 0;
+  info.num_instances = 0;
+  cras_dsp_pipeline_get_debug_info(p, &info);
+  EXPECT_EQ(206 * 1000, info.pipelines[0].total_samples);
+  ASSERT_EQ(3, info.num_instances);
+  for (int i = 0; i < 3; i++) {
+    const struct dsp_instance_debug_info *di = &info.instances[i];
+    uint64_t blocks = 0;
+    EXPECT_EQ(0, di->pipeline_idx);
+    EXPECT_EQ(1000, di->total_samples);
+    EXPECT_EQ(d1->run_called - run_called, di->total_blocks);
+    for (int j = 0; j < DSP_PROFILE_HIST_BUCKETS; j++)
+      blocks += di->histogram[j];
+    EXPECT_EQ(di->total_blocks, blocks);
+    EXPECT_LE(di->max_ns, di->total_ns);
+  }
+  EXPECT_STREQ("m1", info.instances[1].title);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, ApplyNoPipeline) {
+  int16_t samples[4] = { 1, 2, 3, 4 };
+  float float_samples[4] = { 1, 2, 3, 4 };
+
+  // Without a pipeline the samples are left alone.
+  cras_dsp_pipeline_apply(NULL, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 2);
+  cras_dsp_pipeline_apply_float(NULL, float_samples, 2);
+  EXPECT_EQ(4, samples[3]);
+  EXPECT_FLOAT_EQ(4.0f, float_samples[3]);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
@@ -13,12 +13,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cras_audio_thread_trace.h"
 #include "cras_client.h"
 #include "cras_types.h"
 #include "cras_util.h"
@@ -635,6 +637,286 @@ static void audio_debug_info(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
+static void dsp_debug_info(struct cras_client *client)
+{
+	const struct dsp_debug_info *info;
+	const struct dsp_pipeline_debug_info *p;
+	const struct dsp_instance_debug_info *di;
+	int i, j;
+
+	info = cras_client_get_dsp_debug_info(client);
+	if (!info)
+		goto done;
+	if (info->num_pipelines > MAX_DEBUG_DSP_PIPELINES ||
+	    info->num_instances > MAX_DEBUG_DSP_INSTANCES)
+		goto done;
+
+	printf("DSP Profile:\n");
+	for (i = 0; i < info->num_pipelines; i++) {
+		p = &info->pipelines[i];
+		printf("pipeline: %s rate: %u block_size: %u\n",
+		       p->purpose, (unsigned int)p->sample_rate,
+		       (unsigned int)p->block_size);
+		printf("blocks: %llu frames: %llu total: %lluns max: %lluns\n",
+		       (unsigned long long)p->total_blocks,
+		       (unsigned long long)p->total_samples,
+		       (unsigned long long)p->total_ns,
+		       (unsigned long long)p->max_ns);
+		for (j = 0; j < info->num_instances; j++) {
+			int k;
+			di = &info->instances[j];
+			if (di->pipeline_idx != i || !di->total_samples)
+				continue;
+			printf("  %-20s %8.1fns/frame max: %lluns"
+			       " load: %.3f%%\n",
+			       di->title,
+			       (double)di->total_ns / di->total_samples,
+			       (unsigned long long)di->max_ns,
+			       (double)di->total_ns * 1e-7 /
+					di->total_samples * p->sample_rate);
+			printf("  %-20s", "histogram (us, log2):");
+			for (k = 0; k < DSP_PROFILE_HIST_BUCKETS; k++)
+				printf(" %u", (unsigned int)di->histogram[k]);
+			printf("\n");
+		}
+		printf("\n");
+	}
+
+done:
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+static void print_latency_hist(const char *name,
+			       const struct latency_hist_debug_info *h)
+{
+	int i;
+
+	if (!h->count) {
+		printf("  %-12s no samples\n", name);
+		return;
+	}
+	printf("  %-12s count: %llu avg: %lluns max: %lluns\n", name,
+	       (unsigned long long)h->count,
+	       (unsigned long long)(h->total_ns / h->count),
+	       (unsigned long long)h->max_ns);
+	printf("  %-12s", "(us, log2):");
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+		printf(" %u", (unsigned int)h->buckets[i]);
+	printf("\n");
+}
+
+static void latency_info(struct cras_client *client)
+{
+	const struct latency_debug_info *info;
+	int i;
+
+	info = cras_client_get_latency_info(client);
+	if (!info)
+		goto done;
+	if (info->num_devs > MAX_DEBUG_DEVS ||
+	    info->num_streams > MAX_DEBUG_STREAMS)
+		goto done;
+
+	printf("Audio Thread Latency:\n");
+	print_latency_hist("wake_jitter", &info->wake_jitter);
+	for (i = 0; i < info->num_devs; i++) {
+		const struct dev_latency_debug_info *di = &info->devs[i];
+
+		printf("dev: %u %s %s\n", (unsigned int)di->dev_idx,
+		       di->dev_name,
+		       di->direction == CRAS_STREAM_OUTPUT ? "out" : "in");
+		print_latency_hist("hw_io", &di->hw_io);
+	}
+	for (i = 0; i < info->num_streams; i++) {
+		const struct stream_latency_debug_info *si =
+			&info->streams[i];
+
+		printf("stream: %llx dir: %u\n",
+		       (unsigned long long)si->stream_id,
+		       (unsigned int)si->direction);
+		print_latency_hist("fetch", &si->fetch);
+		print_latency_hist("cb_response", &si->cb_response);
+	}
+
+done:
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+#define TRACE_EVENT_NAME(e) [AUDIO_THREAD_##e] = #e
+static const char *trace_event_names[] = {
+	TRACE_EVENT_NAME(WAKE),
+	TRACE_EVENT_NAME(SLEEP),
+	TRACE_EVENT_NAME(READ_AUDIO),
+	TRACE_EVENT_NAME(READ_AUDIO_TSTAMP),
+	TRACE_EVENT_NAME(READ_AUDIO_DONE),
+	TRACE_EVENT_NAME(READ_OVERRUN),
+	TRACE_EVENT_NAME(FILL_AUDIO),
+	TRACE_EVENT_NAME(FILL_AUDIO_TSTAMP),
+	TRACE_EVENT_NAME(FILL_AUDIO_DONE),
+	TRACE_EVENT_NAME(WRITE_STREAMS_WAIT),
+	TRACE_EVENT_NAME(WRITE_STREAMS_WAIT_TO),
+	TRACE_EVENT_NAME(WRITE_STREAMS_MIX),
+	TRACE_EVENT_NAME(WRITE_STREAMS_MIXED),
+	TRACE_EVENT_NAME(WRITE_STREAMS_STREAM),
+	TRACE_EVENT_NAME(FETCH_STREAM),
+	TRACE_EVENT_NAME(STREAM_ADDED),
+	TRACE_EVENT_NAME(STREAM_REMOVED),
+	TRACE_EVENT_NAME(A2DP_ENCODE),
+	TRACE_EVENT_NAME(A2DP_WRITE),
+	TRACE_EVENT_NAME(DEV_STREAM_MIX),
+	TRACE_EVENT_NAME(CAPTURE_POST),
+	TRACE_EVENT_NAME(CAPTURE_WRITE),
+	TRACE_EVENT_NAME(CONV_COPY),
+	TRACE_EVENT_NAME(STREAM_SLEEP_TIME),
+	TRACE_EVENT_NAME(STREAM_SLEEP_ADJUST),
+	TRACE_EVENT_NAME(STREAM_SKIP_CB),
+	TRACE_EVENT_NAME(DEV_SLEEP_TIME),
+	TRACE_EVENT_NAME(SET_DEV_WAKE),
+	TRACE_EVENT_NAME(DEV_ADDED),
+	TRACE_EVENT_NAME(DEV_REMOVED),
+	TRACE_EVENT_NAME(IODEV_CB),
+	TRACE_EVENT_NAME(PB_MSG),
+	TRACE_EVENT_NAME(ODEV_NO_STREAMS),
+	TRACE_EVENT_NAME(ODEV_START),
+	TRACE_EVENT_NAME(ODEV_LEAVE_NO_STREAMS),
+	TRACE_EVENT_NAME(ODEV_DEFAULT_NO_STREAMS),
+	TRACE_EVENT_NAME(FILL_ODEV_ZEROS),
+	TRACE_EVENT_NAME(SEVERE_UNDERRUN),
+};
+#undef TRACE_EVENT_NAME
+
+static const char *trace_file;
+
+/* Events that open and close a slice in the trace viewer. Anything else is
+ * shown as an instant event. */
+static const struct {
+	unsigned int begin;
+	unsigned int end;
+	const char *name;
+} trace_slices[] = {
+	{ AUDIO_THREAD_WAKE, AUDIO_THREAD_SLEEP, "awake" },
+	{ AUDIO_THREAD_FILL_AUDIO, AUDIO_THREAD_FILL_AUDIO_DONE, "fill_audio" },
+	{ AUDIO_THREAD_READ_AUDIO, AUDIO_THREAD_READ_AUDIO_DONE, "read_audio" },
+};
+#define NUM_TRACE_SLICES (sizeof(trace_slices) / sizeof(trace_slices[0]))
+
+/* Writes one event, with the data of e as arguments if given. */
+static void write_trace_event(FILE *f, const char *name, char phase,
+			      uint64_t ns,
+			      const struct audio_thread_trace_event *e,
+			      int *first)
+{
+	fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+		"\"pid\":0,\"tid\":0", *first ? "" : ",", name, phase,
+		(unsigned long long)(ns / 1000), (unsigned int)(ns % 1000));
+	if (e)
+		fprintf(f, ",\"s\":\"t\",\"args\":{\"data1\":%u,"
+			"\"data2\":%u,\"data3\":%u}",
+			e->data1, e->data2, e->data3);
+	fprintf(f, "}");
+	*first = 0;
+}
+
+/* Writes the events of the trace as Chrome trace event JSON, that can be
+ * loaded in chrome://tracing or Perfetto. */
+static int write_chrome_trace(FILE *f, const struct audio_thread_trace *trace,
+			      const struct audio_thread_trace_event *events,
+			      int num_events)
+{
+	int open[NUM_TRACE_SLICES] = { 0 };
+	int first = 1;
+	int i;
+	unsigned int j;
+
+	fprintf(f, "{\"traceEvents\":[");
+	for (i = 0; i < num_events; i++) {
+		const struct audio_thread_trace_event *e = &events[i];
+		uint64_t ns = audio_thread_trace_ticks_to_ns(trace, e->ticks);
+		const char *name = NULL;
+
+		for (j = 0; j < NUM_TRACE_SLICES; j++) {
+			const char *slice = trace_slices[j].name;
+
+			if (e->tag == trace_slices[j].begin) {
+				/* Close a slice whose end was lost. */
+				if (open[j])
+					write_trace_event(f, slice, 'E', ns,
+							  NULL, &first);
+				open[j] = 1;
+				write_trace_event(f, slice, 'B', ns, NULL,
+						  &first);
+			} else if (e->tag == trace_slices[j].end && open[j]) {
+				open[j] = 0;
+				write_trace_event(f, slice, 'E', ns, NULL,
+						  &first);
+			}
+		}
+		if (e->tag < sizeof(trace_event_names) /
+			     sizeof(trace_event_names[0]))
+			name = trace_event_names[e->tag];
+		if (!name)
+			name = "UNKNOWN";
+		write_trace_event(f, name, 'i', ns, e, &first);
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	return ferror(f) ? -EIO : 0;
+}
+
+static void audio_thread_trace(struct cras_client *client, int fd)
+{
+	const struct audio_thread_trace *trace;
+	struct audio_thread_trace_event *events = NULL;
+	FILE *f = NULL;
+	int num_events;
+
+	if (fd < 0) {
+		fprintf(stderr, "Audio thread trace isn't enabled, start the "
+			"server with --trace_audio_thread.\n");
+		goto done;
+	}
+	trace = (const struct audio_thread_trace *)mmap(
+			NULL, sizeof(*trace), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (trace == MAP_FAILED) {
+		perror("mmap trace");
+		goto done;
+	}
+
+	events = (struct audio_thread_trace_event *)malloc(
+			AUDIO_THREAD_TRACE_SIZE * sizeof(*events));
+	if (!events)
+		goto unmap;
+	num_events = audio_thread_trace_snapshot(trace, events);
+	if (num_events < 0) {
+		fprintf(stderr, "Unknown audio thread trace version.\n");
+		goto unmap;
+	}
+
+	f = strcmp(trace_file, "-") ? fopen(trace_file, "w") : stdout;
+	if (!f) {
+		perror("open trace file");
+		goto unmap;
+	}
+	if (write_chrome_trace(f, trace, events, num_events))
+		fprintf(stderr, "Failed to write %s\n", trace_file);
+	else if (f != stdout)
+		printf("Wrote %d events to %s\n", num_events, trace_file);
+	if (f != stdout)
+		fclose(f);
+
+unmap:
+	free(events);
+	munmap((void *)trace, sizeof(*trace));
+done:
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
 static int start_stream(struct cras_client *client,
 			cras_stream_id_t *stream_id,
 			struct cras_stream_params *params,
@@ -977,6 +1259,56 @@ static void print_audio_debug_info(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
+static void print_dsp_debug_info(struct cras_client *client)
+{
+	struct timespec wait_time;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client); /* To synchronize data. */
+	cras_client_update_dsp_debug_info(client, dsp_debug_info);
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+static void print_latency_info(struct cras_client *client)
+{
+	struct timespec wait_time;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client); /* To synchronize data. */
+	cras_client_update_latency_info(client, latency_info);
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+static void dump_audio_thread_trace(struct cras_client *client,
+				    const char *file)
+{
+	struct timespec wait_time;
+
+	trace_file = file;
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client); /* To synchronize data. */
+	cras_client_get_audio_thread_trace(client, audio_thread_trace);
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+}
+
 static void hotword_models_cb(struct cras_client *client,
 			      const char *hotword_models)
 {
@@ -1036,6 +1368,9 @@ static struct option long_options[] = {
 	{"capture_file",	required_argument,	0, 'c'},
 	{"duration_seconds",	required_argument,	0, 'd'},
 	{"dump_dsp",            no_argument,            0, 'f'},
+	{"dump_dsp_profile",    no_argument,            0, 'D'},
+	{"dump_latency",        no_argument,            0, 'H'},
+	{"dump_audio_thread_trace", required_argument,  0, 'E'},
 	{"capture_gain",        required_argument,      0, 'g'},
 	{"help",                no_argument,            0, 'h'},
 	{"dump_server_info",    no_argument,            0, 'i'},
@@ -1091,7 +1426,12 @@ static void show_usage()
 	printf("--channel_layout <layout_str> - Set multiple channel layout.\n");
 	printf("--check_output_plugged <output name> - Check if the output is plugged in\n");
 	printf("--dump_audio_thread - Dumps audio thread info.\n");
+	printf("--dump_audio_thread_trace <file> - Write the audio thread trace"
+	       " as Chrome trace JSON, \"-\" for stdout.\n");
 	printf("--dump_dsp - Print status of dsp to syslog.\n");
+	printf("--dump_dsp_profile - Print cpu time spent in each dsp plugin"
+	       " since the first dump.\n");
+	printf("--dump_latency - Print the audio thread latency histograms.\n");
 	printf("--dump_server_info - Print status of the server.\n");
 	printf("--duration_seconds <N> - Seconds to record or playback.\n");
 	printf("--get_hotword_models <N>:<M> - Get the supported hotword models of node\n");
@@ -1238,6 +1578,15 @@ int main(int argc, char **argv)
 		case 'f':
 			cras_client_dump_dsp_info(client);
 			break;
+		case 'D':
+			print_dsp_debug_info(client);
+			break;
+		case 'H':
+			print_latency_info(client);
+			break;
+		case 'E':
+			dump_audio_thread_trace(client, optarg);
+			break;
 		case 'i':
 			print_server_info(client);
 			break;
@@ -19,6 +19,7 @@ namespace {
 
 extern "C" {
 struct audio_thread_event_log *atlog;
+struct audio_thread_trace *attrace;
 };
 
 static struct timespec clock_gettime_retspec;
@@ -48,6 +49,7 @@ struct cras_audio_area_copy_call {
   const struct cras_audio_area *src;
   unsigned int src_offset;
   float software_gain_scaler;
+  unsigned int num_called;
 };
 
 struct fmt_conv_call {
@@ -67,6 +69,14 @@ struct mix_add_call {
   float mix_vol;
 };
 
+struct mix_add_float_call {
+  float *dst;
+  const uint8_t *src;
+  unsigned int count;
+  int mute;
+  float mix_vol;
+};
+
 struct rstream_get_readable_call {
   struct cras_rstream *rstream;
   unsigned int offset;
@@ -82,6 +92,8 @@ static struct fmt_conv_call conv_frames_call;
 static size_t conv_frames_ret;
 static int cras_audio_area_create_num_channels_val;
 static int cras_fmt_conv_convert_frames_in_frames_val;
+static int cras_fmt_conv_convert_frames_called;
+static int convert_from_stream_called;
 static int cras_fmt_conversion_needed_val;
 static int cras_fmt_conv_set_linear_resample_rates_called;
 static float cras_fmt_conv_set_linear_resample_rates_from;
@@ -89,12 +101,14 @@ static float cras_fmt_conv_set_linear_resample_rates_to;
 
 static unsigned int rstream_playable_frames_ret;
 static struct mix_add_call mix_add_call;
+static struct mix_add_float_call mix_add_float_call;
 static struct rstream_get_readable_call rstream_get_readable_call;
 static unsigned int rstream_get_readable_num;
 static uint8_t *rstream_get_readable_ptr;
 
 static int cras_rstream_audio_ready_called;
 static int cras_rstream_audio_ready_count;
+static unsigned int rstream_dev_offset;
 
 class CreateSuite : public testing::Test{
   protected:
@@ -119,10 +133,13 @@ class CreateSuite : public testing::Test{
 
       config_format_converter_called = 0;
       cras_fmt_conversion_needed_val = 0;
+      cras_fmt_conv_convert_frames_called = 0;
+      convert_from_stream_called = 0;
       cras_fmt_conv_set_linear_resample_rates_called = 0;
 
       cras_rstream_audio_ready_called = 0;
       cras_rstream_audio_ready_count = 0;
+      rstream_dev_offset = 0;
 
       memset(&copy_area_call, 0xff, sizeof(copy_area_call));
       memset(&conv_frames_call, 0xff, sizeof(conv_frames_call));
@@ -176,6 +193,7 @@ TEST_F(CreateSuite, CaptureNoSRC) {
   area->channels[0].buf = (uint8_t *)(cap_buf);
   area->channels[1].step_bytes = 4;
   area->channels[1].buf = (uint8_t *)(cap_buf + 1);
+  area->frames = kBufferFrames / 2;
 
   stream_area = (struct cras_audio_area*)calloc(1, sizeof(*area) +
                                                   2 * sizeof(*area->channels));
@@ -199,6 +217,52 @@ TEST_F(CreateSuite, CaptureNoSRC) {
   free(stream_area);
 }
 
+TEST_F(CreateSuite, CaptureNoSRCWrapsRing) {
+  struct dev_stream devstr;
+  struct cras_audio_area *area;
+  struct cras_audio_area *stream_area;
+  int16_t cap_buf[kBufferFrames * 2];
+  float software_gain_scaler = 1;
+  unsigned int nread;
+
+  rstream_.direction = CRAS_STREAM_INPUT;
+  devstr.stream = &rstream_;
+  devstr.conv = NULL;
+  devstr.conv_buffer = NULL;
+  devstr.conv_buffer_size_frames = 0;
+
+  area = (struct cras_audio_area*)calloc(1, sizeof(*area) +
+                                               2 * sizeof(*area->channels));
+  area->num_channels = 2;
+  channel_area_set_channel(&area->channels[0], CRAS_CH_FL);
+  channel_area_set_channel(&area->channels[1], CRAS_CH_FR);
+  area->channels[0].step_bytes = 4;
+  area->channels[0].buf = (uint8_t *)(cap_buf);
+  area->channels[1].step_bytes = 4;
+  area->channels[1].buf = (uint8_t *)(cap_buf + 1);
+  area->frames = 100;
+
+  stream_area = (struct cras_audio_area*)calloc(1, sizeof(*area) +
+                                                  2 * sizeof(*area->channels));
+  stream_area->num_channels = 2;
+  rstream_.audio_area = stream_area;
+
+  // 24 frames fit before the end of the ring, the rest go at its start.
+  rstream_.shm.area->read_count = kBufferFrames - 24;
+  rstream_.shm.area->write_count = kBufferFrames - 24;
+  copy_area_call.num_called = 0;
+  nread = dev_stream_capture(&devstr, area, 0, software_gain_scaler);
+
+  EXPECT_EQ(100, nread);
+  EXPECT_EQ(2, copy_area_call.num_called);
+  EXPECT_EQ(24, copy_area_call.src_offset);
+  EXPECT_EQ(76, stream_area->frames);
+  EXPECT_EQ(rstream_.shm.area->samples, stream_area->channels[0].buf);
+
+  free(area);
+  free(stream_area);
+}
+
 TEST_F(CreateSuite, CaptureSRC) {
   struct dev_stream devstr;
   struct cras_audio_area *area;
@@ -275,7 +339,10 @@ TEST_F(CreateSuite, CreateSRC44to48) {
   config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
   dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void *)0x55,
                                  &cb_ts);
-  EXPECT_EQ(1, config_format_converter_called);
+  // One converter for the shared cache and one to the device.
+  EXPECT_EQ(2, config_format_converter_called);
+  EXPECT_NE(static_cast<dev_stream_conv_cache*>(NULL),
+            dev_stream->conv_cache);
   EXPECT_NE(static_cast<byte_buffer*>(NULL), dev_stream->conv_buffer);
   EXPECT_LE(cras_frames_at_rate(in_fmt.frame_rate, kBufferFrames,
                                 out_fmt.frame_rate),
@@ -310,7 +377,10 @@ TEST_F(CreateSuite, CreateSRC48to44) {
   config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
   dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_44_1, (void *)0x55,
                                  &cb_ts);
-  EXPECT_EQ(1, config_format_converter_called);
+  // One converter for the shared cache and one to the device.
+  EXPECT_EQ(2, config_format_converter_called);
+  EXPECT_NE(static_cast<dev_stream_conv_cache*>(NULL),
+            dev_stream->conv_cache);
   EXPECT_NE(static_cast<byte_buffer*>(NULL), dev_stream->conv_buffer);
   EXPECT_LE(cras_frames_at_rate(in_fmt.frame_rate, kBufferFrames,
                                 out_fmt.frame_rate),
@@ -456,6 +526,7 @@ TEST_F(CreateSuite, StreamMixNoFrames) {
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
+  dev_stream.conv_cache = NULL;
   rstream_playable_frames_ret = 0;
   fmt.num_channels = 2;
   fmt.format = SND_PCM_FORMAT_S16_LE;
@@ -468,6 +539,7 @@ TEST_F(CreateSuite, StreamMixNoConv) {
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
+  dev_stream.conv_cache = NULL;
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
   rstream_get_readable_num = nfr;
@@ -494,6 +566,7 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
+  dev_stream.conv_cache = NULL;
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
   rstream_get_readable_num = nfr / 2;
@@ -512,6 +585,178 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   EXPECT_EQ(2, rstream_get_readable_call.num_called);
 }
 
+TEST_F(CreateSuite, StreamMixFloatNoConvTwoPass) {
+  struct dev_stream dev_stream;
+  const unsigned int nfr = 100;
+  const unsigned int num_channels = 2;
+  float dst[nfr * num_channels];
+  struct cras_audio_format fmt;
+
+  dev_stream.conv = NULL;
+  dev_stream.conv_cache = NULL;
+  dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr / 2;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  rstream_get_readable_call.num_called = 0;
+  mix_add_call.dst = NULL;
+  fmt.num_channels = num_channels;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(nfr, dev_stream_mix_float(&dev_stream, &fmt, dst, nfr));
+  // The second pass lands half way into the float buffer.
+  EXPECT_EQ(dst + nfr / 2 * num_channels, mix_add_float_call.dst);
+  EXPECT_EQ((uint8_t*)0x4000, mix_add_float_call.src);
+  EXPECT_EQ(nfr / 2 * num_channels, mix_add_float_call.count);
+  EXPECT_EQ(2, rstream_get_readable_call.num_called);
+  // Nothing is mixed in the device format.
+  EXPECT_EQ((int16_t*)NULL, mix_add_call.dst);
+}
+
+TEST_F(CreateSuite, CreateSRCSharesConvCache) {
+  struct dev_stream *dev_stream1, *dev_stream2;
+
+  rstream_.format = fmt_s16le_44_1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream1 = dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void *)0x55,
+                                  &cb_ts);
+  dev_stream2 = dev_stream_create(&rstream_, 1, &fmt_s16le_48, (void *)0x56,
+                                  &cb_ts);
+  // The second device only gets a converter from the cache to its format.
+  EXPECT_EQ(3, config_format_converter_called);
+  EXPECT_NE(static_cast<dev_stream_conv_cache*>(NULL),
+            dev_stream1->conv_cache);
+  EXPECT_EQ(dev_stream1->conv_cache, dev_stream2->conv_cache);
+  dev_stream_destroy(dev_stream1);
+  dev_stream_destroy(dev_stream2);
+}
+
+TEST_F(CreateSuite, CreateSRCDifferentRatesDontShareConvCache) {
+  struct dev_stream *dev_stream1, *dev_stream2;
+  struct cras_audio_format fmt_s16le_96 = fmt_s16le_48;
+
+  fmt_s16le_96.frame_rate = 96000;
+  rstream_.format = fmt_s16le_44_1;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream1 = dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void *)0x55,
+                                  &cb_ts);
+  dev_stream2 = dev_stream_create(&rstream_, 1, &fmt_s16le_96, (void *)0x56,
+                                  &cb_ts);
+  EXPECT_EQ(4, config_format_converter_called);
+  EXPECT_NE(static_cast<dev_stream_conv_cache*>(NULL),
+            dev_stream1->conv_cache);
+  EXPECT_NE(static_cast<dev_stream_conv_cache*>(NULL),
+            dev_stream2->conv_cache);
+  EXPECT_NE(dev_stream1->conv_cache, dev_stream2->conv_cache);
+  dev_stream_destroy(dev_stream1);
+  dev_stream_destroy(dev_stream2);
+}
+
+TEST_F(CreateSuite, CreateNoSRCNoConvCache) {
+  struct dev_stream *dev_stream;
+
+  rstream_.format = fmt_s16le_48;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void *)0x55,
+                                 &cb_ts);
+  EXPECT_EQ(1, config_format_converter_called);
+  EXPECT_EQ(static_cast<dev_stream_conv_cache*>(NULL),
+            dev_stream->conv_cache);
+  dev_stream_destroy(dev_stream);
+}
+
+TEST_F(CreateSuite, StreamMixSharedConvCacheConvertsOnce) {
+  struct dev_stream *dev_stream1, *dev_stream2;
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+  uint8_t *converted;
+
+  rstream_.format = fmt_s16le_44_1;
+  // Count frames one to one through the stubbed converters.
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream1 = dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void *)0x55,
+                                  &cb_ts);
+  dev_stream2 = dev_stream_create(&rstream_, 1, &fmt_s16le_48, (void *)0x56,
+                                  &cb_ts);
+
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  rstream_get_readable_call.num_called = 0;
+  cras_fmt_conv_convert_frames_in_frames_val = nfr;
+  conv_frames_ret = nfr;
+  fmt = fmt_s16le_48;
+
+  EXPECT_EQ(nfr, dev_stream_mix(dev_stream1, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(1, rstream_get_readable_call.num_called);
+  EXPECT_EQ((uint8_t*)0x4000, conv_frames_call.in_buf);
+  converted = conv_frames_call.out_buf;
+  EXPECT_EQ((int16_t*)converted, mix_add_call.src);
+  EXPECT_EQ(nfr, rstream_dev_offset);
+
+  // The second device starts from the same stream frames and mixes what the
+  // first one converted.
+  rstream_dev_offset = 0;
+  EXPECT_EQ(nfr, dev_stream_playback_frames(dev_stream2));
+  EXPECT_EQ(nfr, dev_stream_mix(dev_stream2, &fmt, (uint8_t*)0x6000, nfr));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(1, rstream_get_readable_call.num_called);
+  EXPECT_EQ((int16_t*)0x6000, mix_add_call.dst);
+  EXPECT_EQ((int16_t*)converted, mix_add_call.src);
+  EXPECT_EQ(nfr * 2, mix_add_call.count);
+  EXPECT_EQ(nfr, rstream_dev_offset);
+
+  dev_stream_destroy(dev_stream1);
+  dev_stream_destroy(dev_stream2);
+}
+
+TEST_F(CreateSuite, StreamMixTwoDevicesConvertOncePerPeriod) {
+  struct dev_stream *dev_stream1, *dev_stream2;
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+  unsigned int period;
+
+  rstream_.format = fmt_s16le_44_1;
+  // Count frames one to one through the stubbed converters.
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  rstream_.shm.area->read_count = 0;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  // Neither device has the stream attached when it is added to both.
+  dev_stream1 = dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void *)0x55,
+                                  &cb_ts);
+  dev_stream2 = dev_stream_create(&rstream_, 1, &fmt_s16le_48, (void *)0x56,
+                                  &cb_ts);
+
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  cras_fmt_conv_convert_frames_in_frames_val = nfr;
+  conv_frames_ret = nfr;
+  // Every device converts what it mixes to its own format.
+  cras_fmt_conversion_needed_val = 1;
+  fmt = fmt_s16le_48;
+
+  for (period = 1; period <= 3; period++) {
+    rstream_dev_offset = 0;
+    EXPECT_EQ(nfr, dev_stream_mix(dev_stream1, &fmt, (uint8_t*)0x5000, nfr));
+    rstream_dev_offset = 0;
+    EXPECT_EQ(nfr, dev_stream_mix(dev_stream2, &fmt, (uint8_t*)0x6000, nfr));
+    // The stream is converted once for both devices.
+    EXPECT_EQ(period, convert_from_stream_called);
+
+    // Both devices played the period, the stream moves on.
+    rstream_.shm.area->read_count += nfr;
+  }
+
+  dev_stream_destroy(dev_stream1);
+  dev_stream_destroy(dev_stream2);
+}
+
 TEST_F(CreateSuite, StreamCanFetch) {
   struct dev_stream *dev_stream;
   unsigned int dev_id = 9;
@@ -525,13 +770,16 @@ TEST_F(CreateSuite, StreamCanFetch) {
 
   /* Verify stream can fetch when buffer available. */
   cras_shm_set_callback_pending(&rstream_.shm, 0);
-  rstream_.shm.area->write_offset[0] = 0;
-  rstream_.shm.area->write_offset[1] = 0;
+  rstream_.shm.area->read_count = 0;
+  rstream_.shm.area->write_count = 0;
+  EXPECT_EQ(1, dev_stream_can_fetch(dev_stream));
+
+  /* Verify stream can fetch with exactly one callback of room left. */
+  rstream_.shm.area->write_count = kBufferFrames - rstream_.cb_threshold;
   EXPECT_EQ(1, dev_stream_can_fetch(dev_stream));
 
   /* Verify stream cannot fetch when there's still buffer. */
-  rstream_.shm.area->write_offset[0] = kBufferFrames;
-  rstream_.shm.area->write_offset[1] = kBufferFrames;
+  rstream_.shm.area->write_count = kBufferFrames - rstream_.cb_threshold + 1;
   EXPECT_EQ(0, dev_stream_can_fetch(dev_stream));
   dev_stream_destroy(dev_stream);
 }
@@ -902,6 +1150,7 @@ void cras_rstream_update_output_read_pointer(struct cras_rstream *rstream) {
 void cras_rstream_dev_offset_update(struct cras_rstream *rstream,
 					unsigned int frames,
 					unsigned int dev_id) {
+  rstream_dev_offset += frames;
 }
 
 void cras_rstream_dev_attach(struct cras_rstream *rstream, unsigned int dev_id,
@@ -915,7 +1164,11 @@ void cras_rstream_dev_detach(struct cras_rstream *rstream, unsigned int dev_id)
 
 unsigned int cras_rstream_dev_offset(const struct cras_rstream *rstream,
                                      unsigned int dev_id) {
-  return 0;
+  return rstream_dev_offset;
+}
+
+unsigned int cras_rstream_max_dev_offset(const struct cras_rstream *rstream) {
+  return rstream_dev_offset;
 }
 
 unsigned int cras_rstream_playable_frames(struct cras_rstream *rstream,
@@ -963,6 +1216,9 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 				    uint8_t *out_buf,
 				    unsigned int *in_frames,
 				    unsigned int out_frames) {
+  cras_fmt_conv_convert_frames_called++;
+  if (in_buf == rstream_get_readable_ptr)
+    convert_from_stream_called++;
   conv_frames_call.conv = conv;
   conv_frames_call.in_buf = in_buf;
   conv_frames_call.out_buf = out_buf;
@@ -984,6 +1240,15 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
   mix_add_call.mix_vol = mix_vol;
 }
 
+void cras_mix_add_float(snd_pcm_format_t fmt, float *dst, const uint8_t *src,
+                        unsigned int count, int mute, float mix_vol) {
+  mix_add_float_call.dst = dst;
+  mix_add_float_call.src = src;
+  mix_add_float_call.count = count;
+  mix_add_float_call.mute = mute;
+  mix_add_float_call.mix_vol = mix_vol;
+}
+
 struct cras_audio_area *cras_audio_area_create(int num_channels) {
   cras_audio_area_create_num_channels_val = num_channels;
   return NULL;
@@ -995,6 +1260,7 @@ void cras_audio_area_destroy(struct cras_audio_area *area) {
 void cras_audio_area_config_buf_pointers(struct cras_audio_area *area,
                                          const struct cras_audio_format *fmt,
                                          uint8_t *base_buffer) {
+  area->channels[0].buf = base_buffer;
 }
 
 void cras_audio_area_config_channels(struct cras_audio_area *area,
@@ -1013,7 +1279,8 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
   copy_area_call.src = src;
   copy_area_call.src_offset = src_offset;
   copy_area_call.software_gain_scaler = software_gain_scaler;
-  return src->frames;
+  copy_area_call.num_called++;
+  return MIN(src->frames - src_offset, dst->frames - dst_offset);
 }
 
 size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
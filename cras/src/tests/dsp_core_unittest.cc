@@ -6,10 +6,12 @@
 #include <math.h>
 #include "crossover.h"
 #include "crossover2.h"
+#include "crossovern.h"
 #include "drc.h"
 #include "dsp_util.h"
 #include "eq.h"
 #include "eq2.h"
+#include "eqn.h"
 
 namespace {
 
@@ -74,6 +76,79 @@ TEST(InterleaveTest, All) {
   }
 }
 
+TEST(InterleaveTest, MultiChannel) {
+  const int FRAMES = 13;
+
+  /* Cover the scalar path and each of the vector layouts, including the
+   * overlapping channel groups used for 5, 6 and 7 channels. */
+  for (int channels = 1; channels <= 8; channels++) {
+    int samples = FRAMES * channels;
+    int16_t input[FRAMES * 8];
+    int16_t output2[FRAMES * 8];
+    float output[FRAMES * 8];
+    float *out_ptr[8];
+
+    for (int i = 0; i < samples; i++)
+      input[i] = (int16_t)(i * 2521 - 16384);
+    for (int c = 0; c < channels; c++)
+      out_ptr[c] = output + c * FRAMES;
+
+    dsp_util_deinterleave(input, out_ptr, channels, FRAMES);
+    for (int i = 0; i < FRAMES; i++)
+      for (int c = 0; c < channels; c++)
+        EXPECT_EQ(input[i * channels + c] / 32768.0f, out_ptr[c][i]);
+
+    dsp_util_interleave(out_ptr, output2, channels, FRAMES);
+    for (int i = 0; i < samples; i++)
+      EXPECT_EQ(input[i], output2[i]);
+  }
+}
+
+TEST(InterleaveTest, S24S32) {
+  const int FRAMES = 9;
+  const int CHANNELS = 6;
+  const int SAMPLES = FRAMES * CHANNELS;
+  int32_t input[SAMPLES];
+  int32_t output2[SAMPLES];
+  float output[SAMPLES];
+  float *out_ptr[CHANNELS];
+
+  for (int c = 0; c < CHANNELS; c++)
+    out_ptr[c] = output + c * FRAMES;
+
+  /* S24 samples live in the low three bytes, the top byte is ignored. */
+  for (int i = 0; i < SAMPLES; i++)
+    input[i] = (i * 155649 - 4194304) & 0xffffff;
+  input[0] = 0x800000;
+  input[1] = 0x7fffff;
+
+  dsp_util_deinterleave_s24(input, out_ptr, CHANNELS, FRAMES);
+  EXPECT_EQ(-1.0f, out_ptr[0][0]);
+  EXPECT_EQ(8388607 / 8388608.0f, out_ptr[1][0]);
+
+  dsp_util_interleave_s24(out_ptr, output2, CHANNELS, FRAMES);
+  for (int i = 0; i < SAMPLES; i++) {
+    int32_t expected = (int32_t)((uint32_t)input[i] << 8) >> 8;
+    EXPECT_EQ(expected, output2[i]);
+  }
+
+  /* S32 keeps 24 bits of precision through float, and clips at full
+   * scale. */
+  for (int i = 0; i < SAMPLES; i++)
+    input[i] = (int32_t)((i * 39845887u + 0xc0000000u) & ~0xffu);
+  input[0] = INT32_MIN;
+
+  dsp_util_deinterleave_s32(input, out_ptr, CHANNELS, FRAMES);
+  EXPECT_EQ(-1.0f, out_ptr[0][0]);
+  out_ptr[1][0] = 1.0f;
+
+  dsp_util_interleave_s32(out_ptr, output2, CHANNELS, FRAMES);
+  EXPECT_EQ(INT32_MIN, output2[0]);
+  EXPECT_EQ(INT32_MAX, output2[1]);
+  for (int i = 2; i < SAMPLES; i++)
+    EXPECT_EQ(input[i], output2[i]);
+}
+
 TEST(EqTest, All) {
   struct eq *eq;
   size_t len = 44100;
@@ -207,6 +282,112 @@ TEST(Eq2Test, All) {
   eq2_free(eq2);
 }
 
+TEST(Eq2Test, Avx2FmaMatchesDefault) {
+  const int len = 4800;
+  /* Odd block sizes, shorter and longer than the pipeline depth. */
+  const int blocks[] = { 1, 2, 5, 480, 3, 1024 };
+  float *data[2][2];
+  struct eq2 *eq2[2];
+
+  if (!dsp_util_enable_avx2_fma(1))
+    return;
+
+  for (int k = 0; k < 2; k++) {
+    eq2[k] = eq2_new();
+    /* Nine biquads on the left, seven on the right: two groups of four
+     * and a remainder. */
+    for (int i = 0; i < 9; i++)
+      eq2_append_biquad(eq2[k], 0, BQ_PEAKING, 0.01 + 0.05 * i, 2, -6 + i);
+    for (int i = 0; i < 7; i++)
+      eq2_append_biquad(eq2[k], 1, BQ_PEAKING, 0.02 + 0.06 * i, 3, 5 - i);
+    for (int c = 0; c < 2; c++) {
+      data[k][c] = (float *)calloc(len, sizeof(float));
+      add_sine(data[k][c], len, 0.01 + c * 0.1, 0, 0.5);
+      add_sine(data[k][c], len, 0.3, c, 0.3);
+    }
+  }
+
+  for (int start = 0, n = 0; start < len; n++) {
+    int chunk = std::min(len - start,
+                         blocks[n % (sizeof(blocks) / sizeof(int))]);
+    for (int k = 0; k < 2; k++) {
+      dsp_util_enable_avx2_fma(k);
+      eq2_process(eq2[k], data[k][0] + start, data[k][1] + start, chunk);
+    }
+    start += chunk;
+  }
+  dsp_util_enable_avx2_fma(1);
+
+  for (int c = 0; c < 2; c++)
+    for (int i = 0; i < len; i++)
+      ASSERT_NEAR(data[0][c][i], data[1][c][i], 1e-4) << "frame " << i;
+
+  for (int k = 0; k < 2; k++) {
+    eq2_free(eq2[k]);
+    free(data[k][0]);
+    free(data[k][1]);
+  }
+}
+
+TEST(EqnTest, MatchesEq2) {
+  const int len = 4800;
+  const int num_channels = 6;
+  const int blocks[] = { 1, 63, 480, 65, 2048 };
+  float *data[num_channels], *ref[num_channels];
+  struct eq2 *eq2[num_channels / 2];
+  struct eqn *eqn;
+
+  EXPECT_EQ(NULL, eqn_new(0));
+  EXPECT_EQ(NULL, eqn_new(EQN_MAX_CHANNELS + 1));
+
+  dsp_util_enable_avx2_fma(0);
+  eqn = eqn_new(num_channels);
+  ASSERT_TRUE(eqn != NULL);
+  for (int p = 0; p < num_channels / 2; p++)
+    eq2[p] = eq2_new();
+  for (int c = 0; c < num_channels; c++) {
+    /* A different number of biquads on each channel. */
+    for (int i = 0; i <= c; i++) {
+      float freq = 0.01 + 0.04 * (i + c);
+      float gain = (c & 1) ? -6 + i : 5 - i;
+      EXPECT_EQ(0, eqn_append_biquad(eqn, c, BQ_PEAKING, freq, 2, gain));
+      eq2_append_biquad(eq2[c / 2], c % 2, BQ_PEAKING, freq, 2, gain);
+    }
+    data[c] = (float *)calloc(len, sizeof(float));
+    ref[c] = (float *)calloc(len, sizeof(float));
+    add_sine(data[c], len, 0.01 + c * 0.05, 0, 0.5);
+    add_sine(data[c], len, 0.3, c, 0.3);
+    memcpy(ref[c], data[c], len * sizeof(float));
+  }
+  EXPECT_EQ(-1, eqn_append_biquad(eqn, num_channels, BQ_PEAKING, 0.1, 1, 1));
+
+  for (int start = 0, n = 0; start < len; n++) {
+    int chunk = std::min(len - start,
+                         blocks[n % (sizeof(blocks) / sizeof(int))]);
+    float *d[num_channels];
+    for (int c = 0; c < num_channels; c++)
+      d[c] = data[c] + start;
+    eqn_process(eqn, d, chunk);
+    for (int c = 0; c < num_channels; c += 2)
+      eq2_process(eq2[c / 2], ref[c] + start, ref[c + 1] + start, chunk);
+    start += chunk;
+  }
+  dsp_util_enable_avx2_fma(1);
+
+  for (int c = 0; c < num_channels; c++)
+    for (int i = 0; i < len; i++)
+      ASSERT_NEAR(ref[c][i], data[c][i], 1e-4) << "channel " << c
+                                               << " frame " << i;
+
+  eqn_free(eqn);
+  for (int p = 0; p < num_channels / 2; p++)
+    eq2_free(eq2[p]);
+  for (int c = 0; c < num_channels; c++) {
+    free(data[c]);
+    free(ref[c]);
+  }
+}
+
 TEST(CrossoverTest, All) {
   struct crossover xo;
   size_t len = 44100;
@@ -324,6 +505,111 @@ TEST(Crossover2Test, All) {
   free(data2R);
 }
 
+TEST(Crossover2Test, Avx2FmaMatchesDefault) {
+  const int len = 4800;
+  const int blocks[] = { 1, 480, 7, 2048 };
+  struct crossover2 xo2[2];
+  float *data[2][6];
+
+  if (!dsp_util_enable_avx2_fma(1))
+    return;
+
+  for (int k = 0; k < 2; k++) {
+    crossover2_init(&xo2[k], 250 / 22050.0, 4000 / 22050.0);
+    for (int j = 0; j < 6; j++)
+      data[k][j] = (float *)calloc(len, sizeof(float));
+    for (int c = 0; c < 2; c++) {
+      add_sine(data[k][c], len, 62.5 / 22050, c, 1);
+      add_sine(data[k][c], len, 1000 / 22050.0, 0, 0.5);
+      add_sine(data[k][c], len, 16000 / 22050.0, 0, 0.5);
+    }
+  }
+
+  for (int start = 0, n = 0; start < len; n++) {
+    int chunk = std::min(len - start,
+                         blocks[n % (sizeof(blocks) / sizeof(int))]);
+    for (int k = 0; k < 2; k++) {
+      float **d = data[k];
+      dsp_util_enable_avx2_fma(k);
+      crossover2_process(&xo2[k], chunk, d[0] + start, d[1] + start,
+                         d[2] + start, d[3] + start, d[4] + start,
+                         d[5] + start);
+    }
+    start += chunk;
+  }
+  dsp_util_enable_avx2_fma(1);
+
+  for (int j = 0; j < 6; j++)
+    for (int i = 0; i < len; i++)
+      ASSERT_NEAR(data[0][j][i], data[1][j][i], 1e-4) << "output " << j
+                                                      << " frame " << i;
+
+  for (int k = 0; k < 2; k++)
+    for (int j = 0; j < 6; j++)
+      free(data[k][j]);
+}
+
+TEST(CrossovernTest, MatchesCrossover2) {
+  const int len = 4800;
+  const int num_channels = 5;
+  const int blocks[] = { 1, 480, 7, 2048 };
+  struct crossover2 xo2[3];
+  struct crossovern *xo;
+  float *data[3][num_channels], *ref[3][6];
+
+  EXPECT_EQ(NULL, crossovern_new(CROSSOVERN_MAX_CHANNELS + 1, 0.1, 0.2));
+
+  dsp_util_enable_avx2_fma(0);
+  xo = crossovern_new(num_channels, 250 / 22050.0, 4000 / 22050.0);
+  ASSERT_TRUE(xo != NULL);
+  for (int p = 0; p < 3; p++)
+    crossover2_init(&xo2[p], 250 / 22050.0, 4000 / 22050.0);
+  for (int b = 0; b < 3; b++) {
+    for (int c = 0; c < 6; c++)
+      ref[b][c] = (float *)calloc(len, sizeof(float));
+    for (int c = 0; c < num_channels; c++)
+      data[b][c] = (float *)calloc(len, sizeof(float));
+  }
+  for (int c = 0; c < num_channels; c++) {
+    add_sine(data[0][c], len, 62.5 / 22050, c, 1);
+    add_sine(data[0][c], len, (500 + 200 * c) / 22050.0, 0, 0.5);
+    add_sine(data[0][c], len, 16000 / 22050.0, 0, 0.5);
+    memcpy(ref[0][c], data[0][c], len * sizeof(float));
+  }
+
+  for (int start = 0, n = 0; start < len; n++) {
+    int chunk = std::min(len - start,
+                         blocks[n % (sizeof(blocks) / sizeof(int))]);
+    float *d[3][num_channels];
+    for (int b = 0; b < 3; b++)
+      for (int c = 0; c < num_channels; c++)
+        d[b][c] = data[b][c] + start;
+    crossovern_process(xo, chunk, d[0], d[1], d[2]);
+    for (int p = 0; p < 3; p++)
+      crossover2_process(&xo2[p], chunk,
+                         ref[0][2 * p] + start, ref[0][2 * p + 1] + start,
+                         ref[1][2 * p] + start, ref[1][2 * p + 1] + start,
+                         ref[2][2 * p] + start, ref[2][2 * p + 1] + start);
+    start += chunk;
+  }
+  dsp_util_enable_avx2_fma(1);
+
+  for (int b = 0; b < 3; b++)
+    for (int c = 0; c < num_channels; c++)
+      for (int i = 0; i < len; i++)
+        ASSERT_NEAR(ref[b][c][i], data[b][c][i], 1e-4) << "band " << b
+                                                       << " channel " << c
+                                                       << " frame " << i;
+
+  crossovern_free(xo);
+  for (int b = 0; b < 3; b++) {
+    for (int c = 0; c < 6; c++)
+      free(ref[b][c]);
+    for (int c = 0; c < num_channels; c++)
+      free(data[b][c]);
+  }
+}
+
 TEST(DrcTest, All) {
   size_t len = 44100;
   float NQ = len / 2;
@@ -403,6 +689,80 @@ TEST(DrcTest, All) {
   free(data_right);
 }
 
+/* Creates a DRC with all three bands compressing, so every kernel does
+ * real work. */
+static struct drc *new_compressing_drc(float sample_rate)
+{
+  struct drc *drc = drc_new(sample_rate);
+
+  for (int i = 0; i < DRC_NUM_KERNELS; i++) {
+    drc_set_param(drc, i, PARAM_ENABLED, 1);
+    drc_set_param(drc, i, PARAM_THRESHOLD, -30 + i * 5);
+    drc_set_param(drc, i, PARAM_KNEE, 0);
+    drc_set_param(drc, i, PARAM_RATIO, 3);
+    drc_set_param(drc, i, PARAM_ATTACK, 0.02);
+    drc_set_param(drc, i, PARAM_RELEASE, 0.2);
+    drc_set_param(drc, i, PARAM_POST_GAIN, 6);
+  }
+  drc_set_param(drc, 1, PARAM_CROSSOVER_LOWER_FREQ, 250 / 22050.0f);
+  drc_set_param(drc, 2, PARAM_CROSSOVER_LOWER_FREQ, 4000 / 22050.0f);
+  drc_init(drc);
+  return drc;
+}
+
+TEST(DrcTest, WorkersMatchSerial) {
+  const size_t len = 44100;
+  /* Mix of block sizes, including ones short enough to stay serial. */
+  const int blocks[] = { 480, 32, 2048, 256, 1 };
+  float *serial[2], *parallel[2];
+  struct drc *drc_serial, *drc_parallel;
+
+  dsp_enable_flush_denormal_to_zero();
+  for (int c = 0; c < 2; c++) {
+    serial[c] = (float *)calloc(len, sizeof(float));
+    parallel[c] = (float *)calloc(len, sizeof(float));
+    add_sine(serial[c], len, 62.5 / 22050, c, 1);
+    add_sine(serial[c], len, 1000 / 22050.0, 0, 0.8);
+    add_sine(serial[c], len, 16000 / 22050.0, 0, 0.5);
+    memcpy(parallel[c], serial[c], len * sizeof(float));
+  }
+
+  drc_serial = new_compressing_drc(44100);
+  drc_parallel = new_compressing_drc(44100);
+
+  ASSERT_EQ(0, drc_workers_start(0));
+  /* Starting twice is harmless. */
+  ASSERT_EQ(0, drc_workers_start(0));
+
+  size_t start = 0;
+  for (int n = 0; start < len; n++) {
+    int chunk = std::min(len - start,
+                         (size_t)blocks[n % (sizeof(blocks) / sizeof(int))]);
+    float *s[] = { serial[0] + start, serial[1] + start };
+    float *p[] = { parallel[0] + start, parallel[1] + start };
+
+    drc_workers_stop();
+    EXPECT_EQ(0, drc_workers_running());
+    drc_process(drc_serial, s, chunk);
+    ASSERT_EQ(0, drc_workers_start(0));
+    drc_process(drc_parallel, p, chunk);
+    start += chunk;
+  }
+  drc_workers_stop();
+
+  for (int c = 0; c < 2; c++)
+    for (size_t i = 0; i < len; i++)
+      ASSERT_EQ(serial[c][i], parallel[c][i]) << "channel " << c
+                                              << " frame " << i;
+
+  drc_free(drc_serial);
+  drc_free(drc_parallel);
+  for (int c = 0; c < 2; c++) {
+    free(serial[c]);
+    free(parallel[c]);
+  }
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
@@ -7,10 +7,19 @@
 #include "cras_dsp.h"
 #include "cras_dsp_module.h"
 
+extern "C" {
+#include "cras_tm.h"
+}
+
 #define FILENAME_TEMPLATE "DspTest.XXXXXX"
 
 namespace {
 
+static int free_module_called;
+static void (*reclaim_cb)(struct cras_timer *t, void *data);
+static void *reclaim_cb_data;
+static int cancel_timer_called;
+
 extern "C" {
 struct dsp_module *cras_dsp_module_load_ladspa(struct plugin *plugin)
 {
@@ -117,6 +126,7 @@ static void empty_deinstantiate(struct dsp_module *module) {}
 
 static void empty_free_module(struct dsp_module *module)
 {
+  free_module_called++;
   free(module);
 }
 
@@ -139,6 +149,162 @@ static void empty_init_module(struct dsp_module *module)
   module->dump = &empty_dump;
 }
 
+/* Doubles the samples from port 0 into port 1. */
+static void double_connect_port(struct dsp_module *module, unsigned long port,
+                                float *data_location)
+{
+  float **ports = (float **)module->data;
+  ports[port] = data_location;
+}
+
+static void double_run(struct dsp_module *module, unsigned long sample_count)
+{
+  float **ports = (float **)module->data;
+  for (unsigned long i = 0; i < sample_count; i++)
+    ports[1][i] = ports[0][i] * 2;
+}
+
+static void double_free_module(struct dsp_module *module)
+{
+  free(module->data);
+  empty_free_module(module);
+}
+
+TEST_F(DspTestSuite, ReloadCrossfade) {
+  const char *content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=double\n"
+      "purpose=playback\n"
+      "input_0={a}\n"
+      "output_1={b}\n"
+      "disable=(equal? variable \"off\")\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b}\n"
+      "\n";
+  struct cras_dsp_context *ctx;
+  float buf[600];
+  int i;
+
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  ctx = cras_dsp_context_new(48000, "playback");
+  cras_dsp_set_variable_string(ctx, "variable", "on");
+  cras_dsp_load_pipeline(ctx);
+  ASSERT_EQ(1, cras_dsp_num_input_channels(ctx));
+
+  for (i = 0; i < 600; i++)
+    buf[i] = 1.0f;
+  cras_dsp_apply_float(ctx, buf, 100);
+  EXPECT_FLOAT_EQ(2.0f, buf[0]);
+  EXPECT_FLOAT_EQ(2.0f, buf[99]);
+
+  /* The old pipeline is still running, so it must not be freed yet. */
+  free_module_called = 0;
+  reclaim_cb = NULL;
+  cras_dsp_set_variable_string(ctx, "variable", "off");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(0, free_module_called);
+  ASSERT_TRUE(reclaim_cb != NULL);
+
+  /* The output fades from the old to the new pipeline over 10ms. */
+  for (i = 0; i < 600; i++)
+    buf[i] = 1.0f;
+  cras_dsp_apply_float(ctx, buf, 600);
+  EXPECT_FLOAT_EQ(2.0f, buf[0]);
+  EXPECT_FLOAT_EQ(1.5f, buf[240]);
+  EXPECT_NEAR(1.0f, buf[479], 0.01f);
+  EXPECT_FLOAT_EQ(1.0f, buf[480]);
+  EXPECT_FLOAT_EQ(1.0f, buf[599]);
+
+  /* Done fading, the old pipeline can go. */
+  reclaim_cb(NULL, reclaim_cb_data);
+  EXPECT_EQ(3, free_module_called);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
+TEST_F(DspTestSuite, ReloadIdle) {
+  const char *content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=double\n"
+      "purpose=playback\n"
+      "input_0={a}\n"
+      "output_1={b}\n"
+      "disable=(equal? variable \"off\")\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b}\n"
+      "\n";
+  struct cras_dsp_context *ctx;
+  float buf[100];
+  int i;
+
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  ctx = cras_dsp_context_new(48000, "playback");
+  cras_dsp_set_variable_string(ctx, "variable", "on");
+  cras_dsp_load_pipeline(ctx);
+
+  for (i = 0; i < 100; i++)
+    buf[i] = 1.0f;
+  cras_dsp_apply_float(ctx, buf, 100);
+
+  /* Reloaded after the last apply, the old pipeline waits for the next. */
+  free_module_called = 0;
+  reclaim_cb = NULL;
+  cancel_timer_called = 0;
+  cras_dsp_set_variable_string(ctx, "variable", "off");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(0, free_module_called);
+  ASSERT_TRUE(reclaim_cb != NULL);
+
+  /* The device stops without another apply, so the timer stops and the old
+   * pipeline goes. */
+  cras_dsp_context_idle(ctx);
+  EXPECT_EQ(3, free_module_called);
+  EXPECT_EQ(1, cancel_timer_called);
+
+  /* Reloading while idle frees the replaced pipeline at once. */
+  free_module_called = 0;
+  reclaim_cb = NULL;
+  cras_dsp_set_variable_string(ctx, "variable", "on");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(2, free_module_called);
+  EXPECT_TRUE(reclaim_cb == NULL);
+
+  /* The next apply runs the new pipeline without a crossfade. */
+  for (i = 0; i < 100; i++)
+    buf[i] = 1.0f;
+  cras_dsp_apply_float(ctx, buf, 100);
+  EXPECT_FLOAT_EQ(2.0f, buf[0]);
+  EXPECT_FLOAT_EQ(2.0f, buf[99]);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
 }  //  namespace
 
 extern "C"
@@ -148,8 +314,35 @@ struct dsp_module *cras_dsp_module_load_builtin(struct plugin *plugin)
   struct dsp_module *module;
   module = (struct dsp_module *)calloc(1, sizeof(struct dsp_module));
   empty_init_module(module);
+  if (strcmp(plugin->label, "double") == 0) {
+    module->data = calloc(2, sizeof(float *));
+    module->connect_port = &double_connect_port;
+    module->run = &double_run;
+    module->free_module = &double_free_module;
+  }
   return module;
 }
+
+struct cras_tm *cras_system_state_get_tm()
+{
+  return NULL;
+}
+
+struct cras_timer *cras_tm_create_timer(
+    struct cras_tm *tm,
+    unsigned int ms,
+    void (*cb)(struct cras_timer *t, void *data),
+    void *cb_data)
+{
+  reclaim_cb = cb;
+  reclaim_cb_data = cb_data;
+  return reinterpret_cast<struct cras_timer *>(0x44);
+}
+
+void cras_tm_cancel_timer(struct cras_tm *tm, struct cras_timer *t)
+{
+  cancel_timer_called++;
+}
 } // extern "C"
 
 int main(int argc, char **argv) {
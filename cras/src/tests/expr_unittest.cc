@@ -239,6 +239,47 @@ TEST(ExprTest, Builtin) {
   cras_expr_env_free(&env);
 }
 
+TEST(ExprTest, CachedResult) {
+  struct cras_expr_expression *expr;
+  struct cras_expr_env env1 = CRAS_EXPR_ENV_INIT;
+  struct cras_expr_env env2 = CRAS_EXPR_ENV_INIT;
+  char boolean = 0;
+
+  cras_expr_env_install_builtins(&env1);
+  cras_expr_env_install_builtins(&env2);
+
+  /* The expression is compiled when it is parsed. */
+  expr = cras_expr_expression_parse("(not (equal? a \"x\"))");
+  ASSERT_TRUE(expr->program != NULL);
+
+  cras_expr_env_set_variable_string(&env1, "a", "x");
+  cras_expr_env_set_variable_string(&env2, "a", "y");
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env1, &boolean));
+  EXPECT_EQ(0, boolean);
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env2, &boolean));
+  EXPECT_EQ(1, boolean);
+
+  /* Setting the same value keeps the cached result, a new value doesn't. */
+  cras_expr_env_set_variable_string(&env1, "a", "x");
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env1, &boolean));
+  EXPECT_EQ(0, boolean);
+  cras_expr_env_set_variable_string(&env1, "a", "z");
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env1, &boolean));
+  EXPECT_EQ(1, boolean);
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env2, &boolean));
+  EXPECT_EQ(1, boolean);
+
+  /* A variable which is not read doesn't matter. */
+  cras_expr_env_set_variable_string(&env2, "b", "x");
+  cras_expr_env_set_variable_string(&env2, "a", "x");
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env2, &boolean));
+  EXPECT_EQ(0, boolean);
+
+  cras_expr_expression_free(expr);
+  cras_expr_env_free(&env1);
+  cras_expr_env_free(&env2);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
@@ -0,0 +1,168 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Compares the fused format converters with the chain of converters they
+ * replace, over pairs of sample formats and channel counts.
+ *
+ * Usage: fmt_conv_benchmark [seconds of audio]
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+/* Built with the converter to be able to turn the fused path off. */
+#include "cras_fmt_conv.c"
+
+#define BLOCK_FRAMES 480
+#define RATE 48000
+
+struct bench_case {
+	snd_pcm_format_t in_format;
+	size_t in_channels;
+	snd_pcm_format_t out_format;
+	size_t out_channels;
+};
+
+static const struct bench_case cases[] = {
+	{ SND_PCM_FORMAT_S16_LE, 1, SND_PCM_FORMAT_S32_LE, 2 },
+	{ SND_PCM_FORMAT_S16_LE, 1, SND_PCM_FORMAT_S24_LE, 2 },
+	{ SND_PCM_FORMAT_S16_LE, 2, SND_PCM_FORMAT_S32_LE, 6 },
+	{ SND_PCM_FORMAT_S16_LE, 6, SND_PCM_FORMAT_S32_LE, 2 },
+	{ SND_PCM_FORMAT_S24_LE, 2, SND_PCM_FORMAT_S16_LE, 6 },
+	{ SND_PCM_FORMAT_S24_LE, 2, SND_PCM_FORMAT_S16_LE, 1 },
+	{ SND_PCM_FORMAT_S24_LE, 6, SND_PCM_FORMAT_S16_LE, 2 },
+	{ SND_PCM_FORMAT_S32_LE, 2, SND_PCM_FORMAT_S16_LE, 1 },
+	{ SND_PCM_FORMAT_S32_LE, 2, SND_PCM_FORMAT_S32_LE, 6 },
+	{ SND_PCM_FORMAT_S32_LE, 6, SND_PCM_FORMAT_S24_LE, 2 },
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *format_name(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		return "s16";
+	case SND_PCM_FORMAT_S24_LE:
+		return "s24";
+	case SND_PCM_FORMAT_S32_LE:
+		return "s32";
+	default:
+		return "?";
+	}
+}
+
+static void set_format(struct cras_audio_format *fmt,
+		       snd_pcm_format_t format, size_t num_channels)
+{
+	static const int8_t surround_layout[CRAS_CH_MAX] =
+		{ 0, 1, 2, 3, 4, 5, -1, -1, -1, -1, -1 };
+	unsigned int i;
+
+	fmt->format = format;
+	fmt->frame_rate = RATE;
+	fmt->num_channels = num_channels;
+	for (i = 0; i < CRAS_CH_MAX; i++)
+		fmt->channel_layout[i] = num_channels == 6 ?
+					 surround_layout[i] : -1;
+}
+
+/* Returns the frames converted per second. */
+static double run(struct cras_fmt_conv *conv, uint8_t *in, uint8_t *out,
+		  unsigned long total)
+{
+	unsigned long done = 0;
+	double start;
+
+	start = now_sec();
+	while (done < total) {
+		unsigned int frames = BLOCK_FRAMES;
+
+		cras_fmt_conv_convert_frames(conv, in, out, &frames,
+					     BLOCK_FRAMES);
+		done += frames;
+	}
+	return done / (now_sec() - start);
+}
+
+static int bench(const struct bench_case *bc, unsigned long total)
+{
+	struct cras_audio_format in_fmt, out_fmt;
+	struct cras_fmt_conv *conv;
+	fused_converter_t fused;
+	uint8_t *in, *out, *ref;
+	size_t in_bytes, out_bytes, i;
+	double fused_rate, chain_rate;
+
+	set_format(&in_fmt, bc->in_format, bc->in_channels);
+	set_format(&out_fmt, bc->out_format, bc->out_channels);
+	/* The fused converters handle the default downmix only. */
+	if (bc->in_channels == 6)
+		memset(in_fmt.channel_layout, -1,
+		       sizeof(in_fmt.channel_layout));
+
+	conv = cras_fmt_conv_create(&in_fmt, &out_fmt, BLOCK_FRAMES, 0);
+	if (!conv || !conv->fused_converter) {
+		fprintf(stderr, "No fused converter for case\n");
+		return -1;
+	}
+	fused = conv->fused_converter;
+
+	in_bytes = BLOCK_FRAMES * cras_get_format_bytes(&in_fmt);
+	out_bytes = BLOCK_FRAMES * cras_get_format_bytes(&out_fmt);
+	in = malloc(in_bytes);
+	out = malloc(out_bytes);
+	ref = malloc(out_bytes);
+	for (i = 0; i < in_bytes; i++)
+		in[i] = rand();
+
+	/* Both paths have to give the same samples. */
+	run(conv, in, ref, BLOCK_FRAMES);
+	conv->fused_converter = NULL;
+	run(conv, in, out, BLOCK_FRAMES);
+	if (memcmp(ref, out, out_bytes)) {
+		fprintf(stderr, "Fused and chained conversions differ\n");
+		return -1;
+	}
+
+	chain_rate = run(conv, in, out, total);
+	conv->fused_converter = fused;
+	fused_rate = run(conv, in, out, total);
+
+	printf("%s %zuch -> %s %zuch  chain %7.1f  fused %7.1f Mframes/s"
+	       "  %4.2fx\n",
+	       format_name(bc->in_format), bc->in_channels,
+	       format_name(bc->out_format), bc->out_channels,
+	       chain_rate / 1e6, fused_rate / 1e6, fused_rate / chain_rate);
+
+	cras_fmt_conv_destroy(conv);
+	free(in);
+	free(out);
+	free(ref);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long total;
+	unsigned int i;
+	double secs = 600;
+
+	if (argc > 1)
+		secs = atof(argv[1]);
+	total = secs * RATE;
+
+	printf("Converting %.0f seconds of %d Hz audio\n", secs, RATE);
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		if (bench(&cases[i], total))
+			return 1;
+
+	return 0;
+}
@@ -827,6 +827,100 @@ TEST(FormatConverterTest, ConvertS16LEToS16LEMonoTo51) {
   free(out_buff);
 }
 
+// Test 24 bit stereo to 16 bit 5.1 conversion.
+TEST(FormatConverterTest, ConvertS24LEToS16LEStereoTo51) {
+  struct cras_fmt_conv *c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int32_t *in_buff;
+  int16_t *out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+  int i;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S24_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 6;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    out_fmt.channel_layout[i] = surround_channel_layout[i];
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void *)NULL);
+
+  in_buff = (int32_t *)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int16_t *)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(c,
+                                            (uint8_t *)in_buff,
+                                            (uint8_t *)out_buff,
+                                            &in_buf_size,
+                                            buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  EXPECT_EQ(buf_size, in_buf_size);
+  for (unsigned int i = 0; i < buf_size; i++) {
+    EXPECT_EQ((int16_t)((in_buff[2 * i] & 0x00ffffff) >> 8),
+              out_buff[6 * i]);
+    EXPECT_EQ((int16_t)((in_buff[2 * i + 1] & 0x00ffffff) >> 8),
+              out_buff[6 * i + 1]);
+    EXPECT_EQ(0, out_buff[6 * i + 2]);
+    EXPECT_EQ(0, out_buff[6 * i + 3]);
+    EXPECT_EQ(0, out_buff[6 * i + 4]);
+    EXPECT_EQ(0, out_buff[6 * i + 5]);
+  }
+
+  cras_fmt_conv_destroy(c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test 16 bit mono to 32 bit stereo conversion.
+TEST(FormatConverterTest, ConvertS16LEToS32LEMonoToStereo) {
+  struct cras_fmt_conv *c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int16_t *in_buff;
+  int32_t *out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 1;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void *)NULL);
+
+  in_buff = (int16_t *)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int32_t *)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(c,
+                                            (uint8_t *)in_buff,
+                                            (uint8_t *)out_buff,
+                                            &in_buf_size,
+                                            buf_size / 2);
+  // Only as many frames as fit in the output are converted.
+  EXPECT_EQ(buf_size / 2, out_frames);
+  EXPECT_EQ(buf_size / 2, in_buf_size);
+  for (unsigned int i = 0; i < buf_size / 2; i++) {
+    EXPECT_EQ((int32_t)in_buff[i] << 16, out_buff[2 * i]);
+    EXPECT_EQ((int32_t)in_buff[i] << 16, out_buff[2 * i + 1]);
+  }
+
+  cras_fmt_conv_destroy(c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test 32 bit 5.1 to 16 bit stereo conversion with SRC 1 to 2.
 TEST(FormatConverterTest, ConvertS32LEToS16LEDownmix51ToStereo48To96) {
   struct cras_fmt_conv *c;
@@ -1284,7 +1378,7 @@ float **cras_channel_conv_matrix_create(const struct cras_audio_format *in,
 					out->num_channels);
 }
 struct linear_resampler *linear_resampler_create(unsigned int num_channels,
-             unsigned int format_bytes,
+             snd_pcm_format_t format,
              float src_rate,
              float dst_rate)
 {
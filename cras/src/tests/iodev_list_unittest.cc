@@ -22,8 +22,8 @@ extern "C" {
 
 namespace {
 
-struct cras_server_state server_state_stub;
-struct cras_server_state *server_state_update_begin_return;
+struct cras_server_state_lists server_state_stub;
+struct cras_server_state_lists *server_state_update_begin_return;
 
 /* Data for stubs. */
 static struct cras_observer_ops *observer_ops;
@@ -1300,7 +1300,7 @@ extern "C" {
 
 // Stubs
 
-struct cras_server_state *cras_system_state_update_begin() {
+struct cras_server_state_lists *cras_system_state_update_begin() {
   return server_state_update_begin_return;
 }
 
@@ -51,8 +51,14 @@ static int cras_dsp_pipeline_get_sink_buffer_called;
 static float cras_dsp_pipeline_source_buffer[2][DSP_BUFFER_SIZE];
 static float cras_dsp_pipeline_sink_buffer[2][DSP_BUFFER_SIZE];
 static int cras_dsp_pipeline_get_delay_called;
-static int cras_dsp_pipeline_apply_called;
-static int cras_dsp_pipeline_apply_sample_count;
+static int cras_dsp_apply_called;
+static int cras_dsp_apply_sample_count;
+static int cras_dsp_apply_float_called;
+static int cras_dsp_apply_float_sample_count;
+static int cras_mix_quantize_float_called;
+static unsigned int cras_mix_quantize_float_count;
+static float cras_scale_float_buffer_scaler;
+static int cras_scale_float_buffer_called;
 static unsigned int cras_mix_mute_count;
 static unsigned int cras_dsp_num_input_channels_return;
 static unsigned int cras_dsp_num_output_channels_return;
@@ -80,6 +86,7 @@ static int no_stream_called;
 static int no_stream_enable;
 // This will be used extensively in cras_iodev.
 struct audio_thread_event_log *atlog;
+struct audio_thread_trace *attrace;
 static unsigned int simple_no_stream_called;
 static int simple_no_stream_enable;
 static int dev_stream_playback_frames_ret;
@@ -143,8 +150,14 @@ void ResetStubData() {
   memset(&cras_dsp_pipeline_sink_buffer, 0,
          sizeof(cras_dsp_pipeline_sink_buffer));
   cras_dsp_pipeline_get_delay_called = 0;
-  cras_dsp_pipeline_apply_called = 0;
-  cras_dsp_pipeline_apply_sample_count = 0;
+  cras_dsp_apply_called = 0;
+  cras_dsp_apply_sample_count = 0;
+  cras_dsp_apply_float_called = 0;
+  cras_dsp_apply_float_sample_count = 0;
+  cras_mix_quantize_float_called = 0;
+  cras_mix_quantize_float_count = 0;
+  cras_scale_float_buffer_scaler = 0;
+  cras_scale_float_buffer_called = 0;
   cras_dsp_num_input_channels_return = 2;
   cras_dsp_num_output_channels_return = 2;
   cras_dsp_context_new_return = NULL;
@@ -806,10 +819,97 @@ TEST(IoDevPutOutputBuffer, DSP) {
   EXPECT_EQ((void *)0x5678, post_dsp_hook_cb_data);
   EXPECT_EQ(32, put_buffer_nframes);
   EXPECT_EQ(32, rate_estimator_add_frames_num_frames);
-  EXPECT_EQ(32, cras_dsp_pipeline_apply_sample_count);
+  EXPECT_EQ(32, cras_dsp_apply_sample_count);
   EXPECT_EQ(cras_dsp_get_pipeline_called, cras_dsp_put_pipeline_called);
 }
 
+TEST(IoDevPutOutputBuffer, FloatMixBus) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t *frames = reinterpret_cast<uint8_t*>(0x44);
+  float bus[50 * 2];
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+  iodev.software_volume_needed = 1;
+  cras_system_get_volume_return = 13;
+  softvol_scalers[13] = 0.435;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.ext_format = &fmt;
+  iodev.put_buffer = put_buffer;
+  for (unsigned int i = 0; i < 50 * 2; i++)
+    bus[i] = i;
+  iodev.float_mix_buf = bus;
+  iodev.float_mix_frames = 50;
+
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32);
+  EXPECT_EQ(0, rc);
+  // DSP and volume run on the bus, quantizing happens once.
+  EXPECT_EQ(0, cras_dsp_apply_called);
+  EXPECT_EQ(1, cras_dsp_apply_float_called);
+  EXPECT_EQ(32, cras_dsp_apply_float_sample_count);
+  EXPECT_EQ(0, cras_scale_buffer_called);
+  EXPECT_EQ(1, cras_scale_float_buffer_called);
+  EXPECT_EQ(softvol_scalers[13], cras_scale_float_buffer_scaler);
+  EXPECT_EQ(1, cras_mix_quantize_float_called);
+  EXPECT_EQ(64, cras_mix_quantize_float_count);
+  EXPECT_EQ(32, put_buffer_nframes);
+  EXPECT_EQ(32, rate_estimator_add_frames_num_frames);
+  // The frames mixed past the committed ones move to the front.
+  EXPECT_EQ(18, iodev.float_mix_frames);
+  EXPECT_EQ(64, bus[0]);
+  EXPECT_EQ(99, bus[35]);
+
+  // Committing more than was mixed pads with silence and empties the bus.
+  ResetStubData();
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 20);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, bus[36]);
+  EXPECT_EQ(0, bus[39]);
+  EXPECT_EQ(0, iodev.float_mix_frames);
+  EXPECT_EQ(40, cras_mix_quantize_float_count);
+}
+
+TEST(IoDevPutOutputBuffer, FloatMixBusHooksGetQuantizedFrames) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t *frames = reinterpret_cast<uint8_t*>(0x44);
+  float bus[32 * 2];
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(bus, 0, sizeof(bus));
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.ext_format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.float_mix_buf = bus;
+  iodev.float_mix_frames = 32;
+  cras_iodev_register_pre_dsp_hook(&iodev, pre_dsp_hook, (void *)0x1234);
+  cras_iodev_register_post_dsp_hook(&iodev, post_dsp_hook, (void *)0x5678);
+
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, pre_dsp_hook_called);
+  EXPECT_EQ(frames, pre_dsp_hook_frames);
+  EXPECT_EQ(1, post_dsp_hook_called);
+  EXPECT_EQ(frames, post_dsp_hook_frames);
+  // One copy for each hook and the final one.
+  EXPECT_EQ(3, cras_mix_quantize_float_called);
+  EXPECT_EQ(32, put_buffer_nframes);
+}
+
 TEST(IoDevPutOutputBuffer, SoftVol) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
@@ -2080,11 +2180,22 @@ int cras_dsp_pipeline_get_delay(struct pipeline *pipeline)
   return 0;
 }
 
-void cras_dsp_pipeline_apply(struct pipeline *pipeline,
-			     uint8_t *buf, unsigned int frames)
+void cras_dsp_apply(struct cras_dsp_context *ctx, uint8_t *buf,
+		    snd_pcm_format_t format, unsigned int frames)
+{
+  cras_dsp_apply_called++;
+  cras_dsp_apply_sample_count = frames;
+}
+
+void cras_dsp_apply_float(struct cras_dsp_context *ctx, float *buf,
+                          unsigned int frames)
+{
+  cras_dsp_apply_float_called++;
+  cras_dsp_apply_float_sample_count = frames;
+}
+
+void cras_dsp_context_idle(struct cras_dsp_context *ctx)
 {
-  cras_dsp_pipeline_apply_called++;
-  cras_dsp_pipeline_apply_sample_count = frames;
 }
 
 void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
@@ -2214,6 +2325,25 @@ void cras_scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
   cras_scale_buffer_increment_channel = channel;
 }
 
+void cras_scale_float_buffer_increment(float *buff, unsigned int frame,
+                                       float scaler, float increment,
+                                       int channel)
+{
+}
+
+void cras_scale_float_buffer(float *buff, unsigned int count, float scaler)
+{
+  cras_scale_float_buffer_called++;
+  cras_scale_float_buffer_scaler = scaler;
+}
+
+void cras_mix_quantize_float(snd_pcm_format_t fmt, uint8_t *dst,
+                             const float *src, unsigned int count)
+{
+  cras_mix_quantize_float_called++;
+  cras_mix_quantize_float_count = count;
+}
+
 size_t cras_mix_mute_buffer(uint8_t *dst,
                             size_t frame_bytes,
                             size_t count) {
@@ -0,0 +1,173 @@
+/* Copyright (c) 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Measures the throughput of the linear resampler at the small rate
+ * offsets used to correct device drift.
+ *
+ * Usage: linear_resampler_benchmark [seconds of audio]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "linear_resampler.h"
+
+#define BLOCK_FRAMES 480
+#define SRC_RATE 48000.0f
+#define DST_RATE 48004.8f
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The float divide per output frame the resampler used before it moved to
+ * a phase accumulator, kept as a reference point for S16. */
+static unsigned int reference_resample_s16(unsigned int num_channels,
+					   float f, const int16_t *src,
+					   unsigned int *src_frames,
+					   int16_t *dst,
+					   unsigned int dst_frames)
+{
+	unsigned int src_idx = 0, dst_idx, ch;
+	float src_pos;
+
+	for (dst_idx = 0; dst_idx <= dst_frames; dst_idx++) {
+		src_pos = (float)dst_idx / f;
+		src_idx = (unsigned int)src_pos;
+		if (src_pos > *src_frames - 1 || dst_idx >= dst_frames) {
+			if (src_pos > *src_frames - 1)
+				src_idx = *src_frames - 1;
+			break;
+		}
+		for (ch = 0; ch < num_channels; ch++) {
+			const int16_t *in = src + src_idx * num_channels;
+			if (src_idx == *src_frames - 1)
+				dst[dst_idx * num_channels + ch] = in[ch];
+			else
+				dst[dst_idx * num_channels + ch] = in[ch] +
+					(src_pos - src_idx) *
+					(in[num_channels + ch] - in[ch]);
+		}
+	}
+	*src_frames = src_idx + 1;
+	return dst_idx;
+}
+
+static void report(const char *name, unsigned int num_channels,
+		   unsigned long frames, double secs)
+{
+	printf("%-10s %2u ch  %8.1f Mframes/s  %6.1fx realtime\n",
+	       name, num_channels, frames / secs / 1e6,
+	       frames / secs / SRC_RATE);
+}
+
+static void bench_reference(unsigned int num_channels, unsigned long total)
+{
+	int16_t *src, *dst;
+	unsigned long done = 0;
+	unsigned int i;
+	double start;
+
+	src = calloc(BLOCK_FRAMES * num_channels, sizeof(*src));
+	dst = calloc(2 * BLOCK_FRAMES * num_channels, sizeof(*dst));
+	for (i = 0; i < BLOCK_FRAMES * num_channels; i++)
+		src[i] = rand();
+
+	start = now_sec();
+	while (done < total) {
+		unsigned int count = BLOCK_FRAMES;
+		reference_resample_s16(num_channels, DST_RATE / SRC_RATE,
+				       src, &count, dst, 2 * BLOCK_FRAMES);
+		done += count;
+	}
+	report("reference", num_channels, done, now_sec() - start);
+
+	free(src);
+	free(dst);
+}
+
+static void bench(const char *name, snd_pcm_format_t format,
+		  enum linear_resampler_interp interp,
+		  unsigned int num_channels, unsigned long total)
+{
+	struct linear_resampler *lr;
+	uint8_t *src, *dst;
+	unsigned int frame_bytes;
+	unsigned long done = 0;
+	unsigned int i;
+	double start;
+
+	lr = linear_resampler_create(num_channels, format, SRC_RATE, DST_RATE);
+	if (!lr || linear_resampler_set_interp(lr, interp)) {
+		fprintf(stderr, "Failed to set up %s\n", name);
+		exit(1);
+	}
+
+	/* Random bytes aren't valid floats, fill with a ramp instead. */
+	frame_bytes = num_channels * (format == SND_PCM_FORMAT_S16_LE ? 2 : 4);
+	src = malloc(BLOCK_FRAMES * frame_bytes);
+	dst = malloc(2 * BLOCK_FRAMES * frame_bytes);
+	for (i = 0; i < BLOCK_FRAMES * num_channels; i++) {
+		if (format == SND_PCM_FORMAT_FLOAT_LE)
+			((float *)src)[i] = (float)i / BLOCK_FRAMES - 1.0f;
+		else if (format == SND_PCM_FORMAT_S32_LE)
+			((int32_t *)src)[i] = rand();
+		else
+			((int16_t *)src)[i] = rand();
+	}
+
+	start = now_sec();
+	while (done < total) {
+		unsigned int count = BLOCK_FRAMES;
+		linear_resampler_resample(lr, src, &count, dst,
+					  2 * BLOCK_FRAMES);
+		done += count;
+	}
+	report(name, num_channels, done, now_sec() - start);
+
+	linear_resampler_destroy(lr);
+	free(src);
+	free(dst);
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int channels[] = { 1, 2, 6 };
+	unsigned long total;
+	unsigned int i;
+	double secs = 600;
+
+	if (argc > 1)
+		secs = atof(argv[1]);
+	total = secs * SRC_RATE;
+
+	printf("Resampling %.0f seconds of %.0f Hz audio to %.1f Hz\n",
+	       secs, SRC_RATE, DST_RATE);
+	for (i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+		unsigned int ch = channels[i];
+
+		bench_reference(ch, total);
+		bench("s16", SND_PCM_FORMAT_S16_LE,
+		      LINEAR_RESAMPLER_INTERP_LINEAR, ch, total);
+		bench("s32", SND_PCM_FORMAT_S32_LE,
+		      LINEAR_RESAMPLER_INTERP_LINEAR, ch, total);
+		bench("float", SND_PCM_FORMAT_FLOAT_LE,
+		      LINEAR_RESAMPLER_INTERP_LINEAR, ch, total);
+		bench("s16 cubic", SND_PCM_FORMAT_S16_LE,
+		      LINEAR_RESAMPLER_INTERP_CUBIC, ch, total);
+		bench("s32 cubic", SND_PCM_FORMAT_S32_LE,
+		      LINEAR_RESAMPLER_INTERP_CUBIC, ch, total);
+		bench("flt cubic", SND_PCM_FORMAT_FLOAT_LE,
+		      LINEAR_RESAMPLER_INTERP_CUBIC, ch, total);
+	}
+
+	return 0;
+}
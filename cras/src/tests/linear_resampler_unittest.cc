@@ -31,7 +31,7 @@ TEST(LinearResampler, ReampleToSlightlyLargerRate) {
 		*((int16_t *)(in_buf + i * 4 + 2)) = i * 20;
 	}
 
-	lr = linear_resampler_create(2, 4, 48000, 48001);
+	lr = linear_resampler_create(2, SND_PCM_FORMAT_S16_LE, 48000, 48001);
 
 	count = 20;
 	rc = linear_resampler_resample(lr, in_buf + 4 * in_offset, &count,
@@ -71,7 +71,7 @@ TEST(LinearResampler, ResampleIntegerFractionToLarger) {
 	}
 
 	/* Rate 10 -> 11 */
-	lr = linear_resampler_create(2, 4, 10, 11);
+	lr = linear_resampler_create(2, SND_PCM_FORMAT_S16_LE, 10, 11);
 
 	count = 5;
 	rc = linear_resampler_resample(lr, in_buf + 4 * in_offset, &count,
@@ -121,7 +121,7 @@ TEST(LinearResampler, ResampleIntegerFractionToLess) {
 	}
 
 	/* Rate 10 -> 9 */
-	lr = linear_resampler_create(2, 4, 10, 9);
+	lr = linear_resampler_create(2, SND_PCM_FORMAT_S16_LE, 10, 9);
 
 	count = 6;
 	rc = linear_resampler_resample(lr, in_buf + 4 * in_offset, &count,
@@ -163,7 +163,7 @@ TEST(LinearResampler, ResampleIntegerNoSrcBuffer) {
 	memset(out_buf, 0, BUF_SIZE);
 
 	/* Rate 10 -> 9 */
-	lr = linear_resampler_create(2, 4, 10, 9);
+	lr = linear_resampler_create(2, SND_PCM_FORMAT_S16_LE, 10, 9);
 
 	count = 0;
 	rc = linear_resampler_resample(lr, in_buf, &count,
@@ -181,7 +181,7 @@ TEST(LinearResampler, ResampleIntegerNoDstBuffer) {
 	memset(out_buf, 0, BUF_SIZE);
 
 	/* Rate 10 -> 9 */
-	lr = linear_resampler_create(2, 4, 10, 9);
+	lr = linear_resampler_create(2, SND_PCM_FORMAT_S16_LE, 10, 9);
 
 	count = BUF_SIZE;
 	rc = linear_resampler_resample(lr, in_buf, &count,
@@ -190,6 +190,185 @@ TEST(LinearResampler, ResampleIntegerNoDstBuffer) {
 	EXPECT_EQ(0, count);
 }
 
+TEST(LinearResampler, UnsupportedFormat) {
+	EXPECT_EQ(NULL, linear_resampler_create(2, SND_PCM_FORMAT_U8,
+						48000, 48001));
+	EXPECT_EQ(NULL, linear_resampler_create(2, SND_PCM_FORMAT_S24_LE,
+						48000, 48001));
+}
+
+/* Resamples a ramp in chunks and checks every output sample against the
+ * ramp evaluated at the exact source position. */
+template <typename T>
+static void ResampleRampInChunks(snd_pcm_format_t format, float from,
+				 float to, double tolerance) {
+	const unsigned int num_channels = 3;
+	const unsigned int total_in = 1000;
+	T in[total_in * num_channels];
+	T out[2 * total_in * num_channels];
+	unsigned int in_offset = 0;
+	unsigned int out_offset = 0;
+	unsigned int i, ch;
+	struct linear_resampler *lr;
+
+	for (i = 0; i < total_in; i++)
+		for (ch = 0; ch < num_channels; ch++)
+			in[i * num_channels + ch] = (T)(i * (ch + 1) * 7);
+
+	lr = linear_resampler_create(num_channels, format, from, to);
+	ASSERT_NE((struct linear_resampler *)NULL, lr);
+
+	while (in_offset + 100 <= total_in) {
+		unsigned int count = 100;
+		unsigned int expected_out;
+		unsigned int rc;
+
+		expected_out = linear_resampler_in_frames_to_out(lr, count);
+		rc = linear_resampler_resample(
+				lr, (uint8_t *)(in + in_offset * num_channels),
+				&count,
+				(uint8_t *)(out + out_offset * num_channels),
+				200);
+		EXPECT_EQ(expected_out, rc);
+		EXPECT_EQ(100, count);
+		in_offset += count;
+		out_offset += rc;
+	}
+
+	/* The ratio should hold across calls without drifting. */
+	EXPECT_NEAR(total_in * to / from, out_offset, 2);
+
+	/* Frames at the start of each chunk are copied from the first input
+	 * frame, so compare against the ramp at the position the resampler
+	 * steps through rather than the ideal one. */
+	for (i = 1; i < out_offset - 1; i++) {
+		double pos = (double)i * from / to;
+		for (ch = 0; ch < num_channels; ch++) {
+			double expected = pos * (ch + 1) * 7;
+			EXPECT_NEAR(expected, out[i * num_channels + ch],
+				    tolerance + (ch + 1) * 7);
+		}
+	}
+
+	linear_resampler_destroy(lr);
+}
+
+TEST(LinearResampler, RampS16) {
+	ResampleRampInChunks<int16_t>(SND_PCM_FORMAT_S16_LE, 48000, 48100, 1);
+	ResampleRampInChunks<int16_t>(SND_PCM_FORMAT_S16_LE, 44100, 48000, 1);
+	ResampleRampInChunks<int16_t>(SND_PCM_FORMAT_S16_LE, 48000, 47900, 1);
+}
+
+TEST(LinearResampler, RampS32) {
+	ResampleRampInChunks<int32_t>(SND_PCM_FORMAT_S32_LE, 48000, 48100, 1);
+	ResampleRampInChunks<int32_t>(SND_PCM_FORMAT_S32_LE, 48000, 47900, 1);
+}
+
+TEST(LinearResampler, RampFloat) {
+	ResampleRampInChunks<float>(SND_PCM_FORMAT_FLOAT_LE, 48000, 48100,
+				    0.01);
+	ResampleRampInChunks<float>(SND_PCM_FORMAT_FLOAT_LE, 48000, 47900,
+				    0.01);
+}
+
+TEST(LinearResampler, InterpolateS16Exact) {
+	int16_t in[4] = { 0, -1000, 1000, 0 };
+	int16_t out[8];
+	unsigned int count = 2;
+	unsigned int rc;
+	struct linear_resampler *lr;
+
+	/* Rate 1 -> 4, output frames fall on quarters of the input. */
+	lr = linear_resampler_create(2, SND_PCM_FORMAT_S16_LE, 1, 4);
+	rc = linear_resampler_resample(lr, (uint8_t *)in, &count,
+				       (uint8_t *)out, 4);
+	EXPECT_EQ(4, rc);
+	EXPECT_EQ(2, count);
+	EXPECT_EQ(0, out[0]);
+	EXPECT_EQ(-1000, out[1]);
+	EXPECT_EQ(250, out[2]);
+	EXPECT_EQ(-750, out[3]);
+	EXPECT_EQ(500, out[4]);
+	EXPECT_EQ(-500, out[5]);
+	EXPECT_EQ(750, out[6]);
+	EXPECT_EQ(-250, out[7]);
+	linear_resampler_destroy(lr);
+}
+
+TEST(LinearResampler, InterpolateS32FullScale) {
+	int32_t in[2] = { INT32_MIN, INT32_MAX };
+	int32_t out[2];
+	unsigned int count = 2;
+	unsigned int rc;
+	struct linear_resampler *lr;
+
+	lr = linear_resampler_create(1, SND_PCM_FORMAT_S32_LE, 1, 2);
+	rc = linear_resampler_resample(lr, (uint8_t *)in, &count,
+				       (uint8_t *)out, 2);
+	EXPECT_EQ(2, rc);
+	EXPECT_EQ(INT32_MIN, out[0]);
+	EXPECT_EQ(0, out[1]);
+	linear_resampler_destroy(lr);
+}
+
+TEST(LinearResampler, CubicMatchesLinearOnRamp) {
+	const unsigned int frames = 200;
+	float in[frames];
+	float out_linear[2 * frames];
+	float out_cubic[2 * frames];
+	unsigned int count, rc_linear, rc_cubic, i;
+	struct linear_resampler *linear, *cubic;
+
+	for (i = 0; i < frames; i++)
+		in[i] = i * 0.001f;
+
+	linear = linear_resampler_create(1, SND_PCM_FORMAT_FLOAT_LE,
+					 48000, 48100);
+	cubic = linear_resampler_create(1, SND_PCM_FORMAT_FLOAT_LE,
+					48000, 48100);
+	EXPECT_EQ(0, linear_resampler_set_interp(
+			cubic, LINEAR_RESAMPLER_INTERP_CUBIC));
+
+	count = frames;
+	rc_linear = linear_resampler_resample(linear, (uint8_t *)in, &count,
+					      (uint8_t *)out_linear,
+					      2 * frames);
+	count = frames;
+	rc_cubic = linear_resampler_resample(cubic, (uint8_t *)in, &count,
+					     (uint8_t *)out_cubic,
+					     2 * frames);
+	ASSERT_EQ(rc_linear, rc_cubic);
+
+	/* Cubic interpolation reproduces a straight line, away from the edges
+	 * where the taps are clamped. Its phase is quantized to 1/256th of a
+	 * frame. */
+	for (i = 2; i < rc_cubic - 3; i++)
+		EXPECT_NEAR(out_linear[i], out_cubic[i], 0.001f / 256);
+
+	linear_resampler_destroy(linear);
+	linear_resampler_destroy(cubic);
+}
+
+TEST(LinearResampler, CubicS16Clips) {
+	int16_t in[4] = { 0, INT16_MAX, INT16_MAX, 0 };
+	int16_t out[8];
+	unsigned int count = 4;
+	unsigned int rc, i;
+	struct linear_resampler *lr;
+
+	lr = linear_resampler_create(1, SND_PCM_FORMAT_S16_LE, 1, 2);
+	EXPECT_EQ(0, linear_resampler_set_interp(
+			lr, LINEAR_RESAMPLER_INTERP_CUBIC));
+	rc = linear_resampler_resample(lr, (uint8_t *)in, &count,
+				       (uint8_t *)out, 8);
+	EXPECT_EQ(7, rc);
+	EXPECT_EQ(INT16_MAX, out[2]);
+	EXPECT_EQ(INT16_MAX, out[3]);
+	for (i = 0; i < rc; i++)
+		EXPECT_GE(out[i], 0);
+	linear_resampler_destroy(lr);
+}
+
 extern "C" {
 
 void cras_mix_add_scale_stride(int fmt, uint8_t *dst, uint8_t *src,
@@ -4,10 +4,12 @@
 
 #include <stdio.h>
 #include <gtest/gtest.h>
+#include <vector>
 
 extern "C" {
 #include "cras_shm.h"
 #include "cras_mix.h"
+#include "cras_mix_ops.h"
 #include "cras_types.h"
 
 }
@@ -1091,6 +1093,301 @@ TEST_F(MixTestSuiteS24_3LE, StrideCopy) {
   TestScaleStride(0.1);
 }
 
+/* Runs the SIMD builds of the mix ops that this CPU supports against the
+ * plain C ops and checks the results are bit-exact. */
+class MixOpsBitExactTest : public testing::Test {
+  protected:
+    static const size_t kSamples = 4099;
+
+    virtual void SetUp() {
+#if defined HAVE_SSE42
+      if (__builtin_cpu_supports("sse4.2"))
+        simd_ops_.push_back(&mixer_ops_sse42);
+#endif
+#if defined HAVE_AVX
+      if (__builtin_cpu_supports("avx"))
+        simd_ops_.push_back(&mixer_ops_avx);
+#endif
+#if defined HAVE_AVX2
+      if (__builtin_cpu_supports("avx2"))
+        simd_ops_.push_back(&mixer_ops_avx2);
+#endif
+#if defined HAVE_FMA
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        simd_ops_.push_back(&mixer_ops_fma);
+#endif
+      srand(0x5eed);
+    }
+
+    void SetupFormat(snd_pcm_format_t fmt) {
+      fmt_ = fmt;
+      sample_bytes_ = fmt == SND_PCM_FORMAT_S24_3LE ? 3 :
+          snd_pcm_format_physical_width(fmt) / 8;
+      /* Twice the samples so strided mixing can cover all of them. */
+      size_t bytes = 2 * kSamples * sample_bytes_;
+      src_.resize(bytes);
+      dst_.resize(bytes);
+      FillRandom(&src_);
+      FillRandom(&dst_);
+      ref_ = dst_;
+      out_ = dst_;
+    }
+
+    void FillRandom(std::vector<uint8_t> *buf) {
+      for (size_t i = 0; i < buf->size(); i++)
+        (*buf)[i] = rand();
+      /* Keep S24_LE samples within 24 bits, sign extended. */
+      if (fmt_ == SND_PCM_FORMAT_S24_LE) {
+        int32_t *samples = (int32_t *)&(*buf)[0];
+        for (size_t i = 0; i < buf->size() / 4; i++)
+          samples[i] = (int32_t)((uint32_t)samples[i] << 8) >> 8;
+      }
+    }
+
+    void ResetOutput() {
+      ref_ = dst_;
+      out_ = dst_;
+    }
+
+    void ExpectSameOutput(const char *op, float scaler) {
+      EXPECT_EQ(0, memcmp(&ref_[0], &out_[0], ref_.size()))
+          << op << " format " << fmt_ << " scaler " << scaler;
+    }
+
+    void CheckAllOps() {
+      static const float kVolumes[] = {
+          1.0f, 0.9999999f, 0.99999994f, 0.75f, 0.5f, 0.1234f, 0.0f };
+      static const struct {
+        float scaler, increment;
+        int step;
+      } kRamps[] = {
+          { 0.2f, 0.0013f, 2 }, { 0.99f, 0.0001f, 2 },
+          { 0.1f, -0.0007f, 2 }, { 0.5f, 0.00037f, 1 },
+          { 0.3f, 0.0011f, 6 }, { 0.4f, 0.0021f, 300 } };
+      static const float kStrideScalers[] = {
+          1.0f, 1.005f, 0.5f, 0.1f, 100.0f };
+      const unsigned int s = sample_bytes_;
+      const unsigned int kStrides[][2] = {
+          { s, s }, { 2 * s, 2 * s }, { 2 * s, s }, { 3 * s, 3 * s } };
+
+      for (size_t n = 0; n < simd_ops_.size(); n++) {
+        const struct cras_mix_ops *ops = simd_ops_[n];
+
+        for (size_t v = 0; v < ARRAY_SIZE(kVolumes); v++) {
+          for (unsigned int index = 0; index < 2; index++) {
+            ResetOutput();
+            mixer_ops.add(fmt_, &ref_[0], &src_[0], kSamples, index, 0,
+                          kVolumes[v]);
+            ops->add(fmt_, &out_[0], &src_[0], kSamples, index, 0,
+                     kVolumes[v]);
+            ExpectSameOutput("add", kVolumes[v]);
+          }
+
+          ResetOutput();
+          mixer_ops.scale_buffer(fmt_, &ref_[0], kSamples, kVolumes[v]);
+          ops->scale_buffer(fmt_, &out_[0], kSamples, kVolumes[v]);
+          ExpectSameOutput("scale_buffer", kVolumes[v]);
+        }
+
+        for (size_t r = 0; r < ARRAY_SIZE(kRamps); r++) {
+          ResetOutput();
+          mixer_ops.scale_buffer_increment(fmt_, &ref_[0], kSamples,
+                                           kRamps[r].scaler,
+                                           kRamps[r].increment,
+                                           kRamps[r].step);
+          ops->scale_buffer_increment(fmt_, &out_[0], kSamples,
+                                      kRamps[r].scaler, kRamps[r].increment,
+                                      kRamps[r].step);
+          ExpectSameOutput("scale_buffer_increment", kRamps[r].scaler);
+        }
+
+        for (size_t sc = 0; sc < ARRAY_SIZE(kStrideScalers); sc++) {
+          for (size_t st = 0; st < ARRAY_SIZE(kStrides); st++) {
+            unsigned int count = kSamples * s / kStrides[st][0];
+            ResetOutput();
+            mixer_ops.add_scale_stride(fmt_, &ref_[0], &src_[0], count,
+                                       kStrides[st][0], kStrides[st][1],
+                                       kStrideScalers[sc]);
+            ops->add_scale_stride(fmt_, &out_[0], &src_[0], count,
+                                  kStrides[st][0], kStrides[st][1],
+                                  kStrideScalers[sc]);
+#if defined HAVE_FMA
+            /* The FMA build lets the compiler fuse the multiply and add of
+             * the scaled stride mix, rounding once instead of twice, so only
+             * its unscaled mix is expected to match. */
+            if (ops == &mixer_ops_fma && need_to_scale(kStrideScalers[sc]))
+              continue;
+#endif
+            ExpectSameOutput("add_scale_stride", kStrideScalers[sc]);
+          }
+        }
+      }
+    }
+
+    /* Mixes the second channel of exactly sized interleaved stereo
+     * buffers, so nothing may be touched past the last frame. */
+    void CheckStereoSecondChannel() {
+      static const float kStrideScalers[] = { 1.0f, 0.5f };
+      const unsigned int s = sample_bytes_;
+      /* A whole number of vectors, so the last one would end on the
+       * sample past the buffer. */
+      const unsigned int frames = 32;
+      const size_t bytes = 2 * frames * s;
+
+      for (size_t n = 0; n < simd_ops_.size(); n++) {
+        const struct cras_mix_ops *ops = simd_ops_[n];
+
+        for (size_t sc = 0; sc < ARRAY_SIZE(kStrideScalers); sc++) {
+          std::vector<uint8_t> src(src_.begin(), src_.begin() + bytes);
+          std::vector<uint8_t> ref(dst_.begin(), dst_.begin() + bytes);
+          std::vector<uint8_t> out(ref);
+
+          mixer_ops.add_scale_stride(fmt_, &ref[s], &src[s], frames, 2 * s,
+                                     2 * s, kStrideScalers[sc]);
+          ops->add_scale_stride(fmt_, &out[s], &src[s], frames, 2 * s, 2 * s,
+                                kStrideScalers[sc]);
+#if defined HAVE_FMA
+          if (ops == &mixer_ops_fma && need_to_scale(kStrideScalers[sc]))
+            continue;
+#endif
+          EXPECT_EQ(0, memcmp(&ref[0], &out[0], ref.size()))
+              << "format " << fmt_ << " scaler " << kStrideScalers[sc];
+        }
+      }
+    }
+
+    std::vector<const struct cras_mix_ops *> simd_ops_;
+    snd_pcm_format_t fmt_;
+    unsigned int sample_bytes_;
+    std::vector<uint8_t> src_;
+    std::vector<uint8_t> dst_;
+    std::vector<uint8_t> ref_;
+    std::vector<uint8_t> out_;
+};
+
+TEST_F(MixOpsBitExactTest, S16_LE) {
+  SetupFormat(SND_PCM_FORMAT_S16_LE);
+  CheckAllOps();
+}
+
+TEST_F(MixOpsBitExactTest, S24_LE) {
+  SetupFormat(SND_PCM_FORMAT_S24_LE);
+  CheckAllOps();
+}
+
+TEST_F(MixOpsBitExactTest, S32_LE) {
+  SetupFormat(SND_PCM_FORMAT_S32_LE);
+  CheckAllOps();
+}
+
+TEST_F(MixOpsBitExactTest, S24_3LE) {
+  SetupFormat(SND_PCM_FORMAT_S24_3LE);
+  CheckAllOps();
+}
+
+TEST_F(MixOpsBitExactTest, StereoSecondChannel) {
+  SetupFormat(SND_PCM_FORMAT_S16_LE);
+  CheckStereoSecondChannel();
+  SetupFormat(SND_PCM_FORMAT_S32_LE);
+  CheckStereoSecondChannel();
+}
+
+TEST(MixFloatBus, AddDoesNotClip) {
+  const int16_t src[4] = { 0x7fff, -0x8000, 0x4000, 0 };
+  float dst[4] = { 0.5f, -0.5f, 0, 0.25f };
+
+  cras_mix_add_float(SND_PCM_FORMAT_S16_LE, dst, (uint8_t *)src, 4, 0, 1.0f);
+  EXPECT_FLOAT_EQ(0.5f + 32767.0f / 32768.0f, dst[0]);
+  EXPECT_FLOAT_EQ(-1.5f, dst[1]);
+  EXPECT_FLOAT_EQ(0.5f, dst[2]);
+  EXPECT_FLOAT_EQ(0.25f, dst[3]);
+
+  // Muted and zero volume streams add nothing.
+  cras_mix_add_float(SND_PCM_FORMAT_S16_LE, dst, (uint8_t *)src, 4, 1, 1.0f);
+  cras_mix_add_float(SND_PCM_FORMAT_S16_LE, dst, (uint8_t *)src, 4, 0, 0.0f);
+  EXPECT_FLOAT_EQ(-1.5f, dst[1]);
+
+  cras_mix_add_float(SND_PCM_FORMAT_S16_LE, dst, (uint8_t *)src, 4, 0, 0.5f);
+  EXPECT_FLOAT_EQ(0.75f, dst[2]);
+}
+
+TEST(MixFloatBus, AddS24LESignExtends) {
+  const int32_t src[2] = { 0x00800000, 0x7f400000 };
+  float dst[2] = { 0, 0 };
+
+  cras_mix_add_float(SND_PCM_FORMAT_S24_LE, dst, (uint8_t *)src, 2, 0, 1.0f);
+  EXPECT_FLOAT_EQ(-1.0f, dst[0]);
+  EXPECT_FLOAT_EQ(0.5f, dst[1]);
+}
+
+TEST(MixFloatBus, QuantizeRoundsAndClips) {
+  const float src[5] = { 1.5f, -1.5f, 0.5f, -0.5f, 1.4f / 32768.0f };
+  int16_t s16[5];
+  int32_t s32[5];
+  uint8_t s243[5 * 3];
+  int32_t sample;
+
+  cras_mix_quantize_float(SND_PCM_FORMAT_S16_LE, (uint8_t *)s16, src, 5);
+  EXPECT_EQ(32767, s16[0]);
+  EXPECT_EQ(-32768, s16[1]);
+  EXPECT_EQ(16384, s16[2]);
+  EXPECT_EQ(-16384, s16[3]);
+  EXPECT_EQ(1, s16[4]);
+
+  cras_mix_quantize_float(SND_PCM_FORMAT_S24_LE, (uint8_t *)s32, src, 5);
+  EXPECT_EQ(0x7fffff, s32[0]);
+  EXPECT_EQ(-0x800000, s32[1]);
+  EXPECT_EQ(0x400000, s32[2]);
+
+  cras_mix_quantize_float(SND_PCM_FORMAT_S32_LE, (uint8_t *)s32, src, 5);
+  EXPECT_EQ(INT32_MAX, s32[0]);
+  EXPECT_EQ(INT32_MIN, s32[1]);
+  EXPECT_EQ(0x40000000, s32[2]);
+  EXPECT_EQ(-0x40000000, s32[3]);
+
+  cras_mix_quantize_float(SND_PCM_FORMAT_S24_3LE, s243, src, 5);
+  sample = 0;
+  memcpy((uint8_t *)&sample + 1, s243, 3);
+  EXPECT_EQ(0x7fffff00, sample);
+  memcpy((uint8_t *)&sample + 1, s243 + 9, 3);
+  EXPECT_EQ(-0x40000000, sample);
+}
+
+TEST(MixFloatBus, RoundTripIsLossless) {
+  const unsigned int count = 1000;
+  int16_t src[count];
+  int16_t out[count];
+  float bus[count];
+
+  for (unsigned int i = 0; i < count; i++)
+    src[i] = (i * 131 - 32768 + i * i) & 0xffff;
+  memset(bus, 0, sizeof(bus));
+  cras_mix_add_float(SND_PCM_FORMAT_S16_LE, bus, (uint8_t *)src, count, 0,
+                     1.0f);
+  cras_mix_quantize_float(SND_PCM_FORMAT_S16_LE, (uint8_t *)out, bus, count);
+  EXPECT_EQ(0, memcmp(src, out, sizeof(src)));
+}
+
+TEST(MixFloatBus, Scale) {
+  float buf[6] = { 1, 1, 1, 1, 1, 1 };
+
+  cras_scale_float_buffer(buf, 6, 0.5f);
+  EXPECT_FLOAT_EQ(0.5f, buf[5]);
+  cras_scale_float_buffer(buf, 6, 1.0f);
+  EXPECT_FLOAT_EQ(0.5f, buf[5]);
+  cras_scale_float_buffer(buf, 6, 0.0f);
+  EXPECT_FLOAT_EQ(0.0f, buf[5]);
+
+  for (unsigned int i = 0; i < 6; i++)
+    buf[i] = 1;
+  // Three stereo frames ramping from 0.25 by 0.25 per frame.
+  cras_scale_float_buffer_increment(buf, 3, 0.25f, 0.25f, 2);
+  EXPECT_FLOAT_EQ(0.25f, buf[0]);
+  EXPECT_FLOAT_EQ(0.25f, buf[1]);
+  EXPECT_FLOAT_EQ(0.5f, buf[2]);
+  EXPECT_FLOAT_EQ(0.75f, buf[5]);
+}
+
 /* Stubs */
 extern "C" {
 
@@ -215,10 +215,14 @@ class ObserverTest : public testing::Test {
               cras_alert_create_flags_map[g_observer->alerts.active_node]);
     EXPECT_EQ(reinterpret_cast<void *>(output_node_volume_alert),
             cras_alert_add_callback_map[g_observer->alerts.output_node_volume]);
+    EXPECT_EQ(CRAS_ALERT_FLAG_KEEP_ALL_DATA,
+        cras_alert_create_flags_map[g_observer->alerts.output_node_volume]);
     EXPECT_EQ(reinterpret_cast<void *>(node_left_right_swapped_alert),
        cras_alert_add_callback_map[g_observer->alerts.node_left_right_swapped]);
     EXPECT_EQ(reinterpret_cast<void *>(input_node_gain_alert),
             cras_alert_add_callback_map[g_observer->alerts.input_node_gain]);
+    EXPECT_EQ(CRAS_ALERT_FLAG_KEEP_ALL_DATA,
+        cras_alert_create_flags_map[g_observer->alerts.input_node_gain]);
     EXPECT_EQ(reinterpret_cast<void *>(num_active_streams_alert),
        cras_alert_add_callback_map[g_observer->alerts.num_active_streams[
                                                CRAS_STREAM_OUTPUT]]);
@@ -592,6 +596,9 @@ int cras_alert_add_callback(struct cras_alert *alert, cras_alert_cb cb,
   return 0;
 }
 
+void cras_alert_set_min_interval(struct cras_alert *alert, unsigned int ms) {
+}
+
 void cras_alert_pending(struct cras_alert *alert) {
   cras_alert_pending_alert_value = alert;
 }
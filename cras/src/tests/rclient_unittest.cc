@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <gtest/gtest.h>
 #include <unistd.h>
@@ -39,10 +40,15 @@ static size_t cras_make_fd_nonblocking_called;
 static audio_thread* iodev_get_thread_return;
 static int stream_list_add_stream_return;
 static unsigned int stream_list_add_stream_called;
+static uint32_t stream_list_add_proto_version;
+static int stream_list_attach_stream_return;
+static unsigned int stream_list_attach_stream_called;
 static unsigned int stream_list_disconnect_stream_called;
 static unsigned int cras_iodev_list_rm_input_called;
 static unsigned int cras_iodev_list_rm_output_called;
 static struct cras_rstream dummy_rstream;
+static unsigned int cras_send_with_fds_num_fds;
+static int cras_send_with_fds_fds[4];
 static size_t cras_observer_num_ops_registered;
 static size_t cras_observer_register_notify_called;
 static size_t cras_observer_add_called;
@@ -77,6 +83,9 @@ void ResetStubData() {
   iodev_get_thread_return = reinterpret_cast<audio_thread*>(0xad);
   stream_list_add_stream_return = 0;
   stream_list_add_stream_called = 0;
+  stream_list_add_proto_version = 0;
+  stream_list_attach_stream_return = 0;
+  stream_list_attach_stream_called = 0;
   stream_list_disconnect_stream_called = 0;
   cras_iodev_list_rm_output_called = 0;
   cras_iodev_list_rm_input_called = 0;
@@ -93,6 +102,7 @@ void ResetStubData() {
   memset(&cras_observer_ops_are_empty_empty_ops, 0,
          sizeof(cras_observer_ops_are_empty_empty_ops));
   cras_observer_remove_called = 0;
+  cras_send_with_fds_num_fds = 0;
 }
 
 namespace {
@@ -139,6 +149,7 @@ class RClientMessagesSuite : public testing::Test {
       stream_id_ = 0x10002;
       connect_msg_.header.id = CRAS_SERVER_CONNECT_STREAM;
       connect_msg_.header.length = sizeof(connect_msg_);
+      connect_msg_.proto_version = CRAS_PROTO_VER;
       connect_msg_.stream_type = CRAS_STREAM_TYPE_DEFAULT;
       connect_msg_.direction = CRAS_STREAM_OUTPUT;
       connect_msg_.stream_id = stream_id_;
@@ -170,7 +181,7 @@ class RClientMessagesSuite : public testing::Test {
     int pipe_fds_[2];
 };
 
-TEST_F(RClientMessagesSuite, AudThreadAttachFail) {
+TEST_F(RClientMessagesSuite, StreamCreateFail) {
   struct cras_client_stream_connected out_msg;
   int rc;
 
@@ -187,6 +198,58 @@ TEST_F(RClientMessagesSuite, AudThreadAttachFail) {
   EXPECT_EQ(0, cras_iodev_list_rm_output_called);
   EXPECT_EQ(1, stream_list_add_stream_called);
   EXPECT_EQ(0, stream_list_disconnect_stream_called);
+
+  cras_rclient_attach_pending_streams();
+  EXPECT_EQ(0, stream_list_attach_stream_called);
+}
+
+TEST_F(RClientMessagesSuite, AudThreadAttachFail) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  cras_rstream_create_stream_out = rstream_;
+  stream_list_attach_stream_return = -EINVAL;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, 100);
+  EXPECT_EQ(0, rc);
+
+  // The shm is sent before the stream is attached.
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(stream_id_, out_msg.stream_id);
+  EXPECT_EQ(0, out_msg.err);
+  EXPECT_EQ(0, stream_list_attach_stream_called);
+
+  cras_rclient_attach_pending_streams();
+  EXPECT_EQ(1, stream_list_attach_stream_called);
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(stream_id_, out_msg.stream_id);
+  EXPECT_EQ(-EINVAL, out_msg.err);
+  EXPECT_EQ(0, cras_iodev_list_rm_output_called);
+  EXPECT_EQ(1, stream_list_add_stream_called);
+  EXPECT_EQ(0, stream_list_disconnect_stream_called);
+}
+
+TEST_F(RClientMessagesSuite, StreamRemovedBeforeAttach) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  cras_rstream_create_stream_out = rstream_;
+  stream_list_attach_stream_return = -ENOENT;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, 100);
+  EXPECT_EQ(0, rc);
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(0, out_msg.err);
+
+  // Nothing to report for a stream the client already removed.
+  cras_rclient_attach_pending_streams();
+  EXPECT_EQ(1, stream_list_attach_stream_called);
+  fcntl(pipe_fds_[0], F_SETFL, O_NONBLOCK);
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(-1, rc);
 }
 
 TEST_F(RClientMessagesSuite, ConnectMsgWithBadFd) {
@@ -204,6 +267,58 @@ TEST_F(RClientMessagesSuite, ConnectMsgWithBadFd) {
             stream_list_disconnect_stream_called);
 }
 
+TEST_F(RClientMessagesSuite, ConnectMsgWithBadProtoVersion) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  cras_rstream_create_stream_out = rstream_;
+  connect_msg_.proto_version = CRAS_PROTO_VER + 1;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, 100);
+  EXPECT_EQ(0, rc);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(stream_id_, out_msg.stream_id);
+  EXPECT_EQ(-EINVAL, out_msg.err);
+  EXPECT_EQ(0, stream_list_add_stream_called);
+}
+
+TEST_F(RClientMessagesSuite, ConnectMsgWithProtoVersion1) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  cras_rstream_create_stream_out = rstream_;
+  connect_msg_.proto_version = 1;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, 100);
+  EXPECT_EQ(0, rc);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(stream_id_, out_msg.stream_id);
+  EXPECT_EQ(0, out_msg.err);
+  EXPECT_EQ(1, stream_list_add_stream_called);
+  EXPECT_EQ(1, stream_list_add_proto_version);
+}
+
+TEST_F(RClientMessagesSuite, ConnectMsgWithProtoVersion1AndDoorbell) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  cras_rstream_create_stream_out = rstream_;
+  connect_msg_.proto_version = 1;
+  connect_msg_.flags |= SHM_DOORBELL;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, 100);
+  EXPECT_EQ(0, rc);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(-EINVAL, out_msg.err);
+  EXPECT_EQ(0, stream_list_add_stream_called);
+}
+
 TEST_F(RClientMessagesSuite, SuccessReply) {
   struct cras_client_stream_connected out_msg;
   int rc;
@@ -221,6 +336,28 @@ TEST_F(RClientMessagesSuite, SuccessReply) {
   EXPECT_EQ(0, out_msg.err);
   EXPECT_EQ(1, stream_list_add_stream_called);
   EXPECT_EQ(0, stream_list_disconnect_stream_called);
+  EXPECT_EQ(2, cras_send_with_fds_num_fds);
+
+  cras_rclient_attach_pending_streams();
+  EXPECT_EQ(1, stream_list_attach_stream_called);
+}
+
+TEST_F(RClientMessagesSuite, SuccessReplyWithDoorbell) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  cras_rstream_create_stream_out = rstream_;
+  connect_msg_.flags = SHM_DOORBELL;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, 100);
+  EXPECT_EQ(0, rc);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(0, out_msg.err);
+  ASSERT_EQ(4, cras_send_with_fds_num_fds);
+  EXPECT_EQ(200, cras_send_with_fds_fds[2]);
+  EXPECT_EQ(201, cras_send_with_fds_fds[3]);
 }
 
 TEST_F(RClientMessagesSuite, SuccessCreateThreadReply) {
@@ -324,6 +461,43 @@ TEST_F(RClientMessagesSuite, SetCaptureMute) {
   EXPECT_EQ(1, cras_system_set_capture_mute_locked_value);
 }
 
+TEST(RClientSuite, SupersededSetters) {
+  struct cras_set_system_volume vol1, vol2;
+  struct cras_set_system_mute mute1, mute2;
+  struct cras_set_node_attr attr1, attr2;
+
+  cras_fill_set_system_volume(&vol1, 10);
+  cras_fill_set_system_volume(&vol2, 20);
+  EXPECT_EQ(1, cras_rclient_message_superseded(&vol1.header, &vol2.header));
+  // A truncated message is never dropped.
+  vol1.header.length--;
+  vol2.header.length--;
+  EXPECT_EQ(0, cras_rclient_message_superseded(&vol1.header, &vol2.header));
+
+  // Mute has locked variants, every message is handled.
+  cras_fill_set_system_mute(&mute1, 1);
+  cras_fill_set_system_mute(&mute2, 0);
+  EXPECT_EQ(0, cras_rclient_message_superseded(&mute1.header,
+                                               &mute2.header));
+
+  cras_fill_set_node_attr(&attr1, 0x100000001, IONODE_ATTR_VOLUME, 30);
+  cras_fill_set_node_attr(&attr2, 0x100000001, IONODE_ATTR_VOLUME, 40);
+  EXPECT_EQ(1, cras_rclient_message_superseded(&attr1.header,
+                                               &attr2.header));
+  attr2.node_id = 0x100000002;
+  EXPECT_EQ(0, cras_rclient_message_superseded(&attr1.header,
+                                               &attr2.header));
+  cras_fill_set_node_attr(&attr2, 0x100000001, IONODE_ATTR_CAPTURE_GAIN, 40);
+  EXPECT_EQ(0, cras_rclient_message_superseded(&attr1.header,
+                                               &attr2.header));
+  cras_fill_set_node_attr(&attr1, 0x100000001, IONODE_ATTR_PLUGGED, 1);
+  cras_fill_set_node_attr(&attr2, 0x100000001, IONODE_ATTR_PLUGGED, 0);
+  EXPECT_EQ(0, cras_rclient_message_superseded(&attr1.header,
+                                               &attr2.header));
+  EXPECT_EQ(0, cras_rclient_message_superseded(&attr1.header,
+                                               &vol2.header));
+}
+
 void RClientMessagesSuite::RegisterNotification(
     enum CRAS_CLIENT_MESSAGE_ID msg_id,
     void *callback, void **ops_address) {
@@ -464,6 +638,7 @@ TEST_F(RClientMessagesSuite, SendOutputVolumeChanged) {
   const int32_t volume = 90;
 
   send_output_volume_changed(void_client, volume);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_OUTPUT_VOLUME_CHANGED);
@@ -481,6 +656,7 @@ TEST_F(RClientMessagesSuite, SendOutputMuteChanged) {
   const int mute_locked = 1;
 
   send_output_mute_changed(void_client, muted, user_muted, mute_locked);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_OUTPUT_MUTE_CHANGED);
@@ -498,6 +674,7 @@ TEST_F(RClientMessagesSuite, SendCaptureGainChanged) {
   const int32_t gain = 90;
 
   send_capture_gain_changed(void_client, gain);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_CAPTURE_GAIN_CHANGED);
@@ -514,6 +691,7 @@ TEST_F(RClientMessagesSuite, SendCaptureMuteChanged) {
   const int mute_locked = 0;
 
   send_capture_mute_changed(void_client, muted, mute_locked);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_CAPTURE_MUTE_CHANGED);
@@ -529,6 +707,7 @@ TEST_F(RClientMessagesSuite, SendNodesChanged) {
       (struct cras_client_nodes_changed *)buf;
 
   send_nodes_changed(void_client);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_NODES_CHANGED);
@@ -544,6 +723,7 @@ TEST_F(RClientMessagesSuite, SendActiveNodeChanged) {
   const cras_node_id_t node_id = 0x0001000200030004;
 
   send_active_node_changed(void_client, dir, node_id);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_ACTIVE_NODE_CHANGED);
@@ -561,6 +741,7 @@ TEST_F(RClientMessagesSuite, SendOutputNodeVolumeChanged) {
   const int32_t value = 90;
 
   send_output_node_volume_changed(void_client, node_id, value);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_OUTPUT_NODE_VOLUME_CHANGED);
@@ -578,6 +759,7 @@ TEST_F(RClientMessagesSuite, SendNodeLeftRightSwappedChanged) {
   const int32_t value = 0;
 
   send_node_left_right_swapped_changed(void_client, node_id, value);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_NODE_LEFT_RIGHT_SWAPPED_CHANGED);
@@ -595,6 +777,7 @@ TEST_F(RClientMessagesSuite, SendNodeInputNodeGainChanged) {
   const int32_t value = -19;
 
   send_input_node_gain_changed(void_client, node_id, value);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_INPUT_NODE_GAIN_CHANGED);
@@ -612,6 +795,7 @@ TEST_F(RClientMessagesSuite, SendNumActiveStreamsChanged) {
   const uint32_t num_active_streams = 3;
 
   send_num_active_streams_changed(void_client, dir, num_active_streams);
+  cras_rclient_flush_notifications();
   rc = read(pipe_fds_[0], buf, sizeof(buf));
   ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
   EXPECT_EQ(msg->header.id, CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED);
@@ -619,6 +803,76 @@ TEST_F(RClientMessagesSuite, SendNumActiveStreamsChanged) {
   EXPECT_EQ(msg->num_active_streams, num_active_streams);
 }
 
+TEST_F(RClientMessagesSuite, CoalesceAndBatchNotifications) {
+  void *void_client = reinterpret_cast<void *>(rclient_);
+  struct cras_register_notification reg;
+  uint8_t buf[CRAS_CLIENT_MAX_MSG_SIZE];
+  struct cras_client_notifications *batch =
+      (struct cras_client_notifications *)buf;
+  struct cras_client_volume_changed *vol;
+  struct cras_client_node_value_changed *node;
+  struct cras_client_nodes_changed *nodes;
+  const cras_node_id_t node_id = 0x0001000200030004;
+  ssize_t rc;
+
+  /* Without batching, the latest volume goes out alone. */
+  send_output_volume_changed(void_client, 10);
+  send_output_volume_changed(void_client, 20);
+  cras_rclient_flush_notifications();
+  rc = read(pipe_fds_[0], buf, sizeof(buf));
+  vol = (struct cras_client_volume_changed *)buf;
+  ASSERT_EQ(rc, (ssize_t)sizeof(*vol));
+  EXPECT_EQ(vol->header.id, CRAS_CLIENT_OUTPUT_VOLUME_CHANGED);
+  EXPECT_EQ(vol->volume, 20);
+
+  cras_fill_register_notification_message(&reg, CRAS_CLIENT_NOTIFICATIONS, 1);
+  rc = cras_rclient_message_from_client(rclient_, &reg.header, -1);
+  EXPECT_EQ(0, rc);
+
+  send_output_volume_changed(void_client, 30);
+  send_output_node_volume_changed(void_client, node_id, 40);
+  send_nodes_changed(void_client);
+  send_output_volume_changed(void_client, 50);
+  send_output_node_volume_changed(void_client, node_id, 60);
+  cras_rclient_flush_notifications();
+
+  rc = read(pipe_fds_[0], buf, sizeof(buf));
+  ASSERT_EQ(rc, (ssize_t)(sizeof(*batch) + sizeof(*nodes) + sizeof(*vol) +
+                          sizeof(*node)));
+  EXPECT_EQ(batch->header.id, CRAS_CLIENT_NOTIFICATIONS);
+  EXPECT_EQ(batch->header.length, rc);
+
+  /* The replaced values move to the end, after the nodes change. */
+  nodes = (struct cras_client_nodes_changed *)batch->msgs;
+  EXPECT_EQ(nodes->header.id, CRAS_CLIENT_NODES_CHANGED);
+  vol = (struct cras_client_volume_changed *)(nodes + 1);
+  EXPECT_EQ(vol->header.id, CRAS_CLIENT_OUTPUT_VOLUME_CHANGED);
+  EXPECT_EQ(vol->volume, 50);
+  node = (struct cras_client_node_value_changed *)(vol + 1);
+  EXPECT_EQ(node->header.id, CRAS_CLIENT_OUTPUT_NODE_VOLUME_CHANGED);
+  EXPECT_EQ(node->node_id, node_id);
+  EXPECT_EQ(node->value, 60);
+}
+
+TEST_F(RClientMessagesSuite, ActiveNodeChangesAreNotCoalesced) {
+  void *void_client = reinterpret_cast<void *>(rclient_);
+  uint8_t buf[CRAS_CLIENT_MAX_MSG_SIZE];
+  struct cras_client_active_node_changed *msg =
+      (struct cras_client_active_node_changed *)buf;
+  ssize_t rc;
+
+  send_active_node_changed(void_client, CRAS_STREAM_OUTPUT, 1);
+  send_active_node_changed(void_client, CRAS_STREAM_OUTPUT, 2);
+  cras_rclient_flush_notifications();
+
+  rc = read(pipe_fds_[0], buf, sizeof(*msg));
+  ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
+  EXPECT_EQ(msg->node_id, 1);
+  rc = read(pipe_fds_[0], buf, sizeof(*msg));
+  ASSERT_EQ(rc, (ssize_t)sizeof(*msg));
+  EXPECT_EQ(msg->node_id, 2);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
@@ -778,6 +1032,19 @@ void cras_dsp_dump_info()
 {
 }
 
+void cras_dsp_get_debug_info(struct dsp_debug_info *info)
+{
+}
+
+void cras_iodev_list_get_latency_info(struct latency_debug_info *info)
+{
+}
+
+int audio_thread_trace_get_fd()
+{
+  return -1;
+}
+
 int cras_iodev_list_set_node_attr(cras_node_id_t id,
 				  enum ionode_attr attr, int value)
 {
@@ -810,25 +1077,35 @@ void cras_iodev_list_configure_global_remix_converter(
 {
 }
 
-int stream_list_add(struct stream_list *list,
-                    struct cras_rstream_config *config,
-		    struct cras_rstream **stream)
+int stream_list_add_pending(struct stream_list *list,
+                            struct cras_rstream_config *config,
+                            struct cras_rstream **stream)
 {
   int ret;
 
   *stream = &dummy_rstream;
 
   stream_list_add_stream_called++;
+  stream_list_add_proto_version = config->proto_version;
   ret = stream_list_add_stream_return;
   if (ret)
     stream_list_add_stream_return = -EINVAL;
 
   dummy_rstream.direction = config->direction;
   dummy_rstream.stream_id = config->stream_id;
+  dummy_rstream.fd = config->audio_fd;
+  dummy_rstream.request_fd = (config->flags & SHM_DOORBELL) ? 200 : -1;
+  dummy_rstream.reply_fd = (config->flags & SHM_DOORBELL) ? 201 : -1;
 
   return ret;
 }
 
+int stream_list_attach_stream(struct stream_list *list, cras_stream_id_t id)
+{
+  stream_list_attach_stream_called++;
+  return stream_list_attach_stream_return;
+}
+
 int stream_list_rm(struct stream_list *list, cras_stream_id_t id)
 {
   stream_list_disconnect_stream_called++;
@@ -844,6 +1121,9 @@ int stream_list_rm_all_client_streams(struct stream_list *list,
 int cras_send_with_fds(int sockfd, const void *buf, size_t len, int *fd,
                        unsigned int num_fds)
 {
+  cras_send_with_fds_num_fds = num_fds;
+  memcpy(cras_send_with_fds_fds, fd,
+         MIN(num_fds, 4) * sizeof(*cras_send_with_fds_fds));
   return write(sockfd, buf, len);
 }
 
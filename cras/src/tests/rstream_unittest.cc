@@ -4,7 +4,9 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <gtest/gtest.h>
 
@@ -13,6 +15,7 @@ extern "C" {
 #include "cras_messages.h"
 #include "cras_rstream.h"
 #include "cras_shm.h"
+#include "cras_shm_v1.h"
 }
 
 namespace {
@@ -34,6 +37,7 @@ class RstreamTestSuite : public testing::Test {
       config_.cb_threshold = 2048;
       config_.audio_fd = 1;
       config_.client = NULL;
+      config_.proto_version = CRAS_PROTO_VER;
     }
 
     static bool format_equal(cras_audio_format *fmt1, cras_audio_format *fmt2) {
@@ -193,6 +197,196 @@ TEST_F(RstreamTestSuite, VerifyStreamTypes) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, DoorbellRequestAndReply) {
+  struct cras_rstream *s;
+  struct timespec now = {0, 0};
+  uint64_t count;
+  int rc, request_fd, reply_fd;
+
+  config_.flags = SHM_DOORBELL;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  request_fd = cras_rstream_get_request_fd(s);
+  reply_fd = cras_rstream_get_audio_reply_fd(s);
+  ASSERT_GE(request_fd, 0);
+  ASSERT_GE(reply_fd, 0);
+  EXPECT_NE(config_.audio_fd, reply_fd);
+
+  // Requests ring the doorbell instead of writing to the socket.
+  EXPECT_EQ(sizeof(count), cras_rstream_request_audio(s, &now));
+  EXPECT_EQ(sizeof(count), cras_rstream_request_audio(s, &now));
+  EXPECT_EQ(sizeof(count), read(request_fd, &count, sizeof(count)));
+  EXPECT_EQ(2, count);
+
+  // No reply yet, then one read consumes every reply signaled.
+  EXPECT_EQ(-EAGAIN, cras_rstream_get_audio_request_reply(s));
+  count = 1;
+  EXPECT_EQ(sizeof(count), write(reply_fd, &count, sizeof(count)));
+  EXPECT_EQ(sizeof(count), write(reply_fd, &count, sizeof(count)));
+  EXPECT_EQ(0, cras_rstream_get_audio_request_reply(s));
+  EXPECT_EQ(-EAGAIN, cras_rstream_get_audio_request_reply(s));
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, NoDoorbellByDefault) {
+  struct cras_rstream *s;
+  int rc;
+
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(-1, cras_rstream_get_request_fd(s));
+  EXPECT_EQ(config_.audio_fd, cras_rstream_get_audio_reply_fd(s));
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, LegacyPlaybackMovesFramesToRing) {
+  struct cras_rstream *s;
+  struct cras_audio_shm_area_v1 *area;
+  struct audio_message msg;
+  size_t shm_size;
+  int16_t *buf;
+  int fds[2];
+  int rc, i;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  config_.audio_fd = fds[0];
+  config_.proto_version = 1;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+
+  // The client maps the two buffer layout.
+  shm_size = cras_rstream_get_total_shm_size(s);
+  EXPECT_EQ(cras_shm_v1_total_size(4096 * 4), shm_size);
+  area = (struct cras_audio_shm_area_v1 *)mmap(
+      NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      cras_rstream_output_shm_fd(s), 0);
+  ASSERT_NE(MAP_FAILED, area);
+  EXPECT_EQ(4096 * 4, area->config.used_size);
+  EXPECT_EQ(4, area->config.frame_bytes);
+
+  // Write 100 frames to the first buffer the way an old client does.
+  buf = (int16_t *)area->samples;
+  for (i = 0; i < 200; i++)
+    buf[i] = i;
+  area->write_offset[0] = 100 * 4;
+  area->write_buf_idx = 1;
+  area->volume_scaler = 0.5;
+
+  msg.id = AUDIO_MESSAGE_DATA_READY;
+  msg.error = 0;
+  msg.frames = 100;
+  EXPECT_EQ(sizeof(msg), write(fds[1], &msg, sizeof(msg)));
+  EXPECT_EQ(0, cras_rstream_get_audio_request_reply(s));
+
+  EXPECT_EQ(100, cras_shm_get_frames(&s->shm));
+  EXPECT_EQ(0, memcmp(s->shm.area->samples, buf, 100 * 4));
+  EXPECT_EQ(0, area->write_offset[0]);
+  EXPECT_EQ(1, area->read_buf_idx);
+  EXPECT_FLOAT_EQ(0.5, cras_rstream_get_volume_scaler(s));
+
+  munmap(area, shm_size);
+  cras_rstream_destroy(s);
+  close(fds[1]);
+}
+
+TEST_F(RstreamTestSuite, LegacyCaptureMovesFramesFromRing) {
+  struct cras_rstream *s;
+  struct cras_audio_shm_area_v1 *area;
+  struct audio_message msg;
+  unsigned int frames;
+  size_t shm_size;
+  uint8_t *ring;
+  int fds[2];
+  int rc;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  config_.audio_fd = fds[0];
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.proto_version = 1;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+
+  shm_size = cras_rstream_get_total_shm_size(s);
+  area = (struct cras_audio_shm_area_v1 *)mmap(
+      NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      cras_rstream_input_shm_fd(s), 0);
+  ASSERT_NE(MAP_FAILED, area);
+
+  // Frames captured to the ring land in the first buffer.
+  ring = cras_shm_get_writeable_frames(&s->shm, 0, &frames);
+  memset(ring, 0x55, 100 * 4);
+  cras_shm_buffer_written(&s->shm, 100);
+  EXPECT_EQ(sizeof(msg), cras_rstream_audio_ready(s, 100));
+  EXPECT_EQ(sizeof(msg), read(fds[1], &msg, sizeof(msg)));
+  EXPECT_EQ(100, msg.frames);
+  EXPECT_EQ(100 * 4, area->write_offset[0]);
+  EXPECT_EQ(1, area->write_buf_idx);
+  EXPECT_EQ(0x55, area->samples[99 * 4]);
+  EXPECT_EQ(0, cras_shm_get_frames(&s->shm));
+
+  // Then the second.
+  cras_shm_buffer_written(&s->shm, 50);
+  EXPECT_EQ(sizeof(msg), cras_rstream_audio_ready(s, 50));
+  EXPECT_EQ(sizeof(msg), read(fds[1], &msg, sizeof(msg)));
+  EXPECT_EQ(50, msg.frames);
+  EXPECT_EQ(50 * 4, area->write_offset[1]);
+
+  // Both buffers are unread, the frames stay in the ring.
+  cras_shm_buffer_written(&s->shm, 10);
+  EXPECT_EQ(0, cras_rstream_audio_ready(s, 10));
+  EXPECT_EQ(10, cras_shm_get_frames(&s->shm));
+
+  munmap(area, shm_size);
+  cras_rstream_destroy(s);
+  close(fds[1]);
+}
+
+TEST_F(RstreamTestSuite, CallbackResponseHistogram) {
+  struct cras_rstream s;
+  struct timespec now;
+  uint64_t count = 1;
+
+  memset(&s, 0, sizeof(s));
+  s.direction = CRAS_STREAM_OUTPUT;
+  s.request_fd = eventfd(0, EFD_NONBLOCK);
+  s.reply_fd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_LE(0, s.request_fd);
+  ASSERT_LE(0, s.reply_fd);
+
+  // A reply without a pending request isn't recorded.
+  ASSERT_EQ(sizeof(count), write(s.reply_fd, &count, sizeof(count)));
+  EXPECT_EQ(0, cras_rstream_get_audio_request_reply(&s));
+  EXPECT_EQ(0, s.cb_response_hist.count);
+
+  // The time from the request to reading its reply, 3ms or more here.
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  if (now.tv_nsec < 3000000) {
+    now.tv_sec--;
+    now.tv_nsec += 1000000000;
+  }
+  now.tv_nsec -= 3000000;
+  EXPECT_LT(0, cras_rstream_request_audio(&s, &now));
+  ASSERT_EQ(sizeof(count), write(s.reply_fd, &count, sizeof(count)));
+  EXPECT_EQ(0, cras_rstream_get_audio_request_reply(&s));
+  EXPECT_EQ(1, s.cb_response_hist.count);
+  EXPECT_LE(3000000, s.cb_response_hist.total_ns);
+  EXPECT_GT(1000000000, s.cb_response_hist.total_ns);
+
+  // Only once per request.
+  ASSERT_EQ(sizeof(count), write(s.reply_fd, &count, sizeof(count)));
+  EXPECT_EQ(0, cras_rstream_get_audio_request_reply(&s));
+  EXPECT_EQ(1, s.cb_response_hist.count);
+
+  // The interval between fetches isn't a response time.
+  cras_rstream_record_fetch_interval(&s, &now);
+  EXPECT_EQ(1, s.cb_response_hist.count);
+  EXPECT_EQ(0, s.fetch_hist.count);
+
+  close(s.request_fd);
+  close(s.reply_fd);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
@@ -244,6 +438,11 @@ unsigned int buffer_share_id_offset(const struct buffer_share *mix,
   return 0;
 }
 
+unsigned int buffer_share_max_offset(const struct buffer_share *mix)
+{
+  return 0;
+}
+
 void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction) {
 }
 
@@ -40,152 +40,137 @@ TEST_F(ShmTestSuite, NoneReadableWhenEmpty) {
   buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
   EXPECT_EQ(0, frames_);
   cras_shm_buffer_read(&shm_, frames_);
-  EXPECT_EQ(0, shm_.area->read_offset[0]);
+  EXPECT_EQ(0, shm_.area->read_count);
 }
 
-// Buffer with 100 frames filled.
-TEST_F(ShmTestSuite, OneHundredFilled) {
-  shm_.area->write_offset[0] = 100 * shm_.area->config.frame_bytes;
-  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(100, frames_);
-  EXPECT_EQ(shm_.area->samples, buf_);
-  cras_shm_buffer_read(&shm_, frames_ - 9);
-  EXPECT_EQ((frames_ - 9) * shm_.config.frame_bytes, shm_.area->read_offset[0]);
-  cras_shm_buffer_read(&shm_, 9);
-  EXPECT_EQ(0, shm_.area->read_offset[0]);
-  EXPECT_EQ(1, shm_.area->read_buf_idx);
+// Test that the ring holds the next power of two frames.
+TEST_F(ShmTestSuite, RingSize) {
+  EXPECT_EQ(256, shm_.config.ring_frames);
+  EXPECT_EQ(256, shm_.area->config.ring_frames);
+  EXPECT_EQ(sizeof(*shm_.area) + 1024, cras_shm_total_size(&shm_));
+
+  cras_shm_set_used_size(&shm_, 480 * 4);
+  EXPECT_EQ(512, shm_.config.ring_frames);
+  EXPECT_EQ(sizeof(*shm_.area) + 2048, cras_shm_total_size(&shm_));
 }
 
-// Buffer with 100 frames filled, 50 read.
-TEST_F(ShmTestSuite, OneHundredFilled50Read) {
-  shm_.area->write_offset[0] = 100 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 50 * shm_.config.frame_bytes;
+// Test one frame written.
+TEST_F(ShmTestSuite, OneFrameReadable) {
+  shm_.area->write_count = 1;
   buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(50, frames_);
-  EXPECT_EQ((shm_.area->samples + shm_.area->read_offset[0]), buf_);
-  cras_shm_buffer_read(&shm_, frames_ - 10);
-  EXPECT_EQ(shm_.area->write_offset[0] - 10 * shm_.config.frame_bytes,
-            shm_.area->read_offset[0]);
-  cras_shm_buffer_read(&shm_, 10);
-  EXPECT_EQ(0, shm_.area->read_offset[0]);
+  EXPECT_EQ(1, frames_);
+  EXPECT_EQ(shm_.area->samples, buf_);
+  cras_shm_buffer_read(&shm_, frames_);
+  EXPECT_EQ(1, shm_.area->read_count);
+  EXPECT_EQ(0, cras_shm_get_frames(&shm_));
 }
 
-// Buffer with 100 frames filled, 50 read, offset by 25.
-TEST_F(ShmTestSuite, OneHundredFilled50Read25offset) {
-  shm_.area->write_offset[0] = 100 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 50 * shm_.config.frame_bytes;
-  buf_ = cras_shm_get_readable_frames(&shm_, 25, &frames_);
-  EXPECT_EQ(25, frames_);
-  EXPECT_EQ(shm_.area->samples + shm_.area->read_offset[0] +
-                25 * shm_.area->config.frame_bytes,
-            (uint8_t *)buf_);
+// Test reading from an offset past the read pointer.
+TEST_F(ShmTestSuite, ReadableWithOffset) {
+  shm_.area->read_count = 50;
+  shm_.area->write_count = 100;
+  buf_ = cras_shm_get_readable_frames(&shm_, 10, &frames_);
+  EXPECT_EQ(40, frames_);
+  EXPECT_EQ(shm_.area->samples + 60 * 4, buf_);
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 50, &frames_);
+  EXPECT_EQ(0, frames_);
+  EXPECT_EQ(NULL, buf_);
 }
 
-// Test wrapping across buffers.
-TEST_F(ShmTestSuite, WrapToNextBuffer) {
-  shm_.config.used_size = 480 * shm_.config.frame_bytes;
-  shm_.area->write_offset[0] = 240 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 120 * shm_.config.frame_bytes;
-  shm_.area->write_offset[1] = 240 * shm_.config.frame_bytes;
+// Test that reads stop at the end of the ring and continue at its start.
+TEST_F(ShmTestSuite, ReadWrapsAroundRing) {
+  shm_.area->read_count = 200;
+  shm_.area->write_count = 300;
+  EXPECT_EQ(100, cras_shm_get_frames(&shm_));
+
   buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(120, frames_);
-  EXPECT_EQ(shm_.area->samples + shm_.area->read_offset[0], (uint8_t *)buf_);
-  buf_ = cras_shm_get_readable_frames(&shm_, frames_, &frames_);
-  EXPECT_EQ(240, frames_);
-  EXPECT_EQ(shm_.area->samples + shm_.config.used_size, (uint8_t *)buf_);
-  cras_shm_buffer_read(&shm_, 350); /* Mark all-10 as read */
-  EXPECT_EQ(0, shm_.area->read_offset[0]);
-  EXPECT_EQ(230 * shm_.config.frame_bytes, shm_.area->read_offset[1]);
+  EXPECT_EQ(56, frames_);
+  EXPECT_EQ(shm_.area->samples + 200 * 4, buf_);
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 56, &frames_);
+  EXPECT_EQ(44, frames_);
+  EXPECT_EQ(shm_.area->samples, buf_);
+
+  cras_shm_buffer_read(&shm_, 100);
+  EXPECT_EQ(300, shm_.area->read_count);
 }
 
-// Test wrapping across buffers reading all samples.
-TEST_F(ShmTestSuite, WrapToNextBufferReadAll) {
-  shm_.config.used_size = 480 * shm_.config.frame_bytes;
-  shm_.area->write_offset[0] = 240 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 120 * shm_.config.frame_bytes;
-  shm_.area->write_offset[1] = 240 * shm_.config.frame_bytes;
-  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(120, frames_);
-  EXPECT_EQ(shm_.area->samples + shm_.area->read_offset[0], (uint8_t *)buf_);
-  buf_ = cras_shm_get_readable_frames(&shm_, frames_, &frames_);
-  EXPECT_EQ(240, frames_);
-  EXPECT_EQ(shm_.area->samples + shm_.config.used_size, (uint8_t *)buf_);
-  cras_shm_buffer_read(&shm_, 360); /* Mark all as read */
-  EXPECT_EQ(0, shm_.area->read_offset[0]);
-  EXPECT_EQ(0, shm_.area->read_offset[1]);
-  EXPECT_EQ(0, shm_.area->read_buf_idx);
+// Test that the read pointer doesn't pass the write pointer.
+TEST_F(ShmTestSuite, ReadClampedToWritePointer) {
+  shm_.area->read_count = 10;
+  shm_.area->write_count = 30;
+  cras_shm_buffer_read(&shm_, 40);
+  EXPECT_EQ(30, shm_.area->read_count);
+  EXPECT_EQ(0, cras_shm_get_frames(&shm_));
 }
 
-// Test wrapping last buffer.
-TEST_F(ShmTestSuite, WrapFromFinalBuffer) {
-  shm_.area->read_buf_idx = CRAS_NUM_SHM_BUFFERS - 1;
-  shm_.config.used_size = 480 * shm_.config.frame_bytes;
-  shm_.area->write_offset[shm_.area->read_buf_idx] =
-      240 * shm_.config.frame_bytes;
-  shm_.area->read_offset[shm_.area->read_buf_idx] =
-      120 * shm_.config.frame_bytes;
-  shm_.area->write_offset[0] = 240 * shm_.config.frame_bytes;
+// Test that the counters keep working when they wrap at 2^32.
+TEST_F(ShmTestSuite, CountersWrap) {
+  shm_.area->read_count = 0xffffffc0;
+  shm_.area->write_count = 0xffffffc0;
+  cras_shm_buffer_written(&shm_, 100);
+  EXPECT_EQ(36, shm_.area->write_count);
+  EXPECT_EQ(100, cras_shm_get_frames(&shm_));
+
   buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(120, frames_);
-  EXPECT_EQ((uint8_t *)buf_, shm_.area->samples +
-      shm_.config.used_size * shm_.area->read_buf_idx +
-      shm_.area->read_offset[shm_.area->read_buf_idx]);
-  buf_ = cras_shm_get_readable_frames(&shm_, frames_, &frames_);
-  EXPECT_EQ(240, frames_);
-  EXPECT_EQ(shm_.area->samples, (uint8_t *)buf_);
-  cras_shm_buffer_read(&shm_, 350); /* Mark all-10 as read */
-  EXPECT_EQ(0, shm_.area->read_offset[1]);
-  EXPECT_EQ(230 * shm_.config.frame_bytes, shm_.area->read_offset[0]);
-}
+  EXPECT_EQ(64, frames_);
+  EXPECT_EQ(shm_.area->samples + 192 * 4, buf_);
 
-// Test Check available to write returns 0 if not free buffer.
-TEST_F(ShmTestSuite, WriteAvailNotFree) {
-  size_t ret;
-  shm_.area->write_buf_idx = 0;
-  shm_.area->write_offset[0] = 100 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 50 * shm_.config.frame_bytes;
-  ret = cras_shm_get_num_writeable(&shm_);
-  EXPECT_EQ(0, ret);
+  cras_shm_buffer_read(&shm_, 100);
+  EXPECT_EQ(36, shm_.area->read_count);
 }
 
-// Test Check available to write returns num_frames if free buffer.
-TEST_F(ShmTestSuite, WriteAvailValid) {
-  size_t ret;
-  shm_.area->write_buf_idx = 0;
-  shm_.config.used_size = 480 * shm_.config.frame_bytes;
-  shm_.area->write_offset[0] = 0;
-  shm_.area->read_offset[0] = 0;
-  ret = cras_shm_get_num_writeable(&shm_);
-  EXPECT_EQ(480, ret);
-}
+// Test the number of frames that can be written.
+TEST_F(ShmTestSuite, GetNumWriteable) {
+  EXPECT_EQ(256, cras_shm_get_num_writeable(&shm_));
+
+  shm_.area->read_count = 50;
+  shm_.area->write_count = 150;
+  EXPECT_EQ(156, cras_shm_get_num_writeable(&shm_));
 
-// Test get frames_written returns the number of frames written.
-TEST_F(ShmTestSuite, GetNumWritten) {
-  size_t ret;
-  shm_.area->write_buf_idx = 0;
-  shm_.config.used_size = 480 * shm_.config.frame_bytes;
-  shm_.area->write_offset[0] = 200 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 0;
-  ret = cras_shm_frames_written(&shm_);
-  EXPECT_EQ(200, ret);
+  shm_.area->write_count = 50 + 256;
+  EXPECT_EQ(0, cras_shm_get_num_writeable(&shm_));
 }
 
-// Test that getting the base of the write buffer returns the correct pointer.
-TEST_F(ShmTestSuite, GetWriteBufferBase) {
-  uint8_t* ret;
-
-  shm_.area->write_buf_idx = 0;
-  shm_.config.used_size = 480 * shm_.config.frame_bytes;
-  shm_.area->write_offset[0] = 200 * shm_.config.frame_bytes;
-  shm_.area->write_offset[1] = 200 * shm_.config.frame_bytes;
-  shm_.area->read_offset[0] = 0;
-  shm_.area->read_offset[1] = 0;
-  ret = cras_shm_get_write_buffer_base(&shm_);
+// Test that writes stop at the end of the ring and continue at its start.
+TEST_F(ShmTestSuite, WriteWrapsAroundRing) {
+  unsigned frames;
+  uint8_t *ret;
+
+  shm_.area->read_count = 100;
+  shm_.area->write_count = 200;
+  ret = cras_shm_get_writeable_frames(&shm_, 0, &frames);
+  EXPECT_EQ(56, frames);
+  EXPECT_EQ(shm_.area->samples + 200 * 4, ret);
+
+  ret = cras_shm_get_writeable_frames(&shm_, 56, &frames);
+  EXPECT_EQ(100, frames);
   EXPECT_EQ(shm_.area->samples, ret);
 
-  shm_.area->write_buf_idx = 1;
-  ret = cras_shm_get_write_buffer_base(&shm_);
-  EXPECT_EQ(shm_.area->samples + shm_.config.used_size, ret);
+  ret = cras_shm_get_writeable_frames(&shm_, 156, &frames);
+  EXPECT_EQ(0, frames);
+
+  cras_shm_buffer_written(&shm_, 156);
+  EXPECT_EQ(356, shm_.area->write_count);
+  EXPECT_EQ(256, cras_shm_get_frames(&shm_));
+}
+
+// Test that invalid counters are detected.
+TEST_F(ShmTestSuite, InvalidCounters) {
+  unsigned writeable;
+
+  shm_.area->read_count = 0;
+  shm_.area->write_count = 257;
+  EXPECT_EQ(-EIO, cras_shm_get_frames(&shm_));
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(0, frames_);
+  cras_shm_get_writeable_frames(&shm_, 0, &writeable);
+  EXPECT_EQ(0, writeable);
+
+  // Read pointer ahead of the write pointer.
+  shm_.area->read_count = 300;
+  EXPECT_EQ(-EIO, cras_shm_get_frames(&shm_));
 }
 
 TEST_F(ShmTestSuite, SetVolume) {
@@ -199,56 +184,30 @@ TEST_F(ShmTestSuite, SetVolume) {
   EXPECT_EQ(shm_.area->volume_scaler, 0.5);
 }
 
-// Test that invalid read/write offsets are detected.
-
-TEST_F(ShmTestSuite, InvalidWriteOffset) {
-  shm_.area->write_offset[0] = shm_.config.used_size + 50;
-  shm_.area->read_offset[0] = 0;
-  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(shm_.config.used_size / 4, frames_);
-}
-
-TEST_F(ShmTestSuite, InvalidReadOffset) {
-  // Should ignore read+_offset and assume 0.
-  shm_.area->write_offset[0] = 44;
-  shm_.area->read_offset[0] = shm_.config.used_size + 25;
-  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(shm_.area->write_offset[0] / shm_.config.frame_bytes, frames_);
-  EXPECT_EQ(shm_.area->samples, (uint8_t *)buf_);
-}
-
-TEST_F(ShmTestSuite, InvalidReadAndWriteOffset) {
-  shm_.area->write_offset[0] = shm_.config.used_size + 50;
-  shm_.area->read_offset[0] = shm_.config.used_size + 25;
-  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
-  EXPECT_EQ(shm_.config.used_size / 4, frames_);
-}
-
 TEST_F(ShmTestSuite, InputBufferOverrun) {
   int rc;
-  shm_.area->write_offset[0] = 0;
-  shm_.area->read_offset[0] = 0;
-  shm_.area->write_offset[1] = 0;
-  shm_.area->read_offset[1] = 0;
-
-  shm_.area->write_buf_idx = 0;
-  shm_.area->read_buf_idx = 0;
 
   EXPECT_EQ(0, cras_shm_num_overruns(&shm_));
-  rc = cras_shm_check_write_overrun(&shm_);
+  rc = cras_shm_check_write_overrun(&shm_, 100);
   EXPECT_EQ(0, rc);
   cras_shm_buffer_written(&shm_, 100);
-  cras_shm_buffer_write_complete(&shm_);
 
-  rc = cras_shm_check_write_overrun(&shm_);
+  rc = cras_shm_check_write_overrun(&shm_, 100);
   EXPECT_EQ(0, rc);
   cras_shm_buffer_written(&shm_, 100);
-  cras_shm_buffer_write_complete(&shm_);
 
-  // Assert two consecutive writes causes overrun.
-  rc = cras_shm_check_write_overrun(&shm_);
+  // No room for another 100 frames, the oldest are dropped.
+  rc = cras_shm_check_write_overrun(&shm_, 100);
   EXPECT_EQ(1, rc);
   EXPECT_EQ(1, cras_shm_num_overruns(&shm_));
+  EXPECT_EQ(44, shm_.area->read_count);
+  EXPECT_EQ(156, cras_shm_get_frames(&shm_));
+
+  // An invalid read pointer is reset.
+  shm_.area->read_count = 500;
+  rc = cras_shm_check_write_overrun(&shm_, 100);
+  EXPECT_EQ(1, rc);
+  EXPECT_EQ(156, cras_shm_get_frames(&shm_));
 }
 
 }  //  namespace
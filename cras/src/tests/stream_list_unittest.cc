@@ -72,6 +72,50 @@ TEST(StreamList, AddRemove) {
   stream_list_destroy(l);
 }
 
+TEST(StreamList, AddPendingAttachRemove) {
+  struct stream_list *l;
+  struct cras_rstream *s1;
+  struct cras_rstream_config s1_config;
+
+  reset_test_data();
+  l = stream_list_create(added_cb, removed_cb, create_rstream_cb,
+                         destroy_rstream_cb, NULL);
+  EXPECT_EQ(0, stream_list_add_pending(l, &s1_config, &s1));
+  EXPECT_EQ(1, create_called);
+  EXPECT_EQ(0, add_called);
+  EXPECT_TRUE(stream_list_get(l) == NULL);
+
+  EXPECT_EQ(0, stream_list_attach_stream(l, 0x3003));
+  EXPECT_EQ(1, add_called);
+  EXPECT_EQ(s1, stream_list_get(l));
+  EXPECT_EQ(-ENOENT, stream_list_attach_stream(l, 0x3003));
+
+  EXPECT_EQ(0, stream_list_rm(l, 0x3003));
+  EXPECT_EQ(1, rm_called);
+  EXPECT_EQ(1, destroy_called);
+  stream_list_destroy(l);
+}
+
+TEST(StreamList, RemovePending) {
+  struct stream_list *l;
+  struct cras_rstream *s1;
+  struct cras_rstream_config s1_config;
+
+  reset_test_data();
+  l = stream_list_create(added_cb, removed_cb, create_rstream_cb,
+                         destroy_rstream_cb, NULL);
+  EXPECT_EQ(0, stream_list_add_pending(l, &s1_config, &s1));
+
+  // Never added to a device, destroyed without the removed callback.
+  EXPECT_EQ(0, stream_list_rm(l, 0x3003));
+  EXPECT_EQ(0, rm_called);
+  EXPECT_EQ(1, destroy_called);
+  EXPECT_EQ(s1, destroyed_stream);
+  EXPECT_EQ(-ENOENT, stream_list_attach_stream(l, 0x3003));
+  EXPECT_EQ(0, add_called);
+  stream_list_destroy(l);
+}
+
 extern "C" {
 
 struct cras_timer *cras_tm_create_timer(
@@ -322,6 +322,39 @@ TEST(SystemSettingsStreamCount, StreamCount) {
   cras_system_state_deinit();
 }
 
+TEST(SystemSettingsStreamCount, UpdateFillsOtherCopy) {
+  struct cras_server_state *exp_state;
+  struct cras_server_state_lists *lists;
+  unsigned int count;
+
+  ResetStubData();
+  cras_system_state_init(device_config_dir);
+  exp_state = cras_system_state_get_no_lock();
+  cras_system_state_stream_added(CRAS_STREAM_OUTPUT);
+  count = exp_state->update_count;
+
+  // Clients keep reading the current copy until the update completes.
+  lists = cras_system_state_update_begin();
+  ASSERT_TRUE(lists != NULL);
+  EXPECT_EQ(&exp_state->lists[(count + 1) & 1], lists);
+  EXPECT_EQ(1, lists->num_active_streams[CRAS_STREAM_OUTPUT]);
+  lists->num_output_devs = 3;
+  EXPECT_EQ(count, exp_state->update_count);
+  EXPECT_EQ(0, exp_state->lists[count & 1].num_output_devs);
+  cras_system_state_update_complete();
+
+  EXPECT_EQ(count + 1, exp_state->update_count);
+  const struct cras_iodev_info *devs;
+  EXPECT_EQ(3, cras_system_state_get_output_devs(&devs));
+  EXPECT_EQ(1, cras_system_state_get_active_streams());
+
+  cras_system_state_stream_removed(CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(count + 2, exp_state->update_count);
+  EXPECT_EQ(3, cras_system_state_get_output_devs(&devs));
+  EXPECT_EQ(0, cras_system_state_get_active_streams());
+  cras_system_state_deinit();
+}
+
 TEST(SystemSettingsStreamCount, StreamCountByDirection) {
   ResetStubData();
   cras_system_state_init(device_config_dir);